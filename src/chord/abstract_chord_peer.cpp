@@ -1,4 +1,28 @@
 #include "abstract_chord_peer.h"
+#include <algorithm>
+#include <future>
+#include <sstream>
+#include <thread>
+
+/// Number of finger table entries which RefreshFingerTable looks up at once.
+static const int MAX_CONCURRENT_FINGER_LOOKUPS = 16;
+
+/// Number of chunks of a file which are stored or read at once.
+static const size_t MAX_CONCURRENT_CHUNK_READS = 8;
+
+/// How long a one-hop peer trusts its membership view without confirming it
+/// against its successor's.
+static const std::chrono::seconds MEMBERSHIP_STALE_AFTER(30);
+
+/**
+ * @param file_name Name of a file stored on the overlay network.
+ * @param index Index of one of its chunks.
+ * @return The key under which the chunk is stored.
+ */
+static std::string ChunkName(const std::string &file_name, size_t index)
+{
+    return file_name + "#" + std::to_string(index);
+}
 
 
 /* ----------------------------------------------------------------------------
@@ -67,6 +91,13 @@ void AbstractChordPeer::StartChord()
 {
     // If this is the first peer in the chord, it will control every key, so...
     min_key_.Set(id_ + 1);
+
+    if(one_hop_) {
+        membership_.Apply(MembershipEvent(MembershipEvent::Type::JOIN,
+                                          ToRemotePeer(), incarnation_));
+        std::lock_guard<std::mutex> lock(gossip_mutex_);
+        membership_synced_ = std::chrono::steady_clock::now();
+    }
     StartMaintenance();
 }
 
@@ -88,6 +119,7 @@ void AbstractChordPeer::Join(const std::string &gateway_ip,
     Json::Value join_req, join_resp;
     join_req["COMMAND"] = "JOIN";
     join_req["NEW_PEER"] = PeerAsJson();
+    join_req["INCARNATION"] = Json::UInt64(incarnation_);
 
     join_resp = Client::MakeRequest(gateway_ip, gateway_port, join_req);
 
@@ -95,7 +127,25 @@ void AbstractChordPeer::Join(const std::string &gateway_ip,
     predecessor_.Set(RemotePeer(join_resp["PREDECESSOR"]));
     min_key_.Set(predecessor_.Get().id_ + 1);
 
-    PopulateFingerTable(true);
+    // Take the gateway's view of the ring, and tell the ring about us now,
+    // rather than at the next tick of the maintenance thread, so that the
+    // news has spread by the time we're ready to serve requests.
+    if(one_hop_) {
+        Json::Value sync_req;
+        sync_req["COMMAND"] = "SYNC_MEMBERSHIP";
+        sync_req["CLASS"] = "MAINTENANCE";
+        membership_.Merge(Client::MakeRequest(gateway_ip, gateway_port,
+                                              sync_req)["VIEW"]);
+        {
+            std::lock_guard<std::mutex> lock(gossip_mutex_);
+            membership_synced_ = std::chrono::steady_clock::now();
+        }
+        Broadcast(MembershipEvent(MembershipEvent::Type::JOIN, ToRemotePeer(),
+                                  incarnation_));
+        FlushGossip(true);
+    }
+
+    PopulateFingerTable();
 
     RemotePeer succ = finger_table_.GetNthEntry(0);
     Notify(succ);
@@ -132,6 +182,14 @@ Json::Value AbstractChordPeer::JoinHandler(const Json::Value &req)
     // succs of this peer.
     successors_.Insert(new_peer);
 
+    // Likewise, the peer's broadcast of its joining may not reach everyone
+    // before the next peer joins through us, so add it to our view at once.
+    if(one_hop_) {
+        membership_.Apply(MembershipEvent(MembershipEvent::Type::JOIN,
+                                          new_peer,
+                                          req["INCARNATION"].asUInt64()));
+    }
+
     return join_resp;
 }
 
@@ -147,6 +205,17 @@ void AbstractChordPeer::Notify(const RemotePeer &peer_to_notify)
     AbsorbKeys(keys_to_absorb);
 }
 
+Awaitable<void> AbstractChordPeer::AsyncNotify(RemotePeer peer_to_notify)
+{
+    Json::Value notify_req;
+    notify_req["COMMAND"] = "NOTIFY";
+    notify_req["NEW_PEER"] = PeerAsJson();
+    Json::Value notify_resp = co_await peer_to_notify.AsyncSendRequest(
+            notify_req, std::chrono::steady_clock::now() +
+                        DEFAULT_REQUEST_BUDGET);
+    AbsorbKeys(notify_resp["KEYS_TO_ABSORB"]);
+}
+
 Json::Value AbstractChordPeer::NotifyHandler(const Json::Value &req)
 {
     Json::Value notify_resp, data_to_transfer;
@@ -157,7 +226,7 @@ Json::Value AbstractChordPeer::NotifyHandler(const Json::Value &req)
         RemotePeer old_pred = predecessor_.Get();
         // In this case, the new peer is our predecessor
         HandleNotifyFromPred(new_peer);
-        HandlePredFailure(old_pred);
+        RunCoroutine(HandlePredFailure(old_pred));
         return notify_resp;
     }
 
@@ -183,7 +252,7 @@ Json::Value AbstractChordPeer::NotifyHandler(const Json::Value &req)
     // joins. In this case, it will not have been useful to populate the finger
     // table prior ot a second peer joining.
     if(finger_table_.Empty()) {
-        PopulateFingerTable(true);
+        PopulateFingerTable();
     }
 
     return notify_resp;
@@ -219,6 +288,11 @@ void AbstractChordPeer::Leave()
 
     if(succ_condones_leave) {
         Log("Leaving now.");
+        if(one_hop_) {
+            Broadcast(MembershipEvent(MembershipEvent::Type::LEAVE,
+                                      ToRemotePeer(), incarnation_));
+            FlushGossip(true);
+        }
         Fail();
     } else {
         throw std::runtime_error("Not ready to leave");
@@ -265,8 +339,12 @@ Json::Value AbstractChordPeer::LeaveHandler(const Json::Value &request)
  *                 the overlay network.
  * -------------------------------------------------------------------------- */
 
-void AbstractChordPeer::UploadFile(const std::string &file_path)
+void AbstractChordPeer::UploadFile(const std::string &file_path,
+                                   size_t chunk_size)
 {
+    if(chunk_size == 0) {
+        throw std::runtime_error("Chunk size must be positive");
+    }
     std::ifstream file(file_path, std::ifstream::binary);
     if(! file) {
         throw std::runtime_error("File failed to open");
@@ -274,35 +352,273 @@ void AbstractChordPeer::UploadFile(const std::string &file_path)
 
     // Find the length of the file
     file.seekg(0, std::ifstream::end);
-    std::streampos length = file.tellg();
+    size_t length = file.tellg();
     file.seekg(0, std::ifstream::beg);
 
-    // Read file into char buffer and then into string
-    std::vector<unsigned char> bytes(length);
-    file.read((char *)&bytes[0], length);
-    std::string file_contents(bytes.begin(), bytes.end());
-    std::cout << "File contents are: " << file_contents.substr(0, 5000) << std::endl;
+    // Store the file a window of chunks at a time, so that we never hold
+    // more than a window of it in memory.
+    Log("Uploading " + file_path);
+    size_t num_chunks = (length + chunk_size - 1) / chunk_size;
+    for(size_t first = 0; first < num_chunks;
+        first += MAX_CONCURRENT_CHUNK_READS)
+    {
+        size_t last = std::min(first + MAX_CONCURRENT_CHUNK_READS, num_chunks);
+        std::vector<std::future<void>> creates;
+        for(size_t i = first; i < last; ++i) {
+            std::string chunk(std::min(chunk_size, length - i * chunk_size),
+                              '\0');
+            file.read(chunk.data(), (std::streamsize) chunk.size());
+            creates.push_back(std::async(std::launch::async,
+                [this, key = ChunkName(file_path, i),
+                 chunk = std::move(chunk)] {
+                    Create(key, chunk);
+                }));
+        }
+        for(auto &create : creates) {
+            create.get();
+        }
+    }
     file.close();
 
-    Log("entering create");
-    Create(file_path, file_contents);
+    // The manifest goes last, so that no reader can find the file before
+    // all of its chunks are in place.
+    Json::Value manifest;
+    manifest["VERSION"] = FILE_MANIFEST_VERSION;
+    manifest["SIZE"] = (Json::UInt64) length;
+    manifest["CHUNK_SIZE"] = (Json::UInt64) chunk_size;
+    Create(file_path, Json::writeString(Json::StreamWriterBuilder(), manifest));
 }
 
 void AbstractChordPeer::DownloadFile(const std::string &file_name,
                                      const std::string &output_path)
 {
-    std::string file_contents = Read(file_name);
-    Log("File contents are " + file_contents.substr(0, 5000));
+    std::string contents;
+    std::optional<Json::Value> manifest = ReadManifest(file_name, contents);
+
     std::ofstream output_file(output_path, std::ofstream::binary);
     if(! output_file) {
         throw std::runtime_error("Failed to open output file");
     }
+    if(! manifest.has_value()) {
+        output_file << contents;
+        return;
+    }
+
+    size_t length = (*manifest)["SIZE"].asUInt64(),
+           chunk_size = (*manifest)["CHUNK_SIZE"].asUInt64(),
+           num_chunks = (length + chunk_size - 1) / chunk_size;
+
     Log("Writing to " + output_path);
-    output_file << file_contents;
+    for(size_t first = 0; first < num_chunks;
+        first += MAX_CONCURRENT_CHUNK_READS)
+    {
+        size_t last = std::min(first + MAX_CONCURRENT_CHUNK_READS, num_chunks);
+        for(const std::string &chunk : ReadChunks(file_name, first, last - 1)) {
+            output_file << chunk;
+        }
+    }
     Log("Written");
     output_file.close();
 }
 
+std::string AbstractChordPeer::ReadFileRange(const std::string &file_name,
+                                             size_t offset, size_t length)
+{
+    std::string contents;
+    std::optional<Json::Value> manifest = ReadManifest(file_name, contents);
+    if(! manifest.has_value()) {
+        return offset < contents.size() ? contents.substr(offset, length) : "";
+    }
+
+    size_t file_size = (*manifest)["SIZE"].asUInt64(),
+           chunk_size = (*manifest)["CHUNK_SIZE"].asUInt64();
+    if(offset >= file_size || length == 0) {
+        return "";
+    }
+    length = std::min(length, file_size - offset);
+
+    size_t first = offset / chunk_size,
+           last = (offset + length - 1) / chunk_size;
+    std::string range;
+    range.reserve(length);
+    for(const std::string &chunk : ReadChunks(file_name, first, last)) {
+        range += chunk;
+    }
+
+    // The first chunk may begin before the range, and the last may end after
+    // it.
+    return range.substr(offset - first * chunk_size, length);
+}
+
+std::optional<Json::Value>
+AbstractChordPeer::ReadManifest(const std::string &file_name,
+                                std::string &contents)
+{
+    contents = Read(file_name);
+
+    // A manifest is a JSON object with an integral version, size and
+    // (non-zero) chunk size; anything else is a whole file (which we needn't
+    // try to parse unless it could be an object).
+    Json::Value manifest;
+    std::unique_ptr<Json::CharReader> reader(
+            Json::CharReaderBuilder().newCharReader());
+    if(contents.empty() || contents.front() != '{' ||
+       ! reader->parse(contents.data(), contents.data() + contents.size(),
+                       &manifest, nullptr) ||
+       ! manifest.isObject() || ! manifest["VERSION"].isInt() ||
+       ! manifest["SIZE"].isUInt64() || ! manifest["CHUNK_SIZE"].isUInt64() ||
+       manifest["CHUNK_SIZE"].asUInt64() == 0)
+    {
+        return std::nullopt;
+    }
+
+    if(manifest["VERSION"].asInt() != FILE_MANIFEST_VERSION) {
+        throw std::runtime_error("Unsupported manifest version for " +
+                                 file_name);
+    }
+    contents.clear();
+    return manifest;
+}
+
+std::vector<std::string>
+AbstractChordPeer::ReadChunks(const std::string &file_name, size_t first,
+                              size_t last)
+{
+    std::vector<std::string> chunks;
+    for(size_t window = first; window <= last;
+        window += MAX_CONCURRENT_CHUNK_READS)
+    {
+        size_t window_last = std::min(window + MAX_CONCURRENT_CHUNK_READS - 1,
+                                      last);
+        std::vector<std::future<std::string>> reads;
+        for(size_t i = window; i <= window_last; ++i) {
+            reads.push_back(std::async(std::launch::async,
+                [this, key = ChunkName(file_name, i)] {
+                    return Read(key);
+                }));
+        }
+        for(auto &read : reads) {
+            chunks.push_back(read.get());
+        }
+    }
+    return chunks;
+}
+
+
+/* ----------------------------------------------------------------------------
+ * SCAN: Implement range scans across the ring. Each peer's slice of the range
+ *       is read (by the derived class, which knows how its values are stored)
+ *       while the next peer's slice is prefetched.
+ * -------------------------------------------------------------------------- */
+
+ScanPage AbstractChordPeer::Scan(const ChordKey &lower_bound,
+                                 const ChordKey &upper_bound, size_t limit)
+{
+    ScanPage page;
+    ChordKey cursor = lower_bound;
+    RemotePeer owner = GetSuccessor(cursor);
+
+    // The owner's slice, if it was prefetched along with the previous one.
+    std::optional<Json::Value> slice;
+
+    while(page.kv_pairs_.size() < limit) {
+        bool last_slice = upper_bound.InBetween(cursor, owner.id_, true);
+        size_t remaining = limit - page.kv_pairs_.size();
+
+        std::vector<Awaitable<Json::Value>> reads;
+        if(! slice.has_value()) {
+            reads.push_back(ReadSlice(owner, cursor,
+                                      last_slice ? upper_bound : owner.id_,
+                                      remaining));
+        }
+        if(! last_slice) {
+            reads.push_back(ReadNextSlice(owner, upper_bound, remaining));
+        }
+        auto results = RunCoroutine(WhenAll(std::move(reads)));
+
+        if(! slice.has_value()) {
+            if(! results.front().has_value()) {
+                throw std::runtime_error("Failed to read slice of scan from " +
+                                         std::to_string(owner.port_));
+            }
+            slice = std::move(results.front());
+        }
+
+        // A prefetched slice was read before we knew how much of the page
+        // the current one would fill, so it may hold more than fits.
+        bool more = (*slice)["MORE"].asBool();
+        size_t slice_start = page.kv_pairs_.size();
+        for(const Json::Value &kv_pair : (*slice)["KV_PAIRS"]) {
+            if(page.kv_pairs_.size() == limit) {
+                more = true;
+                break;
+            }
+            page.kv_pairs_.emplace_back(
+                    ChordKey(kv_pair["KEY"].asString(), true),
+                    kv_pair["VAL"].asString());
+        }
+
+        if(more) {
+            // The page had room, so a slice with more to give must have
+            // given something; otherwise we'd have nowhere to resume from.
+            if(page.kv_pairs_.size() == slice_start) {
+                throw std::runtime_error("Slice of scan from " +
+                                         std::to_string(owner.port_) +
+                                         " has more pairs but returned none");
+            }
+            cursor = page.kv_pairs_.back().first + 1;
+            page.next_page_token_ = std::string(cursor) + ":" +
+                                    std::string(upper_bound);
+            return page;
+        }
+        if(last_slice) {
+            return page;
+        }
+
+        cursor = owner.id_ + 1;
+        if(results.back().has_value()) {
+            slice = std::move(results.back());
+            owner = RemotePeer((*slice)["OWNER"]);
+        } else {
+            slice.reset();
+            owner = GetSuccessor(cursor);
+        }
+    }
+
+    page.next_page_token_ = std::string(cursor) + ":" +
+                            std::string(upper_bound);
+    return page;
+}
+
+ScanPage AbstractChordPeer::Scan(const std::string &page_token, size_t limit)
+{
+    size_t separator = page_token.find(':');
+    if(separator == std::string::npos) {
+        throw std::runtime_error("Malformed page token.");
+    }
+
+    return Scan(ChordKey(page_token.substr(0, separator), true),
+                ChordKey(page_token.substr(separator + 1), true), limit);
+}
+
+Awaitable<Json::Value> AbstractChordPeer::ReadNextSlice(RemotePeer owner,
+                                                       ChordKey upper_bound,
+                                                       size_t limit)
+{
+    ChordKey lower_bound = owner.id_ + 1;
+    RemotePeer next_owner = co_await LookupSuccessor(owner, lower_bound);
+
+    // Bound the slice exactly as Scan will when it gets to this peer, so
+    // that the prefetched slice can stand in for the one it would read.
+    bool last_slice = upper_bound.InBetween(lower_bound, next_owner.id_, true);
+    Json::Value slice = co_await ReadSlice(next_owner, lower_bound,
+                                           last_slice ? upper_bound :
+                                                        next_owner.id_,
+                                           limit);
+    slice["OWNER"] = Json::Value(next_owner);
+    co_return slice;
+}
+
 
 /* ----------------------------------------------------------------------------
  * SUCC/PRED FUNCTIONS: Implement member functions which retrieve successors
@@ -316,35 +632,216 @@ RemotePeer AbstractChordPeer::GetSuccessor(const std::string &unhashed_key)
 }
 
 RemotePeer AbstractChordPeer::GetSuccessor(const ChordKey &key)
+{
+    return GetSuccessor(key,
+                        std::chrono::steady_clock::now() + DEFAULT_REQUEST_BUDGET);
+}
+
+RemotePeer AbstractChordPeer::GetSuccessor(const ChordKey &key,
+                                           const Deadline &deadline)
 {
     // Account for case where key is stored locally.
     if(StoredLocally(key)) {
         return ToRemotePeer();
     }
 
-    Json::Value get_succ_req, json_succ;
+    std::optional<RemotePeer> one_hop_succ = OneHopSuccessor(key);
+    if(one_hop_succ.has_value()) {
+        return one_hop_succ.value();
+    }
+
+    // If another thread is already looking up this very key, share its
+    // result rather than routing an identical request around the ring.
+    return succ_lookups_.Do(key, deadline, [&] {
+        Json::Value get_succ_req, json_succ;
+        get_succ_req["COMMAND"] = "GET_SUCC";
+        get_succ_req["KEY"] = std::string(key);
+        json_succ = ForwardRequest(key, get_succ_req, deadline);
+        return RemotePeer(json_succ);
+    });
+}
+
+Awaitable<RemotePeer> AbstractChordPeer::AsyncGetSuccessor(ChordKey key,
+                                                          Deadline deadline)
+{
+    if(StoredLocally(key)) {
+        co_return ToRemotePeer();
+    }
+
+    std::optional<RemotePeer> one_hop_succ = OneHopSuccessor(key);
+    if(one_hop_succ.has_value()) {
+        co_return one_hop_succ.value();
+    }
+
+    Json::Value get_succ_req;
     get_succ_req["COMMAND"] = "GET_SUCC";
     get_succ_req["KEY"] = std::string(key);
-    json_succ = ForwardRequest(key, get_succ_req);
-    return RemotePeer(json_succ);
+    co_return RemotePeer(co_await AsyncForwardRequest(key, get_succ_req,
+                                                      deadline));
 }
 
 Json::Value AbstractChordPeer::GetSuccHandler(const Json::Value &req)
 {
     ChordKey key(req["KEY"].asString(), true);
-    RemotePeer succ = GetSuccessor(key);
+    RemotePeer succ = GetSuccessor(key, Client::GetDeadline(req));
     return Json::Value(succ);
 }
 
+std::vector<RemotePeer> AbstractChordPeer::GetSuccessorBatch(
+        const std::vector<std::string> &unhashed_keys)
+{
+    std::vector<ChordKey> keys;
+    for(const std::string &unhashed_key : unhashed_keys) {
+        keys.emplace_back(unhashed_key, false);
+    }
+
+    std::map<ChordKey, RemotePeer> succs = RunCoroutine(AsyncGetSuccessorBatch(
+            keys, std::chrono::steady_clock::now() + DEFAULT_REQUEST_BUDGET));
+    std::vector<RemotePeer> succs_in_order;
+    for(const ChordKey &key : keys) {
+        auto it = succs.find(key);
+        if(it == succs.end()) {
+            throw std::runtime_error("Lookup failed for key " +
+                                     std::string(key));
+        }
+        succs_in_order.push_back(it->second);
+    }
+    return succs_in_order;
+}
+
+Awaitable<std::map<ChordKey, RemotePeer>>
+AbstractChordPeer::AsyncGetSuccessorBatch(std::vector<ChordKey> keys,
+                                          Deadline deadline)
+{
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    // Answer every key we own, and group the rest by the next hop our finger
+    // table gives for them, so that one message carries every key bound for
+    // the same peer. (We don't answer from our successors list: until the
+    // next stabilize it may be missing recent joiners, and the answers must
+    // agree with those of GetSuccessor.)
+    std::map<ChordKey, RemotePeer> succs;
+    std::map<RemotePeer, std::vector<ChordKey>> sub_batches;
+    std::vector<ChordKey> unrouted;
+    for(const ChordKey &key : keys) {
+        if(StoredLocally(key)) {
+            succs.emplace(key, ToRemotePeer());
+            continue;
+        }
+
+        std::optional<RemotePeer> one_hop_succ = OneHopSuccessor(key);
+        if(one_hop_succ.has_value()) {
+            succs.emplace(key, one_hop_succ.value());
+            continue;
+        }
+
+        // Keys for which the finger table points back to us are routed one
+        // at a time, by AsyncForwardRequest, which knows how to handle them.
+        RemotePeer next_hop = finger_table_.Lookup(key);
+        if(next_hop.id_ == id_) {
+            unrouted.push_back(key);
+        } else {
+            sub_batches[next_hop].push_back(key);
+        }
+    }
+
+    // Forward the sub-batches in parallel. Each stays sorted, since keys
+    // were added to it in order.
+    std::vector<Awaitable<Json::Value>> forwards;
+    for(const auto &[next_hop, sub_batch] : sub_batches) {
+        Json::Value batch_req;
+        batch_req["COMMAND"] = "GET_SUCC_BATCH";
+        for(const ChordKey &key : sub_batch) {
+            batch_req["KEYS"].append(std::string(key));
+        }
+        forwards.push_back(next_hop.AsyncSendRequest(batch_req, deadline));
+    }
+    auto responses = co_await WhenAll(std::move(forwards));
+
+    // Merge the answers. The keys of any sub-batch which failed (or which
+    // its answer left out) are retried one at a time, so that they get the
+    // single-key path's failover.
+    auto response = responses.begin();
+    for(const auto &[next_hop, sub_batch] : sub_batches) {
+        if(response->has_value()) {
+            for(const Json::Value &entry : (**response)["SUCCS"]) {
+                succs.emplace(ChordKey(entry["KEY"].asString(), true),
+                              RemotePeer(entry["PEER"]));
+            }
+        }
+        for(const ChordKey &key : sub_batch) {
+            if(! succs.count(key)) {
+                unrouted.push_back(key);
+            }
+        }
+        ++response;
+    }
+
+    std::vector<Awaitable<RemotePeer>> lookups;
+    for(const ChordKey &key : unrouted) {
+        lookups.push_back(AsyncGetSuccessor(key, deadline));
+    }
+    auto unrouted_succs = co_await WhenAll(std::move(lookups));
+    for(size_t i = 0; i < unrouted.size(); ++i) {
+        if(! unrouted_succs[i].has_value()) {
+            throw std::runtime_error("Lookup failed for key " +
+                                     std::string(unrouted[i]));
+        }
+        succs.emplace(unrouted[i], unrouted_succs[i].value());
+    }
+    co_return succs;
+}
+
+Awaitable<Json::Value> AbstractChordPeer::GetSuccBatchHandler(Json::Value req)
+{
+    std::vector<ChordKey> keys;
+    for(const Json::Value &key : req["KEYS"]) {
+        keys.emplace_back(key.asString(), true);
+    }
+
+    Json::Value resp;
+    resp["SUCCS"] = Json::arrayValue;
+    for(const auto &[key, succ] : co_await AsyncGetSuccessorBatch(
+            keys, Client::GetDeadline(req)))
+    {
+        Json::Value entry;
+        entry["KEY"] = std::string(key);
+        entry["PEER"] = Json::Value(succ);
+        resp["SUCCS"].append(entry);
+    }
+    co_return resp;
+}
+
 std::vector<RemotePeer>
 AbstractChordPeer::GetNSuccessors(const std::string &unhashed_key, int n)
 {
     return GetNSuccessors(ChordKey(unhashed_key, false), n);
 }
 
+std::optional<std::vector<RemotePeer>>
+AbstractChordPeer::ViewNSuccessors(const ChordKey &key, int n)
+{
+    // Only trust the view if it agrees with us as to whether we own the key.
+    if(ViewIsFresh()) {
+        std::vector<RemotePeer> view_succs = membership_.NSuccessors(key, n);
+        if(! view_succs.empty() &&
+           (view_succs.front().id_ == id_) == StoredLocally(key))
+        {
+            return view_succs;
+        }
+    }
+    return std::nullopt;
+}
+
 std::vector<RemotePeer> AbstractChordPeer::GetNSuccessors(const ChordKey &key,
                                                           int n)
 {
+    std::optional<std::vector<RemotePeer>> view_succs = ViewNSuccessors(key, n);
+    if(view_succs.has_value()) {
+        return view_succs.value();
+    }
+
     Log("Getting n succs");
     std::vector<RemotePeer> successors_list;
     std::set<ChordKey> succ_ids;
@@ -372,12 +869,48 @@ std::vector<RemotePeer> AbstractChordPeer::GetNSuccessors(const ChordKey &key,
     return successors_list;
 }
 
+Awaitable<std::vector<RemotePeer>>
+AbstractChordPeer::AsyncGetNSuccessors(ChordKey key, int n)
+{
+    std::optional<std::vector<RemotePeer>> view_succs = ViewNSuccessors(key, n);
+    if(view_succs.has_value()) {
+        co_return view_succs.value();
+    }
+
+    std::vector<RemotePeer> successors_list;
+    std::set<ChordKey> succ_ids;
+    ChordKey previous_peer_id = key - 1;
+
+    for(int i = 0; i < n; i++) {
+        RemotePeer ith_succ = co_await AsyncGetSuccessor(
+                previous_peer_id + 1,
+                std::chrono::steady_clock::now() + DEFAULT_REQUEST_BUDGET);
+
+        // For reasoning here, see comment on the GetNSuccessors member.
+        if(succ_ids.find(ith_succ.id_) != succ_ids.end()) {
+            break;
+        }
+
+        successors_list.push_back(ith_succ);
+        succ_ids.insert(ith_succ.id_);
+        previous_peer_id = ith_succ.id_;
+    }
+    co_return successors_list;
+}
+
 RemotePeer AbstractChordPeer::GetPredecessor(const std::string &unhashed_key)
 {
     return GetPredecessor(ChordKey(unhashed_key, false));
 }
 
 RemotePeer AbstractChordPeer::GetPredecessor(const ChordKey &key)
+{
+    return GetPredecessor(key,
+                          std::chrono::steady_clock::now() + DEFAULT_REQUEST_BUDGET);
+}
+
+RemotePeer AbstractChordPeer::GetPredecessor(const ChordKey &key,
+                                             const Deadline &deadline)
 {
     // If this is the only peer in the chord, then this is the pred.
     if(! predecessor_.IsSet()) {
@@ -389,36 +922,67 @@ RemotePeer AbstractChordPeer::GetPredecessor(const ChordKey &key)
         return predecessor_.Get();
     }
 
-    // Successor list lookup can often be quicker than finger table lookup,
-    // so this is a simple optimization.
+    // As in GetSuccessor, merge identical concurrent lookups.
+    return pred_lookups_.Do(key, deadline, [&] {
+        // Successor list lookup can often be quicker than finger table
+        // lookup, so this is a simple optimization.
+        std::optional<RemotePeer> succ_of_key = successors_.Lookup(key);
+        if(succ_of_key.has_value()) {
+            RemotePeer pred_of_succ = succ_of_key->GetPred();
+            // If the key is between the successor and its predecessor.
+            if(key.InBetween(pred_of_succ.id_, succ_of_key->id_, true)) {
+                return pred_of_succ;
+            }
+        }
+
+        // Even though we're looking for a pred, we forward it to the key's
+        // succ, who in turn gives its pred.
+        Json::Value pred_req, json_pred;
+        pred_req["COMMAND"] = "GET_PRED";
+        pred_req["KEY"] = std::string(key);
+        json_pred = ForwardRequest(key, pred_req, deadline);
+
+        if(json_pred["SUCCESS"].asBool()) {
+            return RemotePeer(json_pred);
+        }
+
+        throw std::runtime_error("Lookup failed w/ error: " +
+                                 json_pred["ERRORS"].asString());
+    });
+}
+
+Awaitable<RemotePeer> AbstractChordPeer::AsyncGetPredecessor(ChordKey key,
+                                                            Deadline deadline)
+{
+    if(! predecessor_.IsSet()) {
+        co_return ToRemotePeer();
+    }
+
+    if(StoredLocally(key)) {
+        co_return predecessor_.Get();
+    }
+
+    // As in GetPredecessor, try our successor list before routing.
     std::optional<RemotePeer> succ_of_key = successors_.Lookup(key);
     if(succ_of_key.has_value()) {
-        RemotePeer pred_of_succ = succ_of_key->GetPred();
-        // If the key is between the successor and its predecessor.
+        RemotePeer pred_of_succ = co_await LookupPredecessor(
+                succ_of_key.value(), succ_of_key->id_);
         if(key.InBetween(pred_of_succ.id_, succ_of_key->id_, true)) {
-            return pred_of_succ;
+            co_return pred_of_succ;
         }
     }
 
-    // Even though we're looking for a pred, we forward it to the key's succ,
-    // who in turn gives its pred.
-    Json::Value pred_req, json_pred;
+    Json::Value pred_req;
     pred_req["COMMAND"] = "GET_PRED";
     pred_req["KEY"] = std::string(key);
-    json_pred = ForwardRequest(key, pred_req);
-
-    if(json_pred["SUCCESS"].asBool()) {
-        return RemotePeer(json_pred);
-    }
-
-    throw std::runtime_error("Lookup failed w/ error: " +
-                             json_pred["ERRORS"].asString());
+    co_return RemotePeer(co_await AsyncForwardRequest(key, pred_req,
+                                                      deadline));
 }
 
 Json::Value AbstractChordPeer::GetPredHandler(const Json::Value &req)
 {
     ChordKey key(req["KEY"].asString(), true);
-    RemotePeer pred = GetPredecessor(key);
+    RemotePeer pred = GetPredecessor(key, Client::GetDeadline(req));
     return Json::Value(pred);
 }
 
@@ -448,38 +1012,65 @@ std::vector<RemotePeer> AbstractChordPeer::GetNPredecessors(const ChordKey &key,
     return pred_list;
 }
 
+Awaitable<std::vector<RemotePeer>>
+AbstractChordPeer::AsyncGetNPredecessors(ChordKey key, int n)
+{
+    std::vector<RemotePeer> pred_list;
+    ChordKey previous_peer_id = key;
+
+    for(int i = 0; i < n; i++) {
+        RemotePeer ith_pred = co_await AsyncGetPredecessor(
+                previous_peer_id - 1,
+                std::chrono::steady_clock::now() + DEFAULT_REQUEST_BUDGET);
+        pred_list.push_back(ith_pred);
+
+        if(previous_peer_id == key && i != 0) {
+            break;
+        }
+
+        previous_peer_id = ith_pred.id_;
+    }
+    co_return pred_list;
+}
+
 /*-----------------------------------------------------------------------------
  * MAINTENANCE: Here, we implement functions necessary to maintain the correct-
  *              ness of the overlay network, in this case Stabilize, which
  *              periodically checks the predecessor of this node's successor
  *              and determines whether or not it ought to be our successor,
- *              and PopulateFingerTable, which initializes/updates our finger
- *              table.
+ *              and PopulateFingerTable/RefreshFingerTable, which initialize/
+ *              update our finger table.
  *----------------------------------------------------------------------------*/
 
 void AbstractChordPeer::Stabilize()
+{
+    RunCoroutine(AsyncStabilize());
+}
+
+Awaitable<void> AbstractChordPeer::AsyncStabilize()
 {
     Log("Running stabilize.");
 
-    if(! predecessor_.Get().IsAlive()) {
-        HandlePredFailure(predecessor_.Get());
+    if(! co_await predecessor_.Get().AsyncIsAlive()) {
+        co_await HandlePredFailure(predecessor_.Get());
     }
 
     // If successors list is empty, initialize w/ GetNSuccessors.
     if(successors_.Size() == 0) {
-        successors_.Populate(GetNSuccessors(id_ + 1, num_succs_));
-        PopulateFingerTable(false);
-        return;
+        successors_.Populate(co_await AsyncGetNSuccessors(id_ + 1, num_succs_));
+        co_await RefreshFingerTable();
+        co_return;
     }
 
     RemotePeer immediate_succ = successors_.GetNthEntry(0);
 
-    while(! immediate_succ.IsAlive()) {
+    while(! co_await immediate_succ.AsyncIsAlive()) {
         successors_.Delete(immediate_succ);
         immediate_succ = successors_.GetNthEntry(0);
     }
 
-    RemotePeer pred_of_succ = immediate_succ.GetPred();
+    RemotePeer pred_of_succ = co_await LookupPredecessor(immediate_succ,
+                                                         immediate_succ.id_);
 
 
     // In this case, we are the correct predecessor (or at least more correct)
@@ -490,58 +1081,49 @@ void AbstractChordPeer::Stabilize()
 
     // If we are in between our succ's listed pred and the succ, or if our
     // succ's listed pred is down, we should be the succ's pred.
-    if(incorrect_succ || ! pred_of_succ.IsAlive()) {
+    if(incorrect_succ || ! co_await pred_of_succ.AsyncIsAlive()) {
         Log("Notifying " + std::to_string(immediate_succ.port_));
-        Notify(immediate_succ);
+        co_await AsyncNotify(immediate_succ);
     }
 
 
     Log("Updating succ list");
-    UpdateSuccList();
+    co_await AsyncUpdateSuccList();
     Log("Finished updating succs");
     Log("Populating FT");
-    PopulateFingerTable(false);
+    co_await RefreshFingerTable();
     Log("Finished updating FT");
+
+    if(one_hop_) {
+        co_await SyncMembership(immediate_succ);
+    }
 }
 
 void AbstractChordPeer::UpdateSuccList()
+{
+    RunCoroutine(AsyncUpdateSuccList());
+}
+
+Awaitable<void> AbstractChordPeer::AsyncUpdateSuccList()
 {
     std::vector<RemotePeer> old_peer_list = successors_.GetEntries();
 
+    // Find any new peers between each entry of the old list and the entry
+    // before it. Each gap is independent of the others, so search them all
+    // at once.
+    std::vector<Awaitable<std::vector<RemotePeer>>> walks;
     ChordKey previous_succ_id = id_;
+    for(const auto &nth_entry : old_peer_list) {
+        walks.push_back(WalkPredecessors(nth_entry, previous_succ_id, id_));
+        previous_succ_id = nth_entry.id_;
+    }
 
-    // Otherwise, iterate through the old list and find any new peers between
-    // old entries.
-    for(auto &nth_entry : old_peer_list) {
-        RemotePeer last_entry = nth_entry;
-
-        // Find any new peers between nth entry of successor list and n - 1th
-        // entry.
-        while(true) {
-            // Contacts dead entries.
-            RemotePeer pred_of_last_entry;
-            try {
-                pred_of_last_entry = last_entry.GetPred();
-            } catch(const std::runtime_error &err) {
-                break;
-            }
-
-            // In this case, we've found all the new nodes between our nth (old)
-            // succ and our n-1th (old) succ, by getting each pred of the nth succ
-            // and each pred of that node until we reach the (n-1th) succ.
-            if(pred_of_last_entry.id_ == previous_succ_id ||
-               pred_of_last_entry.id_ == id_) {
-                break;
-            }
-
-            if(pred_of_last_entry.IsAlive()) {
-                successors_.Insert(pred_of_last_entry);
+    for(const auto &new_peers : co_await WhenAll(std::move(walks))) {
+        if(new_peers) {
+            for(const RemotePeer &peer : *new_peers) {
+                successors_.Insert(peer);
             }
-
-            last_entry = pred_of_last_entry;
         }
-
-        previous_succ_id = nth_entry.id_;
     }
 
     // If successor list is still too small, get successors of final entry
@@ -550,8 +1132,8 @@ void AbstractChordPeer::UpdateSuccList()
         int size = successors_.Size(), discrepancy = num_succs_ - size;
 
         RemotePeer last_succ = successors_.GetNthEntry(size - 1);
-        std::vector<RemotePeer> succs = GetNSuccessors(last_succ.id_ + 1,
-                                                       discrepancy);
+        std::vector<RemotePeer> succs = co_await AsyncGetNSuccessors(
+                last_succ.id_ + 1, discrepancy);
 
         for(const RemotePeer &peer : succs) {
             if(peer.id_ != id_) {
@@ -561,7 +1143,68 @@ void AbstractChordPeer::UpdateSuccList()
     }
 }
 
-void AbstractChordPeer::PopulateFingerTable(bool initialize)
+Awaitable<std::vector<RemotePeer>> AbstractChordPeer::WalkPredecessors(
+        RemotePeer entry, ChordKey stop_id, ChordKey self_id)
+{
+    std::vector<RemotePeer> new_peers;
+    bool is_new = false;
+    while(true) {
+        Json::Value pred_req;
+        pred_req["COMMAND"] = "GET_PRED";
+        pred_req["KEY"] = std::string(entry.id_);
+
+        // If the entry can't tell us its pred, it's dead (or as good as), so
+        // we can neither keep it nor walk past it.
+        RemotePeer pred_of_entry;
+        try {
+            pred_of_entry = RemotePeer(co_await entry.AsyncSendRequest(
+                    pred_req, std::chrono::steady_clock::now() +
+                              DEFAULT_REQUEST_BUDGET));
+        } catch(...) {
+            break;
+        }
+
+        // Otherwise, it's alive.
+        if(is_new) {
+            new_peers.push_back(entry);
+        }
+
+        // In this case, we've found all the new nodes between the succ we
+        // started from and the succ before it, by getting each pred of the
+        // former until we reach the latter.
+        if(pred_of_entry.id_ == stop_id || pred_of_entry.id_ == self_id) {
+            break;
+        }
+
+        entry = pred_of_entry;
+        is_new = true;
+    }
+    co_return new_peers;
+}
+
+Awaitable<RemotePeer> AbstractChordPeer::LookupSuccessor(RemotePeer peer,
+                                                        ChordKey key)
+{
+    Json::Value succ_req;
+    succ_req["COMMAND"] = "GET_SUCC";
+    succ_req["KEY"] = std::string(key);
+    co_return RemotePeer(co_await peer.AsyncSendRequest(
+            succ_req, std::chrono::steady_clock::now() +
+                      DEFAULT_REQUEST_BUDGET));
+}
+
+Awaitable<RemotePeer> AbstractChordPeer::LookupPredecessor(RemotePeer peer,
+                                                          ChordKey key)
+{
+    Json::Value pred_req;
+    pred_req["COMMAND"] = "GET_PRED";
+    pred_req["KEY"] = std::string(key);
+    co_return RemotePeer(co_await peer.AsyncSendRequest(
+            pred_req, std::chrono::steady_clock::now() +
+                      DEFAULT_REQUEST_BUDGET));
+}
+
+void AbstractChordPeer::PopulateFingerTable()
 {
     Log("Populating ft");
     for(int i = 0; i < finger_table_.num_entries_; ++i) {
@@ -570,48 +1213,67 @@ void AbstractChordPeer::PopulateFingerTable(bool initialize)
         succ_req["COMMAND"] = "GET_SUCC";
         succ_req["KEY"] = std::string(entry_range.first);
 
-        if(initialize) {
-            // If key is local, then entry should just point to ourselves.
-            if(StoredLocally(entry_range.first)) {
-                finger_table_.AddFinger(ChordFingerTable::FingerType {
-                        entry_range.first,
-                        entry_range.second,
-                        ToRemotePeer()
-                });
-            }
-
-            else {
-                // The closest preceding node that we know of for any entry
-                // entry is the previous entry, so we should query it.
-                // For i = 0, no previous entry exists, so we'll just ask the
-                // predecessor.
-                RemotePeer peer_to_query = i == 0 ?
-                                           predecessor_.Get() :
-                                           finger_table_.GetNthEntry(i - 1);
-                Json::Value succ_resp = peer_to_query.SendRequest(succ_req);
-                finger_table_.AddFinger(ChordFingerTable::FingerType {
-                        entry_range.first,
-                        entry_range.second,
-                        RemotePeer(succ_resp)
-                });
-            }
+        // If key is local, then entry should just point to ourselves.
+        if(StoredLocally(entry_range.first)) {
+            finger_table_.AddFinger(ChordFingerTable::FingerType {
+                    entry_range.first,
+                    entry_range.second,
+                    ToRemotePeer()
+            });
         }
 
         else {
-            if(i == 0) {
-                finger_table_.EditNthFinger(i, GetSuccessor(entry_range.first));
-            } else {
-                // If i is not 0, then the path closest preceding node we know
-                // of for this entry is the peer in the last entry, so query it.
-                RemotePeer peer_to_query = finger_table_.GetNthEntry(i - 1);
-                Json::Value succ_resp = peer_to_query.SendRequest(succ_req);
-                finger_table_.EditNthFinger(i, RemotePeer(succ_resp));
-            }
+            // The closest preceding node that we know of for any entry
+            // entry is the previous entry, so we should query it.
+            // For i = 0, no previous entry exists, so we'll just ask the
+            // predecessor.
+            RemotePeer peer_to_query = i == 0 ?
+                                       predecessor_.Get() :
+                                       *finger_table_.GetNthEntry(i - 1);
+            Json::Value succ_resp = peer_to_query.SendRequest(succ_req);
+            finger_table_.AddFinger(ChordFingerTable::FingerType {
+                    entry_range.first,
+                    entry_range.second,
+                    RemotePeer(succ_resp)
+            });
         }
     }
     Log("Ended ft pop");
 }
 
+Awaitable<void> AbstractChordPeer::RefreshFingerTable()
+{
+    finger_table_.EditNthFinger(0, co_await AsyncGetSuccessor(
+            finger_table_.GetNthRange(0).first,
+            std::chrono::steady_clock::now() + DEFAULT_REQUEST_BUDGET));
+
+    // For i > 0, the closest preceding node we know of for entry i is the
+    // peer in entry i - 1 (as of the start of this refresh, which is just as
+    // good a place to start the lookup), so query it. This makes the lookups
+    // independent, so run them concurrently, a window at a time so as not to
+    // flood the peers we query.
+    int num_entries = (int) finger_table_.num_entries_;
+    for(int first = 1; first < num_entries;
+        first += MAX_CONCURRENT_FINGER_LOOKUPS)
+    {
+        int last = std::min(first + MAX_CONCURRENT_FINGER_LOOKUPS, num_entries);
+        std::vector<Awaitable<RemotePeer>> lookups;
+        for(int i = first; i < last; ++i) {
+            lookups.push_back(LookupSuccessor(finger_table_.GetNthEntry(i - 1),
+                                              finger_table_.GetNthRange(i).first));
+        }
+
+        // Entries whose lookup failed are left as they are until the next
+        // refresh.
+        auto fingers = co_await WhenAll(std::move(lookups));
+        for(int i = first; i < last; ++i) {
+            if(fingers[i - first]) {
+                finger_table_.EditNthFinger(i, *fingers[i - first]);
+            }
+        }
+    }
+}
+
 void AbstractChordPeer::FixOtherFingers(const ChordKey &starting_key)
 {
     // Affected nodes should update their finger tables to account for this
@@ -619,7 +1281,7 @@ void AbstractChordPeer::FixOtherFingers(const ChordKey &starting_key)
     // affected.
     std::optional<RemotePeer> former_peer;
     for(int i = 1; i <= ChordKey::BinaryLen(); ++i) {
-        ChordKey decrease_interval(mp::pow(mp::uint256_t(2), i - 1));
+        ChordKey decrease_interval = ChordKey::PowerOfTwo(i - 1);
         RemotePeer p = GetPredecessor(starting_key - decrease_interval);
 
         // No need to notify the same peer twice.
@@ -644,14 +1306,19 @@ void AbstractChordPeer::FixOtherFingers(const ChordKey &starting_key)
     }
 }
 
-void AbstractChordPeer::Rectify(const RemotePeer &failed_peer)
+Awaitable<void> AbstractChordPeer::Rectify(RemotePeer failed_peer)
 {
     // Have to ensure that rectify is not being called erroneously.
-    if(failed_peer.IsAlive()) {
-        return;
+    if(co_await failed_peer.AsyncIsAlive()) {
+        co_return;
     }
 
     Log("Rectifying failure of " + std::to_string(failed_peer.port_));
+    if(one_hop_) {
+        Broadcast(MembershipEvent(MembershipEvent::Type::FAIL, failed_peer,
+                                  membership_.Incarnation(failed_peer.id_)));
+    }
+
     Json::Value rectify_req;
     rectify_req["COMMAND"] = "RECTIFY";
     rectify_req["FAILED_NODE"] = Json::Value(failed_peer);
@@ -659,8 +1326,10 @@ void AbstractChordPeer::Rectify(const RemotePeer &failed_peer)
 
     std::optional<RemotePeer> former_peer;
     for(int i = 1; i <= ChordKey::BinaryLen(); ++i) {
-        ChordKey decrease_interval(mp::pow(mp::uint256_t(2), i - 1));
-        RemotePeer p = GetPredecessor(failed_peer.id_ - decrease_interval);
+        ChordKey decrease_interval = ChordKey::PowerOfTwo(i - 1);
+        RemotePeer p = co_await AsyncGetPredecessor(
+                failed_peer.id_ - decrease_interval,
+                std::chrono::steady_clock::now() + DEFAULT_REQUEST_BUDGET);
 
         // No need to notify the same peer twice.
         if(former_peer.has_value() && former_peer.value() == p) {
@@ -675,8 +1344,10 @@ void AbstractChordPeer::Rectify(const RemotePeer &failed_peer)
             break;
         }
 
-        if(p.IsAlive()) {
-            p.SendRequest(rectify_req);
+        if(co_await p.AsyncIsAlive()) {
+            co_await p.AsyncSendRequest(rectify_req,
+                                        std::chrono::steady_clock::now() +
+                                        DEFAULT_REQUEST_BUDGET);
         }
     }
 }
@@ -697,10 +1368,291 @@ Json::Value AbstractChordPeer::RectifyHandler(const Json::Value &req)
     return resp;
 }
 
+/*-----------------------------------------------------------------------------
+ * ONE-HOP: Keep a full view of the ring's membership up to date by gossip,
+ *          disseminating events along the ring such that each peer receives
+ *          each event once, and repairing whatever gossip misses by periodic
+ *          anti-entropy with our successor.
+ *----------------------------------------------------------------------------*/
+
+void AbstractChordPeer::Broadcast(const MembershipEvent &event)
+{
+    membership_.Apply(event);
+    Json::Value events = Json::arrayValue;
+    events.append(Json::Value(event));
+    QueueGossip(events, id_);
+}
+
+void AbstractChordPeer::QueueGossip(const Json::Value &events,
+                                    const ChordKey &limit)
+{
+    std::lock_guard<std::mutex> lock(gossip_mutex_);
+    Json::Value &queued = gossip_outbox_[limit];
+    for(const Json::Value &event : events) {
+        queued.append(event);
+    }
+}
+
+void AbstractChordPeer::FlushGossip(bool wait)
+{
+    std::map<ChordKey, Json::Value> outbox;
+    {
+        std::lock_guard<std::mutex> lock(gossip_mutex_);
+        outbox.swap(gossip_outbox_);
+    }
+    if(outbox.empty()) {
+        return;
+    }
+
+    std::vector<Awaitable<Json::Value>> sends;
+    for(const auto &[limit, events] : outbox) {
+        for(const auto &[target, target_limit] :
+                membership_.BroadcastTargets(id_, limit))
+        {
+            Json::Value gossip_req;
+            gossip_req["COMMAND"] = "GOSSIP";
+            gossip_req["EVENTS"] = events;
+            gossip_req["LIMIT"] = std::string(target_limit);
+            sends.push_back(target.AsyncSendRequest(
+                    gossip_req, std::chrono::steady_clock::now() +
+                                DEFAULT_REQUEST_BUDGET));
+        }
+    }
+
+    // Should a target be unreachable, it and the part of the ring it was to
+    // pass the events on to miss them until the next round of anti-entropy.
+    // The sends hold copies of everything they need, so they can outlive us.
+    if(wait) {
+        RunCoroutine(WhenAll(std::move(sends)));
+    } else {
+        boost::asio::co_spawn(boost::asio::make_strand(MaintenanceExecutor()),
+                              WhenAll(std::move(sends)),
+                              boost::asio::detached);
+    }
+}
+
+Json::Value AbstractChordPeer::GossipHandler(const Json::Value &req)
+{
+    if(! one_hop_) {
+        throw std::runtime_error("One-hop routing is not enabled.");
+    }
+
+    // Pass the events on even if they weren't news to us (e.g. because the
+    // peer joined through us), since the peers in our part of the ring may
+    // not have heard of them. Each part we pass them on to is strictly
+    // smaller than ours, so, even should views disagree, they can't circle.
+    for(const Json::Value &event : req["EVENTS"]) {
+        membership_.Apply(MembershipEvent(event));
+    }
+    QueueGossip(req["EVENTS"], ChordKey(req["LIMIT"].asString(), true));
+
+    RefuteRemoval();
+    return Json::Value();
+}
+
+Awaitable<void> AbstractChordPeer::SyncMembership(RemotePeer peer)
+{
+    Json::Value sync_req;
+    sync_req["COMMAND"] = "SYNC_MEMBERSHIP";
+    sync_req["CLASS"] = "MAINTENANCE";
+    sync_req["DIGEST"] = membership_.Digest();
+    Json::Value sync_resp = co_await peer.AsyncSendRequest(
+            sync_req, std::chrono::steady_clock::now() +
+                      DEFAULT_REQUEST_BUDGET);
+
+    // If our views differed, merge theirs into ours, and, if theirs lacked
+    // anything of ours, send them ours in turn.
+    if(sync_resp.isMember("VIEW")) {
+        membership_.Merge(sync_resp["VIEW"]);
+        if(membership_.Digest() != sync_resp["DIGEST"].asString()) {
+            sync_req["DIGEST"] = membership_.Digest();
+            sync_req["VIEW"] = Json::Value(membership_);
+            co_await peer.AsyncSendRequest(sync_req,
+                                           std::chrono::steady_clock::now() +
+                                           DEFAULT_REQUEST_BUDGET);
+        }
+        RefuteRemoval();
+    }
+
+    std::lock_guard<std::mutex> lock(gossip_mutex_);
+    membership_synced_ = std::chrono::steady_clock::now();
+}
+
+Json::Value AbstractChordPeer::SyncMembershipHandler(const Json::Value &req)
+{
+    if(! one_hop_) {
+        throw std::runtime_error("One-hop routing is not enabled.");
+    }
+
+    if(req.isMember("VIEW")) {
+        membership_.Merge(req["VIEW"]);
+        RefuteRemoval();
+    }
+
+    Json::Value resp;
+    resp["DIGEST"] = membership_.Digest();
+    if(req["DIGEST"].asString() != resp["DIGEST"].asString()) {
+        resp["VIEW"] = Json::Value(membership_);
+    }
+    return resp;
+}
+
+void AbstractChordPeer::RefuteRemoval()
+{
+    if(membership_.IsMember(id_)) {
+        return;
+    }
+
+    uint64_t incarnation = std::max(incarnation_.load(),
+                                    membership_.Incarnation(id_)) + 1;
+    incarnation_ = incarnation;
+    Log("Refuting our removal from the membership view.");
+    Broadcast(MembershipEvent(MembershipEvent::Type::JOIN, ToRemotePeer(),
+                              incarnation));
+}
+
+bool AbstractChordPeer::ViewIsFresh()
+{
+    if(! one_hop_) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(gossip_mutex_);
+    return std::chrono::steady_clock::now() - membership_synced_ <
+           MEMBERSHIP_STALE_AFTER;
+}
+
+std::optional<RemotePeer> AbstractChordPeer::OneHopSuccessor(const ChordKey &key)
+{
+    if(! ViewIsFresh()) {
+        return std::nullopt;
+    }
+
+    // If the view says we own a key we don't, it's behind (on a join or
+    // leave next to us), and if it names a peer which keeps failing, it may
+    // be behind on that peer's failure. Either way, route instead.
+    std::optional<RemotePeer> succ = membership_.Successor(key);
+    if(! succ.has_value() || succ->id_ == id_ ||
+       PeerHealth::Of(succ->ip_addr_, succ->port_)->IsTripped())
+    {
+        return std::nullopt;
+    }
+    return succ;
+}
+
 /*-----------------------------------------------------------------------------
  * MISCELLANEOUS: Anything else.
  *----------------------------------------------------------------------------*/
 
+Json::Value AbstractChordPeer::SendForwardedRequest(const RemotePeer &next_hop,
+                                                    const ChordKey &key,
+                                                    const Json::Value &request,
+                                                    const Deadline &deadline)
+{
+    int retry_after_ms;
+    try {
+        return next_hop.SendRequest(request, deadline);
+    } catch(const BusyError &err) {
+        retry_after_ms = err.retry_after_ms_;
+    }
+
+    // The key's owner, if we know it, is the best detour. Otherwise, try our
+    // successors from the one closest to the key backwards. We never detour
+    // via successors past the key or via our predecessor, since either could
+    // send the request back through us.
+    std::vector<RemotePeer> detours;
+    std::optional<RemotePeer> owner = successors_.Lookup(key);
+    if(owner.has_value()) {
+        detours.push_back(owner.value());
+    }
+
+    std::vector<RemotePeer> succs = successors_.GetEntries();
+    for(auto it = succs.rbegin(); it != succs.rend(); ++it) {
+        if(it->id_.InBetween(id_, key, false)) {
+            detours.push_back(*it);
+        }
+    }
+
+    for(const auto &detour : detours) {
+        if(detour.id_ == next_hop.id_ || detour.id_ == id_ ||
+           ! detour.IsAvailable())
+        {
+            continue;
+        }
+
+        try {
+            return detour.SendRequest(request, deadline);
+        } catch(const BusyError &err) {
+            retry_after_ms = std::max(retry_after_ms, err.retry_after_ms_);
+        }
+    }
+
+    // We run on a server IO thread, holding an admission slot, so waiting
+    // out the hint here would only shed more of our own traffic. Pass the
+    // "BUSY" back instead, for the requester to route around us or wait.
+    Log("All routes for " + std::string(key) + " busy for " +
+        std::to_string(retry_after_ms) + "ms");
+    throw BusyError(retry_after_ms);
+}
+
+Awaitable<Json::Value> AbstractChordPeer::AsyncForwardRequest(
+        ChordKey key, Json::Value request, Deadline deadline)
+{
+    RemotePeer next_hop = finger_table_.Lookup(key);
+    if(next_hop.id_ == id_ && predecessor_.IsSet()) {
+        next_hop = predecessor_.Get();
+    }
+
+    // After the next hop, the detours are as in SendForwardedRequest.
+    std::vector<RemotePeer> routes { next_hop };
+    std::optional<RemotePeer> owner = successors_.Lookup(key);
+    if(owner.has_value()) {
+        routes.push_back(owner.value());
+    }
+    std::vector<RemotePeer> succs = successors_.GetEntries();
+    for(auto it = succs.rbegin(); it != succs.rend(); ++it) {
+        if(it->id_.InBetween(id_, key, false)) {
+            routes.push_back(*it);
+        }
+    }
+
+    // A route which is down or tripped fails at once, without waiting on the
+    // network, so there's no need to check first.
+    std::set<ChordKey> tried;
+    std::optional<RemotePeer> busy_route;
+    int retry_after_ms = 0;
+    for(const RemotePeer &route : routes) {
+        if(route.id_ == id_ || ! tried.insert(route.id_).second) {
+            continue;
+        }
+
+        try {
+            co_return co_await route.AsyncSendRequest(request, deadline);
+        } catch(const BusyError &err) {
+            retry_after_ms = std::max(retry_after_ms, err.retry_after_ms_);
+            if(! busy_route.has_value()) {
+                busy_route = route;
+            }
+        } catch(const std::exception &err) {}
+    }
+
+    if(! busy_route.has_value()) {
+        throw std::runtime_error("Lookup failed");
+    }
+
+    auto retry_time = std::chrono::steady_clock::now() +
+                      std::chrono::milliseconds(retry_after_ms);
+    if(retry_time >= deadline) {
+        throw std::runtime_error("All routes busy until past deadline.");
+    }
+
+    Log("All routes for " + std::string(key) + " busy, retrying in " +
+        std::to_string(retry_after_ms) + "ms");
+    boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor,
+                                    retry_time);
+    co_await timer.async_wait(boost::asio::use_awaitable);
+    co_return co_await busy_route->AsyncSendRequest(request, deadline);
+}
+
 RemotePeer AbstractChordPeer::ToRemotePeer()
 {
     return RemotePeer(id_, min_key_.Get(), ip_addr_, port_);
@@ -758,6 +1710,16 @@ RemotePeer AbstractChordPeer::GetPredecessor()
     return predecessor_.Get();
 }
 
+size_t AbstractChordPeer::NumMembers()
+{
+    return membership_.Size();
+}
+
+void AbstractChordPeer::EnableOneHop()
+{
+    one_hop_ = true;
+}
+
 std::vector<RemotePeer> AbstractChordPeer::GetSuccessors()
 {
     return successors_.GetEntries();
@@ -42,15 +42,52 @@
 #include "../data_structures/database.h"
 #include "../data_structures/finger_table.h"
 #include "../data_structures/key.h"
+#include "../data_structures/single_flight.h"
 #include "../data_structures/thread_safe.h"
+#include "../networking/request_trace.h"
+#include "membership_view.h"
+#include "peer_directory.h"
 #include "remote_peer_list.h"
+#include <atomic>
 #include <boost/thread/mutex.hpp>
 #include <fstream>
 #include <json/json.h>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <set>
 #include <string>
 #include <utility>
 
-using ChordFingerTable = FingerTable<RemotePeer>;
+/// Size of the chunks into which files are split by default, in bytes.
+static const size_t DEFAULT_FILE_CHUNK_SIZE = 1 << 20;
+
+/// Version of the manifests written by UploadFile. Values stored under a
+/// file's name without one are whole files, uploaded before files were split
+/// into chunks.
+static const int FILE_MANIFEST_VERSION = 1;
+
+/// Commands which clients send to peers, and so which peers capture by
+/// default. (Peers send one another these too, e.g. when forwarding lookups or
+/// placing fragments, but those requests, unlike the rest, read or write keys
+/// rather than the ring's membership, so they're harmless to replay.)
+static const std::set<std::string> CLIENT_COMMANDS {
+        "GET_SUCC", "CREATE_KEY", "READ_KEY", "READ_RANGE" };
+
+/// Fingers store handles to interned peers rather than copies of them.
+using ChordFingerTable = FingerTable<PeerHandle>;
+
+/**
+ * One page of the results of a ring-wide range scan.
+ */
+struct ScanPage {
+    /// Key-value pairs, in ring order.
+    std::vector<std::pair<ChordKey, std::string>> kv_pairs_;
+
+    /// Token from which the scan can be resumed, or empty if the scan is
+    /// complete.
+    std::string next_page_token_;
+};
 
 /**
  * Implement base chord functionality to be inherited by ChordPeer, DHashPeer,
@@ -70,6 +107,20 @@ public:
     RemotePeer GetPredecessor();
     std::vector<RemotePeer> GetSuccessors();
 
+    /**
+     * @return Number of live peers in our membership view (one-hop mode only).
+     */
+    size_t NumMembers();
+
+    /**
+     * Run in one-hop mode: keep a view of every peer in the ring, up to date
+     * by gossip, and resolve successor lookups from it rather than by routing
+     * them through the finger table (which remains the fallback for when the
+     * view may be stale). Must be called before starting or joining a chord,
+     * and every peer in the chord must do so, since each passes gossip on.
+     */
+    void EnableOneHop();
+
     /**
      * Start a chord.
      */
@@ -103,6 +154,22 @@ public:
      */
     virtual std::string Read(const std::string &unhashed) = 0;
 
+    /**
+     * Start appending the requests this peer receives to a trace file, from
+     * which its workload can later be replayed (see request_trace.h).
+     * @param path Path of the trace file.
+     * @param filter Which requests to capture. By default, only those which
+     *               clients send.
+     */
+    virtual void StartRequestCapture(
+            const std::string &path,
+            TraceFilter filter = { CLIENT_COMMANDS }) = 0;
+
+    /**
+     * Stop capturing requests, flushing the trace file.
+     */
+    virtual void StopRequestCapture() = 0;
+
     /**
      * Retrieve the successor node of a given key.
      * @param unhashed_key The unhashed version of the key to lookup in the
@@ -124,6 +191,40 @@ public:
     std::vector<RemotePeer> GetNSuccessors(const std::string &unhashed_key,
                                            int n);
 
+    /**
+     * Retrieve the successors of many keys at once. Keys are routed together
+     * for as long as they share a path, so the number of messages sent grows
+     * with the number of distinct successors, not the number of keys.
+     * @param unhashed_keys The unhashed versions of the keys to lookup in the
+     *                      overlay network.
+     * @return The successor of each key, in the same order as unhashed_keys,
+     *         or throw an error if any key's successor can't be found.
+     */
+    std::vector<RemotePeer> GetSuccessorBatch(
+            const std::vector<std::string> &unhashed_keys);
+
+    /**
+     * Read the key-value pairs in a range of the keyspace, walking the peers
+     * which own it in ring order. Each peer's slice of the range is read as a
+     * paged cursor, and the next peer's slice is prefetched while the current
+     * one is being read.
+     * @param lower_bound First key of the range.
+     * @param upper_bound Last key of the range (which may wrap past zero).
+     * @param limit Maximum number of pairs to return.
+     * @return Up to limit pairs, and a token from which to resume the scan
+     *         if the range holds more.
+     */
+    ScanPage Scan(const ChordKey &lower_bound, const ChordKey &upper_bound,
+                  size_t limit);
+
+    /**
+     * Resume a scan.
+     * @param page_token Token given with the previous page of the scan.
+     * @param limit Maximum number of pairs to return.
+     * @return The next page of the scan.
+     */
+    ScanPage Scan(const std::string &page_token, size_t limit);
+
     /**
      * Retrieve the successor node of a given key.
      * @param unhashed_key The unhashed version of the key to lookup in the
@@ -145,10 +246,18 @@ public:
                                              int n);
 
     /**
-     * Upload a file to the overlay network.
+     * Upload a file to the overlay network. The file is split into chunks,
+     * each stored under its own key, and a manifest giving the file's size
+     * and chunk size is stored under the file's name. (Files uploaded before
+     * files were chunked are stored whole under their names, and can still be
+     * downloaded and read.)
      * @param file_path The path of the file to upload.
+     * @param chunk_size Size of each chunk (but the last) in bytes. Must be
+     *                   positive.
      */
-    void UploadFile(const std::string &file_path);
+    void UploadFile(const std::string &file_path,
+                    size_t chunk_size = DEFAULT_FILE_CHUNK_SIZE);
+
     /**
      * Download a file's contents from the overlay network, and write it to
      * output_path.
@@ -159,6 +268,18 @@ public:
     void DownloadFile(const std::string &file_name,
                       const std::string &output_path);
 
+    /**
+     * Read part of a file from the overlay network, fetching only the chunks
+     * which cover it (in parallel).
+     * @param file_name The name of the file stored on the overlay network.
+     * @param offset Offset of the first byte to read.
+     * @param length Number of bytes to read.
+     * @return The bytes in [offset, offset + length) (fewer if the file ends
+     *         before offset + length).
+     */
+    std::string ReadFileRange(const std::string &file_name, size_t offset,
+                              size_t length);
+
 protected:
     /**
      * Construct chord base peer running at specified IP addr and port.
@@ -215,6 +336,13 @@ protected:
      */
     void Notify(const RemotePeer &peer_to_notify);
 
+    /**
+     * Awaitable version of Notify, for use from maintenance coroutines.
+     *
+     * @param peer_to_notify Peer to which a notification will be sent.
+     */
+    Awaitable<void> AsyncNotify(RemotePeer peer_to_notify);
+
     /**
      * Pure virtual function handler to respond to notification from a new peer
      * in the network.
@@ -233,6 +361,27 @@ protected:
      */
     RemotePeer GetSuccessor(const ChordKey &key);
 
+    /**
+     * Query the chord overlay network, determine which peer succeeds a given
+     * key, giving up once deadline passes.
+     *
+     * @param key Key whose successor should be found.
+     * @param deadline Time by which the lookup must complete.
+     * @return The peer which succeeds the key.
+     */
+    RemotePeer GetSuccessor(const ChordKey &key, const Deadline &deadline);
+
+    /**
+     * Awaitable version of GetSuccessor(key, deadline), for use from
+     * maintenance coroutines. Unlike GetSuccessor, it doesn't join identical
+     * lookups in flight, since a coroutine mustn't wait on another thread.
+     *
+     * @param key Key whose successor should be found.
+     * @param deadline Time by which the lookup must complete.
+     * @return The peer which succeeds the key.
+     */
+    Awaitable<RemotePeer> AsyncGetSuccessor(ChordKey key, Deadline deadline);
+
     /**
      * Respond to request intended to determine successor of key.
      *
@@ -241,6 +390,30 @@ protected:
      */
     Json::Value GetSuccHandler(const Json::Value &req);
 
+    /**
+     * Determine the successors of a set of keys. Keys we own are answered
+     * directly; the rest are split into sub-batches by the next hop our
+     * finger table gives for them, and the sub-batches are forwarded (as
+     * GET_SUCC_BATCH requests) in parallel.
+     *
+     * @param keys Keys whose successors should be found.
+     * @param deadline Time by which the lookup must complete.
+     * @return Map of each key to its successor.
+     */
+    Awaitable<std::map<ChordKey, RemotePeer>> AsyncGetSuccessorBatch(
+            std::vector<ChordKey> keys, Deadline deadline);
+
+    /**
+     * Respond to request intended to determine the successors of several
+     * keys. This is a coroutine handler: it holds no server thread while it
+     * waits on the next hops.
+     *
+     * @param req Req specifying, in its KEYS array, the keys whose successors
+     *            ought to be found.
+     * @return JSON response with a SUCCS array of {KEY, PEER} entries.
+     */
+    Awaitable<Json::Value> GetSuccBatchHandler(Json::Value req);
+
     /**
      * Issue GetSuccessor calls such that we determine the N successors of a
      * key.
@@ -251,6 +424,27 @@ protected:
      */
     std::vector<RemotePeer> GetNSuccessors(const ChordKey &key, int n);
 
+    /**
+     * Awaitable version of GetNSuccessors, for use from maintenance
+     * coroutines.
+     *
+     * @param key Key whose n successors will be found.
+     * @param n Number of successors to find.
+     * @return Vector of successors of key.
+     */
+    Awaitable<std::vector<RemotePeer>> AsyncGetNSuccessors(ChordKey key, int n);
+
+    /**
+     * Take the n successors of a key from our membership view, if it can be
+     * trusted to give them.
+     *
+     * @param key Key whose n successors will be found.
+     * @param n Number of successors to find.
+     * @return The successors, or std::nullopt if they must be looked up.
+     */
+    std::optional<std::vector<RemotePeer>> ViewNSuccessors(const ChordKey &key,
+                                                           int n);
+
     /**
      * Return the predecessor of a key.
      *
@@ -259,6 +453,25 @@ protected:
      */
     RemotePeer GetPredecessor(const ChordKey &key);
 
+    /**
+     * Return the predecessor of a key, giving up once deadline passes.
+     *
+     * @param key Key whose predecessor will be found.
+     * @param deadline Time by which the lookup must complete.
+     * @return The predecessor of the key in question.
+     */
+    RemotePeer GetPredecessor(const ChordKey &key, const Deadline &deadline);
+
+    /**
+     * Awaitable version of GetPredecessor(key, deadline), for use from
+     * maintenance coroutines.
+     *
+     * @param key Key whose predecessor will be found.
+     * @param deadline Time by which the lookup must complete.
+     * @return The predecessor of the key in question.
+     */
+    Awaitable<RemotePeer> AsyncGetPredecessor(ChordKey key, Deadline deadline);
+
     /**
      * Respond to request by remote peer to find successor of key.
      *
@@ -277,26 +490,83 @@ protected:
      */
     std::vector<RemotePeer> GetNPredecessors(const ChordKey &key, int n);
 
+    /**
+     * Awaitable version of GetNPredecessors, for use from maintenance
+     * coroutines.
+     *
+     * @param key Key whose predecessors will be found.
+     * @param n Number predecessors to find.
+     * @return N predecessors of key as a vector.
+     */
+    Awaitable<std::vector<RemotePeer>> AsyncGetNPredecessors(ChordKey key,
+                                                             int n);
+
+    /**
+     * Run AsyncStabilize to completion, blocking the calling thread.
+     */
+    void Stabilize();
+
     /**
      * Find predecessor of successor, determine whether a new node has joined
      * between the us and our successor but failed to alert us.
      * Update finger table.
      */
-    void Stabilize();
+    Awaitable<void> AsyncStabilize();
+
+    /**
+     * Run AsyncUpdateSuccList to completion, blocking the calling thread.
+     */
+    void UpdateSuccList();
 
     /**
      * Called inside stabilize. Given an already-populated succ list, update
+     * its entries. The gaps between consecutive entries are searched for new
+     * peers concurrently.
+     */
+    Awaitable<void> AsyncUpdateSuccList();
+
+    /**
+     * Walk backwards from entry, predecessor by predecessor, until reaching
+     * stop_id (or self_id), collecting the live peers passed along the way.
+     *
+     * @param entry Peer from which to start walking.
+     * @param stop_id ID of the peer at which to stop.
+     * @param self_id Our own ID, at which to stop as well.
+     * @return Live peers found strictly between stop_id and entry.
+     */
+    static Awaitable<std::vector<RemotePeer>> WalkPredecessors(
+            RemotePeer entry, ChordKey stop_id, ChordKey self_id);
+
+    /**
+     * Lookup the successors of all keys in an empty finger table and fill in
      * its entries.
      */
-    void UpdateSuccList();
+    void PopulateFingerTable();
+
+    /**
+     * Update the entries of an already-populated finger table, looking them
+     * up concurrently.
+     */
+    Awaitable<void> RefreshFingerTable();
+
+    /**
+     * Ask peer for the successor of key.
+     *
+     * @param peer Peer to ask.
+     * @param key Key whose successor to find.
+     * @return Successor of key.
+     */
+    static Awaitable<RemotePeer> LookupSuccessor(RemotePeer peer, ChordKey key);
 
     /**
-     * Lookup the successors of all keys in the finger table and fill in its
-     * entries.
+     * Ask peer for the predecessor of key.
      *
-     * @param initialize Has finger table been populated before, or is it empty?
+     * @param peer Peer to ask.
+     * @param key Key whose predecessor to find.
+     * @return Predecessor of key.
      */
-    void PopulateFingerTable(bool initialize);
+    static Awaitable<RemotePeer> LookupPredecessor(RemotePeer peer,
+                                                   ChordKey key);
 
     /**
      * Upon joining, notify predecessors of starting_key - 2^i for i = 0...m of
@@ -329,14 +599,62 @@ protected:
      * in order to fix other nodes' finger tables, update our minimum key, and
      * adjust our finger table.
      */
-    virtual void HandlePredFailure(const RemotePeer &old_pred) = 0;
+    virtual Awaitable<void> HandlePredFailure(RemotePeer old_pred) = 0;
+
+    /**
+     * Read what is stored under a file's name: the manifest of a file
+     * uploaded by UploadFile or, if the file was stored whole, its contents.
+     * @param file_name The name of the file stored on the overlay network.
+     * @param contents Set to the file's contents, if it was stored whole.
+     * @return The manifest (the file's SIZE and CHUNK_SIZE, in bytes), or
+     *         std::nullopt if the file was stored whole.
+     */
+    std::optional<Json::Value> ReadManifest(const std::string &file_name,
+                                            std::string &contents);
+
+    /**
+     * Read chunks [first, last] of a file, at most
+     * MAX_CONCURRENT_CHUNK_READS at a time.
+     * @param file_name The name of the file stored on the overlay network.
+     * @param first Index of the first chunk to read.
+     * @param last Index of the last chunk to read.
+     * @return The chunks, in order.
+     */
+    std::vector<std::string> ReadChunks(const std::string &file_name,
+                                        size_t first, size_t last);
+
+    /**
+     * Read (up to limit pairs of) the slice of a scan held by owner, the
+     * successor of every key in [lower_bound, upper_bound].
+     * @param owner Peer which owns the slice.
+     * @param lower_bound First key of the slice.
+     * @param upper_bound Last key of the slice.
+     * @param limit Maximum number of pairs to return.
+     * @return JSON response with a KV_PAIRS array of {KEY, VAL} entries in
+     *         ring order, and MORE set if the slice holds further pairs.
+     */
+    virtual Awaitable<Json::Value> ReadSlice(RemotePeer owner,
+                                             ChordKey lower_bound,
+                                             ChordKey upper_bound,
+                                             size_t limit) = 0;
+
+    /**
+     * Find the peer following owner and read its slice of a scan (for
+     * prefetching).
+     * @param owner Owner of the slice currently being read.
+     * @param upper_bound Last key of the scan.
+     * @param limit Maximum number of pairs to return.
+     * @return As ReadSlice, with the peer whose slice it is as OWNER.
+     */
+    Awaitable<Json::Value> ReadNextSlice(RemotePeer owner, ChordKey upper_bound,
+                                         size_t limit);
 
     /**
      * When a peer fails, tell its predecessors to delete the node from their
      * finger tables and successor lists.
      * @param failed_peer The peer which has failed.
      */
-    void Rectify(const RemotePeer &failed_peer);
+    Awaitable<void> Rectify(RemotePeer failed_peer);
 
     /**
      * Given a rectify request, remove failed node from finger table/succ list.
@@ -345,6 +663,78 @@ protected:
      */
     Json::Value RectifyHandler(const Json::Value &req);
 
+    /**
+     * Apply a membership event to our view and gossip it to the rest of the
+     * ring.
+     * @param event Event which we originated (e.g. we joined, or detected a
+     *              failure).
+     */
+    void Broadcast(const MembershipEvent &event);
+
+    /**
+     * Queue events to be gossiped to the peers in (id_, limit) on the next
+     * FlushGossip.
+     * @param events JSON array of events.
+     * @param limit End (exclusive) of the range of the ring to which we are
+     *              to pass them on. Our own ID for the whole ring.
+     */
+    void QueueGossip(const Json::Value &events, const ChordKey &limit);
+
+    /**
+     * Send any queued events on to the peers responsible for each part of the
+     * range they're bound for. Events bound for the same range are sent in
+     * the same message. Called every few ms by the maintenance thread, which
+     * doesn't wait for the sends, lest a slow target hold up the next flush.
+     *
+     * @param wait Wait for every target to have received its events? (So
+     *             that news of our joining or leaving is out before we go on.)
+     */
+    void FlushGossip(bool wait);
+
+    /**
+     * Apply gossiped events, and queue them all (news to us or not) to be
+     * passed on to the rest of our part of the ring.
+     * @param req Request giving EVENTS and the LIMIT of our part of the ring.
+     * @return Empty response.
+     */
+    Json::Value GossipHandler(const Json::Value &req);
+
+    /**
+     * Anti-entropy for membership views: compare digests with peer and, if
+     * they differ, exchange and merge views. Catches any events lost to gossip
+     * to peers which were down or unreachable.
+     * @param peer Peer (our successor) with which to compare views.
+     */
+    Awaitable<void> SyncMembership(RemotePeer peer);
+
+    /**
+     * Give our digest, merging any VIEW sent along with the request, and send
+     * back our whole view if the requester's digest differs from ours.
+     * @param req Request giving the requester's DIGEST, and maybe its VIEW.
+     * @return Response giving our DIGEST, and maybe our VIEW.
+     */
+    Json::Value SyncMembershipHandler(const Json::Value &req);
+
+    /**
+     * If our view holds that we've left the ring (e.g. a peer mistook us for
+     * failed), rejoin it under a new incarnation.
+     */
+    void RefuteRemoval();
+
+    /**
+     * @return Are we in one-hop mode, with a view recently enough confirmed
+     *         by anti-entropy to be trusted?
+     */
+    bool ViewIsFresh();
+
+    /**
+     * Look up the successor of a key (which we don't own) in our view.
+     * @param key Key to look up.
+     * @return The key's successor, or std::nullopt if the view can't be
+     *         trusted to give it, in which case lookups fall back to routing.
+     */
+    std::optional<RemotePeer> OneHopSuccessor(const ChordKey &key);
+
     /**
      * Is key stored on this peer?
      * I.e. Is this peer one of the NUM_REPLICAS successors of the key?
@@ -361,10 +751,50 @@ protected:
      * @param request Request to forward
      * @param key The key to which the request corresponds, which
      *            will be queried in the finger table.
+     * @param deadline Time by which the request must be answered. The next
+     *                 hop is only given what remains of it.
      * @return The response given by the relevant peer.
      */
     virtual Json::Value ForwardRequest(const ChordKey &key,
-                                       const Json::Value &request) = 0;
+                                       const Json::Value &request,
+                                       const Deadline &deadline) = 0;
+
+    /**
+     * Send a request chosen by ForwardRequest to the next hop. If that hop
+     * sheds the request as "BUSY", route around it via the peers in our
+     * successor list which precede (or own) the key, since any of them can
+     * resolve the request, if in more hops. If all of them are busy or down,
+     * we answer "BUSY" in turn (with the longest retry hint we were given)
+     * rather than block the thread we run on waiting out the hint.
+     *
+     * @param next_hop The peer to which ForwardRequest chose to send request.
+     * @param key The key to which the request corresponds.
+     * @param request Request to forward.
+     * @param deadline Time by which the request must be answered.
+     * @return The response given by whichever peer accepted the request, or
+     *         throw a BusyError if every route was busy.
+     */
+    Json::Value SendForwardedRequest(const RemotePeer &next_hop,
+                                     const ChordKey &key,
+                                     const Json::Value &request,
+                                     const Deadline &deadline);
+
+    /**
+     * Awaitable version of ForwardRequest, for use from maintenance
+     * coroutines. The request goes to the next hop our finger table gives
+     * (or our predecessor, if that's us), and, should that hop be down or
+     * busy, to the detours SendForwardedRequest would take. Only once all of
+     * them are down or busy do we wait out the longest retry hint and try
+     * the first busy one again, and only if the deadline leaves time to.
+     *
+     * @param key The key to which the request corresponds.
+     * @param request Request to forward.
+     * @param deadline Time by which the request must be answered.
+     * @return The response given by whichever peer accepted the request.
+     */
+    Awaitable<Json::Value> AsyncForwardRequest(ChordKey key,
+                                               Json::Value request,
+                                               Deadline deadline);
 
     /**
      * Convert this peer to a representation of a RemotePeer (in order to send
@@ -413,6 +843,29 @@ protected:
 
     /// Minimum key held by this peer.
     ThreadSafeChordKey min_key_;
+
+    /// In-flight successor/predecessor lookups, keyed by the key looked up,
+    /// through which concurrent identical lookups are merged into one.
+    SingleFlight<ChordKey, RemotePeer> succ_lookups_, pred_lookups_;
+
+    /// Is this peer running in one-hop mode?
+    bool one_hop_ = false;
+
+    /// Every peer in the ring (one-hop mode only).
+    MembershipView membership_;
+
+    /// Our incarnation, raised whenever we have to rejoin the view. Starts
+    /// from the wall clock, so that restarts outrank our earlier selves.
+    std::atomic<uint64_t> incarnation_ {
+        static_cast<uint64_t>(std::chrono::duration_cast<
+                std::chrono::milliseconds>(std::chrono::system_clock::now()
+                .time_since_epoch()).count()) };
+
+    /// Events waiting to be gossiped, by the limit of the range to which
+    /// they're bound, and when our view was last confirmed by anti-entropy.
+    std::mutex gossip_mutex_;
+    std::map<ChordKey, Json::Value> gossip_outbox_;
+    std::chrono::steady_clock::time_point membership_synced_;
 };
 
 
@@ -0,0 +1,257 @@
+#include "chord_client.h"
+#include <set>
+
+ChordClient::ChordClient(std::string gateway_ip, unsigned short gateway_port,
+                         Protocol protocol, int n, int m, int p)
+    : gateway_(std::move(gateway_ip), gateway_port)
+    , protocol_(protocol)
+    , n_(n)
+    , m_(m)
+    , p_(p)
+{}
+
+/* ----------------------------------------------------------------------------
+ * CREATE/READ: Send requests straight to the peers which store the key.
+ * -------------------------------------------------------------------------- */
+
+void ChordClient::Create(const std::string &unhashed, const std::string &val)
+{
+    ChordKey key(unhashed, false);
+    if(protocol_ == Protocol::DHASH) {
+        CreateBlock(key, val);
+        return;
+    }
+
+    Json::Value create_req;
+    create_req["COMMAND"] = "CREATE_KEY";
+    create_req["KEY"] = std::string(key);
+    create_req["VALUE"] = val;
+    SendToOwner(key, create_req);
+}
+
+std::string ChordClient::Read(const std::string &unhashed)
+{
+    ChordKey key(unhashed, false);
+    if(protocol_ == Protocol::DHASH) {
+        return ReadBlock(key);
+    }
+
+    Json::Value read_req;
+    read_req["COMMAND"] = "READ_KEY";
+    read_req["KEY"] = std::string(key);
+    return SendToOwner(key, read_req)["VALUE"].asString();
+}
+
+Json::Value ChordClient::SendToOwner(const ChordKey &key,
+                                     const Json::Value &request)
+{
+    Deadline deadline = std::chrono::steady_clock::now() +
+                        DEFAULT_REQUEST_BUDGET;
+    RemotePeer owner = Lookup(key);
+    try {
+        return owner.SendRequest(request, deadline);
+    } catch(const RequestError &err) {
+        // The owner heard us, so its answer stands, unless it is that the
+        // key is no longer its own (another peer has joined and taken it).
+        if(err.response_["ERRORS"].asString() != NOT_OWNER_ERROR) {
+            throw;
+        }
+    } catch(const BusyError &) {
+        // The owner is alive, just overloaded; another won't take the key.
+        throw;
+    } catch(const std::exception &) {
+        // Unless we ran out of time (in which case the owner may yet have
+        // carried out the request), we couldn't reach the owner, which has
+        // presumably left.
+        if(std::chrono::steady_clock::now() >= deadline) {
+            throw;
+        }
+    }
+
+    // Either way, our view of the owner is wrong.
+    Forget(owner);
+    return Lookup(key).SendRequest(request, deadline);
+}
+
+void ChordClient::CreateBlock(const ChordKey &key, const std::string &val)
+{
+    DataBlock block(val, n_, m_, p_);
+    std::vector<RemotePeer> succs = GetNSuccessors(key, n_);
+    if(succs.size() < (size_t) m_) {
+        throw std::runtime_error("Insufficient succs in ring to complete "
+                                 "request.");
+    }
+
+    std::vector<Awaitable<Json::Value>> creates;
+    for(size_t i = 0; i < succs.size(); ++i) {
+        Json::Value create_req;
+        create_req["COMMAND"] = "CREATE_KEY";
+        create_req["KEY"] = std::string(key);
+        create_req["VALUE"] = Json::Value(block.fragments_.at(i));
+        creates.push_back(succs[i].AsyncSendRequest(
+                create_req, std::chrono::steady_clock::now() +
+                            DEFAULT_REQUEST_BUDGET));
+    }
+
+    int num_replicas = 0;
+    for(const auto &resp : RunCoroutine(WhenAll(std::move(creates)))) {
+        num_replicas += resp.has_value();
+    }
+
+    // As in DHashPeer, the block can be reconstructed so long as m_ peers
+    // stored fragments of it.
+    if(num_replicas < m_) {
+        throw std::runtime_error("Too few succs responded to requests.");
+    }
+}
+
+std::string ChordClient::ReadBlock(const ChordKey &key)
+{
+    Json::Value read_req;
+    read_req["COMMAND"] = "READ_KEY";
+    read_req["KEY"] = std::string(key);
+
+    // Read from m_ successors at once, and, should any fail to produce a
+    // fragment, from as many more as we're short of, until we run out.
+    std::vector<RemotePeer> succs = GetNSuccessors(key, n_);
+    std::set<DataFragment> fragments;
+    for(size_t next = 0; fragments.size() < (size_t) m_ && next < succs.size();) {
+        std::vector<Awaitable<Json::Value>> reads;
+        for(size_t i = fragments.size();
+            i < (size_t) m_ && next < succs.size(); ++i, ++next)
+        {
+            reads.push_back(succs[next].AsyncSendRequest(
+                    read_req, std::chrono::steady_clock::now() +
+                              DEFAULT_REQUEST_BUDGET));
+        }
+
+        for(const auto &resp : RunCoroutine(WhenAll(std::move(reads)))) {
+            if(resp.has_value()) {
+                fragments.insert(DataFragment((*resp)["VALUE"]));
+            }
+        }
+    }
+
+    if(fragments.size() < (size_t) m_) {
+        // Our view of the key's successors may be out of date, so don't
+        // trust it next time.
+        for(const RemotePeer &succ : succs) {
+            Forget(succ);
+        }
+        throw std::runtime_error("Less than " + std::to_string(m_) +
+                                 " distinct frags.");
+    }
+
+    std::vector<DataFragment> frag_vec(fragments.begin(), fragments.end());
+    return DataBlock::DecodeFragments(frag_vec, n_, m_, p_);
+}
+
+
+/* ----------------------------------------------------------------------------
+ * VIEW: Maintain our partial view of the ring, and look up peers through it.
+ * -------------------------------------------------------------------------- */
+
+RemotePeer ChordClient::Lookup(const ChordKey &key)
+{
+    std::optional<RemotePeer> owner = CachedOwner(key);
+    if(owner.has_value()) {
+        return owner.value();
+    }
+
+    Json::Value succ_req;
+    succ_req["COMMAND"] = "GET_SUCC";
+    succ_req["KEY"] = std::string(key);
+
+    // Should the gateway be down, any other peer we know of will do.
+    std::vector<RemotePeer> gateways { gateway_ };
+    {
+        ReadLock lock(mutex_);
+        for(const auto &[id, peer] : view_) {
+            gateways.push_back(peer);
+        }
+    }
+
+    for(const RemotePeer &gateway : gateways) {
+        try {
+            RemotePeer succ(gateway.SendRequest(succ_req));
+            Learn(succ);
+            return succ;
+        } catch(const std::exception &err) {
+            continue;
+        }
+    }
+    throw std::runtime_error("Lookup failed");
+}
+
+std::optional<RemotePeer> ChordClient::CachedOwner(const ChordKey &key)
+{
+    ReadLock lock(mutex_);
+    if(view_.empty()) {
+        return std::nullopt;
+    }
+
+    // The owner is the first peer at or after the key, wrapping around.
+    auto it = view_.lower_bound(key);
+    if(it == view_.end()) {
+        it = view_.begin();
+    }
+
+    if(key.InBetween(it->second.min_key_, it->second.id_, true)) {
+        return it->second;
+    }
+    return std::nullopt;
+}
+
+void ChordClient::Learn(const RemotePeer &peer)
+{
+    WriteLock lock(mutex_);
+    for(auto it = view_.begin(); it != view_.end();) {
+        if(it->first != peer.id_ &&
+           it->first.InBetween(peer.min_key_, peer.id_, true))
+        {
+            it = view_.erase(it);
+        } else {
+            ++it;
+        }
+    }
+    view_.insert_or_assign(peer.id_, peer);
+}
+
+void ChordClient::Forget(const RemotePeer &peer)
+{
+    WriteLock lock(mutex_);
+    view_.erase(peer.id_);
+}
+
+RemotePeer ChordClient::NextPeer(const RemotePeer &peer)
+{
+    // If we know of the peer whose range starts just past this one's, that's
+    // its successor. Otherwise, the peer itself knows.
+    std::optional<RemotePeer> next = CachedOwner(peer.id_ + 1);
+    if(next.has_value()) {
+        return next.value();
+    }
+
+    RemotePeer succ = peer.GetSucc();
+    Learn(succ);
+    return succ;
+}
+
+std::vector<RemotePeer> ChordClient::GetNSuccessors(const ChordKey &key, int n)
+{
+    std::vector<RemotePeer> succs { Lookup(key) };
+    while(succs.size() < (size_t) n) {
+        RemotePeer next = NextPeer(succs.back());
+        if(next.id_ == succs.front().id_) {
+            break;
+        }
+        succs.push_back(next);
+    }
+    return succs;
+}
+
+size_t ChordClient::NumCachedPeers()
+{
+    ReadLock lock(mutex_);
+    return view_.size();
+}
@@ -0,0 +1,149 @@
+/**
+ * chord_client.h
+ *
+ * This file aims to implement ChordClient, a lightweight means for an
+ * application to store and read data on a chord (or DHash) ring without
+ * joining it. A peer must run a server, a maintenance thread, and a finger
+ * table, and each peer adds to the maintenance load of its neighbours, all of
+ * which is wasted on a process which only wants to issue creates and reads.
+ *
+ * A client instead bootstraps from any peer in the ring (its "gateway"), and
+ * caches a partial view of the ring: the peers it has heard of, along with the
+ * range of keys each owned when it heard of it. Requests are sent straight to
+ * the owner of the key according to this view, so that, once the view is warm,
+ * most requests take a single hop. The view is refreshed from the peers found
+ * in responses, and entries are dropped whenever a peer turns out not to own
+ * a key it was thought to (e.g. because another peer has since joined), upon
+ * which the key's owner is looked up afresh via the gateway.
+ *
+ * For DHash rings, a block's fragments are read from its owner and the peers
+ * which follow it in parallel, m_ at a time.
+ */
+
+#ifndef CHORD_AND_DHASH_CHORD_CLIENT_H
+#define CHORD_AND_DHASH_CHORD_CLIENT_H
+
+#include "../data_structures/key.h"
+#include "../data_structures/thread_safe.h"
+#include "../networking/coroutines.h"
+#include "remote_peer.h"
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+class ChordClient : public ThreadSafe {
+public:
+    /// How the ring stores values: whole (as ChordPeer does), or encoded
+    /// into fragments spread across successors (as DHashPeer does).
+    enum class Protocol { CHORD, DHASH };
+
+    /**
+     * Constructor.
+     * @param gateway_ip IP address of any peer in the ring.
+     * @param gateway_port Port on which that peer is run.
+     * @param protocol Protocol run by the ring.
+     * @param n Total number of fragments into which DHash peers encode
+     *          blocks.
+     * @param m Number of fragments needed to decode a block.
+     * @param p Prime modulus of the peers' IDA.
+     */
+    ChordClient(std::string gateway_ip, unsigned short gateway_port,
+                Protocol protocol = Protocol::CHORD, int n = 14, int m = 10,
+                int p = 257);
+
+    /**
+     * Create a key-value pair and store it on the ring.
+     * @param unhashed Unhashed key.
+     * @param val Value associated with said key.
+     */
+    void Create(const std::string &unhashed, const std::string &val);
+
+    /**
+     * Read the value of a key on the ring.
+     * @param unhashed Unhashed key.
+     * @return Value of key if it exists or throw an error if it does not.
+     */
+    std::string Read(const std::string &unhashed);
+
+    /**
+     * Determine the owner (i.e. successor) of a key, from the cached view of
+     * the ring if possible.
+     * @param key Key whose owner will be found.
+     * @return The peer which owns key.
+     */
+    RemotePeer Lookup(const ChordKey &key);
+
+    /**
+     * @return Number of peers in the cached view of the ring.
+     */
+    size_t NumCachedPeers();
+
+private:
+    /**
+     * @param key Key to look up.
+     * @return The peer owning key according to our view, if any.
+     */
+    std::optional<RemotePeer> CachedOwner(const ChordKey &key);
+
+    /**
+     * Add a peer to our view of the ring, evicting any peers whose IDs fall
+     * within its range (they must have left the ring).
+     * @param peer Peer (with up-to-date min key) to add.
+     */
+    void Learn(const RemotePeer &peer);
+
+    /**
+     * Drop a peer from our view of the ring.
+     * @param peer Peer which did not answer as our view said it would.
+     */
+    void Forget(const RemotePeer &peer);
+
+    /**
+     * Find the peer following peer in the ring.
+     * @param peer Peer whose successor will be found.
+     * @return Its successor.
+     */
+    RemotePeer NextPeer(const RemotePeer &peer);
+
+    /**
+     * Find the n successors of a key (fewer if the ring has fewer peers).
+     * @param key Key whose successors will be found.
+     * @param n Number of successors to find.
+     * @return The successors, in ring order.
+     */
+    std::vector<RemotePeer> GetNSuccessors(const ChordKey &key, int n);
+
+    /**
+     * Send a request concerning key to its owner. If the owner can't be
+     * reached, or refuses it as not its own (because our view was stale),
+     * look the owner up again and retry once. Any other error (e.g. the key
+     * not being found, the owner being busy, or the deadline passing) is
+     * thrown as it is.
+     * @param key Key to which the request pertains.
+     * @param request Request to send.
+     * @return The owner's response.
+     */
+    Json::Value SendToOwner(const ChordKey &key, const Json::Value &request);
+
+    /**
+     * As DHashPeer::Create/Read, but sending each fragment request directly
+     * to the successor which stores it.
+     */
+    void CreateBlock(const ChordKey &key, const std::string &val);
+    std::string ReadBlock(const ChordKey &key);
+
+    /// Peer through which we look up keys we know nothing about.
+    RemotePeer gateway_;
+
+    /// Protocol run by the ring.
+    Protocol protocol_;
+
+    /// Our view of the ring: peers by ID.
+    std::map<ChordKey, RemotePeer> view_;
+
+    /// IDA parameters, which must match those of the ring's peers.
+    int n_, m_, p_;
+};
+
+#endif
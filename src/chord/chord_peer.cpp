@@ -34,12 +34,29 @@ ChordPeer::ChordPeer(std::string ip_addr, unsigned short port, int num_succs)
             { "READ_KEY", [this](const Json::Value &req) {
               return ReadKeyHandler(req);
             } },
+            { "READ_RANGE", [this](const Json::Value &req) {
+              return ReadRangeHandler(req);
+            } },
+            { "GOSSIP", [this](const Json::Value &req) {
+              return GossipHandler(req);
+            } },
+            { "SYNC_MEMBERSHIP", [this](const Json::Value &req) {
+              return SyncMembershipHandler(req);
+            } },
             { "RECTIFY", [this](const Json::Value &req) {
               return RectifyHandler(req);
              } }
     };
 
-    server_ = std::make_shared<ServerType>(port, 3, commands);
+    // Batched lookups wait on the next hops for as long as it takes the
+    // whole batch to resolve, so they run as coroutines, holding no thread.
+    std::map<std::string, AsyncReqHandler> async_commands {
+            { "GET_SUCC_BATCH", [this](Json::Value req) {
+              return GetSuccBatchHandler(std::move(req));
+            } }
+    };
+
+    server_ = std::make_shared<ServerType>(port, 3, commands, async_commands);
     server_->RunInBackground();
 
     // Avoid race condition.
@@ -127,7 +144,7 @@ Json::Value ChordPeer::CreateKeyHandler(const Json::Value &req)
     if(StoredLocally(key)) {
         db_.Insert({key, value});
     } else {
-        throw std::runtime_error("Key not in range.");
+        throw std::runtime_error(NOT_OWNER_ERROR);
     }
 
     return create_key_resp;
@@ -170,12 +187,47 @@ Json::Value ChordPeer::ReadKeyHandler(const Json::Value &req)
     if(StoredLocally(key)) {
         read_key_resp["VALUE"] = db_.Lookup(key);
     } else {
-        throw std::runtime_error("Key not stored locally.");
+        throw std::runtime_error(NOT_OWNER_ERROR);
     }
 
     return read_key_resp;
 }
 
+Awaitable<Json::Value> ChordPeer::ReadSlice(RemotePeer owner,
+                                            ChordKey lower_bound,
+                                            ChordKey upper_bound, size_t limit)
+{
+    Json::Value read_range_req;
+    read_range_req["COMMAND"] = "READ_RANGE";
+    read_range_req["LOWER_BOUND"] = std::string(lower_bound);
+    read_range_req["UPPER_BOUND"] = std::string(upper_bound);
+    read_range_req["LIMIT"] = (Json::UInt64) limit;
+    co_return co_await owner.AsyncSendRequest(
+            read_range_req, std::chrono::steady_clock::now() +
+                            DEFAULT_REQUEST_BUDGET);
+}
+
+Json::Value ChordPeer::ReadRangeHandler(const Json::Value &req)
+{
+    Json::Value read_range_resp, kv_pair;
+    ChordKey lower_bound(req["LOWER_BOUND"].asString(), true),
+             upper_bound(req["UPPER_BOUND"].asString(), true);
+    size_t limit = req["LIMIT"].asUInt64();
+
+    // Read one pair more than asked for, to find out if there are more.
+    std::vector<TextDb::KeyValPair> kv_pairs = db_.ReadRange(lower_bound,
+                                                             upper_bound,
+                                                             limit + 1);
+    read_range_resp["MORE"] = kv_pairs.size() > limit;
+    read_range_resp["KV_PAIRS"] = Json::arrayValue;
+    for(size_t i = 0; i < kv_pairs.size() && i < limit; ++i) {
+        kv_pair["KEY"] = std::string(kv_pairs[i].first);
+        kv_pair["VAL"] = kv_pairs[i].second;
+        read_range_resp["KV_PAIRS"].append(kv_pair);
+    }
+    return read_range_resp;
+}
+
 
 /* ----------------------------------------------------------------------------
  * MISC: Anything else. Mostly implementing pure virtual methods from the base
@@ -183,7 +235,8 @@ Json::Value ChordPeer::ReadKeyHandler(const Json::Value &req)
  * -------------------------------------------------------------------------- */
 
 Json::Value ChordPeer::ForwardRequest(const ChordKey &key,
-                                      const Json::Value &request)
+                                      const Json::Value &request,
+                                      const Deadline &deadline)
 {
     // Get closest preceding node of key in finger table, forward request
     // to it.
@@ -195,33 +248,39 @@ Json::Value ChordPeer::ForwardRequest(const ChordKey &key,
         key_succ = predecessor_.Get();
     }
 
-    // If, for whatever reason, the successor selected so far is not alive,
-    // then we need to select another one, preferably from our successors list
-    // but possibly just by defaulting to our predecessor.
-    else if(! key_succ.IsAlive()) {
+    // If, for whatever reason, the successor selected so far is not alive
+    // (or keeps failing to answer, tripping its circuit breaker), then we
+    // need to select another one, preferably from our successors list but
+    // possibly just by defaulting to our predecessor.
+    else if(! key_succ.IsAvailable()) {
         std::optional<RemotePeer> succ_lookup = successors_.Lookup(key);
-        if(succ_lookup.has_value() && succ_lookup->IsAlive()) {
+        if(succ_lookup.has_value() && succ_lookup->IsAvailable()) {
             key_succ = succ_lookup.value();
         } else {
             throw std::runtime_error("Lookup failed");
         }
     }
 
-    return key_succ.SendRequest(request);
+    return SendForwardedRequest(key_succ, key, request, deadline);
 }
 
 void ChordPeer::StabilizeLoop()
 {
+    // Each round of stabilize runs as one coroutine on the maintenance
+    // executor, so that its RPCs hold no thread of ours. This thread just
+    // flushes gossip, starts a round 5 seconds after the last one ended, and
+    // checks every 10ms whether it has.
+    std::future<void> round;
     auto timestamp = std::chrono::high_resolution_clock::now();
     while(continue_stabilize_) {
         try {
-            auto now = std::chrono::high_resolution_clock::now();
-            if (now - timestamp < 5s) {
-                std::this_thread::sleep_for(10ms);
-                continue;
+            FlushGossip(false);
+            if(round.valid() &&
+               round.wait_for(0s) == std::future_status::ready)
+            {
+                timestamp = std::chrono::high_resolution_clock::now();
+                round.get();
             }
-            Stabilize();
-            timestamp = std::chrono::high_resolution_clock::now();
         } catch(const std::exception &ex) {
             // In this case, we've become isolated from the chord. This can
             // occur for one of two reasons:
@@ -233,9 +292,20 @@ void ChordPeer::StabilizeLoop()
             //        find continue_stabilize_ to be true, and attempt stabiliz-
             //        ation again in an attempt to rejoin the network.
             Log("CAUGHT " + std::string(ex.what()) + " - CONTINUING");
-            timestamp = std::chrono::high_resolution_clock::now();
-            continue;
         }
+
+        auto now = std::chrono::high_resolution_clock::now();
+        if(! round.valid() && now - timestamp >= 5s) {
+            round = boost::asio::co_spawn(
+                    boost::asio::make_strand(MaintenanceExecutor()),
+                    AsyncStabilize(), boost::asio::use_future);
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+
+    // The round in progress, if any, still uses us.
+    if(round.valid()) {
+        round.wait();
     }
 }
 
@@ -280,14 +350,14 @@ Json::Value ChordPeer::HandleNotifyFromPred(const RemotePeer &new_pred)
 }
 
 
-void ChordPeer::HandlePredFailure(const RemotePeer &old_pred)
+Awaitable<void> ChordPeer::HandlePredFailure(RemotePeer old_pred)
 {
     // Adjust our finger table to account for that fact.
     finger_table_.AdjustFingers(ToRemotePeer());
     // Inform other nodes that we are replacing the failed predecessor and that
     // they ought to update their FTs.
 //    Rectify(predecessor_.Get());
-    Rectify(old_pred);
+    co_await Rectify(old_pred);
 }
 
 void ChordPeer::Fail()
@@ -299,6 +369,17 @@ void ChordPeer::Fail()
     continue_stabilize_ = false;
 }
 
+void ChordPeer::StartRequestCapture(const std::string &path,
+                                    TraceFilter filter)
+{
+    server_->StartRequestCapture(path, std::move(filter));
+}
+
+void ChordPeer::StopRequestCapture()
+{
+    server_->StopRequestCapture();
+}
+
 Json::Value ChordPeer::KeysAsJson()
 {
     Json::Value keys_to_transfer;
@@ -312,5 +393,4 @@ Json::Value ChordPeer::KeysAsJson()
 void ChordPeer::StartMaintenance()
 {
     stabilize_thread_ = std::thread([this] { StabilizeLoop(); });
-    stabilize_thread_.detach();
 }
\ No newline at end of file
@@ -57,6 +57,20 @@ public:
      */
     void Fail() override;
 
+    /**
+     * Start appending the requests this peer receives to a trace file.
+     * @param path Path of the trace file.
+     * @param filter Which requests to capture. By default, only those which
+     *               clients send.
+     */
+    void StartRequestCapture(const std::string &path,
+                             TraceFilter filter = { CLIENT_COMMANDS }) override;
+
+    /**
+     * Stop capturing requests, flushing the trace file.
+     */
+    void StopRequestCapture() override;
+
     /**
      * Create a key-value pair and store it on the chord.
      * @param unhashed Unhashed key.
@@ -152,17 +166,35 @@ protected:
      */
     Json::Value ReadKeyHandler(const Json::Value &req);
 
+    /**
+     * Instruct owner to return a page of the key-value pairs it holds in a
+     * range (see AbstractChordPeer::ReadSlice).
+     */
+    Awaitable<Json::Value> ReadSlice(RemotePeer owner, ChordKey lower_bound,
+                                     ChordKey upper_bound,
+                                     size_t limit) override;
+
+    /**
+     * Given a READ_RANGE request, return up to LIMIT of the key-value pairs
+     * in our database between LOWER_BOUND and UPPER_BOUND, in ring order.
+     *
+     * @param req Request indicating range to read.
+     * @return JSON response with a KV_PAIRS array of {KEY, VAL} entries, and
+     *         MORE set if the range holds further pairs.
+     */
+    Json::Value ReadRangeHandler(const Json::Value &req);
+
     /**
      * Run chord stabilize algorithm at intervals of five seconds in a loop
      * while continue_stabilize_ is set to true.
      */
     void StabilizeLoop();
 
-    Json::Value ForwardRequest(const ChordKey &key, const Json::Value &request)
-                override;
+    Json::Value ForwardRequest(const ChordKey &key, const Json::Value &request,
+                               const Deadline &deadline) override;
 
 
-    void HandlePredFailure(const RemotePeer &old_pred) override;
+    Awaitable<void> HandlePredFailure(RemotePeer old_pred) override;
 
     /**
      * When given a JSON map of key-value pairs by a remote peer, read this map
@@ -0,0 +1,258 @@
+#include "membership_view.h"
+
+/* ----------------------------------------------------------------------------
+ * MEMBERSHIP EVENT: Conversions to and from JSON.
+ * -------------------------------------------------------------------------- */
+
+static const std::map<MembershipEvent::Type, std::string> EVENT_NAMES {
+        { MembershipEvent::Type::JOIN, "JOIN" },
+        { MembershipEvent::Type::LEAVE, "LEAVE" },
+        { MembershipEvent::Type::FAIL, "FAIL" }
+};
+
+MembershipEvent::MembershipEvent(Type type, RemotePeer peer,
+                                 uint64_t incarnation)
+    : type_(type)
+    , peer_(std::move(peer))
+    , incarnation_(incarnation)
+{}
+
+MembershipEvent::MembershipEvent(const Json::Value &event_json)
+    : peer_(event_json["PEER"])
+    , incarnation_(event_json["INCARNATION"].asUInt64())
+{
+    std::string type = event_json["TYPE"].asString();
+    for(const auto &[event_type, name] : EVENT_NAMES) {
+        if(name == type) {
+            type_ = event_type;
+            return;
+        }
+    }
+    throw std::runtime_error("Invalid membership event type: " + type);
+}
+
+MembershipEvent::operator Json::Value() const
+{
+    Json::Value event_json;
+    event_json["TYPE"] = EVENT_NAMES.at(type_);
+    event_json["PEER"] = Json::Value(peer_);
+    event_json["INCARNATION"] = Json::UInt64(incarnation_);
+    return event_json;
+}
+
+
+/* ----------------------------------------------------------------------------
+ * UPDATES: Apply events and merge views.
+ * -------------------------------------------------------------------------- */
+
+MembershipView::MembershipView(std::chrono::steady_clock::duration tombstone_ttl)
+    : tombstone_ttl_(tombstone_ttl)
+{}
+
+bool MembershipView::Apply(const MembershipEvent &event)
+{
+    WriteLock lock(mutex_);
+    auto now = std::chrono::steady_clock::now();
+    CollectTombstones(now);
+    bool alive = event.type_ == MembershipEvent::Type::JOIN;
+    auto it = members_.find(event.peer_.id_);
+
+    // Later incarnations always win. For the same incarnation, removal wins,
+    // since a peer never rejoins without raising its incarnation.
+    if(it != members_.end()) {
+        const Member &member = it->second;
+        bool newer = event.incarnation_ > member.incarnation_ ||
+                     (event.incarnation_ == member.incarnation_ &&
+                      member.alive_ && ! alive);
+        if(! newer) {
+            return false;
+        }
+        num_alive_ -= member.alive_;
+    }
+
+    // The min key of a peer isn't part of its membership, so leave it out, so
+    // that every member is interned only once.
+    RemotePeer peer(event.peer_.id_, event.peer_.id_, event.peer_.ip_addr_,
+                    event.peer_.port_);
+    members_.insert_or_assign(event.peer_.id_,
+                              Member { peer, event.incarnation_, alive, now });
+    num_alive_ += alive;
+    if(! alive) {
+        tombstones_.emplace_back(now, event.peer_.id_);
+    }
+    digest_.clear();
+    return true;
+}
+
+void MembershipView::CollectTombstones(
+        std::chrono::steady_clock::time_point now)
+{
+    while(! tombstones_.empty() &&
+          now - tombstones_.front().first >= tombstone_ttl_)
+    {
+        auto &[removed_at, id] = tombstones_.front();
+        auto it = members_.find(id);
+        if(it != members_.end() && ! it->second.alive_ &&
+           it->second.removed_at_ == removed_at)
+        {
+            members_.erase(it);
+        }
+        tombstones_.pop_front();
+    }
+}
+
+int MembershipView::Merge(const Json::Value &view_json)
+{
+    int num_changes = 0;
+    for(const Json::Value &member : view_json) {
+        MembershipEvent::Type type = member["ALIVE"].asBool() ?
+                                     MembershipEvent::Type::JOIN :
+                                     MembershipEvent::Type::FAIL;
+        num_changes += Apply(MembershipEvent(
+                type, RemotePeer(member["PEER"]),
+                member["INCARNATION"].asUInt64()));
+    }
+    return num_changes;
+}
+
+
+/* ----------------------------------------------------------------------------
+ * LOOKUPS: Find successors and broadcast targets from the view.
+ * -------------------------------------------------------------------------- */
+
+uint64_t MembershipView::Incarnation(const ChordKey &id) const
+{
+    ReadLock lock(mutex_);
+    auto it = members_.find(id);
+    return it == members_.end() ? 0 : it->second.incarnation_;
+}
+
+bool MembershipView::IsMember(const ChordKey &id) const
+{
+    ReadLock lock(mutex_);
+    auto it = members_.find(id);
+    return it != members_.end() && it->second.alive_;
+}
+
+std::optional<RemotePeer> MembershipView::Successor(const ChordKey &key) const
+{
+    ReadLock lock(mutex_);
+    auto it = LiveSuccessor(key);
+    if(it == members_.end()) {
+        return std::nullopt;
+    }
+    return ToRemotePeer(it);
+}
+
+std::vector<RemotePeer> MembershipView::NSuccessors(const ChordKey &key,
+                                                    int n) const
+{
+    ReadLock lock(mutex_);
+    std::vector<RemotePeer> succs;
+    auto first = LiveSuccessor(key);
+    if(first == members_.end()) {
+        return succs;
+    }
+
+    auto it = first;
+    while(succs.size() < (size_t) n && succs.size() < num_alive_) {
+        succs.push_back(ToRemotePeer(it));
+        it = LiveSuccessor(it->first + 1);
+    }
+    return succs;
+}
+
+std::vector<std::pair<RemotePeer, ChordKey>>
+MembershipView::BroadcastTargets(const ChordKey &self_id,
+                                 const ChordKey &limit) const
+{
+    ReadLock lock(mutex_);
+
+    // Distances are measured clockwise from self_id. That of a limit equal to
+    // self_id is the whole ring, which is just what we want.
+    ChordKey limit_dist = limit - self_id;
+    std::vector<RemotePeer> targets;
+    for(unsigned int i = 0; i < ChordKey::BinaryLen(); ++i) {
+        auto it = LiveSuccessor(self_id + ChordKey::PowerOfTwo(i));
+        if(it == members_.end() || it->first == self_id ||
+           it->first - self_id >= limit_dist)
+        {
+            break;
+        }
+        if(targets.empty() || targets.back().id_ != it->first) {
+            targets.push_back(ToRemotePeer(it));
+        }
+    }
+
+    std::vector<std::pair<RemotePeer, ChordKey>> targets_and_limits;
+    for(size_t i = 0; i < targets.size(); ++i) {
+        targets_and_limits.emplace_back(
+                targets[i], i + 1 < targets.size() ? targets[i + 1].id_ : limit);
+    }
+    return targets_and_limits;
+}
+
+std::string MembershipView::Digest()
+{
+    WriteLock lock(mutex_);
+    if(digest_.empty()) {
+        std::string members_str;
+        for(const auto &[id, member] : members_) {
+            if(member.alive_) {
+                members_str += std::string(id) + ":" +
+                               std::to_string(member.incarnation_) + ";";
+            }
+        }
+        digest_ = std::string(ChordKey(members_str, false));
+    }
+    return digest_;
+}
+
+size_t MembershipView::Size() const
+{
+    ReadLock lock(mutex_);
+    return num_alive_;
+}
+
+MembershipView::operator Json::Value() const
+{
+    ReadLock lock(mutex_);
+    Json::Value view_json = Json::arrayValue;
+    for(const auto &[id, member] : members_) {
+        Json::Value member_json;
+        member_json["PEER"] = Json::Value(member.peer_);
+        member_json["INCARNATION"] = Json::UInt64(member.incarnation_);
+        member_json["ALIVE"] = member.alive_;
+        view_json.append(member_json);
+    }
+    return view_json;
+}
+
+std::map<ChordKey, MembershipView::Member>::const_iterator
+MembershipView::LiveSuccessor(const ChordKey &key) const
+{
+    if(num_alive_ == 0) {
+        return members_.end();
+    }
+
+    // There's at least one live member, so we'll find it within one lap.
+    auto it = members_.lower_bound(key);
+    while(it == members_.end() || ! it->second.alive_) {
+        it = it == members_.end() ? members_.begin() : std::next(it);
+    }
+    return it;
+}
+
+RemotePeer MembershipView::ToRemotePeer(
+        std::map<ChordKey, Member>::const_iterator it) const
+{
+    auto pred = it;
+    do {
+        pred = pred == members_.begin() ? std::prev(members_.end())
+                                        : std::prev(pred);
+    } while(! pred->second.alive_);
+
+    RemotePeer peer = *it->second.peer_;
+    peer.min_key_ = pred->first + 1;
+    return peer;
+}
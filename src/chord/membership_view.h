@@ -0,0 +1,205 @@
+/**
+ * membership_view.h
+ *
+ * This file aims to implement MembershipView, a complete, sorted view of the
+ * peers in a ring, for peers running in one-hop mode. Even for rings of tens of
+ * thousands of peers, such a view takes a few MB, and with it a peer can find
+ * the successor of any key without routing a single message.
+ *
+ * The view changes only through membership events (a peer joining, leaving, or
+ * being found to have failed), which peers disseminate to one another by
+ * gossip. Since events may arrive late, twice, or out of order, every event
+ * carries the incarnation of the peer it concerns: a number which the peer
+ * raises each time it (re)joins. An event only takes effect if it concerns a
+ * later incarnation than the one in the view, or, for the same incarnation, if
+ * it removes the peer, so that the views of any two peers which have seen the
+ * same events agree, whatever order they saw them in. Removed peers are kept
+ * as tombstones, so that a stale join cannot resurrect them, until long after
+ * any such join could still be in flight; then they are collected, so that the
+ * view doesn't grow with every peer which ever left.
+ */
+
+#ifndef CHORD_AND_DHASH_MEMBERSHIP_VIEW_H
+#define CHORD_AND_DHASH_MEMBERSHIP_VIEW_H
+
+#include "../data_structures/key.h"
+#include "../data_structures/thread_safe.h"
+#include "peer_directory.h"
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <json/json.h>
+#include <map>
+#include <optional>
+#include <string>
+#include <vector>
+
+/**
+ * A change in the membership of the ring.
+ */
+struct MembershipEvent {
+    enum class Type { JOIN, LEAVE, FAIL };
+
+    /**
+     * Constructor.
+     * @param type Kind of change.
+     * @param peer Peer which joined or left.
+     * @param incarnation Incarnation of peer to which the change applies.
+     */
+    MembershipEvent(Type type, RemotePeer peer, uint64_t incarnation);
+
+    /**
+     * Construct from JSON.
+     * @param event_json JSON-encoded event.
+     */
+    explicit MembershipEvent(const Json::Value &event_json);
+
+    /**
+     * @return The event, as JSON.
+     */
+    explicit operator Json::Value() const;
+
+    Type type_;
+    RemotePeer peer_;
+    uint64_t incarnation_;
+};
+
+/**
+ * Thread-safe view of every peer in the ring, sorted by ID.
+ */
+class MembershipView : public ThreadSafe {
+public:
+    /**
+     * Constructor.
+     * @param tombstone_ttl Time for which removed peers are remembered.
+     */
+    explicit MembershipView(std::chrono::steady_clock::duration tombstone_ttl =
+                                    DEFAULT_TOMBSTONE_TTL);
+
+    /**
+     * Apply an event to the view, collecting any expired tombstones.
+     * @param event Event to apply.
+     * @return Did the event change the view (i.e. was it news to us)?
+     */
+    bool Apply(const MembershipEvent &event);
+
+    /**
+     * Merge another peer's view (as given by its JSON conversion) into ours.
+     * @param view_json JSON-encoded view.
+     * @return Number of entries which changed our view.
+     */
+    int Merge(const Json::Value &view_json);
+
+    /**
+     * @param id ID of a peer.
+     * @return Incarnation of the peer in the view, or 0 if it isn't in it.
+     */
+    uint64_t Incarnation(const ChordKey &id) const;
+
+    /**
+     * @param id ID of a peer.
+     * @return Is the peer in the view, and alive?
+     */
+    bool IsMember(const ChordKey &id) const;
+
+    /**
+     * Find the successor of key among the live peers in the view. Its min key
+     * is set from the live peer preceding it.
+     * @param key Key whose successor will be found.
+     * @return The successor, or std::nullopt if the view is empty.
+     */
+    std::optional<RemotePeer> Successor(const ChordKey &key) const;
+
+    /**
+     * Find the n successors of key (fewer if there are fewer live peers).
+     * @param key Key whose successors will be found.
+     * @param n Number of successors to find.
+     * @return The successors, in ring order.
+     */
+    std::vector<RemotePeer> NSuccessors(const ChordKey &key, int n) const;
+
+    /**
+     * Choose the peers to which a peer should pass on a broadcast for which it
+     * is responsible for (self_id, limit), so that each live peer in the
+     * range receives it exactly once (see El-Ansary et al., "Efficient
+     * Broadcast in Structured P2P Networks"). The peers chosen are those which
+     * the fingers of self_id point to, each of which becomes responsible for
+     * the range from itself to the next.
+     * @param self_id ID of the peer passing on the broadcast.
+     * @param limit End (exclusive) of the range for which it is responsible.
+     *              If limit is self_id, the range is the whole ring.
+     * @return Each peer to which to send the broadcast, with its own limit.
+     */
+    std::vector<std::pair<RemotePeer, ChordKey>> BroadcastTargets(
+            const ChordKey &self_id, const ChordKey &limit) const;
+
+    /**
+     * @return Hash of the live peers in the view, by which two peers can
+     *         cheaply tell whether their views agree. Tombstones are left out,
+     *         since peers collect them at different times.
+     */
+    std::string Digest();
+
+    /**
+     * @return Number of live peers in the view.
+     */
+    size_t Size() const;
+
+    /**
+     * @return The view (tombstones included), as JSON.
+     */
+    explicit operator Json::Value() const;
+
+private:
+    /// Default time for which removed peers are remembered: long enough for
+    /// any gossip or anti-entropy round to have long since finished.
+    static constexpr std::chrono::minutes DEFAULT_TOMBSTONE_TTL { 10 };
+
+    /// What the view knows of a peer.
+    struct Member {
+        PeerHandle peer_;
+        uint64_t incarnation_;
+        bool alive_;
+        /// When the peer was removed, if it isn't alive.
+        std::chrono::steady_clock::time_point removed_at_;
+    };
+
+    /**
+     * Erase the tombstones older than tombstone_ttl_. Call with the lock held.
+     * @param now Current time.
+     */
+    void CollectTombstones(std::chrono::steady_clock::time_point now);
+
+    /**
+     * @param key Key whose successor will be found.
+     * @return Iterator to the first live member at or after key (wrapping),
+     *         or end() if there are none. Call with the lock held.
+     */
+    std::map<ChordKey, Member>::const_iterator LiveSuccessor(
+            const ChordKey &key) const;
+
+    /**
+     * @param it Iterator to a live member.
+     * @return The member as a RemotePeer, its min key set from the live
+     *         member preceding it. Call with the lock held.
+     */
+    RemotePeer ToRemotePeer(std::map<ChordKey, Member>::const_iterator it)
+            const;
+
+    /// Members (live or not), by ID.
+    std::map<ChordKey, Member> members_;
+
+    /// Number of live members.
+    size_t num_alive_ = 0;
+
+    /// IDs of removed members, with when they were removed, oldest first. An
+    /// entry is stale if its member has since rejoined or been removed again.
+    std::deque<std::pair<std::chrono::steady_clock::time_point, ChordKey>>
+            tombstones_;
+    std::chrono::steady_clock::duration tombstone_ttl_;
+
+    /// Cached digest, or empty if the view has changed since it was taken.
+    std::string digest_;
+};
+
+#endif
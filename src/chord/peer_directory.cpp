@@ -0,0 +1,122 @@
+#include "peer_directory.h"
+
+/* ----------------------------------------------------------------------------
+ * PEER HANDLE
+ * -------------------------------------------------------------------------- */
+
+PeerHandle::PeerHandle()
+    : PeerHandle(RemotePeer())
+{}
+
+PeerHandle::PeerHandle(const RemotePeer &peer)
+    : index_(PeerDirectory::Instance().Intern(peer))
+{}
+
+PeerHandle::PeerHandle(const Json::Value &members)
+    : PeerHandle(RemotePeer(members))
+{}
+
+RemotePeer PeerHandle::operator * () const
+{
+    return PeerDirectory::Instance().Get(index_);
+}
+
+PeerHandle::operator RemotePeer() const
+{
+    return **this;
+}
+
+PeerHandle::operator Json::Value() const
+{
+    return Json::Value(**this);
+}
+
+/* ----------------------------------------------------------------------------
+ * PEER DIRECTORY
+ * -------------------------------------------------------------------------- */
+
+PeerDirectory &PeerDirectory::Instance()
+{
+    // Intentionally leaked, so that handles held by other statics remain
+    // valid however the statics are destroyed at exit.
+    static PeerDirectory *directory = new PeerDirectory();
+    return *directory;
+}
+
+uint32_t PeerDirectory::Intern(const RemotePeer &peer)
+{
+    // Peers seldom share an address, so the address alone spreads them
+    // across shards well enough, without formatting their IDs.
+    size_t shard_index = (std::hash<std::string>()(peer.ip_addr_) * 31 +
+                          peer.port_) % NUM_SHARDS;
+    Shard &shard = shards_[shard_index];
+    Identity identity { peer.id_, peer.ip_addr_, peer.port_ };
+    {
+        Shard::ReadLock lock(shard.mutex_);
+        auto it = shard.indices_.find(identity);
+        if(it != shard.indices_.end()) {
+            Record &record = At(it->second);
+            if(record.peer_.min_key_ == peer.min_key_) {
+                return it->second;
+            }
+        }
+    }
+
+    // Look again, in case someone else interned the peer in the meantime.
+    Shard::WriteLock lock(shard.mutex_);
+    auto it = shard.indices_.find(identity);
+    if(it != shard.indices_.end()) {
+        At(it->second).peer_.min_key_ = peer.min_key_;
+        return it->second;
+    }
+
+    // Indices are claimed across shards, and chunks allocated by whichever
+    // shard first claims an index in them.
+    uint32_t index = size_.fetch_add(1);
+    if(index / CHUNK_SIZE >= MAX_CHUNKS) {
+        size_.fetch_sub(1);
+        throw std::runtime_error("Peer directory full.");
+    }
+    std::atomic<Chunk *> &slot = chunks_[index / CHUNK_SIZE];
+    Chunk *chunk = slot.load(std::memory_order_acquire);
+    if(! chunk) {
+        std::lock_guard<std::mutex> chunks_lock(chunks_mutex_);
+        chunk = slot.load(std::memory_order_acquire);
+        if(! chunk) {
+            chunk = new Chunk();
+            slot.store(chunk, std::memory_order_release);
+        }
+    }
+    (*chunk)[index % CHUNK_SIZE] = std::make_unique<Record>(Record {
+            peer, PeerHealth::Of(peer.ip_addr_, peer.port_), shard_index });
+    shard.indices_.emplace(identity, index);
+    return index;
+}
+
+RemotePeer PeerDirectory::Get(uint32_t index) const
+{
+    Record &record = At(index);
+    Shard::ReadLock lock(shards_[record.shard_].mutex_);
+    return record.peer_;
+}
+
+const std::shared_ptr<PeerHealth> &PeerDirectory::Health(uint32_t index) const
+{
+    return At(index).health_;
+}
+
+size_t PeerDirectory::Size() const
+{
+    return size_.load();
+}
+
+PeerDirectory::Record &PeerDirectory::At(uint32_t index) const
+{
+    Chunk *chunk = index / CHUNK_SIZE < MAX_CHUNKS
+                   ? chunks_[index / CHUNK_SIZE].load(std::memory_order_acquire)
+                   : nullptr;
+    if(! chunk || ! (*chunk)[index % CHUNK_SIZE]) {
+        throw std::out_of_range("No peer at index " + std::to_string(index));
+    }
+    return *(*chunk)[index % CHUNK_SIZE];
+}
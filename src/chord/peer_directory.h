@@ -0,0 +1,180 @@
+/**
+ * peer_directory.h
+ *
+ * This file exists to implement PeerDirectory and PeerHandle. RemotePeers are
+ * large (two ChordKeys, each holding a 256 bit integer and its string forms,
+ * plus an IP address string), yet routing state refers to the same handful of
+ * peers over and over: a finger table alone has 128 entries, most of which
+ * point to the same few peers. So rather than storing a copy of a peer in each
+ * entry, routing structures can intern the peer in the process-wide
+ * PeerDirectory once and store a PeerHandle, a trivially copyable index into
+ * the directory.
+ *
+ * Handles convert implicitly to and from RemotePeers, so code which works with
+ * RemotePeers can read from and write to structures of handles unchanged. A
+ * peer is identified by its ID, IP address, and port, and has one record
+ * however many min keys it is interned with; the record keeps the min key it
+ * was last interned with, since a peer's range changes as its neighbours come
+ * and go. Records are never removed, so the directory grows with the number
+ * of peers seen, not the number of changes to their ranges. The network-level
+ * state of each peer (RTT estimates, breaker state) is kept alongside its
+ * record, so it can be reached from a handle without a lookup.
+ *
+ * Lookups of records (by handle) and of indices (by identity) are spread
+ * across shards, each behind its own lock, so that threads resolving handles
+ * to different peers don't contend with each other.
+ */
+
+#ifndef CHORD_AND_DHASH_PEER_DIRECTORY_H
+#define CHORD_AND_DHASH_PEER_DIRECTORY_H
+
+#include "remote_peer.h"
+#include "../data_structures/thread_safe.h"
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <tuple>
+
+/**
+ * Small, trivially copyable reference to a peer interned in the PeerDirectory.
+ */
+class PeerHandle {
+public:
+    /**
+     * Default constructor. Refers to a default-constructed RemotePeer.
+     */
+    PeerHandle();
+
+    /**
+     * Intern peer, refer to it.
+     * @param peer Peer to refer to.
+     */
+    PeerHandle(const RemotePeer &peer);
+
+    /**
+     * Construct from JSON (as RemotePeer(const Json::Value &)).
+     * @param members JSON-encoded peer.
+     */
+    explicit PeerHandle(const Json::Value &members);
+
+    /**
+     * @return The peer to which this handle refers, with its latest min key.
+     */
+    RemotePeer operator * () const;
+    operator RemotePeer() const;
+
+    /**
+     * @return The peer, as JSON.
+     */
+    explicit operator Json::Value() const;
+
+    /**
+     * Handles compare equal iff they refer to the same peer (ID, IP address,
+     * and port), whatever the min keys they were made with.
+     */
+    friend bool operator == (const PeerHandle &lhs, const PeerHandle &rhs)
+    {
+        return lhs.index_ == rhs.index_;
+    }
+
+    /// Index of the peer in the directory.
+    uint32_t index_;
+};
+
+/**
+ * Process-wide, append-only registry of peers. Thread-safe.
+ */
+class PeerDirectory {
+public:
+    /**
+     * @return The directory.
+     */
+    static PeerDirectory &Instance();
+
+    /**
+     * Find the index of peer's record, adding one if there is none, and
+     * record peer's min key as its latest.
+     * @param peer Peer to intern.
+     * @return Index of peer's record.
+     */
+    uint32_t Intern(const RemotePeer &peer);
+
+    /**
+     * @param index Index of a record.
+     * @return The peer whose record is at index.
+     */
+    RemotePeer Get(uint32_t index) const;
+
+    /**
+     * @param index Index of a record.
+     * @return Health of the peer at index.
+     */
+    const std::shared_ptr<PeerHealth> &Health(uint32_t index) const;
+
+    /**
+     * @return Number of distinct peers interned.
+     */
+    size_t Size() const;
+
+private:
+    PeerDirectory() = default;
+
+    /// Everything which identifies a peer: ID, IP address, port.
+    using Identity = std::tuple<ChordKey, std::string, unsigned short>;
+
+    /// Number of shards, and the records in each chunk of the record table.
+    static const size_t NUM_SHARDS = 16, CHUNK_SIZE = 1024;
+
+    /// Maximum number of chunks, and so of peers (CHUNK_SIZE each).
+    static const size_t MAX_CHUNKS = 4096;
+
+    /// A peer and its health. The peer's min key is guarded by the lock of
+    /// the shard holding its identity; the rest never changes.
+    struct Record {
+        RemotePeer peer_;
+        std::shared_ptr<PeerHealth> health_;
+        size_t shard_;
+    };
+
+    /// A share of the identities, and the lock over them and their records.
+    struct Shard : public ThreadSafe {
+        std::map<Identity, uint32_t> indices_;
+    };
+
+    using Chunk = std::array<std::unique_ptr<Record>, CHUNK_SIZE>;
+
+    /**
+     * @param index Index of a record.
+     * @return The record at index, or throw an error if there is none.
+     */
+    Record &At(uint32_t index) const;
+
+    /// Identities, by hash.
+    mutable std::array<Shard, NUM_SHARDS> shards_;
+
+    /// Records, by index, in chunks which never move once allocated, so
+    /// that a record can be reached without taking any lock but its shard's.
+    std::array<std::atomic<Chunk *>, MAX_CHUNKS> chunks_ {};
+
+    /// Number of records.
+    std::atomic<uint32_t> size_ { 0 };
+
+    /// Serializes the allocation of chunks.
+    std::mutex chunks_mutex_;
+};
+
+/**
+ * Resolve a handle stored in a routing structure to its peer (for use by
+ * templates which may be instantiated with either handles or peers).
+ * @param handle Handle to resolve.
+ * @return Peer to which handle refers.
+ */
+inline RemotePeer PeerOf(const PeerHandle &handle)
+{
+    return *handle;
+}
+
+#endif
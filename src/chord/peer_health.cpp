@@ -0,0 +1,106 @@
+#include "peer_health.h"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+std::shared_ptr<PeerHealth> PeerHealth::Of(const std::string &ip_addr,
+                                           unsigned short port)
+{
+    static std::mutex registry_mutex;
+    static std::map<std::string, std::shared_ptr<PeerHealth>> registry;
+
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::shared_ptr<PeerHealth> &health =
+            registry[ip_addr + ":" + std::to_string(port)];
+    if(! health) {
+        health = std::make_shared<PeerHealth>();
+    }
+    return health;
+}
+
+std::chrono::milliseconds PeerHealth::Timeout(const std::string &command) const
+{
+    ReadLock lock(mutex_);
+    auto it = rtts_.find(command);
+    if(it == rtts_.end()) {
+        return MAX_TIMEOUT;
+    }
+
+    const RttEstimate &est = it->second;
+    auto rto = std::chrono::milliseconds(
+            (long long) std::ceil((est.srtt_us_ + 4 * est.rttvar_us_) / 1000));
+    return std::clamp(rto, MIN_TIMEOUT, MAX_TIMEOUT);
+}
+
+bool PeerHealth::IsTripped() const
+{
+    ReadLock lock(mutex_);
+    return open_ && (probing_ || Clock::now() - opened_at_ < COOLDOWN);
+}
+
+bool PeerHealth::AllowRequest()
+{
+    WriteLock lock(mutex_);
+    if(! open_) {
+        return true;
+    }
+
+    // Half-open: let one request through to test the waters.
+    if(! probing_ && Clock::now() - opened_at_ >= COOLDOWN) {
+        probing_ = true;
+        return true;
+    }
+    return false;
+}
+
+void PeerHealth::RecordSuccess()
+{
+    WriteLock lock(mutex_);
+    consecutive_failures_ = 0;
+    open_ = false;
+    probing_ = false;
+}
+
+void PeerHealth::RecordRtt(const std::string &command, Clock::duration rtt)
+{
+    WriteLock lock(mutex_);
+    double rtt_us = (double) std::chrono::duration_cast<
+            std::chrono::microseconds>(rtt).count();
+
+    // Jacobson/Karels, with the gains used by TCP (RFC 6298).
+    auto it = rtts_.find(command);
+    if(it == rtts_.end()) {
+        rtts_[command] = { rtt_us, rtt_us / 2 };
+    } else {
+        RttEstimate &est = it->second;
+        est.rttvar_us_ = 0.75 * est.rttvar_us_ +
+                         0.25 * std::abs(est.srtt_us_ - rtt_us);
+        est.srtt_us_ = 0.875 * est.srtt_us_ + 0.125 * rtt_us;
+    }
+}
+
+void PeerHealth::RecordFailure()
+{
+    WriteLock lock(mutex_);
+    ++consecutive_failures_;
+    if(probing_ || consecutive_failures_ >= FAILURE_THRESHOLD) {
+        open_ = true;
+        opened_at_ = Clock::now();
+        probing_ = false;
+    }
+}
+
+void PeerHealth::RecordUnreachable()
+{
+    WriteLock lock(mutex_);
+    if(probing_) {
+        opened_at_ = Clock::now();
+        probing_ = false;
+    }
+}
+
+void PeerHealth::RecordAbandoned()
+{
+    WriteLock lock(mutex_);
+    probing_ = false;
+}
@@ -0,0 +1,132 @@
+/**
+ * peer_health.h
+ *
+ * This file exists to implement PeerHealth, which tracks how a remote peer
+ * has been responding to our requests, so that we can:
+ *   - Time out requests to it based on its usual round trip time (in the
+ *     style of TCP's retransmission timeout) rather than a fixed interval.
+ *     Since handlers differ wildly in how long they take (a GET_SUCC may be
+ *     answered locally, whereas a JOIN triggers lookups of its own), RTTs are
+ *     measured separately for each command.
+ *   - Stop sending it requests for a while after several consecutive ones
+ *     have failed (i.e. "trip a circuit breaker"), routing around it instead
+ *     of paying for a full timeout each time, then let a single probe request
+ *     through once the cooldown has passed to determine if it has recovered.
+ *
+ * Since RemotePeers are copied freely (into finger tables, successor lists,
+ * responses, etc.), their health is stored in a registry keyed by address
+ * rather than in the RemotePeers themselves.
+ */
+
+#ifndef CHORD_AND_DHASH_PEER_HEALTH_H
+#define CHORD_AND_DHASH_PEER_HEALTH_H
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include "../data_structures/thread_safe.h"
+
+class PeerHealth : public ThreadSafe {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    /// Smallest timeout we will ever compute (as recommended by RFC 6298).
+    static constexpr std::chrono::milliseconds MIN_TIMEOUT { 1000 };
+    /// Largest timeout we will ever compute, also used before any RTTs have
+    /// been measured.
+    static constexpr std::chrono::milliseconds MAX_TIMEOUT { 5000 };
+    /// Number of consecutive failures after which the breaker trips.
+    static constexpr int FAILURE_THRESHOLD = 3;
+    /// How long the breaker stays open before letting a probe through.
+    static constexpr std::chrono::milliseconds COOLDOWN { 2000 };
+
+    PeerHealth() = default;
+
+    /**
+     * Get the health record of the peer at ip_addr:port, creating it if we
+     * have never contacted that peer before.
+     * @param ip_addr IP address of peer.
+     * @param port Port of peer.
+     * @return Shared health record of that peer.
+     */
+    static std::shared_ptr<PeerHealth> Of(const std::string &ip_addr,
+                                          unsigned short port);
+
+    /**
+     * @param command Command of the request to be sent.
+     * @return How long to wait for a response: the smoothed RTT of command
+     *         plus four times its variance, clamped to [MIN_TIMEOUT,
+     *         MAX_TIMEOUT].
+     */
+    std::chrono::milliseconds Timeout(const std::string &command) const;
+
+    /**
+     * Is the breaker open, such that requests to this peer should not be
+     * sent (i.e. it has failed repeatedly and is either still cooling down or
+     * already being probed)?
+     * @return Whether requests to this peer should currently be avoided.
+     */
+    bool IsTripped() const;
+
+    /**
+     * Claim permission to send a request. Always granted while the breaker
+     * is closed. While it is open, granted to exactly one caller once the
+     * cooldown has passed, whose request then serves as the probe.
+     * @return Whether a request may be sent.
+     */
+    bool AllowRequest();
+
+    /**
+     * Record a response from the peer, closing the breaker.
+     */
+    void RecordSuccess();
+
+    /**
+     * Fold a measured round trip time into the smoothed RTT of command and
+     * its variance.
+     * @param command Command of the request which was answered.
+     * @param rtt Time between sending the request and receiving the response.
+     */
+    void RecordRtt(const std::string &command, Clock::duration rtt);
+
+    /**
+     * Record a request which the peer accepted but never answered properly,
+     * tripping the breaker if this makes for too many consecutive failures
+     * (or if this was the probe).
+     */
+    void RecordFailure();
+
+    /**
+     * Record that we could not even connect to the peer. Since that is cheap
+     * to find out, it doesn't count towards tripping the breaker, but it does
+     * fail the probe, if this was it.
+     */
+    void RecordUnreachable();
+
+    /**
+     * Record a request which timed out on its caller's deadline before the
+     * peer's own timeout was up. That says nothing about the peer, so it
+     * doesn't count as a failure, but if this was the probe, another request
+     * may be let through in its place.
+     */
+    void RecordAbandoned();
+
+private:
+    /// Smoothed RTT and RTT variance of a single command, in microseconds.
+    struct RttEstimate {
+        double srtt_us_, rttvar_us_;
+    };
+
+    /// Map of commands to their RTT estimates (absent if never measured).
+    std::map<std::string, RttEstimate> rtts_;
+    /// Number of requests which have failed since the last success.
+    int consecutive_failures_ = 0;
+    /// Is the breaker open? If so, when was it (last) opened?
+    bool open_ = false;
+    Clock::time_point opened_at_;
+    /// Has a probe request been let through the open breaker?
+    bool probing_ = false;
+};
+
+#endif
@@ -3,6 +3,7 @@
 RemotePeer::RemotePeer()
     : id_("0", true)
     , min_key_("0", true)
+    , port_(0)
 {}
 
 RemotePeer::RemotePeer(ChordKey id, ChordKey min_key, std::string ip_addr,
@@ -27,17 +28,126 @@ RemotePeer::RemotePeer(const Json::Value &members)
 
 Json::Value RemotePeer::SendRequest(const Json::Value &request) const
 {
-    if(IsAlive()) {
-        Json::Value resp = Client::MakeRequest(ip_addr_, port_, request);
-        if(resp["SUCCESS"].asBool()) {
-            return resp;
+    return SendRequest(request,
+                       std::chrono::steady_clock::now() + DEFAULT_REQUEST_BUDGET);
+}
+
+Json::Value RemotePeer::SendRequest(const Json::Value &request,
+                                    const Deadline &deadline) const
+{
+    std::shared_ptr<PeerHealth> health = PeerHealth::Of(ip_addr_, port_);
+    bool peer_bound;
+    Deadline hop_deadline = AdmitRequest(request, deadline, *health,
+                                         peer_bound);
+
+    if(! IsAlive()) {
+        health->RecordUnreachable();
+        throw std::runtime_error("Peer is down.");
+    }
+
+    auto start = PeerHealth::Clock::now();
+    Json::Value resp;
+    try {
+        resp = Client::MakeRequest(ip_addr_, port_, request, hop_deadline);
+    } catch(...) {
+        RecordError(*health, hop_deadline, peer_bound);
+        throw;
+    }
+    return AcceptResponse(request, std::move(resp), *health, start);
+}
+
+Awaitable<Json::Value> RemotePeer::AsyncSendRequest(Json::Value request,
+                                                    Deadline deadline) const
+{
+    return AsyncSendRequestTo(*this, std::move(request), deadline);
+}
+
+Awaitable<Json::Value> RemotePeer::AsyncSendRequestTo(RemotePeer peer,
+                                                      Json::Value request,
+                                                      Deadline deadline)
+{
+    std::shared_ptr<PeerHealth> health = PeerHealth::Of(peer.ip_addr_,
+                                                        peer.port_);
+    bool peer_bound;
+    Deadline hop_deadline = AdmitRequest(request, deadline, *health,
+                                         peer_bound);
+
+    auto start = PeerHealth::Clock::now();
+    Json::Value resp;
+    try {
+        resp = co_await Client::AsyncMakeRequest(peer.ip_addr_, peer.port_,
+                                                 request, hop_deadline);
+    } catch(const boost::system::system_error &err) {
+        if(err.code() == boost::asio::error::connection_refused) {
+            health->RecordUnreachable();
+            throw std::runtime_error("Peer is down.");
         }
-        throw std::runtime_error("Failed request: " + resp.toStyledString());
+        RecordError(*health, hop_deadline, peer_bound);
+        throw;
+    } catch(...) {
+        RecordError(*health, hop_deadline, peer_bound);
+        throw;
+    }
+    co_return AcceptResponse(request, std::move(resp), *health, start);
+}
+
+Deadline RemotePeer::AdmitRequest(const Json::Value &request,
+                                  const Deadline &deadline,
+                                  PeerHealth &health, bool &peer_bound)
+{
+    // Running out of our own time isn't the peer's fault, so find out before
+    // involving the peer's health.
+    auto now = PeerHealth::Clock::now();
+    if(deadline <= now) {
+        throw std::runtime_error("Deadline exceeded.");
     }
 
-    else {
-        throw std::runtime_error("Peer is down.");
+    if(! health.AllowRequest()) {
+        throw std::runtime_error("Peer is unresponsive (circuit open).");
     }
+
+    // Unless this is maintenance traffic, whose handlers are long-running
+    // and slow in proportion to how much needs repairing, don't wait any
+    // longer than the peer usually takes to answer this kind of request.
+    Deadline peer_deadline = now +
+                             health.Timeout(request["COMMAND"].asString());
+    peer_bound = deadline >= peer_deadline;
+    if(request["CLASS"].asString() == "MAINTENANCE") {
+        return deadline;
+    }
+    return std::min(deadline, peer_deadline);
+}
+
+void RemotePeer::RecordError(PeerHealth &health, const Deadline &hop_deadline,
+                             bool peer_bound)
+{
+    // A request which ran out of its caller's (shorter) time could have been
+    // answered had the peer been given its usual time.
+    if(! peer_bound && PeerHealth::Clock::now() >= hop_deadline) {
+        health.RecordAbandoned();
+        return;
+    }
+    health.RecordFailure();
+}
+
+Json::Value RemotePeer::AcceptResponse(const Json::Value &request,
+                                       Json::Value resp, PeerHealth &health,
+                                       PeerHealth::Clock::time_point start)
+{
+    health.RecordSuccess();
+    if(resp["BUSY"].asBool()) {
+        throw BusyError(resp["RETRY_AFTER_MS"].asInt());
+    }
+
+    if(request["CLASS"].asString() != "MAINTENANCE") {
+        health.RecordRtt(request["COMMAND"].asString(),
+                         PeerHealth::Clock::now() - start);
+    }
+
+    if(resp["SUCCESS"].asBool()) {
+        return resp;
+    }
+    throw RequestError(std::move(resp));
 }
 
 bool RemotePeer::IsAlive() const
@@ -45,6 +155,18 @@ bool RemotePeer::IsAlive() const
     return Client::IsAlive(ip_addr_, port_);
 }
 
+Awaitable<bool> RemotePeer::AsyncIsAlive() const
+{
+    return Client::AsyncIsAlive(ip_addr_, port_,
+                                std::chrono::steady_clock::now() +
+                                DEFAULT_REQUEST_BUDGET);
+}
+
+bool RemotePeer::IsAvailable() const
+{
+    return ! PeerHealth::Of(ip_addr_, port_)->IsTripped() && IsAlive();
+}
+
 RemotePeer RemotePeer::GetSucc() const
 {
     // To find the successor of a remote peer, we can simply ask it for the
@@ -14,8 +14,13 @@
  #include "../ida/data_block.h"
 #include "../data_structures/key.h"
 #include "../networking/client.h"
+#include "peer_health.h"
 #include <json/json.h>
 
+/// Error with which a chord peer refuses a request concerning a key it doesn't
+/// own, so that whoever sent it can tell that their view of the ring is stale.
+static const std::string NOT_OWNER_ERROR = "Key not in range.";
+
 /**
  * This class exists to represent peers.
  * Peers will store instances of this class to represent their successors,
@@ -62,11 +67,39 @@ public:
     /**
      * Send a request to this remote peer, return the response it gives.
      *
-     * @param request Request to send to this remote peer.
-     * @return Remote peer's response
+     * @param request Request to send to this remote peer, which must be
+     *                answered within the default request budget.
+     * @return Remote peer's response, or throw BusyError if the peer shed the
+     *         request due to overload, or another error if it failed.
      */
     [[nodiscard]] Json::Value SendRequest(const Json::Value &request) const;
 
+    /**
+     * Send a request which must be answered by deadline to this remote peer,
+     * return the response it gives.
+     *
+     * @param request Request to send to this remote peer.
+     * @param deadline Time by which the request must be answered. The peer is
+     *                 told how much of it remains, so that it can drop the
+     *                 request (or bound any requests it makes on our behalf).
+     * @return Remote peer's response, or throw an error as above, or if the
+     *         deadline passes first.
+     */
+    [[nodiscard]] Json::Value SendRequest(const Json::Value &request,
+                                          const Deadline &deadline) const;
+
+    /**
+     * Awaitable version of SendRequest(request, deadline), for use from
+     * coroutines. Rather than probing the peer with IsAlive first, a refused
+     * connection is taken to mean that the peer is down.
+     *
+     * @param request Request to send to this remote peer.
+     * @param deadline Time by which the request must be answered.
+     * @return Remote peer's response, or throw an error as above.
+     */
+    [[nodiscard]] Awaitable<Json::Value> AsyncSendRequest(
+            Json::Value request, Deadline deadline) const;
+
     /**
      * Is remote peer up and running?
      *
@@ -75,6 +108,23 @@ public:
      */
     bool IsAlive() const;
 
+    /**
+     * Awaitable version of IsAlive, for use from coroutines.
+     *
+     * @return Whether or not a connection to this remote peer can be
+     *         established within the default request budget.
+     */
+    [[nodiscard]] Awaitable<bool> AsyncIsAlive() const;
+
+    /**
+     * Is remote peer worth sending requests to? As IsAlive, but also false
+     * if the peer has been failing to answer requests, and we have tripped
+     * its circuit breaker in order to route around it for a while.
+     *
+     * @return Whether or not requests to this peer are likely to succeed.
+     */
+    bool IsAvailable() const;
+
     /**
      * Retrieve the successor of this remote peer.
      * @return This peer's succ.
@@ -121,6 +171,54 @@ public:
 
     /// Port on which peer runs.
     unsigned short port_;
+
+private:
+    /**
+     * Coroutine body of AsyncSendRequest, which takes the peer by value so
+     * that it outlives the RemotePeer which started it.
+     */
+    static Awaitable<Json::Value> AsyncSendRequestTo(RemotePeer peer,
+                                                     Json::Value request,
+                                                     Deadline deadline);
+
+    /**
+     * Perform the checks made before sending any request to this peer.
+     *
+     * @param request Request to be sent.
+     * @param deadline Time by which the request must be answered.
+     * @param health This peer's health record.
+     * @param peer_bound Set to whether the peer was given at least its usual
+     *                   timeout, such that timing out would be its fault.
+     * @return Time by which this hop must be answered, or throw an error if
+     *         the deadline has passed or the peer's breaker is open.
+     */
+    static Deadline AdmitRequest(const Json::Value &request,
+                                 const Deadline &deadline,
+                                 PeerHealth &health, bool &peer_bound);
+
+    /**
+     * Record a request to this peer which failed without a response.
+     *
+     * @param health This peer's health record.
+     * @param hop_deadline Time by which the hop had to be answered.
+     * @param peer_bound Was the peer given at least its usual timeout?
+     */
+    static void RecordError(PeerHealth &health, const Deadline &hop_deadline,
+                            bool peer_bound);
+
+    /**
+     * Record the outcome of a request which this peer answered.
+     *
+     * @param request Request which was sent.
+     * @param resp The peer's response.
+     * @param health This peer's health record.
+     * @param start When the request was sent.
+     * @return resp, or throw BusyError or another error if the request was
+     *         shed or failed.
+     */
+    static Json::Value AcceptResponse(const Json::Value &request,
+                                      Json::Value resp, PeerHealth &health,
+                                      PeerHealth::Clock::time_point start);
 };
 
 /**
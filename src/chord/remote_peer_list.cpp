@@ -115,14 +115,14 @@ RemotePeerList::LookupLiving(const ChordKey &key) const
     ReadLock lock(mutex_);
     std::optional<RemotePeer> succ = Lookup(key);
     if(succ.has_value()) {
-        if(succ->IsAlive()) {
+        if(succ->IsAvailable()) {
             return succ;
         }
 
         int succ_ind = GetIndex(succ.value());
         for(int i = succ_ind; i % peers_.size() < succ_ind; ++i) {
             RemotePeer peer = peers_.at(i % peers_.size());
-            if(peer.IsAlive()) {
+            if(peer.IsAvailable()) {
                 return peer;
             }
         }
@@ -50,6 +50,14 @@ public:
     std::optional<RemotePeer> Lookup(const ChordKey &key,
                                      bool succ = true) const;
 
+    /**
+     * As Lookup, but skip over peers which are down or whose circuit breakers
+     * have tripped, returning the first available peer at or after the key's
+     * successor.
+     * @param key Key to lookup.
+     * @return The first available peer succeeding the key in the list, or
+     *         std::nullopt.
+     */
     std::optional<RemotePeer> LookupLiving(const ChordKey &key) const;
 
     /**
@@ -0,0 +1,176 @@
+/**
+ * compact_encoding.h
+ *
+ * Merkle sync messages mostly consist of keys and hashes. Written out as hex
+ * strings (plus the JSON punctuation around each one), these cost more than
+ * twice their size in bytes. This file provides what's needed to pack them
+ * into JSON strings instead:
+ *      - Varints : Unsigned integers of any width, 7 bits per byte, low bits
+ *                  first, with the top bit of each byte set if more follow.
+ *                  Small numbers (e.g. the gaps between sorted keys) take
+ *                  few bytes.
+ *      - Fixed   : Unsigned integers written as a fixed number of bytes,
+ *                  most significant first, for values (e.g. hashes) which
+ *                  are no smaller for being close together.
+ *      - Base64  : So that packed bytes survive being put in a JSON string.
+ */
+
+#ifndef CHORD_AND_DHASH_COMPACT_ENCODING_H
+#define CHORD_AND_DHASH_COMPACT_ENCODING_H
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+/**
+ * Append an unsigned integer to a byte string as a varint.
+ * @tparam Int Unsigned integer type (built-in or boost::multiprecision).
+ * @param out String to which to append.
+ * @param value Value to append.
+ */
+template<typename Int>
+void AppendVarint(std::string &out, Int value)
+{
+    while(value >= 0x80) {
+        out += (char) (static_cast<unsigned>(value & 0x7f) | 0x80);
+        value >>= 7;
+    }
+    out += (char) static_cast<unsigned>(value);
+}
+
+/**
+ * Read a varint from a byte string.
+ * @tparam Int Unsigned integer type (built-in or boost::multiprecision).
+ * @param in String from which to read.
+ * @param offset Offset at which the varint starts. Advanced past it.
+ * @return The value read, or throw an error if in ends before it does (or
+ *         it doesn't fit in an Int).
+ */
+template<typename Int>
+Int ReadVarint(const std::string &in, size_t &offset)
+{
+    Int value = 0;
+    for(int shift = 0;; shift += 7) {
+        if(offset >= in.size()) {
+            throw std::runtime_error("Truncated varint.");
+        }
+        if(shift >= std::numeric_limits<Int>::digits) {
+            throw std::runtime_error("Varint too long.");
+        }
+        auto byte = (unsigned char) in[offset++];
+        value |= Int(byte & 0x7f) << shift;
+        if(! (byte & 0x80)) {
+            return value;
+        }
+    }
+}
+
+/**
+ * Append an unsigned integer to a byte string as num_bytes bytes, most
+ * significant first.
+ */
+template<typename Int>
+void AppendFixed(std::string &out, const Int &value, int num_bytes)
+{
+    for(int i = num_bytes - 1; i >= 0; --i) {
+        out += (char) static_cast<unsigned>((value >> (8 * i)) & 0xff);
+    }
+}
+
+/**
+ * Read an unsigned integer written by AppendFixed.
+ * @param offset Offset at which the integer starts. Advanced past it.
+ */
+template<typename Int>
+Int ReadFixed(const std::string &in, size_t &offset, int num_bytes)
+{
+    if(offset + num_bytes > in.size()) {
+        throw std::runtime_error("Truncated fixed-size integer.");
+    }
+    Int value = 0;
+    for(int i = 0; i < num_bytes; ++i) {
+        value = (value << 8) | Int((unsigned char) in[offset++]);
+    }
+    return value;
+}
+
+/**
+ * @param bytes Bytes to encode.
+ * @return bytes in (padded) base64.
+ */
+inline std::string EncodeBase64(const std::string &bytes)
+{
+    static const char ALPHABET[] =
+            "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    std::string encoded;
+    encoded.reserve((bytes.size() + 2) / 3 * 4);
+    for(size_t i = 0; i < bytes.size(); i += 3) {
+        uint32_t group = (unsigned char) bytes[i] << 16;
+        if(i + 1 < bytes.size()) {
+            group |= (unsigned char) bytes[i + 1] << 8;
+        }
+        if(i + 2 < bytes.size()) {
+            group |= (unsigned char) bytes[i + 2];
+        }
+        encoded += ALPHABET[(group >> 18) & 0x3f];
+        encoded += ALPHABET[(group >> 12) & 0x3f];
+        encoded += i + 1 < bytes.size() ? ALPHABET[(group >> 6) & 0x3f] : '=';
+        encoded += i + 2 < bytes.size() ? ALPHABET[group & 0x3f] : '=';
+    }
+    return encoded;
+}
+
+/**
+ * @param encoded Output of EncodeBase64.
+ * @return The bytes it encodes, or throw an error if it isn't valid base64.
+ */
+inline std::string DecodeBase64(const std::string &encoded)
+{
+    static const std::array<int8_t, 256> DIGITS = [] {
+        std::array<int8_t, 256> digits {};
+        digits.fill(-1);
+        const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "abcdefghijklmnopqrstuvwxyz0123456789+/";
+        for(int i = 0; i < 64; ++i) {
+            digits[(unsigned char) alphabet[i]] = (int8_t) i;
+        }
+        return digits;
+    }();
+
+    if(encoded.size() % 4 != 0) {
+        throw std::runtime_error("Invalid base64 length.");
+    }
+
+    std::string bytes;
+    bytes.reserve(encoded.size() / 4 * 3);
+    for(size_t i = 0; i < encoded.size(); i += 4) {
+        // Padding may only end the last group, and only its last two digits.
+        bool last_group = i + 4 == encoded.size();
+        uint32_t group = 0;
+        int num_padding = 0;
+        for(size_t j = i; j < i + 4; ++j) {
+            int digit = 0;
+            if(encoded[j] == '=' && last_group && j >= i + 2) {
+                ++num_padding;
+            } else {
+                digit = DIGITS[(unsigned char) encoded[j]];
+                if(digit < 0 || num_padding > 0) {
+                    throw std::runtime_error("Invalid base64 character.");
+                }
+            }
+            group = (group << 6) | (uint32_t) digit;
+        }
+        bytes += (char) (group >> 16);
+        if(num_padding < 2) {
+            bytes += (char) ((group >> 8) & 0xff);
+        }
+        if(num_padding < 1) {
+            bytes += (char) (group & 0xff);
+        }
+    }
+    return bytes;
+}
+
+#endif
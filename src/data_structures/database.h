@@ -142,6 +142,40 @@ public:
         return index_.ReadRange(lower_bound, upper_bound);
     }
 
+    /**
+     * List at most limit entries between lower_bound and upper_bound (on the
+     * logical ring, so the range may wrap past zero), in ring order starting
+     * from lower_bound. Unlike the unbounded overload, this walks the index
+     * entry by entry, so its cost is proportional to limit rather than to
+     * the size of the range.
+     * @param lower_bound Lower bound of range.
+     * @param upper_bound Upper bound of range.
+     * @param limit Maximum number of entries to return.
+     * @return The first (up to) limit entries of the range, in ring order.
+     */
+    std::vector<KeyValPair> ReadRange(const ChordKey &lower_bound,
+                                      const ChordKey &upper_bound,
+                                      size_t limit)
+    {
+        ReadLock lock(mutex_);
+        std::vector<KeyValPair> kv_pairs;
+        ChordKey cursor = lower_bound - 1;
+        while(kv_pairs.size() < limit) {
+            // Next treats the keyspace as a ring, so it's up to us to stop
+            // once we've gone past the upper bound (or all the way around).
+            std::optional<KeyValPair> next = index_.Next(cursor);
+            if(! next.has_value() ||
+               ! next->first.InBetween(lower_bound, upper_bound, true) ||
+               (! kv_pairs.empty() && next->first == kv_pairs.front().first))
+            {
+                break;
+            }
+            kv_pairs.push_back(next.value());
+            cursor = next->first;
+        }
+        return kv_pairs;
+    }
+
     /**
      * State whether the database contains given key.
      * @param key ChordKey to lookup.
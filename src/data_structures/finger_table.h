@@ -4,11 +4,24 @@
 #include "key.h"
 #include "thread_safe.h"
 #include <boost/uuid/uuid.hpp>
+#include <json/json.h>
 #include <map>
 #include <utility>
 
 namespace mp = boost::multiprecision;
 
+/**
+ * Fingers may store peers themselves, or handles to them (see PeerHandle).
+ * Resolves either to the peer itself; handle types provide their own overload.
+ * @param peer A peer.
+ * @return The same peer.
+ */
+template<typename PeerType>
+const PeerType &PeerOf(const PeerType &peer)
+{
+    return peer;
+}
+
 /**
  * A finger table enables O(log(n)) lookups by mapping ranges
  * of keys/documents to the node succeeding the lower bound.
@@ -17,6 +30,7 @@ namespace mp = boost::multiprecision;
  * its request to that node. Said node will either process the req,
  * if it owns the key in question, or forward it to another node.
  */
+
 template<typename PeerType>
 struct Finger {
     /// Lower bound of finger's range.
@@ -37,11 +51,9 @@ public:
      * @param starting_key First table entry minus 1.
      */
     explicit FingerTable(ChordKey starting_key)
-        : starting_key_(std::move(starting_key))
-        // Num keys in chord is 16 ^ hex-id-length.
-        , keys_in_chord_(mp::pow(mp::cpp_int(16), 32))
         // Num entries is binary ID length of key.
-        , num_entries_(ChordKey::BinaryLen())
+        : num_entries_(ChordKey::BinaryLen())
+        , starting_key_(std::move(starting_key))
     {}
 
     /**
@@ -49,10 +61,9 @@ public:
      * @param finger_json JSON list of fingers.
      */
     explicit FingerTable(const Json::Value &finger_json)
-        : starting_key_(finger_json["STARTING_KEY"].asString(), true)
-        , keys_in_chord_(mp::pow(mp::cpp_int(16), 32))
         // Num entries is binary ID length of key.
-        , num_entries_(ChordKey::BinaryLen())
+        : num_entries_(ChordKey::BinaryLen())
+        , starting_key_(finger_json["STARTING_KEY"].asString(), true)
     {
         for(const auto &finger : finger_json["FINGERS"]) {
             AddFinger(FingerType {
@@ -68,10 +79,9 @@ public:
      * @param fingers Finger table to copy.
      */
     FingerTable(const FingerTable<PeerType> &fingers)
-        : starting_key_(fingers.starting_key_)
-        , keys_in_chord_(fingers.keys_in_chord_)
-        , num_entries_(fingers.num_entries_)
+        : num_entries_(fingers.num_entries_)
         , table_(fingers.table_)
+        , starting_key_(fingers.starting_key_)
     {}
 
 
@@ -81,7 +91,6 @@ public:
         num_entries_ = std::move(rhs.num_entries_);
         table_ = std::move(rhs.table_);
         starting_key_ = std::move(rhs.starting_key_);
-        keys_in_chord_ = std::move(rhs.keys_in_chord_);
     }
 
     /**
@@ -150,7 +159,8 @@ public:
         WriteLock lock(mutex_);
 
         for(auto &finger : table_) {
-            if(finger.lower_bound_.InBetween(new_peer.min_key_, new_peer.id_)) {
+            if(finger.lower_bound_.InBetween(PeerOf(new_peer).min_key_,
+                                             PeerOf(new_peer).id_)) {
                 finger.successor_ = new_peer;
             }
         }
@@ -161,7 +171,7 @@ public:
         WriteLock lock(mutex_);
 
         for(auto &finger : table_) {
-            if(finger.successor_.id_ == dead_peer.id_) {
+            if(PeerOf(finger.successor_).id_ == PeerOf(dead_peer).id_) {
                 finger.successor_ = replacement;
             }
         }
@@ -177,14 +187,8 @@ public:
     std::pair<ChordKey, ChordKey> GetNthRange(int n)
     {
         ReadLock lock(mutex_);
-        mp::cpp_int starting_key = starting_key_;
-        mp::cpp_int lb_increment_value = mp::pow(mp::cpp_int(2), n);
-        auto lower_bound = mp::uint256_t((starting_key + lb_increment_value)
-                                         % keys_in_chord_);
-        mp::cpp_int ub_increment_value = mp::pow(mp::cpp_int(2), n + 1);
-        auto upper_bound = mp::uint256_t((starting_key + ub_increment_value)
-                                         % keys_in_chord_) - 1;
-        return { ChordKey(lower_bound), ChordKey(upper_bound) };
+        return { starting_key_ + ChordKey::PowerOfTwo(n),
+                 starting_key_ + ChordKey::PowerOfTwo(n + 1) - 1 };
     }
 
     /**
@@ -200,7 +204,8 @@ public:
         for(const auto &finger : table_) {
             if(display_fingers.empty()) {
                 display_fingers.push_back(finger);
-            } else if(display_fingers.back().successor_.id_ == finger.successor_.id_) {
+            } else if(PeerOf(display_fingers.back().successor_).id_ ==
+                      PeerOf(finger.successor_).id_) {
                 display_fingers.back().upper_bound_ = finger.upper_bound_;
                 // If this seems redundant, bear in mind that trying to get the
                 // successor of back if it's empty would cause a segfault.
@@ -226,15 +231,16 @@ public:
         // the width is one char larger for every digit that is missing in the key
         // for any given column.
         for(const auto &finger : display_fingers) {
+            const auto &succ = PeerOf(finger.successor_);
             res << std::setfill(' ') << "| " << std::setw(5)
                 << std::string(finger.lower_bound_)
                 << std::setw(5 + (32 - finger.lower_bound_.Size())) << "| "
                 << std::string(finger.upper_bound_)
                 << std::setw(5 + (32 - finger.upper_bound_.Size())) << "| "
-                << std::string(finger.successor_.id_)
-                << std::setw(5 + (32 - finger.successor_.id_.Size())) << "| "
-                << std::string(finger.successor_.ip_addr_) << ":"
-                << std::to_string(finger.successor_.port_) << std::setw(5)
+                << std::string(succ.id_)
+                << std::setw(5 + (32 - succ.id_.Size())) << "| "
+                << std::string(succ.ip_addr_) << ":"
+                << std::to_string(succ.port_) << std::setw(5)
                 << "|\n";
         }
         res << std::string(131, '-') << "\n";
@@ -282,9 +288,6 @@ private:
 
     /// First finger table entry - 1.
     ChordKey starting_key_;
-
-    /// Number keys in entire hash ring.
-    mp::cpp_int keys_in_chord_;
 };
 
 #endif
\ No newline at end of file
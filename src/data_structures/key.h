@@ -14,6 +14,8 @@
 #include <boost/multiprecision/cpp_int.hpp>
 #include <boost/uuid/uuid_generators.hpp>
 #include <boost/multiprecision/cpp_bin_float.hpp>
+#include <bit>
+#include <cctype>
 #include <string>
 #include <cmath>
 #include "thread_safe.h"
@@ -39,18 +41,55 @@ static boost::uuids::uuid GenerateSha1Hash(const std::string &plaintext)
  * @return Int as hexadecimal stirng.
  */
 template<typename int_type>
-static std::string IntToHexStr(int_type val)
+inline std::string IntToHexStr(int_type val)
 {
     std::stringstream hex_stream;
     hex_stream << std::hex << val;
     return hex_stream.str();
 }
 
+/**
+ * Overload for native 128-bit integers, which streams can't print.
+ */
+inline std::string IntToHexStr(unsigned __int128 val)
+{
+    char digits[32];
+    char *end = digits + sizeof(digits), *begin = end;
+    do {
+        *--begin = "0123456789abcdef"[(int) (val & 0xf)];
+        val >>= 4;
+    } while(val != 0);
+    return std::string(begin, end);
+}
+
+/**
+ * @param val Non-zero integer.
+ * @return Index of val's highest set bit, i.e. floor(log2(val)).
+ */
+inline int HighestSetBit(const mp::uint256_t &val)
+{
+    return (int) mp::msb(val);
+}
+
+inline int HighestSetBit(unsigned __int128 val)
+{
+    auto high = (uint64_t) (val >> 64), low = (uint64_t) val;
+    return high != 0 ? 127 - __builtin_clzll(high) : 63 - __builtin_clzll(low);
+}
+
 /**
  * Generic class for keys in a logical ring. The behavior of this type depends
  * upon the size of the ring, which will be computed from template parameters.
  *
- * @tparam key_base The base of the key. E.g. 16 for a hex key.
+ * Rings of up to 64 bits (e.g. 16 hex digits) store keys as native integers,
+ * so that key arithmetic compiles down to a handful of instructions. These are
+ * 128 bits wide, rather than 64, since the number of keys in the ring (one
+ * past the largest key) must be representable too: it's what key - key yields
+ * for equal keys, and MerkleTree uses it as the upper bound of its root.
+ * Larger rings fall back to boost's 256-bit integers.
+ *
+ * @tparam key_base The base of the key. E.g. 16 for a hex key. Must be a power
+ *                  of 2.
  * @tparam key_len The maximum number of digits in the key.
  */
 template<int key_base, int key_len>
@@ -58,6 +97,20 @@ class GenericKey {
 public:
     using KeyType = GenericKey<key_base, key_len>;
 
+    static_assert(key_base > 1 && (key_base & (key_base - 1)) == 0,
+                  "Key base must be a power of 2.");
+
+    /// Number of bits in a key.
+    static constexpr int BINARY_LEN = std::bit_width((unsigned) key_base - 1) *
+                                      key_len;
+
+    /// Does this ring use native integers?
+    static constexpr bool NATIVE = BINARY_LEN <= 64;
+
+    /// Type in which keys' values are stored.
+    using ValueType = std::conditional_t<NATIVE, unsigned __int128,
+                                         mp::uint256_t>;
+
     GenericKey() = default;
 
     /**
@@ -70,26 +123,31 @@ public:
     explicit GenericKey(const std::string &key, bool hashed = true)
         : plaintext_(hashed ? "" : key)
     {
-        if(hashed) {
+        if constexpr(NATIVE) {
+            // Wider IDs (e.g. SHA-1 hashes) are taken modulo the size of the
+            // ring - though not the size of the ring itself (see above).
+            value_ = hashed ? ParseHex(key) : FromUuid(GenerateSha1Hash(key));
+            if(value_ > KEYS_IN_RING) {
+                value_ %= KEYS_IN_RING;
+            }
+        } else if(hashed) {
             // Boost interprets numeric strings beginning with 0x as hashes.
             value_ = boost::multiprecision::uint256_t("0x" + key);
         } else {
             boost::uuids::uuid uuid = GenerateSha1Hash(key);
             value_ = boost::multiprecision::uint256_t (uuid);
         }
-
-        string_ = IntToHexStr(value_);
     }
 
     /**
-     * Constructor 2: Generate a key from a boost::multiprecision::uint128_t.
+     * Constructor 2: Generate a key from a number (either a built-in integer
+     * or a boost::multiprecision integer).
      *
      * @param key A numeric value.
      */
     template<typename T>
     explicit GenericKey(T key)
-        : value_(std::move(key))
-        , string_(IntToHexStr(value_))
+        : value_(ToValue(std::move(key)))
     {}
 
     /**
@@ -100,8 +158,7 @@ public:
      * @param inclusive Is range inclusive?
      * @return Whether or not this key is within specified range on logical ring.
      */
-    bool InBetween(const boost::multiprecision::uint256_t &lower_bound,
-                   const boost::multiprecision::uint256_t &upper_bound,
+    bool InBetween(const ValueType &lower_bound, const ValueType &upper_bound,
                    bool inclusive = true) const
     {
         // If upper and lower bound are same value, see if value is equal to either.
@@ -113,9 +170,9 @@ public:
         }
 
         // Modulo the upper bound, lower bound, and value by number keys in ring.
-        mp::cpp_int mod_lower_bound = lower_bound % keys_in_ring_;
-        mp::cpp_int mod_upper_bound = upper_bound % keys_in_ring_;
-        mp::cpp_int mod_value = value_ % keys_in_ring_;
+        RingInt mod_lower_bound = lower_bound % KEYS_IN_RING;
+        RingInt mod_upper_bound = upper_bound % KEYS_IN_RING;
+        RingInt mod_value = value_ % KEYS_IN_RING;
 
         // Now compare.
         if (lower_bound < upper_bound) {
@@ -130,6 +187,15 @@ public:
         }
     }
 
+    /**
+     * As above, for bounds which are themselves keys.
+     */
+    bool InBetween(const KeyType &lower_bound, const KeyType &upper_bound,
+                   bool inclusive = true) const
+    {
+        return InBetween(lower_bound.value_, upper_bound.value_, inclusive);
+    }
+
     /**
      * Return key length.
      */
@@ -151,25 +217,33 @@ public:
      */
     static unsigned long long BinaryLen()
     {
-        return log2(key_base) * key_len;
+        return BINARY_LEN;
     }
 
     /**
-     * Non-const version of above function.
-     *
-     * @param lower_bound Lower bound of query.
-     * @param upper_bound Upper bound of query.
-     * @param inclusive Is range inclusive?
-     * @return Whether or not this key is within specified range on logical ring.
+     * @return Number of keys in the ring (i.e. one past the largest key).
+     */
+    static KeyType KeysInRing()
+    {
+        return KeyType(ValueType(KEYS_IN_RING));
+    }
+
+    /**
+     * @param exponent Non-negative integer.
+     * @return 2^exponent, modulo the number of keys in the ring.
+     */
+    static KeyType PowerOfTwo(int exponent)
+    {
+        return exponent >= BINARY_LEN ? KeyType(0) :
+                                        KeyType(ValueType(1) << exponent);
+    }
+
+    /**
+     * @return Numeric value of key.
      */
-    bool InBetween(const boost::multiprecision::uint256_t &lower_bound,
-                   const boost::multiprecision::uint256_t &upper_bound,
-                   bool inclusive)
+    [[nodiscard]] const ValueType &Value() const
     {
-        // Cast away the const from the non-const version of this method.
-        return (const_cast<const KeyType*>(this)->InBetween(lower_bound,
-                                                            upper_bound,
-                                                            inclusive));
+        return value_;
     }
 
     /**
@@ -178,7 +252,12 @@ public:
      */
     operator boost::multiprecision::uint256_t() const
     {
-        return value_;
+        if constexpr(NATIVE) {
+            return (mp::uint256_t((uint64_t) (value_ >> 64)) << 64) |
+                   (uint64_t) value_;
+        } else {
+            return value_;
+        }
     }
 
     /**
@@ -188,16 +267,18 @@ public:
      */
     operator boost::multiprecision::cpp_int() const
     {
-        return boost::multiprecision::cpp_int(value_);
+        return boost::multiprecision::cpp_int(mp::uint256_t(*this));
     }
 
     /**
-     * Overload typecast to std::string.
+     * Overload typecast to std::string. The string is formatted when asked
+     * for, rather than whenever a key is made, since most keys (e.g. the
+     * results of key arithmetic) are never printed or sent.
      *
-     * @return ChordKey::string_ (a string version of ChordKey::value_).
+     * @return ChordKey::value_, in hex.
      */
     operator std::string() const  {
-        return string_;
+        return IntToHexStr(value_);
     }
 
     /// Overload operators for numeric comparison using ChordKey::value_.
@@ -236,48 +317,117 @@ public:
     template<typename T>
     friend KeyType operator + (const KeyType &key, T number)
     {
-        return KeyType((key.value_ + number) % keys_in_ring_);
+        if constexpr(NATIVE) {
+            return key + KeyType(number);
+        } else {
+            return KeyType((key.value_ + number) % KEYS_IN_RING);
+        }
     }
 
     template<typename T>
     friend KeyType operator - (const KeyType &key, T number)
     {
-        mp::cpp_int diff = key.value_ - number;
-        if(diff > 0) {
-            return KeyType(diff);
+        if constexpr(NATIVE) {
+            return key - KeyType(number);
+        } else {
+            mp::cpp_int diff = key.value_ - number;
+            if(diff > 0) {
+                return KeyType(diff);
+            }
+            return KeyType(KEYS_IN_RING + diff);
         }
-        return KeyType(keys_in_ring_ + diff);
     }
 
     friend KeyType operator + (const KeyType &key1, const KeyType &key2)
     {
-        assert(key1.keys_in_ring_ == key2.keys_in_ring_);
-        return KeyType((key1.value_ + key2.value_) % keys_in_ring_);
+        return KeyType((key1.value_ + key2.value_) % KEYS_IN_RING);
     }
 
     friend KeyType operator - (const KeyType &key1, const KeyType &key2)
     {
-        assert(key1.keys_in_ring_ == key2.keys_in_ring_);
+        if constexpr(NATIVE) {
+            // As below, equal keys are a whole ring apart.
+            ValueType lhs = key1.value_ % KEYS_IN_RING,
+                      rhs = key2.value_ % KEYS_IN_RING;
+            return KeyType(lhs > rhs ? lhs - rhs : KEYS_IN_RING + lhs - rhs);
+        } else {
+            // Since values are unsigned, we must cast them to signed cpp_ints
+            // before subtracting.
+            mp::cpp_int diff = mp::cpp_int(key1.value_) -
+                               mp::cpp_int(key2.value_);
+            if(diff > 0) {
+                return KeyType(diff);
+            }
 
-        // Since values are unsigned, we must cast them to signed cpp_ints
-        // before subtracting.
-        mp::cpp_int diff = mp::cpp_int(key1.value_) - mp::cpp_int(key2.value_);
-        if(diff > 0) {
-            return KeyType(diff);
+            return KeyType(KEYS_IN_RING + diff);
         }
-
-        return KeyType(keys_in_ring_ + diff);
     }
 
 private:
-    /// Numeric value of key stored as boost uuid.
-    boost::multiprecision::uint256_t value_;
+    /// Type in which the number of keys in the ring is stored, and in which
+    /// arithmetic modulo it is done.
+    using RingInt = std::conditional_t<NATIVE, ValueType, mp::cpp_int>;
+
+    static inline const RingInt KEYS_IN_RING = RingInt(1) << BINARY_LEN;
+
+    /**
+     * @param hex Hex string.
+     * @return Its value, modulo 2^128.
+     */
+    static ValueType ParseHex(const std::string &hex)
+    {
+        // As with boost, an empty string is zero.
+        ValueType value = 0;
+        for(char digit : hex) {
+            auto c = (unsigned char) digit;
+            int digit_val = std::isdigit(c) ? c - '0' :
+                            std::isxdigit(c) ? std::tolower(c) - 'a' + 10 : -1;
+            if(digit_val < 0) {
+                throw std::runtime_error("Invalid key: " + hex);
+            }
+            value = (value << 4) | (unsigned) digit_val;
+        }
+        return value;
+    }
 
-    /// String representation of key.
-    std::string string_, plaintext_;
+    /**
+     * @param uuid 128-bit UUID.
+     * @return Its value, read big-endian.
+     */
+    static ValueType FromUuid(const boost::uuids::uuid &uuid)
+    {
+        ValueType value = 0;
+        for(uint8_t byte : uuid) {
+            value = (value << 8) | byte;
+        }
+        return value;
+    }
 
-    static const inline mp::cpp_int keys_in_ring_ = mp::pow(mp::cpp_int(key_base),
-                                                            key_len);
+    /**
+     * @param number Built-in integer, or anything from which boost can make
+     *               a uint256_t (e.g. a cpp_int, or a numeric string).
+     * @return number as a ValueType.
+     */
+    template<typename T>
+    static ValueType ToValue(T number)
+    {
+        if constexpr(! NATIVE || std::is_integral_v<T> ||
+                     std::is_same_v<T, ValueType>)
+        {
+            return ValueType(std::move(number));
+        } else {
+            // Boost won't convert to __int128, so go a half at a time.
+            mp::uint256_t wide(std::move(number));
+            return (ValueType(static_cast<uint64_t>(wide >> 64)) << 64) |
+                   static_cast<uint64_t>(wide & UINT64_MAX);
+        }
+    }
+
+    /// Numeric value of key.
+    ValueType value_ = 0;
+
+    /// Plaintext from which the key was hashed, if any.
+    std::string plaintext_;
 };
 
 /**
@@ -352,7 +502,12 @@ private:
     KeyType key_;
 };
 
-using ChordKey = GenericKey<16, 32>;
-using ThreadSafeChordKey = ThreadSafeKey<16, 32>;
+/// Width of the chord ring's IDs, in bits (set per build; see CMakeLists.txt).
+#ifndef CHORD_KEY_BITS
+#define CHORD_KEY_BITS 128
+#endif
+
+using ChordKey = GenericKey<16, CHORD_KEY_BITS / 4>;
+using ThreadSafeChordKey = ThreadSafeKey<16, CHORD_KEY_BITS / 4>;
 
 #endif
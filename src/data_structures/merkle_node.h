@@ -41,22 +41,20 @@
 
 namespace mp = boost::multiprecision;
 
-/// Because log2 requires this type, and because this type has only one
-/// application in this file, I will refer to the type based on this single
-/// application: representing the distance between two keys.
-typedef mp::cpp_bin_float_100 KeyDist;
+/// The distance between two keys.
+typedef int KeyDist;
 
 /**
  * Return the distance between two keys.
  *
  * @param key1 First key.
  * @param key2 Second key.
- * @return floor(log_base2(key1 ^ key2))
+ * @return floor(log_base2(key1 ^ key2)), or -1 if the keys are equal.
  */
 static KeyDist Distance(const ChordKey &key1, const ChordKey &key2)
 {
-    mp::uint256_t xor_keys = mp::uint256_t(key1) ^ mp::uint256_t(key2);
-    return floor(log2(mp::cpp_bin_float_100(xor_keys)));
+    ChordKey::ValueType xor_keys = key1.Value() ^ key2.Value();
+    return xor_keys == 0 ? -1 : HighestSetBit(xor_keys);
 }
 
 /**
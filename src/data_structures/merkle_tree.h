@@ -11,13 +11,21 @@
  *
  * This file now replaces the functionality contained within merkle_node.h,
  * which implements a compact sparse merkle tree.
+ *
+ * Nodes exchanged during synchronization are sent in a compact form: a node's
+ * range is implied by its position, so only the position is sent; a leaf's
+ * keys are sorted and sent as varint-encoded gaps from the start of its
+ * range; and an internal node's children are sent as a packed array of their
+ * hashes, in order.
  */
 
 #ifndef CHORD_AND_DHASH_MERKLE_TREE_H
 #define CHORD_AND_DHASH_MERKLE_TREE_H
 
+#include <algorithm>
 #include <utility>
 #include <json/json.h>
+#include "compact_encoding.h"
 #include "key.h"
 
 
@@ -39,7 +47,7 @@ public:
      *                represented by ChordKey.
      */
     MerkleTree()
-            : max_key_(mp::pow(mp::cpp_int(ChordKey::Base()), ChordKey::Size()))
+            : max_key_(ChordKey::KeysInRing())
     {
         CreateChildren();
     }
@@ -61,18 +69,25 @@ public:
     {}
 
     /**
-     * Constructor 3. Construct a node from a JSON representation of it.
+     * Constructor 3. Construct a node from a JSON representation of it, either
+     *                as given by Json::Value(tree) or, if it has no MIN_KEY,
+     *                by NonRecursiveSerialize.
      * @param json_node The JSON representation of the node in question.
      */
     explicit MerkleTree(const Json::Value &json_node)
-            : min_key_(json_node["MIN_KEY"].asString(), true)
-            , max_key_(json_node["KEY"].asString(), true)
-            , hash_(json_node["HASH"].asString(), true)
+            : hash_(json_node["HASH"].asString(), true)
     {
         for(const auto &dir : json_node["POSITION"]) {
             position_.push_back(dir.asInt());
         }
 
+        if(! json_node.isMember("MIN_KEY")) {
+            FromCompactJson(json_node);
+            return;
+        }
+
+        min_key_ = ChordKey(json_node["MIN_KEY"].asString(), true);
+        max_key_ = ChordKey(json_node["KEY"].asString(), true);
         for(const auto &child : json_node["CHILDREN"]) {
             child_nodes_.push_back(MerkleTree<ValType>(child));
         }
@@ -207,8 +222,7 @@ public:
             // is intended to represent a circular keyspace), then return the ranges
             // [lb, MAX_KEY] and [0, ub].
         else if(lb_index > ub_index) {
-            ChordKey max_key(mp::pow(mp::cpp_int(ChordKey::Base()),
-                                     ChordKey::Size()) - 1);
+            ChordKey max_key = ChordKey::KeysInRing() - 1;
             KvMap below_ub = ReadRange(ChordKey(0), upper_bound),
                     above_lb = ReadRange(lower_bound, max_key);
             below_ub.insert(above_lb.begin(), above_lb.end());
@@ -583,42 +597,63 @@ public:
      * You can't send a whole merkle tree over a network easily, so it's better
      * to have a method where we can serialize only a given node and its children.
      * If, upon inspection, a node wishes to see one of the children, it can
-     * subsequently request its children. This method simply serializes a node
-     * and its children in JSON format.
-     * @param children Should we include this node's children (allows a recursive
-     *                 call).
-     * @return Node and its children (w/o their children) as JSON.
+     * subsequently request its children. This method serializes a node (its
+     * hash, position, and, if it's a leaf, its keys but not their values) and
+     * the hashes of its children, in the compact form described above.
+     * @param children Should we include the hashes of this node's children?
+     * @return Node and its children's hashes as JSON.
      */
     [[nodiscard]] Json::Value NonRecursiveSerialize(bool children = true) const
     {
         Json::Value node;
         node["HASH"] = std::string(hash_);
-        node["MIN_KEY"] = std::string(min_key_);
-        node["KEY"] = std::string(max_key_);
+        node["POSITION"] = Json::arrayValue;
+        for(int dir : position_) {
+            node["POSITION"].append(dir);
+        }
 
         if(IsLeaf()) {
-            Json::Value kv_pairs;
+            // Keys are sorted, and all lie in our range, so each can be sent
+            // as its distance from the one before (the first, from min_key_).
+            std::string keys;
+            ChordKey::ValueType last_key = min_key_.Value();
             for(const auto &[key, val] : data_) {
-                kv_pairs[std::string(key)] = "";
+                AppendVarint(keys, ChordKey::ValueType(key.Value() - last_key));
+                last_key = key.Value();
             }
-            node["KV_PAIRS"] = kv_pairs;
+            node["KEYS"] = EncodeBase64(keys);
         }
 
         else if(children) {
-            node["CHILDREN"] = Json::arrayValue;
+            std::string hashes;
             for(const auto &child : child_nodes_) {
-                node["CHILDREN"].append(child.NonRecursiveSerialize(false));
+                AppendFixed(hashes, child.hash_.Value(), HASH_BYTES);
             }
-        }
-
-        node["POSITION"] = Json::arrayValue;
-        for(int dir : position_) {
-            node["POSITION"].append(dir);
+            node["HASHES"] = EncodeBase64(hashes);
         }
 
         return node;
     }
 
+    /**
+     * Find the range of the node at a given position, exactly as
+     * CreateChildren would have divided it up.
+     * @param position Position of a node.
+     * @return { min key, max key } of the node at that position.
+     */
+    static std::pair<ChordKey, ChordKey> RangeAt(const std::deque<int> &position)
+    {
+        ChordKey min_key(0), max_key = ChordKey::KeysInRing();
+        for(int dir : position) {
+            ChordKey::ValueType width = (max_key - min_key).Value() /
+                                        num_children_;
+            ChordKey::ValueType lower = min_key.Value() + width * dir;
+            min_key = ChordKey(lower);
+            max_key = ChordKey(ChordKey::ValueType(lower + width));
+        }
+        return { min_key, max_key };
+    }
+
     /**
      * Serialize an entire tree as JSON.
      * @return Recursively-generated JSON merkle tree.
@@ -678,6 +713,11 @@ private:
     /// Number of children per node.
     static int num_children_;
 
+    /// Number of bytes in which a hash is packed. Hashes are as wide as the
+    /// ring, except that in wide rings they are 128-bit SHA-1 digests.
+    static constexpr int HASH_BYTES =
+            (std::max(ChordKey::BINARY_LEN, ChordKey::NATIVE ? 0 : 128) + 7) / 8;
+
     /// List of children of this node. Empty at leaf nodes.
     std::vector<NodeType> child_nodes_;
 
@@ -688,6 +728,43 @@ private:
     /// Largest key stored in this subtree (makes "Next" much more efficient).
     std::optional<ChordKey> largest_key_;
 
+    /**
+     * Fill in the rest of a node (whose hash and position are set) from the
+     * JSON given by NonRecursiveSerialize.
+     * @param json_node The node as JSON.
+     */
+    void FromCompactJson(const Json::Value &json_node)
+    {
+        std::tie(min_key_, max_key_) = RangeAt(position_);
+
+        if(json_node.isMember("KEYS")) {
+            std::string keys = DecodeBase64(json_node["KEYS"].asString());
+            ChordKey::ValueType key = min_key_.Value();
+            for(size_t offset = 0; offset < keys.size();) {
+                key += ReadVarint<ChordKey::ValueType>(keys, offset);
+                data_.insert({ ChordKey(key), ValType() });
+            }
+        }
+
+        if(json_node.isMember("HASHES")) {
+            std::string hashes = DecodeBase64(json_node["HASHES"].asString());
+            if(hashes.size() != (size_t) num_children_ * HASH_BYTES) {
+                throw std::runtime_error("Wrong number of child hashes.");
+            }
+
+            size_t offset = 0;
+            for(int i = 0; i < num_children_; ++i) {
+                std::deque<int> child_pos = position_;
+                child_pos.push_back(i);
+                auto [child_min, child_max] = RangeAt(child_pos);
+                child_nodes_.emplace_back(child_min, child_max, child_pos);
+                child_nodes_.back().hash_ = ChordKey(
+                        ReadFixed<ChordKey::ValueType>(hashes, offset,
+                                                       HASH_BYTES));
+            }
+        }
+    }
+
     /**
      * Turn a leaf node into an internal node.
      */
@@ -711,14 +788,11 @@ private:
             return 0;
         }
 
-        mp::cpp_int key_num(key);
-        mp::cpp_int key_space = mp::pow(mp::cpp_int(ChordKey::Base()),
-                                        ChordKey::Size());
-        mp::cpp_bin_float_100 key_len = ChordKey::BinaryLen(),
-                child_id_len = log2(num_children_);
-        int shift(key_len - (child_id_len * (GetDepth() + 1)));
-        mp::cpp_int shifted_key = (key_num >> shift);
-        return (unsigned long) (shifted_key & (num_children_ - 1));
+        // num_children_ is a power of two, so each level of the tree consumes
+        // a fixed number of the key's bits, from the most significant down.
+        int child_id_len = std::bit_width((unsigned) num_children_) - 1;
+        int shift = ChordKey::BinaryLen() - child_id_len * (GetDepth() + 1);
+        return (unsigned long) ((key.Value() >> shift) & (num_children_ - 1));
     }
 
     void Rehash()
@@ -754,10 +828,10 @@ private:
      */
     void CreateChildren()
     {
-        mp::uint256_t key_range(max_key_ - min_key_),
-                last_key = min_key_;
+        ChordKey::ValueType key_range = (max_key_ - min_key_).Value(),
+                            last_key = min_key_.Value();
         for(int i = 0; i < num_children_; ++i) {
-            mp::uint256_t ub = last_key + (key_range / num_children_);
+            ChordKey::ValueType ub = last_key + (key_range / num_children_);
             std::deque<int> child_pos = position_;
             child_pos.push_back(i);
 
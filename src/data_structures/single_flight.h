@@ -0,0 +1,112 @@
+/**
+ * single_flight.h
+ *
+ * Bursts of activity (e.g. stabilization, notifications and leaves all
+ * happening at once) tend to make a peer issue several identical lookups at
+ * the same moment, each of which would otherwise be routed around the ring
+ * independently. The class SingleFlight deduplicates such work: the first
+ * thread to request a given key runs the lookup, and any threads requesting
+ * the same key while it is in flight simply wait for and share its result
+ * (or its error). Once the lookup completes, the key is forgotten, so nothing
+ * is ever cached past the lifetime of a single lookup.
+ */
+#ifndef CHORD_AND_DHASH_SINGLE_FLIGHT_H
+#define CHORD_AND_DHASH_SINGLE_FLIGHT_H
+
+#include "thread_safe.h"
+#include <chrono>
+#include <future>
+#include <map>
+#include <stdexcept>
+
+/**
+ * Merges concurrent, identical calls into one.
+ * @tparam KeyType Type identifying calls which can be merged.
+ * @tparam ValType Result of a call.
+ */
+template<typename KeyType, typename ValType>
+class SingleFlight : ThreadSafe {
+public:
+    using TimePoint = std::chrono::steady_clock::time_point;
+
+    SingleFlight() = default;
+
+    /**
+     * Disable copying, since in-flight calls can't be shared between copies.
+     */
+    SingleFlight(const SingleFlight &rhs) = delete;
+
+    /**
+     * Return the result of fn(), unless a call for key is already in flight,
+     * in which case wait for that call's result instead.
+     * @tparam Fn Callable taking no arguments and returning a ValType.
+     * @param key Identifies the call.
+     * @param deadline Time after which to stop waiting on another thread's
+     *                 call (our own call is bounded however fn bounds it).
+     * @param fn Performs the call.
+     * @return The result of the call, or throw the error it threw, or throw
+     *         an error if deadline passes while waiting on it.
+     */
+    template<typename Fn>
+    ValType Do(const KeyType &key, const TimePoint &deadline, Fn fn)
+    {
+        std::shared_future<ValType> in_flight;
+        std::promise<ValType> promise;
+        {
+            WriteLock lock(mutex_);
+            auto it = calls_.find(key);
+            if(it != calls_.end()) {
+                in_flight = it->second;
+            } else {
+                calls_.insert({ key, promise.get_future().share() });
+            }
+        }
+
+        // Someone else is already on it.
+        if(in_flight.valid()) {
+            if(in_flight.wait_until(deadline) != std::future_status::ready) {
+                throw std::runtime_error("Deadline exceeded waiting on "
+                                         "identical call.");
+            }
+            return in_flight.get();
+        }
+
+        // Otherwise, it's our job. Forget about the call before publishing
+        // its result, so that no one can join it after it has completed.
+        try {
+            ValType result = fn();
+            Forget(key);
+            promise.set_value(result);
+            return result;
+        } catch(...) {
+            Forget(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+    }
+
+    /**
+     * @return Number of distinct calls currently in flight.
+     */
+    size_t NumInFlight() const
+    {
+        ReadLock lock(mutex_);
+        return calls_.size();
+    }
+
+private:
+    /// Map of keys to the (shared) results of the calls in flight for them.
+    std::map<KeyType, std::shared_future<ValType>> calls_;
+
+    /**
+     * Remove the call for key from calls_.
+     * @param key Identifies the call.
+     */
+    void Forget(const KeyType &key)
+    {
+        WriteLock lock(mutex_);
+        calls_.erase(key);
+    }
+};
+
+#endif
@@ -1,4 +1,5 @@
 #include "dhash_peer.h"
+#include <algorithm>
 #include <random>
 #include <chrono>
 
@@ -10,6 +11,7 @@ using namespace std::literals;
 
 DHashPeer::DHashPeer(std::string ip_addr, int port, int num_replicas)
     : AbstractChordPeer(std::move(ip_addr), port, num_replicas)
+    , maintenance_slots_(std::make_shared<AsyncSemaphore>(MAINTENANCE_SLOTS))
     , continue_maintenance_(true)
     , n_(14)
     , m_(10)
@@ -23,6 +25,8 @@ DHashPeer::DHashPeer(std::string ip_addr, int port, int num_replicas)
                 return NotifyHandler(req);
             } },
             { "LEAVE", [this](const Json::Value &req) {
+                RecordMembershipChange(ChordKey(req["LEAVING_ID"].asString(),
+                                                true));
                 return LeaveHandler(req);
             } },
             { "GET_SUCC", [this](const Json::Value &req) {
@@ -34,6 +38,9 @@ DHashPeer::DHashPeer(std::string ip_addr, int port, int num_replicas)
             { "CREATE_KEY", [this](const Json::Value &req) {
                 return CreateKeyHandler(req);
             } },
+            { "CREATE_HINT", [this](const Json::Value &req) {
+                return CreateHintHandler(req);
+            } },
             { "READ_KEY", [this](const Json::Value &req) {
                 return ReadKeyHandler(req);
             } },
@@ -43,12 +50,27 @@ DHashPeer::DHashPeer(std::string ip_addr, int port, int num_replicas)
             { "XCHNG_NODE", [this](const Json::Value &req) {
                 return ExchangeNodeHandler(req);
             } },
+            { "GOSSIP", [this](const Json::Value &req) {
+                return GossipHandler(req);
+            } },
+            { "SYNC_MEMBERSHIP", [this](const Json::Value &req) {
+                return SyncMembershipHandler(req);
+            } },
             { "RECTIFY", [this](const Json::Value &req) {
+                RecordMembershipChange(RemotePeer(req["FAILED_NODE"]).id_);
                 return RectifyHandler(req);
             } }
     };
 
-    server_ = std::make_shared<ServerType>(port, 3, commands);
+    // Batched lookups wait on the next hops for as long as it takes the
+    // whole batch to resolve, so they run as coroutines, holding no thread.
+    std::map<std::string, AsyncReqHandler> async_commands {
+            { "GET_SUCC_BATCH", [this](Json::Value req) {
+                return GetSuccBatchHandler(std::move(req));
+            } }
+    };
+
+    server_ = std::make_shared<ServerType>(port, 3, commands, async_commands);
     server_->RunInBackground();
 }
 
@@ -56,6 +78,7 @@ DHashPeer::DHashPeer(DHashPeer &&rhs) noexcept
     : AbstractChordPeer(std::move(rhs))
     , server_(std::move(rhs.server_))
     , db_(std::move(rhs.db_))
+    , maintenance_slots_(std::move(rhs.maintenance_slots_))
     , continue_maintenance_(rhs.continue_maintenance_)
     , maintenance_thread_(std::move(rhs.maintenance_thread_))
 {}
@@ -102,7 +125,7 @@ void DHashPeer::Create(const ChordKey &key, const std::string &val)
 
 void DHashPeer::Create(const ChordKey &key, const DataBlock &val)
 {
-    int num_replicas = 0;
+    int num_replicas = 0, num_existing = 0;
     std::vector<RemotePeer> succ_list = GetNSuccessors(key, n_);
 
     // A minimum of ten replicas are needed to reconstruct the block.
@@ -111,20 +134,51 @@ void DHashPeer::Create(const ChordKey &key, const DataBlock &val)
                                  "request.");
     }
 
+    std::vector<int> missed;
     for(int i = 0; i < succ_list.size(); i++) {
         RemotePeer succ = succ_list.at(i);
         if(succ.id_ == id_) {
             db_.Insert({ key, val.fragments_.at(i) });
             num_replicas++;
-        } else if(succ.IsAlive() && CreateKey(key, val.fragments_.at(i), succ)) {
-            ++num_replicas;
+            continue;
+        }
+
+        try {
+            if(succ.IsAlive() && CreateKey(key, val.fragments_.at(i), succ)) {
+                ++num_replicas;
+                continue;
+            }
+        } catch(const RequestError &err) {
+            // The successor is up and refused the fragment (e.g. it already
+            // holds one of the key), so a hint would only be refused in turn.
+            num_existing += err.response_["ERRORS"].asString() ==
+                            KEY_EXISTS_ERROR;
+            continue;
+        } catch(const std::exception &err) {}
+        missed.push_back(i);
+    }
+
+    // Rather than leave the fragments of unreachable successors for local
+    // maintenance to rebuild (which takes a full read of the block), leave
+    // each with a peer past them, which will hand it off once it can.
+    if(! missed.empty()) {
+        std::vector<RemotePeer> holders = HintHolders(succ_list, missed.size());
+        for(size_t j = 0; j < missed.size() && j < holders.size(); ++j) {
+            int i = missed[j];
+            try {
+                CreateHint(key, val.fragments_.at(i), succ_list.at(i),
+                           holders[j]);
+            } catch(const std::exception &err) {
+                Log("Failed to leave hint for " + std::string(key));
+            }
         }
     }
 
     // If at least 10 peers successfully stored fragments, then the block can
     // be reconstructed by messaging them.
     if(num_replicas < m_) {
-        throw std::runtime_error("Too few succs responded to requests.");
+        throw std::runtime_error(num_existing > 0 ? KEY_EXISTS_ERROR :
+                                 "Too few succs responded to requests.");
     }
 }
 
@@ -139,6 +193,19 @@ bool DHashPeer::CreateKey(const ChordKey &key, const DataFragment &val,
     return create_resp["SUCCESS"].asBool();
 }
 
+Awaitable<bool> DHashPeer::AsyncCreateKey(ChordKey key, DataFragment val,
+                                          RemotePeer peer)
+{
+    Json::Value create_req;
+    create_req["COMMAND"] = "CREATE_KEY";
+    create_req["KEY"] = std::string(key);
+    create_req["VALUE"] = Json::Value(val);
+    Json::Value create_resp = co_await peer.AsyncSendRequest(
+            create_req, std::chrono::steady_clock::now() +
+                        DEFAULT_REQUEST_BUDGET);
+    co_return create_resp["SUCCESS"].asBool();
+}
+
 Json::Value DHashPeer::CreateKeyHandler(const Json::Value &req)
 {
     Json::Value create_resp;
@@ -146,21 +213,194 @@ Json::Value DHashPeer::CreateKeyHandler(const Json::Value &req)
     DataFragment val(req["VALUE"]);
 
     if(db_.Contains(key)) {
-        throw std::runtime_error("Key already exists in db.");
+        // A handed-off fragment only needs us to have some fragment of the
+        // key, so it's no error if we already do.
+        if(req["HANDOFF"].asBool()) {
+            return create_resp;
+        }
+        throw std::runtime_error(KEY_EXISTS_ERROR);
     }
 
     db_.Insert({ key, val });
     return create_resp;
 }
 
+std::vector<RemotePeer> DHashPeer::HintHolders(
+        const std::vector<RemotePeer> &succ_list, size_t num_holders)
+{
+    std::set<ChordKey> succ_ids;
+    for(const RemotePeer &succ : succ_list) {
+        succ_ids.insert(succ.id_);
+    }
+
+    // Some of the peers past the successors may be down too, so look a little
+    // further than we need to.
+    std::vector<RemotePeer> holders;
+    for(const RemotePeer &peer : GetNSuccessors(succ_list.back().id_ + 1,
+                                                2 * num_holders))
+    {
+        if(holders.size() == num_holders) {
+            break;
+        }
+        if(succ_ids.find(peer.id_) == succ_ids.end() &&
+           (peer.id_ == id_ || peer.IsAlive()))
+        {
+            holders.push_back(peer);
+        }
+    }
+    return holders;
+}
+
+void DHashPeer::CreateHint(const ChordKey &key, const DataFragment &val,
+                           const RemotePeer &owner, const RemotePeer &holder)
+{
+    Json::Value hint_req;
+    hint_req["COMMAND"] = "CREATE_HINT";
+    hint_req["KEY"] = std::string(key);
+    hint_req["VALUE"] = Json::Value(val);
+    hint_req["OWNER"] = Json::Value(owner);
+    if(holder.id_ == id_) {
+        CreateHintHandler(hint_req);
+    } else {
+        // The response is empty; SendRequest throws if the hint was refused.
+        (void) holder.SendRequest(hint_req);
+    }
+}
+
+Json::Value DHashPeer::CreateHintHandler(const Json::Value &req)
+{
+    RemotePeer owner(req["OWNER"]);
+    ChordKey key(req["KEY"].asString(), true);
+
+    std::lock_guard<std::mutex> lock(hints_mutex_);
+    auto [it, inserted] = hints_.try_emplace(
+            owner.id_, HintedFragments { owner, {},
+                                         std::chrono::steady_clock::now() });
+    it->second.owner_ = owner;
+    it->second.fragments_.insert_or_assign(key, DataFragment(req["VALUE"]));
+    return Json::Value();
+}
+
+Awaitable<bool> DHashPeer::HandOff(ChordKey key, DataFragment val,
+                                   RemotePeer owner)
+{
+    Json::Value handoff_req;
+    handoff_req["COMMAND"] = "CREATE_KEY";
+    handoff_req["KEY"] = std::string(key);
+    handoff_req["VALUE"] = Json::Value(val);
+    handoff_req["HANDOFF"] = true;
+    try {
+        co_await SendMaintenanceRequest(owner, handoff_req);
+        co_return true;
+    } catch(const std::exception &err) {
+        co_return false;
+    }
+}
+
+void DHashPeer::HandOffHints(bool succs_changed)
+{
+    RunCoroutine(AsyncHandOffHints(succs_changed));
+}
+
+Awaitable<void> DHashPeer::AsyncHandOffHints(bool succs_changed)
+{
+    std::map<ChordKey, HintedFragments> hints;
+    {
+        std::lock_guard<std::mutex> lock(hints_mutex_);
+        if(succs_changed) {
+            for(auto &[owner_id, held] : hints_) {
+                held.redirect_ = true;
+            }
+        }
+        hints = hints_;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    for(const auto &[owner_id, held] : hints) {
+        bool owner_back = co_await held.owner_.AsyncIsAlive();
+        bool expired = now - held.since_ >= HINT_TTL;
+        if(! owner_back && ! held.redirect_ && ! expired) {
+            continue;
+        }
+
+        std::vector<ChordKey> done;
+        for(const auto &[key, frag] : held.fragments_) {
+            bool delivered = false, redundant = false;
+            if(owner_back) {
+                delivered = co_await HandOff(key, frag, held.owner_);
+            } else {
+                // The owner may have been replaced among the key's successors,
+                // in which case whichever successor lacks a fragment of the key
+                // should take ours. If the owner is no longer among them, and
+                // all of them already hold fragments of the key (e.g. local
+                // maintenance rebuilt ours), ours is no longer needed.
+                bool unsettled = false;
+                try {
+                    for(const RemotePeer &succ :
+                            co_await AsyncGetNSuccessors(key, n_))
+                    {
+                        if(succ.id_ == owner_id) {
+                            unsettled = true;
+                            continue;
+                        }
+                        if(succ.id_ == id_) {
+                            delivered = ! db_.Contains(key);
+                            if(delivered) {
+                                db_.Insert({ key, frag });
+                            }
+                        } else {
+                            try {
+                                delivered = co_await AsyncCreateKey(key, frag,
+                                                                    succ);
+                            } catch(const RequestError &err) {
+                                unsettled |= err.response_["ERRORS"]
+                                                     .asString() !=
+                                             KEY_EXISTS_ERROR;
+                            } catch(const std::exception &err) {
+                                unsettled = true;
+                            }
+                        }
+                        if(delivered) {
+                            break;
+                        }
+                    }
+                    redundant = ! delivered && ! unsettled;
+                } catch(const std::exception &err) {}
+            }
+
+            if(delivered || redundant || expired) {
+                done.push_back(key);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(hints_mutex_);
+        auto it = hints_.find(owner_id);
+        if(it == hints_.end()) {
+            continue;
+        }
+        for(const ChordKey &key : done) {
+            it->second.fragments_.erase(key);
+        }
+        if(it->second.fragments_.empty()) {
+            hints_.erase(it);
+        }
+    }
+}
+
 std::string DHashPeer::Read(const std::string &key)
 {
+    // Only the value is wanted, so there's no need to regenerate the
+    // fragments we didn't read, as constructing a DataBlock would.
     ChordKey encoded_key(key, false);
-    DataBlock encoded_value = Read(encoded_key);
-    return encoded_value.Decode();
+    return DataBlock::DecodeFragments(ReadFragments(encoded_key), n_, m_, p_);
 }
 
 DataBlock DHashPeer::Read(const ChordKey &key)
+{
+    return DataBlock(ReadFragments(key), n_, m_, p_);
+}
+
+std::vector<DataFragment> DHashPeer::ReadFragments(const ChordKey &key)
 {
     std::vector<RemotePeer> succ_list = GetNSuccessors(key, num_succs_);
     std::set<DataFragment> fragments;
@@ -192,8 +432,37 @@ DataBlock DHashPeer::Read(const ChordKey &key)
                                  " distinct frags.");
     }
 
-    std::vector<DataFragment> frag_vec(fragments.begin(), fragments.end());
-    return DataBlock(frag_vec, n_, m_, p_);
+    return std::vector<DataFragment>(fragments.begin(), fragments.end());
+}
+
+Awaitable<std::vector<DataFragment>> DHashPeer::AsyncReadFragments(
+        ChordKey key)
+{
+    std::vector<RemotePeer> succ_list = co_await AsyncGetNSuccessors(
+            key, num_succs_);
+    std::set<DataFragment> fragments;
+
+    for(const RemotePeer &succ : succ_list) {
+        if(fragments.size() == m_) {
+            break;
+        }
+
+        if(succ.id_ == id_ && db_.Contains(key)) {
+            fragments.insert(db_.Lookup(key));
+        } else {
+            // As in ReadFragments, a successor without the key is skipped.
+            try {
+                fragments.insert(co_await AsyncReadKey(key, succ));
+            } catch(const std::exception &err) {}
+        }
+    }
+
+    if(fragments.size() < m_) {
+        throw std::runtime_error("Less than " + std::to_string(m_) +
+                                 " distinct frags.");
+    }
+
+    co_return std::vector<DataFragment>(fragments.begin(), fragments.end());
 }
 
 DataFragment DHashPeer::ReadKey(const ChordKey &key, const RemotePeer &peer)
@@ -205,6 +474,17 @@ DataFragment DHashPeer::ReadKey(const ChordKey &key, const RemotePeer &peer)
     return DataFragment(read_resp["VALUE"]);
 }
 
+Awaitable<DataFragment> DHashPeer::AsyncReadKey(ChordKey key, RemotePeer peer)
+{
+    Json::Value read_req;
+    read_req["COMMAND"] = "READ_KEY";
+    read_req["KEY"] = std::string(key);
+    Json::Value read_resp = co_await peer.AsyncSendRequest(
+            read_req, std::chrono::steady_clock::now() +
+                      DEFAULT_REQUEST_BUDGET);
+    co_return DataFragment(read_resp["VALUE"]);
+}
+
 Json::Value DHashPeer::ReadKeyHandler(const Json::Value &req)
 {
     Json::Value read_resp;
@@ -216,21 +496,22 @@ Json::Value DHashPeer::ReadKeyHandler(const Json::Value &req)
     return read_resp;
 }
 
-DHashPeer::KvMap DHashPeer::ReadRange(const RemotePeer &succ,
-                                      const KeyRange &key_range)
+Awaitable<DHashPeer::KvMap> DHashPeer::ReadRange(RemotePeer succ,
+                                                 KeyRange key_range)
 {
-    Json::Value read_range_req, read_range_resp;
+    Json::Value read_range_req;
     read_range_req["COMMAND"] = "READ_RANGE";
     read_range_req["LOWER_BOUND"] = std::string(key_range.first);
     read_range_req["UPPER_BOUND"] = std::string(key_range.second);
-    read_range_resp = succ.SendRequest(read_range_req);
+    Json::Value read_range_resp = co_await SendMaintenanceRequest(
+            succ, read_range_req);
 
     KvMap ret_val;
     for(const auto &kv_pair : read_range_resp["KV_PAIRS"]) {
         ret_val.insert({ ChordKey(kv_pair["KEY"].asString(), true),
                          DataFragment(kv_pair["VAL"]) });
     }
-    return ret_val;
+    co_return ret_val;
 }
 
 Json::Value DHashPeer::ReadRangeHandler(const Json::Value &request)
@@ -239,6 +520,21 @@ Json::Value DHashPeer::ReadRangeHandler(const Json::Value &request)
     ChordKey lower_bound(request["LOWER_BOUND"].asString(), true),
              upper_bound(request["UPPER_BOUND"].asString(), true);
 
+    // Scans read the range a page at a time. As in ChordPeer, read one pair
+    // more than asked for, to find out if there are more.
+    if(request.isMember("LIMIT")) {
+        size_t limit = request["LIMIT"].asUInt64();
+        std::vector<FragmentDb::KeyValPair> kv_pairs =
+                db_.ReadRange(lower_bound, upper_bound, limit + 1);
+        read_range_resp["MORE"] = kv_pairs.size() > limit;
+        read_range_resp["KV_PAIRS"] = Json::arrayValue;
+        for(size_t i = 0; i < kv_pairs.size() && i < limit; ++i) {
+            key_frag_pair["KEY"] = std::string(kv_pairs[i].first);
+            key_frag_pair["VAL"] = Json::Value(kv_pairs[i].second);
+            read_range_resp["KV_PAIRS"].append(key_frag_pair);
+        }
+        return read_range_resp;
+    }
 
     for(const auto &[key, val] : db_.ReadRange(lower_bound, upper_bound)) {
         key_frag_pair["KEY"] = std::string(key);
@@ -252,6 +548,123 @@ Json::Value DHashPeer::ReadRangeHandler(const Json::Value &request)
     return read_range_resp;
 }
 
+Awaitable<Json::Value> DHashPeer::ReadSlice(RemotePeer owner,
+                                            ChordKey lower_bound,
+                                            ChordKey upper_bound, size_t limit)
+{
+    Deadline deadline = std::chrono::steady_clock::now() +
+                        DEFAULT_REQUEST_BUDGET;
+    Json::Value read_range_req, slice;
+    read_range_req["COMMAND"] = "READ_RANGE";
+    read_range_req["LOWER_BOUND"] = std::string(lower_bound);
+    read_range_req["UPPER_BOUND"] = std::string(upper_bound);
+    read_range_req["LIMIT"] = (Json::UInt64) limit;
+    Json::Value owner_resp = co_await owner.AsyncSendRequest(read_range_req,
+                                                             deadline);
+
+    // The owner's fragments determine which keys are in this page of the
+    // slice.
+    std::map<ChordKey, std::set<DataFragment>> fragments;
+    for(const auto &kv_pair : owner_resp["KV_PAIRS"]) {
+        fragments[ChordKey(kv_pair["KEY"].asString(), true)].insert(
+                DataFragment(kv_pair["VAL"]));
+    }
+
+    slice["MORE"] = owner_resp["MORE"];
+    slice["KV_PAIRS"] = Json::arrayValue;
+    if(fragments.empty()) {
+        co_return slice;
+    }
+
+    // The remaining fragments of each block are held by the peers which
+    // follow the owner, so read the same page from as many of them as we
+    // still need fragments from, in parallel, until every block can be
+    // decoded or we run out of successors. A replica's page is bounded by
+    // the last key of the owner's, not by the limit: a replica may hold keys
+    // the owner lacks, and a limit would cut its page short of the keys we
+    // need.
+    read_range_req["UPPER_BOUND"] = owner_resp["KV_PAIRS"][
+            owner_resp["KV_PAIRS"].size() - 1]["KEY"];
+    read_range_req.removeMember("LIMIT");
+    RemotePeer replica = owner;
+    int num_replicas_read = 0;
+    size_t num_frags_needed = m_;
+    while(num_replicas_read < num_succs_ - 1) {
+        size_t fewest_frags = num_frags_needed;
+        for(const auto &[key, key_frags] : fragments) {
+            fewest_frags = std::min(fewest_frags, key_frags.size());
+        }
+        if(fewest_frags == num_frags_needed) {
+            break;
+        }
+
+        std::vector<Awaitable<Json::Value>> reads;
+        for(size_t i = fewest_frags;
+            i < num_frags_needed && num_replicas_read < num_succs_ - 1;
+            ++i, ++num_replicas_read)
+        {
+            // A replica which can't name its successor (e.g. because it, or
+            // the successor, has failed) is skipped, by taking its successor
+            // from our membership view, or else from our own routing.
+            std::optional<RemotePeer> next_replica;
+            try {
+                next_replica = co_await LookupSuccessor(replica,
+                                                        replica.id_ + 1);
+            } catch(const std::exception &e) {
+                Log("Skipping replica " + std::string(replica.id_) + ": " +
+                    e.what());
+            }
+            if(! next_replica.has_value()) {
+                auto view_succs = ViewNSuccessors(replica.id_ + 1, 1);
+                if(view_succs.has_value()) {
+                    next_replica = view_succs->front();
+                }
+            }
+            if(! next_replica.has_value()) {
+                try {
+                    next_replica = co_await AsyncGetSuccessor(replica.id_ + 1,
+                                                              deadline);
+                } catch(const std::exception &) {
+                    num_replicas_read = num_succs_;
+                    break;
+                }
+            }
+            replica = *next_replica;
+            if(replica.id_ == owner.id_) {
+                num_replicas_read = num_succs_;
+                break;
+            }
+            reads.push_back(replica.AsyncSendRequest(read_range_req, deadline));
+        }
+
+        for(const auto &resp : co_await WhenAll(std::move(reads))) {
+            if(! resp.has_value()) {
+                continue;
+            }
+            for(const auto &kv_pair : (*resp)["KV_PAIRS"]) {
+                auto key_frags = fragments.find(
+                        ChordKey(kv_pair["KEY"].asString(), true));
+                if(key_frags != fragments.end()) {
+                    key_frags->second.insert(DataFragment(kv_pair["VAL"]));
+                }
+            }
+        }
+    }
+
+    Json::Value kv_pair;
+    for(const auto &[key, key_frags] : fragments) {
+        if(key_frags.size() < num_frags_needed) {
+            throw std::runtime_error("Less than " + std::to_string(m_) +
+                                     " distinct frags of " + std::string(key));
+        }
+        std::vector<DataFragment> frag_vec(key_frags.begin(), key_frags.end());
+        kv_pair["KEY"] = std::string(key);
+        kv_pair["VAL"] = DataBlock::DecodeFragments(frag_vec, n_, m_, p_);
+        slice["KV_PAIRS"].append(kv_pair);
+    }
+    co_return slice;
+}
+
 
 /* ----------------------------------------------------------------------------
  * MAINTENANCE FUNCTIONS: Implement member functions which ensure that lookups,
@@ -270,56 +683,98 @@ void DHashPeer::StartMaintenance()
 
 void DHashPeer::MaintenanceLoop()
 {
+    std::future<void> round;
     auto timestamp = std::chrono::high_resolution_clock::now();
     while(continue_maintenance_) {
+        // This method of sleeping has several appealing properties. Since we
+        // check every 10ms whether the round has ended, or 5 seconds have
+        // passed since it did, this means that, when the destructor is
+        // called, it will terminate within 10ms of the round in progress.
+        // This means we don't have to detach threads.
         try {
-            // This method of sleeping has several appealing properties. Since we
-            // check to see if 5 seconds have elapsed every 10ms and otherwise
-            // continue, this means that, when the destructor is called, it will
-            // terminate within 10ms. This means we don't have to detach threads.
-            auto now = std::chrono::high_resolution_clock::now();
-            if (now - timestamp < 5s) {
-                std::this_thread::sleep_for(10ms);
-                continue;
+            FlushGossip(false);
+            if(round.valid() &&
+               round.wait_for(0s) == std::future_status::ready)
+            {
+                timestamp = std::chrono::high_resolution_clock::now();
+                round.get();
             }
-
-            Stabilize();
-            RunGlobalMaintenance();
-            RunLocalMaintenance();
-            timestamp = std::chrono::high_resolution_clock::now();
         } catch(const std::exception &ex) {
             Log("Continuing");
-            timestamp = std::chrono::high_resolution_clock::now();
-            continue;
         }
+
+        auto now = std::chrono::high_resolution_clock::now();
+        if(! round.valid() && now - timestamp >= 5s) {
+            round = boost::asio::co_spawn(
+                    boost::asio::make_strand(MaintenanceExecutor()),
+                    MaintenanceRound(), boost::asio::use_future);
+        }
+        std::this_thread::sleep_for(10ms);
+    }
+
+    // The round in progress, if any, still uses us.
+    if(round.valid()) {
+        round.wait();
+    }
+}
+
+Awaitable<void> DHashPeer::MaintenanceRound()
+{
+    co_await AsyncStabilize();
+    bool succs_changed = RecordSuccListChanges();
+    co_await AsyncHandOffHints(succs_changed);
+    if(std::chrono::steady_clock::now() - last_full_sweep_ >=
+       FULL_SWEEP_INTERVAL)
+    {
+        co_await AsyncRunGlobalMaintenance();
+    } else {
+        co_await RunDirtyMaintenance();
     }
+    co_await RunLocalMaintenance();
 }
 
 void DHashPeer::RunGlobalMaintenance()
 {
-    Log("running global maintenance");
-    ChordKey current_key = id_, previous_key, starting_key;
+    RunCoroutine(AsyncRunGlobalMaintenance());
+}
+
+void DHashPeer::RunGlobalMaintenance(const KeyRange &key_range)
+{
+    RunCoroutine(AsyncRunGlobalMaintenance(key_range));
+}
 
-    if(db_.Next(id_).has_value()) {
-        starting_key = db_.Next(id_)->first;
+Awaitable<void> DHashPeer::AsyncRunGlobalMaintenance()
+{
+    // Whatever changes were pending, this covers them too.
+    {
+        std::lock_guard<std::mutex> lock(membership_mutex_);
+        membership_changes_.clear();
     }
+    last_full_sweep_ = std::chrono::steady_clock::now();
 
-    bool first_iter = true;
-    while(db_.Next(current_key).has_value()) {
-        KvPair next = db_.Next(current_key).value();
+    // Start just past our own ID, so that the keys we own come last.
+    co_await AsyncRunGlobalMaintenance({ id_ + 1, id_ });
+}
 
-        bool first_iteration = current_key == id_;
-        // Next key will always be starting key on first iteration, so we have
-        // to prevent the loop from breaking immediately.
-        bool loop_around = next.first.InBetween(id_, starting_key, true);
-        if(loop_around && ! first_iter) {
+Awaitable<void> DHashPeer::AsyncRunGlobalMaintenance(KeyRange key_range)
+{
+    Log("running global maintenance");
+    ChordKey cursor = key_range.first - 1;
+
+    while(true) {
+        // Only look past the cursor, so that we stop rather than wrap around
+        // to keys we've already checked.
+        std::optional<KvPair> next = db_.Next(cursor);
+        if(! next.has_value() ||
+           ! next->first.InBetween(cursor + 1, key_range.second))
+        {
             break;
         }
-        first_iter = false;
 
         // If this peer's id is contained within the n_ successors of the key
         // in question, then it should possess the key.
-        std::vector<RemotePeer> succs = GetNSuccessors(next.first, n_);
+        std::vector<RemotePeer> succs = co_await AsyncGetNSuccessors(
+                next->first, n_);
         bool key_is_misplaced = true;
         for(int i = 0; i < succs.size(); ++i) {
             if(succs.at(i).id_ == id_) {
@@ -329,45 +784,115 @@ void DHashPeer::RunGlobalMaintenance()
 
         if(key_is_misplaced) {
             for(auto &succ : succs) {
-                KvMap resp = ReadRange(succ, { next.first, succs.at(0).id_ }),
-                      keys_in_range = db_.ReadRange(next.first, succs.at(0).id_);
+                KvMap resp = co_await ReadRange(succ, { next->first,
+                                                        succs.at(0).id_ });
+                KvMap keys_in_range = db_.ReadRange(next->first,
+                                                    succs.at(0).id_);
 
                 for(const auto &[key, frag] : keys_in_range) {
                     if(resp.find(key) == resp.end()) {
-                        CreateKey(key, frag, succ);
+                        co_await AsyncCreateKey(key, frag, succ);
                         db_.Delete(key);
                     }
                 }
             }
         }
 
-        current_key = succs.at(0).id_;
-        previous_key = next.first;
+        // Every key up to the key's successor has the same successors, so
+        // we can skip straight past it, unless that takes us past the range.
+        ChordKey succ_id = succs.at(0).id_;
+        if(succ_id == key_range.second ||
+           ! succ_id.InBetween(next->first, key_range.second))
+        {
+            break;
+        }
+        cursor = succ_id;
     }
     Log("Global maintenance over");
 }
 
-void DHashPeer::RunLocalMaintenance()
+Awaitable<void> DHashPeer::RunDirtyMaintenance()
+{
+    std::set<ChordKey> changes;
+    {
+        std::lock_guard<std::mutex> lock(membership_mutex_);
+        changes = membership_changes_;
+    }
+
+    for(const ChordKey &peer_id : changes) {
+        co_await AsyncRunGlobalMaintenance(co_await DirtyRange(peer_id));
+
+        std::lock_guard<std::mutex> lock(membership_mutex_);
+        membership_changes_.erase(peer_id);
+    }
+}
+
+void DHashPeer::RecordMembershipChange(const ChordKey &peer_id)
+{
+    if(peer_id == id_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(membership_mutex_);
+    membership_changes_.insert(peer_id);
+}
+
+bool DHashPeer::RecordSuccListChanges()
+{
+    std::set<ChordKey> succ_ids;
+    for(const RemotePeer &succ : successors_.GetEntries()) {
+        succ_ids.insert(succ.id_);
+    }
+
+    std::vector<ChordKey> changed;
+    std::set_symmetric_difference(succ_ids.begin(), succ_ids.end(),
+                                  last_succ_ids_.begin(),
+                                  last_succ_ids_.end(),
+                                  std::back_inserter(changed));
+    for(const ChordKey &peer_id : changed) {
+        RecordMembershipChange(peer_id);
+    }
+    last_succ_ids_ = std::move(succ_ids);
+    return ! changed.empty();
+}
+
+Awaitable<DHashPeer::KeyRange> DHashPeer::DirtyRange(ChordKey peer_id)
+{
+    // A key's placement depends on its n_ successors, so a peer joining or
+    // leaving only affects the keys it is (or was) one of those for.
+    std::vector<RemotePeer> preds = co_await AsyncGetNPredecessors(peer_id, n_);
+    for(const RemotePeer &pred : preds) {
+        if(pred.id_ == peer_id) {
+            co_return KeyRange { peer_id + 1, peer_id };
+        }
+    }
+    if(preds.size() < n_) {
+        co_return KeyRange { peer_id + 1, peer_id };
+    }
+    co_return KeyRange { preds.back().id_ + 1, peer_id };
+}
+
+Awaitable<void> DHashPeer::RunLocalMaintenance()
 {
     Log("Running local maintenance");
     if(db_.Size() == 0) {
         Log("Size is 0.");
-        return;
+        co_return;
     }
 
     for(int i = 0; i < successors_.Size(); ++i) {
         if(successors_.GetNthEntry(i).id_ != id_) {
-            Synchronize(successors_.GetNthEntry(i), { min_key_.Get(), id_ });
+            co_await AsyncSynchronize(successors_.GetNthEntry(i),
+                                      { min_key_.Get(), id_ });
         }
     }
 
     Log("Local maintenance over");
 }
 
-void DHashPeer::RetrieveMissing(const ChordKey &key)
+Awaitable<void> DHashPeer::RetrieveMissing(ChordKey key)
 {
     Log("Retrieving " + std::string(key));
-    DataBlock block = Read(key);
+    DataBlock block(co_await AsyncReadFragments(key), n_, m_, p_);
     std::vector<DataFragment> random_els;
     std::sample(block.fragments_.begin(),
                 block.fragments_.end(),
@@ -380,16 +905,21 @@ void DHashPeer::RetrieveMissing(const ChordKey &key)
 
 void DHashPeer::Synchronize(const RemotePeer &succ, const KeyRange &key_range)
 {
-    SynchronizeHelper(succ, key_range, db_.GetIndex());
+    RunCoroutine(AsyncSynchronize(succ, key_range));
+}
+
+Awaitable<void> DHashPeer::AsyncSynchronize(RemotePeer succ, KeyRange key_range)
+{
+    co_await SynchronizeHelper(succ, key_range, db_.GetIndex());
 }
 
-void DHashPeer::SynchronizeHelper(const RemotePeer &succ,
-                                  const KeyRange &key_range,
-                                  const MerkleTree<DataFragment> &local_node)
+Awaitable<void> DHashPeer::SynchronizeHelper(RemotePeer succ,
+                                             KeyRange key_range,
+                                             const DbEntry &local_node)
 {
-    ChordKey lower_bound = key_range.first, upper_bound = key_range.second;
-    DbEntry remote_node = ExchangeNode(succ, local_node, key_range);
-    CompareNodes(remote_node, local_node, succ, key_range);
+    DbEntry remote_node = co_await AsyncExchangeNode(succ, local_node,
+                                                     key_range);
+    co_await CompareNodes(remote_node, local_node, succ, key_range);
 
     if(! remote_node.IsLeaf() && ! local_node.IsLeaf()) {
         for(int i = 0; i < MerkleTree<std::string>::GetNumChildren(); ++i) {
@@ -397,7 +927,8 @@ void DHashPeer::SynchronizeHelper(const RemotePeer &succ,
                                         local_node.GetNthChild(i),
                                         key_range);
             if(needs_sync) {
-                SynchronizeHelper(succ, key_range, local_node.GetNthChild(i));
+                co_await SynchronizeHelper(succ, key_range,
+                                           local_node.GetNthChild(i));
             }
         }
     }
@@ -413,15 +944,14 @@ bool DHashPeer::NeedsSync(const DbEntry &remote_node, const DbEntry &local_node,
 }
 
 
-void DHashPeer::CompareNodes(const DbEntry &remote_node,
-                             const DbEntry &local_node,
-                             const RemotePeer &succ,
-                             const KeyRange &key_range)
+Awaitable<void> DHashPeer::CompareNodes(const DbEntry &remote_node,
+                                        const DbEntry &local_node,
+                                        RemotePeer succ, KeyRange key_range)
 {
     if(remote_node.IsLeaf()) {
         for(const auto &[k, _] : remote_node.GetEntries()) {
             if(IsMissing(k, key_range)) {
-                RetrieveMissing(k);
+                co_await RetrieveMissing(k);
             }
         }
     }
@@ -432,10 +962,10 @@ void DHashPeer::CompareNodes(const DbEntry &remote_node,
     // In this case, a node should simply request all keys the synchronizing
     // node possesses within the given range and insert them into its tree.
     else if(local_node.IsLeaf()) {
-        KvMap succ_kvs = ReadRange(succ, local_node.GetRange());
+        KvMap succ_kvs = co_await ReadRange(succ, local_node.GetRange());
 
         for(const auto &[k, _] : succ_kvs) {
-            RetrieveMissing(k);
+            co_await RetrieveMissing(k);
         }
     }
 }
@@ -449,6 +979,12 @@ bool DHashPeer::IsMissing(const ChordKey &k, const KeyRange &key_range)
 DHashPeer::DbEntry DHashPeer::ExchangeNode(const RemotePeer &succ,
                                            const DbEntry &node,
                                            const KeyRange &key_range)
+{
+    return RunCoroutine(AsyncExchangeNode(succ, node, key_range));
+}
+
+Awaitable<DHashPeer::DbEntry> DHashPeer::AsyncExchangeNode(
+        RemotePeer succ, const DbEntry &node, KeyRange key_range)
 {
     Json::Value exchange_req;
     exchange_req["COMMAND"] = "XCHNG_NODE";
@@ -458,9 +994,9 @@ DHashPeer::DbEntry DHashPeer::ExchangeNode(const RemotePeer &succ,
     exchange_req["LOWER_BOUND"] = std::string(key_range.first);
     exchange_req["UPPER_BOUND"] = std::string(key_range.second);
 
-    Json::Value resp = succ.SendRequest(exchange_req);
+    Json::Value resp = co_await SendMaintenanceRequest(succ, exchange_req);
 
-    return DbEntry(resp);
+    co_return DbEntry(resp);
 }
 
 Json::Value DHashPeer::ExchangeNodeHandler(const Json::Value &request)
@@ -473,13 +1009,36 @@ Json::Value DHashPeer::ExchangeNodeHandler(const Json::Value &request)
     KeyRange key_range = { ChordKey(request["LOWER_BOUND"].asString(), true),
                            ChordKey(request["UPPER_BOUND"].asString(), true) };
 
+    // XCHNG_NODE is maintenance traffic, so this runs on one of our server's
+    // maintenance threads, which may wait on the comparison's reads.
     Log("Comparing nodes");
-    CompareNodes(remote_node, local_node.value(), requesting_node, key_range);
+    RunCoroutine(CompareNodes(remote_node, local_node.value(), requesting_node,
+                              key_range));
     Log("Nodes compared");
 
     return local_node->NonRecursiveSerialize(true);
 }
 
+Awaitable<Json::Value> DHashPeer::SendMaintenanceRequest(RemotePeer peer,
+                                                         Json::Value request)
+{
+    // Let the peer's server run this on its maintenance lane, so that it
+    // doesn't hold up any foreground requests there.
+    request["CLASS"] = "MAINTENANCE";
+
+    co_await maintenance_slots_->Acquire();
+    try {
+        Json::Value resp = co_await peer.AsyncSendRequest(
+                request, std::chrono::steady_clock::now() +
+                         DEFAULT_REQUEST_BUDGET);
+        maintenance_slots_->Release();
+        co_return resp;
+    } catch(...) {
+        maintenance_slots_->Release();
+        throw;
+    }
+}
+
 /* ----------------------------------------------------------------------------
  * MISC: Anything else. Mostly implementing pure virtual methods from the base
  *       class.
@@ -498,7 +1057,8 @@ void DHashPeer::SetIdaParams(int n, int m, int p)
 }
 
 Json::Value DHashPeer::ForwardRequest(const ChordKey &key,
-                                      const Json::Value &request)
+                                      const Json::Value &request,
+                                      const Deadline &deadline)
 {
     // Get closest preceding node of key in finger table, forward request
     // to it.
@@ -510,22 +1070,23 @@ Json::Value DHashPeer::ForwardRequest(const ChordKey &key,
         key_succ = predecessor_.Get();
     }
 
-        // If, for whatever reason, the successor selected so far is not alive,
-        // then we need to select another one, preferably from our successors list
-        // but possibly just by defaulting to our predecessor.
-    else if(! key_succ.IsAlive()) {
+        // If, for whatever reason, the successor selected so far is not alive
+        // (or keeps failing to answer, tripping its circuit breaker), then we
+        // need to select another one, preferably from our successors list but
+        // possibly just by defaulting to our predecessor.
+    else if(! key_succ.IsAvailable()) {
         std::optional<RemotePeer> succ_lookup = successors_.LookupLiving(key);
 
         if(succ_lookup.has_value()) {
             key_succ = succ_lookup.value();
-        } else if(successors_.GetNthEntry(0).IsAlive()) {
+        } else if(successors_.GetNthEntry(0).IsAvailable()) {
             key_succ = successors_.GetNthEntry(0);
         } else {
             throw std::runtime_error("Lookup failed");
         }
     }
 
-    return key_succ.SendRequest(request);
+    return SendForwardedRequest(key_succ, key, request, deadline);
 }
 
 Json::Value DHashPeer::HandleNotifyFromPred(const RemotePeer &new_pred)
@@ -535,6 +1096,7 @@ Json::Value DHashPeer::HandleNotifyFromPred(const RemotePeer &new_pred)
     // Update any finger tables which should now point to new peer.
     finger_table_.AdjustFingers(new_pred);
     predecessor_.Set(new_pred);
+    RecordMembershipChange(new_pred.id_);
     min_key_.Set(predecessor_.Get().id_ + 1);
 
     if(successors_.Size() == 0) {
@@ -553,6 +1115,17 @@ void DHashPeer::Fail()
     continue_maintenance_ = false;
 }
 
+void DHashPeer::StartRequestCapture(const std::string &path,
+                                    TraceFilter filter)
+{
+    server_->StartRequestCapture(path, std::move(filter));
+}
+
+void DHashPeer::StopRequestCapture()
+{
+    server_->StopRequestCapture();
+}
+
 void DHashPeer::AbsorbKeys(const Json::Value &kv_pairs)
 {
     // This is a pure virtual function which gets called in the join handler
@@ -570,9 +1143,11 @@ Json::Value DHashPeer::KeysAsJson()
 }
 
 
-void DHashPeer::HandlePredFailure(const RemotePeer &old_pred)
+Awaitable<void> DHashPeer::HandlePredFailure(RemotePeer old_pred)
 {
+    RecordMembershipChange(old_pred.id_);
+
     // Adjust our finger table to account for that fact.
     finger_table_.AdjustFingers(ToRemotePeer());
-    Rectify(predecessor_.Get());
+    co_await Rectify(old_pred);
 }
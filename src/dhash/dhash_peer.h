@@ -10,9 +10,15 @@
 #define CHORD_AND_DHASH_DHASH_PEER_H
 
 #include <gtest/gtest.h>
+#include <mutex>
+#include <set>
 #include "../chord/abstract_chord_peer.h"
 #include "../networking/server.h"
 
+/// Error with which a peer refuses to store a fragment of a key it already
+/// holds one of, so that whoever sent it can tell it apart from a failure.
+static const std::string KEY_EXISTS_ERROR = "Key already exists in db.";
+
 /**
  * See Josh Cates' thesis:
  * https://pdos.csail.mit.edu/papers/chord:cates-meng.pdf
@@ -66,6 +72,20 @@ public:
      */
     void Fail() override;
 
+    /**
+     * Start appending the requests this peer receives to a trace file.
+     * @param path Path of the trace file.
+     * @param filter Which requests to capture. By default, only those which
+     *               clients send.
+     */
+    void StartRequestCapture(const std::string &path,
+                             TraceFilter filter = { CLIENT_COMMANDS }) override;
+
+    /**
+     * Stop capturing requests, flushing the trace file.
+     */
+    void StopRequestCapture() override;
+
     /**
      * Get parameters of information dispersal algorithm.
      * @return (n, m, p)
@@ -112,6 +132,12 @@ protected:
     bool CreateKey(const ChordKey &key, const DataFragment &val,
                    const RemotePeer &peer);
 
+    /**
+     * Awaitable version of CreateKey, for use from maintenance coroutines.
+     */
+    Awaitable<bool> AsyncCreateKey(ChordKey key, DataFragment val,
+                                   RemotePeer peer);
+
     /**
      * When instructed by a remote peer to hold a key, insert it in our database
      * and return a response indicating success/failure.
@@ -121,15 +147,89 @@ protected:
      */
     Json::Value CreateKeyHandler(const Json::Value &req);
 
+    /**
+     * Choose the peers which will hold the fragments of successors that were
+     * down when a block was created: the first live peers past the last of the
+     * block's successors.
+     * @param succ_list The key's successors, as found by Create.
+     * @param num_holders Number of holders wanted.
+     * @return Up to num_holders live peers, none of which are in succ_list.
+     */
+    std::vector<RemotePeer> HintHolders(const std::vector<RemotePeer> &succ_list,
+                                        size_t num_holders);
+
+    /**
+     * Instruct a peer to hold a fragment on behalf of the successor which
+     * should store it, until it can be handed off.
+     * @param key Key of the fragment.
+     * @param val The fragment.
+     * @param owner The successor which should store the fragment.
+     * @param holder The peer which will hold the fragment until then.
+     */
+    void CreateHint(const ChordKey &key, const DataFragment &val,
+                    const RemotePeer &owner, const RemotePeer &holder);
+
+    /**
+     * Hold the fragment in the request for its owner. Hinted fragments are
+     * kept apart from db_, as they aren't ours to serve or synchronize.
+     * @param req Request giving the KEY, VALUE, and OWNER of a fragment.
+     * @return Empty response indicating success.
+     */
+    Json::Value CreateHintHandler(const Json::Value &req);
+
+    /**
+     * Hand off the fragments we hold for other peers. Those whose owners are
+     * alive again are sent to them. Once our successor list has changed, the
+     * owners of the rest may have been replaced, so those are offered to the
+     * current successors of their keys instead, every round until taken (or
+     * until all of those successors hold fragments of their keys anyway).
+     * Fragments held for longer than HINT_TTL are dropped, since local
+     * maintenance will have rebuilt them.
+     * @param succs_changed Has our successor list changed since last round?
+     */
+    Awaitable<void> AsyncHandOffHints(bool succs_changed);
+
+    /**
+     * Run AsyncHandOffHints to completion, blocking the calling thread.
+     * @param succs_changed Has our successor list changed since last round?
+     */
+    void HandOffHints(bool succs_changed);
+
+    /**
+     * Send a hinted fragment to its owner. Unlike CREATE_KEY, this succeeds
+     * if the owner already has a fragment of the key (e.g. from an earlier
+     * handoff whose response was lost).
+     * @param key Key of the fragment.
+     * @param val The fragment.
+     * @param owner Peer which should store the fragment.
+     * @return true if the owner now has a fragment of the key.
+     */
+    Awaitable<bool> HandOff(ChordKey key, DataFragment val, RemotePeer owner);
+
     /**
      * Find the num_succs_ successors of the key in the network, query each for
-     * its fragment of the given key, and reconstruct the original data block.
+     * its fragment of the given key, and reconstruct the original data block
+     * (including all n_ of its fragments).
      * @param key Key to find in network.
      * @return The decoded value or throw an error if less than 10 fragments
      *         exist on the num_succs_ successors of the key.
      */
     DataBlock Read(const ChordKey &key);
 
+    /**
+     * Find the num_succs_ successors of the key in the network, and query
+     * them for their fragments of the given key until m_ have been found.
+     * @param key Key to find in network.
+     * @return m_ distinct fragments of the key's block, or throw an error if
+     *         less than m_ exist on the num_succs_ successors of the key.
+     */
+    std::vector<DataFragment> ReadFragments(const ChordKey &key);
+
+    /**
+     * Awaitable version of ReadFragments, for use from maintenance coroutines.
+     */
+    Awaitable<std::vector<DataFragment>> AsyncReadFragments(ChordKey key);
+
     /**
      * Contact a remote peer and instruct it to return the data fragment assoc-
      * iated with a given key.
@@ -140,6 +240,11 @@ protected:
      */
     DataFragment ReadKey(const ChordKey &key, const RemotePeer &peer);
 
+    /**
+     * Awaitable version of ReadKey, for use from maintenance coroutines.
+     */
+    Awaitable<DataFragment> AsyncReadKey(ChordKey key, RemotePeer peer);
+
     /**
      * When instructed by a remote peer to return the value of a given key,
      * return its value in a JSON response if it exists in our database,
@@ -158,16 +263,28 @@ protected:
      *                  tree.
      * @return A map of k => v pairs from the successor.
      */
-    static KvMap ReadRange(const RemotePeer &succ, const KeyRange &key_range);
+    Awaitable<KvMap> ReadRange(RemotePeer succ, KeyRange key_range);
 
     /**
      * Given a READ_RANGE request, find all trees stored in our merkle tree
      * within the specified range, and return them.
+     * If the request has a LIMIT, return only that many fragments, in ring
+     * order, setting MORE if the range holds further fragments.
      * @param request The request to read a certain range of keys from our index.
      * @return A JSON response of form { "[KEY]" : "[SERIALIZED_DATA_FRAG]" }.
      */
     Json::Value ReadRangeHandler(const Json::Value &request);
 
+    /**
+     * Read a page of the owner's slice of a scan (see
+     * AbstractChordPeer::ReadSlice). The owner gives the keys in the page, and
+     * the rest of each key's fragments are read from the peers which follow
+     * it, so that each block can be decoded.
+     */
+    Awaitable<Json::Value> ReadSlice(RemotePeer owner, ChordKey lower_bound,
+                                     ChordKey upper_bound,
+                                     size_t limit) override;
+
     /**
      * Upon receiving a notify from the predecessor. This works the same as in
      * ChordPeer - the peer sets its min_key_ to the predecessor's ID + 1 and
@@ -184,7 +301,7 @@ protected:
      * Call rectify, set new pred.
      * @param old_pred The failed predecessor.
      */
-    void HandlePredFailure(const RemotePeer &old_pred) override;
+    Awaitable<void> HandlePredFailure(RemotePeer old_pred) override;
 
     /**
      * Start a thread to periodically run local maintenance, global maintenance,
@@ -193,12 +310,21 @@ protected:
     void StartMaintenance() override;
 
     /**
-     * A loop which runs local maintenance, global maintenance, and the
-     * stabilize protocol on a 5-second interval for as long as
-     * continue_maintenance_ is set to true.
+     * A loop which runs a MaintenanceRound on a 5-second interval for as long
+     * as continue_maintenance_ is set to true. Each round runs as one
+     * coroutine on the maintenance executor, so that its RPCs hold no thread
+     * of ours; this thread only flushes gossip and starts the next round.
      */
     void MaintenanceLoop();
 
+    /**
+     * Run the stabilize protocol, hand off hints, and run global and local
+     * maintenance. Global maintenance only covers the ranges dirtied by
+     * membership changes since the last round, except every
+     * FULL_SWEEP_INTERVAL, when it sweeps the whole database.
+     */
+    Awaitable<void> MaintenanceRound();
+
     /**
      * Protocol to push misplaced fragments to their correct nodes. Iterate
      * through the database, find any fragments which this peer possesses but
@@ -206,8 +332,59 @@ protected:
      * of the given key), and push them to a successor of the key which does
      * not have the key in question.
      */
+    Awaitable<void> AsyncRunGlobalMaintenance();
+
+    /**
+     * As above, but only for the keys we store within key_range, so that the
+     * cost is proportional to the number of peers in the range rather than
+     * to the size of our database.
+     * @param key_range Range of keys (inclusive, on the ring) to check.
+     */
+    Awaitable<void> AsyncRunGlobalMaintenance(KeyRange key_range);
+
+    /**
+     * Run AsyncRunGlobalMaintenance to completion, blocking the calling
+     * thread.
+     */
     void RunGlobalMaintenance();
 
+    /**
+     * Run AsyncRunGlobalMaintenance(key_range) to completion, blocking the
+     * calling thread.
+     * @param key_range Range of keys (inclusive, on the ring) to check.
+     */
+    void RunGlobalMaintenance(const KeyRange &key_range);
+
+    /**
+     * Run global maintenance over the dirty range of each membership change
+     * recorded since the last round. A change is only forgotten once its
+     * range has been checked, so changes survive failed rounds.
+     */
+    Awaitable<void> RunDirtyMaintenance();
+
+    /**
+     * Note that the peer with the given ID has joined or left the ring, so
+     * that the keys whose successors it affects are checked by the next round
+     * of global maintenance.
+     * @param peer_id ID of the peer which joined or left.
+     */
+    void RecordMembershipChange(const ChordKey &peer_id);
+
+    /**
+     * Record a membership change for each peer which has entered or left our
+     * successor list since the last time this was called.
+     * @return Did our successor list change?
+     */
+    bool RecordSuccListChanges();
+
+    /**
+     * Keys whose n_ successors include peer_id, i.e. (pred_n(peer_id),
+     * peer_id], or the whole ring if it has too few peers to tell.
+     * @param peer_id ID of a peer which joined or left.
+     * @return The range of keys whose placement the change may have affected.
+     */
+    Awaitable<KeyRange> DirtyRange(ChordKey peer_id);
+
     /**
      * Protocol to ensure that all successors of this peer store replicas of
      * the keys owned by this peer. Compare our database index (a merkle tree)
@@ -215,7 +392,7 @@ protected:
      * for which equivalently-placed hashes do not match. This will allow this
      * node to synchronize a certain range of keys with a successor.
      */
-    void RunLocalMaintenance();
+    Awaitable<void> RunLocalMaintenance();
 
     /**
      * Ensure that succ stores all of the keys that we store inside key range
@@ -223,6 +400,13 @@ protected:
      * @param succ Successor with which we are synchronizing key_range.
      * @param key_range The range of keys to synchronize with succ.
      */
+    Awaitable<void> AsyncSynchronize(RemotePeer succ, KeyRange key_range);
+
+    /**
+     * Run AsyncSynchronize to completion, blocking the calling thread.
+     * @param succ Successor with which we are synchronizing key_range.
+     * @param key_range The range of keys to synchronize with succ.
+     */
     void Synchronize(const RemotePeer &succ, const KeyRange &key_range);
 
     /**
@@ -236,8 +420,8 @@ protected:
      *                   compare with the equivalently placed merkle tree node
      *                   at succ.
      */
-    void SynchronizeHelper(const RemotePeer &succ, const KeyRange &key_range,
-                           const DbEntry &local_node);
+    Awaitable<void> SynchronizeHelper(RemotePeer succ, KeyRange key_range,
+                                      const DbEntry &local_node);
 
     /**
      * Send merkle tree node node to succ in pursuit of synchronizing key_range
@@ -249,6 +433,12 @@ protected:
      * @return The merkle tree node of succ's database index with an identical
      *         position to node.
      */
+    Awaitable<DbEntry> AsyncExchangeNode(RemotePeer succ, const DbEntry &node,
+                                         KeyRange key_range);
+
+    /**
+     * Run AsyncExchangeNode to completion, blocking the calling thread.
+     */
     DbEntry ExchangeNode(const RemotePeer &succ, const DbEntry &node,
                          const KeyRange &key_range);
 
@@ -273,8 +463,9 @@ protected:
      * @param succ The node requesting synchronization.
      * @param key_range The range of keys which they are seeking to synchronize.
      */
-    void CompareNodes(const DbEntry &remote_node, const DbEntry &local_node,
-                      const RemotePeer &succ, const KeyRange &key_range);
+    Awaitable<void> CompareNodes(const DbEntry &remote_node,
+                                 const DbEntry &local_node, RemotePeer succ,
+                                 KeyRange key_range);
 
     /**
      * Are both the local and remote node in the range being synchronized, and
@@ -300,7 +491,20 @@ protected:
      * db.
      * @param key The missing key.
      */
-    void RetrieveMissing(const ChordKey &key);
+    Awaitable<void> RetrieveMissing(ChordKey key);
+
+    /**
+     * Tag request as maintenance traffic and send it to peer. Waits for one of
+     * our maintenance slots first, so that repair storms can only ever have a
+     * bounded number of bulk requests outstanding from this peer, leaving the
+     * rest of the network's capacity to foreground traffic. The wait polls
+     * rather than blocks, so as not to hold up the maintenance executor.
+     * @param peer Peer to which to send request.
+     * @param request Maintenance request (e.g. "XCHNG_NODE", "READ_RANGE").
+     * @return The peer's response, or throw an error as SendRequest does.
+     */
+    Awaitable<Json::Value> SendMaintenanceRequest(RemotePeer peer,
+                                                  Json::Value request);
 
     /**
      * Pure virtual function which has no use in this particular derivation.
@@ -318,11 +522,13 @@ protected:
      * the request to that node.
      * @param key Key whose successor ought to receive request.
      * @param request The request which should be forwarded.
+     * @param deadline Time by which the request must be answered.
      * @return The response from the successor of the key or throw an error
      *         if the key's successor cannot be found.
      */
     Json::Value ForwardRequest(const ChordKey &key,
-                               const Json::Value &request) override;
+                               const Json::Value &request,
+                               const Deadline &deadline) override;
 
     /// A DB consisting of a merkle tree index of the entire chord keyspace,
     /// with <key, data-fragment> pairs stored on leaf nodes.
@@ -332,12 +538,52 @@ protected:
     /// outlined by Stoica.
     std::thread maintenance_thread_;
 
+    /// Number of maintenance requests this peer may have outstanding at once.
+    /// Our maintenance round and each of our server's maintenance threads
+    /// hold at most one slot at a time, so as long as there are more slots
+    /// than those, waiting on a slot can never deadlock a sync.
+    static constexpr int MAINTENANCE_SLOTS = DEFAULT_NUM_MAINTENANCE_THREADS + 2;
+
+    /// Bounds the number of maintenance requests this peer has outstanding.
+    std::shared_ptr<AsyncSemaphore> maintenance_slots_;
+
     /// Server to respond to queries from other nodes.
     std::shared_ptr<ServerType> server_;
 
     /// Stabilize thread will run while this is true.
     bool continue_maintenance_;
 
+    /// IDs of peers which have joined or left the ring since global
+    /// maintenance last checked the keys they affect.
+    std::set<ChordKey> membership_changes_;
+    std::mutex membership_mutex_;
+
+    /// IDs in our successor list as of the last maintenance round. Only
+    /// touched by maintenance rounds, which never overlap.
+    std::set<ChordKey> last_succ_ids_;
+
+    /// When global maintenance last swept the whole database. The sweep is a
+    /// backstop for changes we never hear of (e.g. joins several peers behind
+    /// us), which can only leave surplus fragments, so it can be infrequent.
+    std::chrono::steady_clock::time_point last_full_sweep_ =
+            std::chrono::steady_clock::now();
+    static constexpr std::chrono::minutes FULL_SWEEP_INTERVAL { 10 };
+
+    /// Fragments we hold for peers which were down when they were created,
+    /// by the ID of their intended owner.
+    struct HintedFragments {
+        RemotePeer owner_;
+        KvMap fragments_;
+        std::chrono::steady_clock::time_point since_;
+        /// Has our successor list changed since we began holding them? If
+        /// so, they're offered to their keys' successors until one takes
+        /// them, since news of the owner's replacement may lag the change.
+        bool redirect_ = false;
+    };
+    std::map<ChordKey, HintedFragments> hints_;
+    std::mutex hints_mutex_;
+    static constexpr std::chrono::minutes HINT_TTL { 30 };
+
     int n_, m_, p_;
 
 private:
@@ -345,9 +591,12 @@ private:
     FRIEND_TEST(DHashSynchronize, SynchronizeUsesGivenRange);
     FRIEND_TEST(DHashSynchronize, HighDepth);
     FRIEND_TEST(DHashGlobalMaintenance, MisplacedKeys);
+    FRIEND_TEST(DHashGlobalMaintenance, OnlyDirtyRange);
     FRIEND_TEST(DHashExchangeNode, ExistingNode);
     FRIEND_TEST(DHashExchangeNode, NonExistentNode);
     FRIEND_TEST(DHashGlobalMaintenance, NoNeedToCorrect);
+    FRIEND_TEST(DHashHintedHandoff, HandsOffWhenOwnerReturns);
+    FRIEND_TEST(DHashHintedHandoff, CreateHintsPastDeadSuccessor);
 };
 
 
@@ -1,17 +1,78 @@
 #include "data_block.h"
 #include "ida.h"
+#include <algorithm>
+#include <cstring>
+#include <optional>
+
+/**
+ * @param fragments Fragments of a block.
+ * @param m Number of fragments needed to decode.
+ * @return Length of the block's payload, if the fragments record it, or
+ *         throw an error if they record more than they could hold (i.e. they
+ *         are garbage, or belong to differently-encoded blocks).
+ */
+static std::optional<size_t> PayloadSize(
+        const std::vector<DataFragment> &fragments, int m)
+{
+    if(fragments.empty() || ! fragments.front().payload_size_.has_value()) {
+        return std::nullopt;
+    }
+    size_t payload_size = *fragments.front().payload_size_;
+    if(payload_size > fragments.front().fragment_.size() * m) {
+        throw std::runtime_error("Fragments hold fewer bytes than their "
+                                 "payload size.");
+    }
+    return payload_size;
+}
+
+/**
+ * Decode the payload of a block from (at least m of) its fragments.
+ * @param ida IDA with which the fragments were encoded.
+ * @param fragments Fragments of the block.
+ * @param m Number of fragments needed to decode.
+ * @return The payload.
+ */
+static std::string DecodePayload(IDA &ida,
+                                 const std::vector<DataFragment> &fragments,
+                                 int m)
+{
+    std::optional<size_t> payload_size = PayloadSize(fragments, m);
+    if(payload_size.has_value()) {
+        std::string payload(*payload_size, '\0');
+        ida.Decode(fragments, payload.data(), payload.size());
+        return payload;
+    }
+
+    // Fragments which don't record their payload's size hold payloads which
+    // end at their last non-zero byte, as IDA::Decode assumes.
+    Vector symbols = ida.Decode(fragments);
+    return std::string(symbols.begin(), symbols.end());
+}
+
+/**
+ * @param matrix Fragments given by IDA::Encode.
+ * @param payload_size Length of the payload they encode.
+ * @return The fragments, recording payload_size.
+ */
+static std::vector<DataFragment> FragsOfPayload(const Matrix &matrix,
+                                                size_t payload_size)
+{
+    std::vector<DataFragment> fragments = FragsFromMatrix(matrix);
+    for(DataFragment &fragment : fragments) {
+        fragment.payload_size_ = payload_size;
+    }
+    return fragments;
+}
 
 DataBlock::DataBlock(const std::string &input, int n, int m, int p)
     : n_(n)
     , m_(m)
     , p_(p)
-    , original_(StrToInts(input))
     , ida_(n, m, p)
+    , original_(input)
 {
-    Matrix frags = ida_.Encode(original_);
-    for(int i = 0; i < frags.size(); ++i) {
-        fragments_.emplace_back(frags[i], i + 1);
-    }
+    fragments_ = FragsOfPayload(ida_.Encode(StrToInts(original_)),
+                                original_.size());
 }
 
 DataBlock::DataBlock(const Json::Value &json_block)
@@ -24,7 +85,7 @@ DataBlock::DataBlock(const Json::Value &json_block)
     for(const auto &frag : json_block["FRAGMENTS"]) {
         fragments_.emplace_back(frag);
     }
-    original_ = ida_.Decode(fragments_);
+    original_ = DecodePayload(ida_, fragments_, m_);
 }
 
 DataBlock::DataBlock(const std::vector<DataFragment> &fragments, int n, int m,
@@ -34,23 +95,16 @@ DataBlock::DataBlock(const std::vector<DataFragment> &fragments, int n, int m,
     , p_(p)
     , ida_(n_, m_, p_)
 {
-    // Create fragments and indices.
-    std::vector<int> frag_indices;
-    Matrix frag_matrix;
-    for(const DataFragment &fragment : fragments) {
-        frag_indices.push_back(fragment.index_);
-        frag_matrix.push_back(fragment.fragment_);
-    }
-
     // This may seem redundant. Why decode original and then re-encode it?
     // The answer is because the IDA::Decode method requires only a fraction
     // of the total fragments produced from encoding (in this case, only 10
     // of the 14 fragments produced from encoding are needed to decode.)
-    // As a result, we cannot simply pass a list of fragments created from
-    // frag_indices and frag_matrix to "FragsFromMatrix", we must instead
-    // re-generate all 14 fragments, in case less than 14 were passed to us.
-    original_ = ida_.Decode(frag_matrix, frag_indices);
-    fragments_ = FragsFromMatrix(ida_.Encode(original_));
+    // As a result, we cannot simply take the fragments passed to us, we must
+    // instead re-generate all 14 fragments, in case less than 14 were passed
+    // to us.
+    original_ = DecodePayload(ida_, fragments, m_);
+    fragments_ = FragsOfPayload(ida_.Encode(StrToInts(original_)),
+                                original_.size());
 }
 
 DataBlock::operator Json::Value() const
@@ -80,20 +134,31 @@ DataBlock::operator std::string() const
 
 [[nodiscard]] std::string DataBlock::Decode() const
 {
-    std::string res;
+    return original_;
+}
 
-    // "original_" is a double vector consisting of UTF codes, possibly
-    // with padding.
-    for(const auto &char_code : original_) {
-        res += char(char_code);
-    }
+size_t DataBlock::Size() const
+{
+    return original_.size();
+}
 
-    // 0 codes are used to pad end of buffer
-    while(char(res.back()) == 0) {
-        res.pop_back();
-    }
+void DataBlock::DecodeInto(char *buffer) const
+{
+    std::memcpy(buffer, original_.data(), original_.size());
+}
 
-    return res;
+void DataBlock::DecodeInto(std::string &out) const
+{
+    size_t offset = out.size();
+    out.resize(offset + Size());
+    DecodeInto(out.data() + offset);
+}
+
+std::string DataBlock::DecodeFragments(
+        const std::vector<DataFragment> &fragments, int n, int m, int p)
+{
+    IDA ida(n, m, p);
+    return DecodePayload(ida, fragments, m);
 }
 
 bool operator == (const DataBlock &db1, const DataBlock &db2)
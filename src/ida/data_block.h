@@ -77,6 +77,39 @@ public:
      */
     [[nodiscard]] std::string Decode() const;
 
+    /**
+     * @return Length of the decoded string, in bytes.
+     */
+    [[nodiscard]] size_t Size() const;
+
+    /**
+     * Copy the decoded string (which the block keeps) into a caller-provided
+     * buffer. To decode a block's fragments alone, see DecodeFragments.
+     * @param buffer Buffer of at least Size() bytes.
+     */
+    void DecodeInto(char *buffer) const;
+
+    /**
+     * Decode onto the end of a caller-provided string.
+     * @param out String to which the decoded string will be appended.
+     */
+    void DecodeInto(std::string &out) const;
+
+    /**
+     * Decode fragments straight into the string they encode. Unlike
+     * constructor #4, this does not re-encode the original to regenerate all
+     * n fragments, so use it whenever only the string is needed (i.e. for
+     * reads).
+     *
+     * @param fragments At least m distinct fragments of a block.
+     * @param n Total number fragments generated by IDA.
+     * @param m Minimum number of fragments needed to reconstruct the original.
+     * @return The string from which the fragments were encoded.
+     */
+    [[nodiscard]] static std::string DecodeFragments(
+            const std::vector<DataFragment> &fragments, int n = 14, int m = 10,
+            int p = 257);
+
     /**
      * Comparison operator (for unit tests).
      *
@@ -91,9 +124,10 @@ public:
 
     IDA ida_;
 
-    /// The original string translated into a vector of doubles, with
-    /// the nth double corresponding to string's nth char's UTF code.
-    Vector original_;
+    /// The original string's bytes. (Their length is recorded in each
+    /// fragment, so that the padding IDA adds can be stripped without
+    /// mistaking trailing zero bytes for padding.)
+    std::string original_;
 
     /// A two-d vector containing one-d vectors of doubles, with each one-d
     /// double vector representing a "fragment". These can be decoded into
@@ -15,7 +15,11 @@ DataFragment::DataFragment(const Json::Value &json_frag)
     , p_(json_frag["P"].asInt())
     , fragment_(ParseFromBase64(json_frag["FRAGMENT"].asString(),
                                 ceil(log(p_) / log(64))))
-{}
+{
+    if(json_frag.isMember("SIZE")) {
+        payload_size_ = json_frag["SIZE"].asUInt64();
+    }
+}
 
 DataFragment::DataFragment(const std::string &encoded_frag)
 {
@@ -58,6 +62,9 @@ bool DataFragment::WriteToFile(const char *file_path) const
     // represent a number in that range.
     int digits_per_val = ceil(log(p_) / log(64));
     frag["FRAGMENT"] = SerializeToBase64(fragment_, digits_per_val);
+    if(payload_size_.has_value()) {
+        frag["SIZE"] = (Json::UInt64) *payload_size_;
+    }
     return frag;
 }
 
@@ -4,6 +4,7 @@
 #include <string>
 #include <json/json.h>
 #include <fstream>
+#include <optional>
 #include "matrix_math.h"
 
 /**
@@ -97,6 +98,12 @@ public:
     /// A vector of doubles representing a row from a matrix given by
     /// IDA::Encode.
     Vector fragment_;
+
+    /// Length, in bytes, of the payload the fragment's block encodes, so that
+    /// the padding IDA adds can be stripped without mistaking trailing zero
+    /// bytes for padding. Absent in fragments stored before it was recorded,
+    /// whose payloads end at their last non-zero byte.
+    std::optional<size_t> payload_size_;
 };
 
 using StringArr = std::vector<std::string>;
@@ -1,19 +1,19 @@
 #include "ida.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 Vector CharsToInts(const std::vector<unsigned char> &v)
 {
-    Vector res;
-    for(unsigned char el : v) {
-        res.push_back((int) el);
-    }
-    return res;
+    return Vector(v.begin(), v.end());
 }
 
 Vector StrToInts(const std::string &str)
 {
-    std::vector<unsigned char> chars;
-    std::copy(str.begin(), str.end(), std::back_inserter(chars));
-    return CharsToInts(chars);
+    // Go via unsigned char, so that bytes above 127 aren't sign-extended.
+    return Vector((const unsigned char *) str.data(),
+                  (const unsigned char *) str.data() + str.size());
 }
 
 bool AllZeroes(const Vector &v)
@@ -27,7 +27,7 @@ bool AllZeroes(const Vector &v)
     return true;
 }
 
-char *ReadFile(const char *file_path)
+std::string ReadFile(const char *file_path)
 {
     std::ifstream file_stream(file_path, std::ifstream::binary);
     if(! file_stream) {
@@ -36,15 +36,131 @@ char *ReadFile(const char *file_path)
 
     // Get file length, read file contents.
     file_stream.seekg(0, std::ifstream::end);
-    int file_len = file_stream.tellg();
+    std::streamsize file_len = file_stream.tellg();
     file_stream.seekg(0, std::ifstream::beg);
-    char *buffer = new char[file_len + 1];
-    file_stream.read(buffer, file_len + 1);
+    std::string contents(file_len, '\0');
+    file_stream.read(contents.data(), file_len);
+    return contents;
+}
+
+/* ----------------------------------------------------------------------------
+ * FRAGMENT FILES: Binary fragment files, as written by IDA::EncodeToFiles.
+ *
+ * Each begins with a header - FRAG_FILE_MAGIC, then n, m, p, the fragment's
+ * index and the length of the encoded file, all little-endian - followed by
+ * the fragment's symbols, two bytes apiece.
+ * -------------------------------------------------------------------------- */
+
+static const char FRAG_FILE_MAGIC[4] = { 'I', 'D', 'A', 'F' };
+
+/// Number of segments encoded (or decoded) at a time when streaming files;
+/// small enough that a batch's input and output stay in cache.
+static const int SEGMENTS_PER_BATCH = 2048;
+
+/// Buffer size for each fragment file's stream.
+static const size_t FRAG_FILE_BUFFER_SIZE = 1 << 16;
+
+struct FragFileHeader {
+    int n, m, p, index;
+    uint64_t file_len;
+};
+
+static void WriteLittleEndian(std::ostream &out, uint64_t val, int num_bytes)
+{
+    char bytes[8];
+    for(int i = 0; i < num_bytes; ++i) {
+        bytes[i] = (char) ((val >> (8 * i)) & 0xff);
+    }
+    out.write(bytes, num_bytes);
+}
+
+static uint64_t ReadLittleEndian(std::istream &in, int num_bytes)
+{
+    unsigned char bytes[8];
+    if(! in.read((char *) bytes, num_bytes)) {
+        throw std::runtime_error("Truncated fragment file.");
+    }
 
-    file_stream.close();
-    return buffer;
+    uint64_t val = 0;
+    for(int i = 0; i < num_bytes; ++i) {
+        val |= (uint64_t) bytes[i] << (8 * i);
+    }
+    return val;
 }
 
+static void WriteFragFileHeader(std::ostream &out, const FragFileHeader &header)
+{
+    out.write(FRAG_FILE_MAGIC, sizeof(FRAG_FILE_MAGIC));
+    for(int field : { header.n, header.m, header.p, header.index }) {
+        WriteLittleEndian(out, field, 4);
+    }
+    WriteLittleEndian(out, header.file_len, 8);
+}
+
+static FragFileHeader ReadFragFileHeader(std::istream &in)
+{
+    char magic[sizeof(FRAG_FILE_MAGIC)];
+    if(! in.read(magic, sizeof(magic)) ||
+       ! std::equal(magic, magic + sizeof(magic), FRAG_FILE_MAGIC))
+    {
+        throw std::runtime_error("Not a fragment file.");
+    }
+
+    FragFileHeader header {};
+    header.n = (int) ReadLittleEndian(in, 4);
+    header.m = (int) ReadLittleEndian(in, 4);
+    header.p = (int) ReadLittleEndian(in, 4);
+    header.index = (int) ReadLittleEndian(in, 4);
+    header.file_len = ReadLittleEndian(in, 8);
+    return header;
+}
+
+/**
+ * Read-only mapping of a whole file into memory, unmapped on destruction.
+ */
+class MappedFile {
+public:
+    explicit MappedFile(const char *file_path)
+    {
+        int fd = open(file_path, O_RDONLY);
+        if(fd < 0) {
+            throw std::runtime_error("Error opening file");
+        }
+
+        struct stat file_stat {};
+        if(fstat(fd, &file_stat) < 0) {
+            close(fd);
+            throw std::runtime_error("Error reading file");
+        }
+
+        // Empty files can't be mapped, but neither do they need to be.
+        size_ = file_stat.st_size;
+        if(size_ > 0) {
+            void *addr = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if(addr == MAP_FAILED) {
+                close(fd);
+                throw std::runtime_error("Error mapping file");
+            }
+            data_ = (const unsigned char *) addr;
+            madvise(addr, size_, MADV_SEQUENTIAL);
+        }
+        close(fd);
+    }
+
+    ~MappedFile()
+    {
+        if(data_ != nullptr) {
+            munmap((void *) data_, size_);
+        }
+    }
+
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator = (const MappedFile &) = delete;
+
+    const unsigned char *data_ = nullptr;
+    size_t size_ = 0;
+};
+
 IDA::IDA(int n, int m, int p)
     : n_(n)
     , m_(m)
@@ -58,18 +174,10 @@ IDA::IDA(int n, int m, int p)
 
 Matrix IDA::Encode(const Vector &v)
 {
-    Matrix segments = SplitToSegments(v);
-    Matrix fragments;
-    for(int i = 0; i < n_; ++i) {
-        Vector fragment;
-        for(const auto &segment : segments) {
-            int prod = InnerProduct(encoding_matrix_[i], segment, p_);
-            fragment.push_back(prod);
-        }
-        fragments.push_back(fragment);
-    }
-
-    return fragments;
+    // Fragment i holds the inner product of row i of the encoding matrix with
+    // each segment, i.e. row i of the encoding matrix times the segments laid
+    // out as columns.
+    return MatrixProduct(encoding_matrix_, SplitToSegments(v), p_);
 }
 
 Matrix IDA::EncodePlaintext(const std::string &str)
@@ -79,41 +187,141 @@ Matrix IDA::EncodePlaintext(const std::string &str)
 
 Matrix IDA::EncodeFile(const char *file_path)
 {
-    std::ifstream file_stream(file_path, std::ifstream::binary);
-    if(! file_stream) {
-        throw std::runtime_error("Error opening file");
+    return Encode(StrToInts(ReadFile(file_path)));
+}
+
+void IDA::EncodeToFiles(const char *in_file,
+                        const std::vector<std::string> &out_files)
+{
+    if(out_files.size() != n_) {
+        throw std::runtime_error("Number of outfiles should be " +
+                                 std::to_string(n_));
+    }
+    if(p_ > (1 << 16)) {
+        throw std::runtime_error("Fragment files hold symbols below 2^16.");
     }
 
-    std::vector<unsigned char> file_contents;
+    MappedFile input(in_file);
 
-    if(! file_stream.eof() && ! file_stream.fail())
-    {
-        // Find the length of the file, allocate appropriately sized buffer
-        file_stream.seekg(0, std::ifstream::end);
-        std::streampos length = file_stream.tellg();
-        file_stream.seekg(0, std::ifstream::beg);
-        file_contents.resize(length);
+    std::vector<std::vector<char>> buffers(n_);
+    std::vector<std::ofstream> outputs(n_);
+    for(int i = 0; i < n_; ++i) {
+        buffers[i].resize(FRAG_FILE_BUFFER_SIZE);
+        outputs[i].rdbuf()->pubsetbuf(buffers[i].data(), buffers[i].size());
+        outputs[i].open(out_files[i], std::ofstream::binary);
+        if(! outputs[i]) {
+            throw std::runtime_error("Error opening " + out_files[i]);
+        }
+        WriteFragFileHeader(outputs[i], { n_, m_, p_, i + 1, input.size_ });
+    }
+
+    // Encode a batch of segments at a time, laid out as columns (as
+    // SplitToSegments does), and append each fragment's share of the batch to
+    // its file.
+    size_t num_segments = (input.size_ + m_ - 1) / m_;
+    std::string encoded_batch;
+    for(size_t first = 0; first < num_segments; first += SEGMENTS_PER_BATCH) {
+        size_t batch_len = std::min<size_t>(SEGMENTS_PER_BATCH,
+                                            num_segments - first);
+        Matrix segments(m_, Vector(batch_len, 0));
+        size_t offset = first * m_,
+               end = std::min(input.size_, offset + batch_len * m_);
+        for(size_t i = offset; i < end; ++i) {
+            segments[(i - offset) % m_][(i - offset) / m_] = input.data_[i];
+        }
 
-        file_stream.seekg(0, std::ios_base::beg);
-        file_stream.read((char *) &file_contents[0], length);
+        Matrix fragments = MatrixProduct(encoding_matrix_, segments, p_);
+        for(int i = 0; i < n_; ++i) {
+            encoded_batch.clear();
+            for(int symbol : fragments[i]) {
+                encoded_batch.push_back((char) (symbol & 0xff));
+                encoded_batch.push_back((char) (symbol >> 8));
+            }
+            outputs[i].write(encoded_batch.data(), encoded_batch.size());
+        }
     }
 
-    file_stream.close();
-    return Encode(CharsToInts(file_contents));
+    for(int i = 0; i < n_; ++i) {
+        outputs[i].close();
+        if(! outputs[i]) {
+            throw std::runtime_error("Error writing " + out_files[i]);
+        }
+    }
 }
 
-void IDA::EncodeToFiles(const char *in_file,
-                        const std::vector<std::string> &out_files)
+void IDA::DecodeFromFiles(const std::vector<std::string> &in_files,
+                          const char *out_file)
 {
-    if(out_files.size() != n_) {
-        throw std::runtime_error("Number of outfiles should be " +
-                                 std::to_string(n_));
+    if(in_files.size() < m_) {
+        throw std::runtime_error(std::to_string(m_) + " frags are required"
+                                                      " to decode.");
+    }
+
+    std::vector<std::ifstream> inputs(m_);
+    Vector frag_indices;
+    uint64_t file_len = 0;
+    for(int i = 0; i < m_; ++i) {
+        inputs[i].open(in_files[i], std::ifstream::binary);
+        if(! inputs[i]) {
+            throw std::runtime_error("Error opening " + in_files[i]);
+        }
+
+        FragFileHeader header = ReadFragFileHeader(inputs[i]);
+        if(header.n != n_ || header.m != m_ || header.p != p_) {
+            throw std::runtime_error(in_files[i] + " was encoded with "
+                                     "different parameters.");
+        }
+        if(i > 0 && header.file_len != file_len) {
+            throw std::runtime_error(in_files[i] + " is a fragment of a "
+                                     "different file.");
+        }
+        file_len = header.file_len;
+        frag_indices.push_back(header.index);
     }
 
-    Matrix encoded_file = EncodeFile(in_file);
-    std::vector<DataFragment> frags = FragsFromMatrix(encoded_file);
-    for(int i = 0; i < out_files.size(); ++i) {
-        frags[i].WriteToFile(out_files[i].c_str());
+    std::ofstream output(out_file, std::ofstream::binary);
+    if(! output) {
+        throw std::runtime_error("Error opening output file");
+    }
+
+    // Decode a batch of segments at a time, as in EncodeToFiles, and write
+    // out as many of the decoded bytes as belong to the file (the rest being
+    // padding).
+    Matrix inv_encoding_matrix = VandermondeInverse(frag_indices, p_);
+    uint64_t num_segments = (file_len + m_ - 1) / m_;
+    std::string encoded_batch, decoded_batch;
+    for(uint64_t first = 0; first < num_segments; first += SEGMENTS_PER_BATCH) {
+        size_t batch_len = std::min<uint64_t>(SEGMENTS_PER_BATCH,
+                                              num_segments - first);
+        Matrix encoded(m_, Vector(batch_len));
+        encoded_batch.resize(2 * batch_len);
+        for(int i = 0; i < m_; ++i) {
+            if(! inputs[i].read(encoded_batch.data(), encoded_batch.size())) {
+                throw std::runtime_error("Truncated fragment file.");
+            }
+            for(size_t j = 0; j < batch_len; ++j) {
+                encoded[i][j] = (unsigned char) encoded_batch[2 * j] |
+                                (unsigned char) encoded_batch[2 * j + 1] << 8;
+            }
+        }
+
+        Matrix segments = MatrixProduct(inv_encoding_matrix, encoded, p_);
+        size_t batch_bytes = std::min<uint64_t>(batch_len * m_,
+                                                file_len - first * m_);
+        decoded_batch.resize(batch_bytes);
+        for(size_t i = 0; i < batch_bytes; ++i) {
+            int symbol = segments[i % m_][i / m_];
+            if(symbol > 0xff) {
+                throw std::runtime_error("Fragments decoded to a non-byte.");
+            }
+            decoded_batch[i] = (char) symbol;
+        }
+        output.write(decoded_batch.data(), decoded_batch.size());
+    }
+
+    output.close();
+    if(! output) {
+        throw std::runtime_error("Error writing output file");
     }
 }
 
@@ -142,14 +350,14 @@ Vector IDA::Decode(const Matrix &encoded, const Vector &frag_indices)
 
     // Sometimes, reconstructed block will have several zeroed-out rows
     // at the back. These are useless and should be removed.
-    while(AllZeroes(original_segments.back())) {
+    while(! original_segments.empty() && AllZeroes(original_segments.back())) {
         original_segments.pop_back();
     }
 
     // Likewise, the final non-zero row of the block may have some tailing
     // zeroes. Remove those as well. It would be akin to having several
     // null-terminating characters, one after the other.
-    while(original_segments.back().back() == 0) {
+    while(! original_segments.empty() && original_segments.back().back() == 0) {
         original_segments.back().pop_back();
     }
 
@@ -174,17 +382,44 @@ Vector IDA::Decode(const std::vector<DataFragment> &frags)
     return Decode(encoded, frag_indices);
 }
 
+void IDA::Decode(const std::vector<DataFragment> &frags, char *out,
+                 size_t length)
+{
+    if(frags.size() < (size_t) m_) {
+        throw std::runtime_error(std::to_string(m_) + " frags are required"
+                                                      " to decode.");
+    }
+    size_t frag_len = frags.front().fragment_.size();
+    if(length > frag_len * m_) {
+        throw std::runtime_error("Frags hold fewer than " +
+                                 std::to_string(length) + " symbols.");
+    }
+    if(length == 0) {
+        return;
+    }
+
+    Matrix encoded;
+    Vector frag_indices;
+    for(int i = 0; i < m_; ++i) {
+        encoded.push_back(frags[i].fragment_);
+        frag_indices.push_back(frags[i].index_);
+    }
+
+    // Each column of the product is a segment of m symbols of the original.
+    Matrix segments = MatrixProduct(VandermondeInverse(frag_indices, p_),
+                                    encoded, p_);
+    for(size_t i = 0; i < length; ++i) {
+        out[i] = (char) segments[i % m_][i / m_];
+    }
+}
+
 Matrix IDA::SplitToSegments(const Vector &v)
 {
-    Matrix segments;
-    for(int i = 0; i < v.size(); i += m_) {
-        Vector segment(m_, 0);
-        int end_pos = (i + m_) > (v.size()) ? (v.size()) : (i + m_);
-        // The end pos should either be the last element in the array or
-        // m positions ahead of start_pos, whichever comes first.
-        std::copy(v.begin()+i, v.begin()+end_pos,  segment.begin());
-        segments.push_back(segment);
+    int num_segments = (v.size() + m_ - 1) / m_;
+    Matrix segments(m_, Vector(num_segments, 0));
+    for(int i = 0; i < v.size(); ++i) {
+        segments[i % m_][i / m_] = v[i];
     }
 
     return segments;
-}
\ No newline at end of file
+}
@@ -36,9 +36,9 @@ bool AllZeroes(const Vector &v);
 /**
  * Read the contents of a file.
  * @param file_path Absolute path to file (maybe rework to allow relative).
- * @return Contents of the file as a char *.
+ * @return Contents of the file.
  */
-char *ReadFile(const char *file_path);
+std::string ReadFile(const char *file_path);
 
 class IDA {
 public:
@@ -77,13 +77,25 @@ public:
 
     /**
      * Take a file, encode it, store each resulting fragment in a file
-     * given by the out_files vector.
+     * given by the out_files vector. The file is mapped into memory and
+     * encoded a batch of segments at a time, with each fragment streamed to
+     * its file in binary (see ida.cpp for the format), so memory use doesn't
+     * grow with the size of the file.
      * @param in_file Path to file to encode.
      * @param out_files Paths to files in which to store fragments.
      */
     void EncodeToFiles(const char *in_file,
                        const std::vector<std::string> &out_files);
 
+    /**
+     * Decode the file encoded by EncodeToFiles from (the first m of) the
+     * given fragment files, streaming it into out_file a batch at a time.
+     * @param in_files Paths to at least m fragment files.
+     * @param out_file Path to which the decoded file will be written.
+     */
+    void DecodeFromFiles(const std::vector<std::string> &in_files,
+                         const char *out_file);
+
     /**
      * Given a matrix of encoded fragments and a corresponding vector of their
      * indices, decode the fragments into the original vector.
@@ -102,6 +114,18 @@ public:
      */
     Vector Decode(const std::vector<DataFragment> &frags);
 
+    /**
+     * Decode the first length symbols encoded by a vector of DataFragments
+     * straight into a buffer of bytes. Unlike the other Decode overloads,
+     * this strips no padding, since the caller says how much to keep.
+     * @param frags At least m DataFragments.
+     * @param out Buffer of at least length bytes.
+     * @param length Number of symbols to decode, or throw an error if the
+     *               fragments hold fewer.
+     */
+    void Decode(const std::vector<DataFragment> &frags, char *out,
+                size_t length);
+
 private:
     /// Paramters of IDA; IDA will produce n fragments but require only n to
     /// decode any datum. It will use some prime number p for purposes of
@@ -111,11 +135,11 @@ private:
     Matrix encoding_matrix_;
 
     /**
-     * Take a flat vector, split it into rows of length m. If the length of the
-     * vector is not evenly divisible by 10, the remaining elements should be
-     * padded with 0s.
+     * Take a flat vector, split it into segments of length m. If the length of
+     * the vector is not evenly divisible by m, the remaining elements should
+     * be padded with 0s.
      * @param v A vector of ints.
-     * @return The vector split into a matrix with rows of length m.
+     * @return The segments, laid out as the columns of an m-row matrix.
      */
     Matrix SplitToSegments(const Vector &v);
 };
@@ -1,4 +1,9 @@
 #include "matrix_math.h"
+#include <algorithm>
+#include <cstdint>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 void Print(const Vector &v)
 {
@@ -32,6 +37,143 @@ int InnerProduct(const Vector &lhs, const Vector &rhs, int prime)
     return Modulo(sum, prime);
 }
 
+/*
+ * Kernels for MatrixProduct's fast path, in which every entry of both matrices
+ * lies in [0, prime), so that products can be summed in unsigned 32-bit lanes
+ * and reduced only once per cell, rather than once per term.
+ */
+
+/**
+ * acc[j] += coeff * row[j], for j in [0, len).
+ */
+static void MulAddScalar(uint32_t *acc, const int *row, uint32_t coeff,
+                         size_t len)
+{
+    for(size_t j = 0; j < len; ++j) {
+        acc[j] += coeff * (uint32_t) row[j];
+    }
+}
+
+/**
+ * out[j] = acc[j] % prime, for j in [0, len).
+ */
+static void ReduceScalar(const uint32_t *acc, int *out, size_t len, int prime)
+{
+    for(size_t j = 0; j < len; ++j) {
+        out[j] = (int) (acc[j] % (uint32_t) prime);
+    }
+}
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define HAVE_AVX2_KERNELS
+
+static bool HasAvx2()
+{
+    static const bool has_avx2 = __builtin_cpu_supports("avx2");
+    return has_avx2;
+}
+
+__attribute__((target("avx2")))
+static void MulAddAvx2(uint32_t *acc, const int *row, uint32_t coeff,
+                       size_t len)
+{
+    const __m256i coeffs = _mm256_set1_epi32((int) coeff);
+    size_t j = 0;
+    for(; j + 8 <= len; j += 8) {
+        __m256i sums = _mm256_loadu_si256((const __m256i *) (acc + j)),
+                vals = _mm256_loadu_si256((const __m256i *) (row + j));
+        sums = _mm256_add_epi32(sums, _mm256_mullo_epi32(vals, coeffs));
+        _mm256_storeu_si256((__m256i *) (acc + j), sums);
+    }
+    MulAddScalar(acc + j, row + j, coeff, len - j);
+}
+
+/**
+ * As ReduceScalar for prime = 257. Since 256 = -1 (mod 257), the bytes of a
+ * 32-bit x can be folded as b0 - b1 + b2 - b3 (in [-510, 510]), and, after
+ * adding 2 * 257, folded again (into [-4, 255]), leaving at most one 257 to
+ * add.
+ */
+__attribute__((target("avx2")))
+static void Reduce257Avx2(const uint32_t *acc, int *out, size_t len)
+{
+    const __m256i low_byte = _mm256_set1_epi32(0xff),
+                  two_p = _mm256_set1_epi32(2 * 257),
+                  p = _mm256_set1_epi32(257),
+                  zero = _mm256_setzero_si256();
+    size_t j = 0;
+    for(; j + 8 <= len; j += 8) {
+        __m256i x = _mm256_loadu_si256((const __m256i *) (acc + j));
+        __m256i b0 = _mm256_and_si256(x, low_byte),
+                b1 = _mm256_and_si256(_mm256_srli_epi32(x, 8), low_byte),
+                b2 = _mm256_and_si256(_mm256_srli_epi32(x, 16), low_byte),
+                b3 = _mm256_srli_epi32(x, 24);
+        __m256i t = _mm256_add_epi32(_mm256_sub_epi32(b0, b1),
+                                     _mm256_sub_epi32(b2, b3));
+        t = _mm256_add_epi32(t, two_p);
+        t = _mm256_sub_epi32(_mm256_and_si256(t, low_byte),
+                             _mm256_srli_epi32(t, 8));
+        t = _mm256_add_epi32(t, _mm256_and_si256(_mm256_cmpgt_epi32(zero, t),
+                                                 p));
+        _mm256_storeu_si256((__m256i *) (out + j), t);
+    }
+    ReduceScalar(acc + j, out + j, len - j, 257);
+}
+#endif
+
+static void MulAdd(uint32_t *acc, const int *row, uint32_t coeff, size_t len)
+{
+#ifdef HAVE_AVX2_KERNELS
+    if(HasAvx2()) {
+        MulAddAvx2(acc, row, coeff, len);
+        return;
+    }
+#endif
+    MulAddScalar(acc, row, coeff, len);
+}
+
+static void Reduce(const uint32_t *acc, int *out, size_t len, int prime)
+{
+#ifdef HAVE_AVX2_KERNELS
+    if(prime == 257 && HasAvx2()) {
+        Reduce257Avx2(acc, out, len);
+        return;
+    }
+#endif
+    ReduceScalar(acc, out, len, prime);
+}
+
+/**
+ * Can lhs * rhs (mod prime) take the fast path?
+ */
+static bool FitsKernels(const Matrix &lhs, const Matrix &rhs, int prime)
+{
+    size_t lhs_cols = lhs[0].size(), rhs_cols = rhs[0].size();
+    auto reduced = [prime](int cell) { return cell >= 0 && cell < prime; };
+
+    // No sum of lhs_cols products may overflow the accumulators.
+    if(prime <= 0 || rhs.size() < lhs_cols ||
+       (uint64_t) lhs_cols * (prime - 1) * (prime - 1) > UINT32_MAX)
+    {
+        return false;
+    }
+    for(const Vector &row : lhs) {
+        if(row.size() != lhs_cols ||
+           ! std::all_of(row.begin(), row.end(), reduced))
+        {
+            return false;
+        }
+    }
+    for(size_t k = 0; k < lhs_cols; ++k) {
+        if(rhs[k].size() != rhs_cols ||
+           ! std::all_of(rhs[k].begin(), rhs[k].end(), reduced))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 Matrix MatrixProduct(const Matrix &lhs, const Matrix &rhs, int prime)
 {
     Matrix result;
@@ -39,6 +181,25 @@ Matrix MatrixProduct(const Matrix &lhs, const Matrix &rhs, int prime)
             lhs_cols = lhs[0].size(),
             rhs_cols = rhs[0].size();
 
+    if(FitsKernels(lhs, rhs, prime)) {
+        // Build each row of the result as a sum of rows of rhs, scaled by the
+        // corresponding row of lhs, so that the kernels run over contiguous
+        // memory.
+        std::vector<uint32_t> acc(rhs_cols);
+        for(int i = 0; i < lhs_rows; ++i) {
+            std::fill(acc.begin(), acc.end(), 0);
+            for(int k = 0; k < lhs_cols; ++k) {
+                if(lhs[i][k] != 0) {
+                    MulAdd(acc.data(), rhs[k].data(), lhs[i][k], rhs_cols);
+                }
+            }
+            Vector row(rhs_cols);
+            Reduce(acc.data(), row.data(), rhs_cols, prime);
+            result.push_back(std::move(row));
+        }
+        return result;
+    }
+
     for(int i = 0; i < lhs_rows; ++i) {
         Vector row;
         for (int j = 0; j < rhs_cols; ++j) {
@@ -100,14 +261,14 @@ Matrix ConstructEncodingMatrix(int m, int n, int p)
     return encoding_matrix;
 }
 
-Vector ElementarySymmetricTransform(const Vector &v, int m)
+Vector ElementarySymmetricTransform(const Vector &v, int m, int p)
 {
     Matrix el(m + 1, Vector(v.size() + 1, 0));
     for(int i = 1; i <= v.size(); ++i)
-        el[1][i] = el[1][i-1] + v[i-1];
+        el[1][i] = Modulo(el[1][i-1] + v[i-1], p);
     for(int i = 2; i <= m; ++i)
         for(int j = i; j <= v.size(); ++j)
-            el[i][j] = el[i-1][j-1] * v[j-1] + el[i][j-1];
+            el[i][j] = Modulo(el[i-1][j-1] * v[j-1] + el[i][j-1], p);
 
     Vector result;
     for(int i = 0; i <= m; ++i)
@@ -119,7 +280,7 @@ Matrix VandermondeInverse(const Vector &basis, int p)
 {
     int m = basis.size();
 
-    Vector el = ElementarySymmetricTransform(basis, m), denominators;
+    Vector el = ElementarySymmetricTransform(basis, m, p), denominators;
 
     for(int i = 0; i < m; ++i) {
         int prod = 1, elt = basis[i];
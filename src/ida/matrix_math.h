@@ -38,6 +38,8 @@ int InnerProduct(const Vector &lhs, const Vector &rhs, int prime);
 
 /**
  * Multiply two matrices, but every operation is done modulo some prime number.
+ * When every entry is already reduced modulo prime, this accumulates products
+ * without reducing and reduces each cell once, using AVX2 where available.
  *
  * @param lhs Matrix 1.
  * @param rhs Matrix 2.
@@ -75,16 +77,16 @@ int ModInverse(int n, int p);
 Matrix ConstructEncodingMatrix(int m, int n, int p);
 
 /**
- * Elementary symmetrical transformation of a vector.
+ * Elementary symmetrical transformation of a vector, modulo p. (Without the
+ * modulo, the sums overflow for all but the smallest fragment indices.)
  * @param v Vector to transform.
  * @param m Minimum number of fragments needed to reproduce original vector
  *          after encoding.
+ * @param p Prime number.
  * @return List in which element i is the sum of products of i distinct elements
- *         of the given vector.
- * Note: Should this be done modulo p? Why is p parameter unused in original
- * repo?
+ *         of the given vector, modulo p.
  */
-Vector ElementarySymmetricTransform(const Vector &v, int m);
+Vector ElementarySymmetricTransform(const Vector &v, int m, int p);
 
 /**
  * Compute the inverse of a vandermonde matrix, with all ops modulo p.
@@ -1,5 +1,15 @@
 #include "client.h"
+#include "io_uring.h"
 #include <iostream>
+#include <boost/throw_exception.hpp>
+
+#ifdef HAVE_IO_URING
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
 
 /**
  * Split a string into a vector of substrings based on delimiter.
@@ -48,15 +58,72 @@ static std::string SanitizeJson(const std::string &serializedJson)
     return res_str;
 }
 
-Json::Value Client::MakeRequest(const std::string &ip_addr, unsigned short port,
-                                const Json::Value &request)
+/**
+ * Parse a response read off the wire.
+ *
+ * @param reply_buf Serialized response.
+ * @return Parsed response, or throw an error if it isn't valid JSON.
+ */
+static Json::Value ParseResponse(const std::string &reply_buf)
 {
-    boost::asio::io_context io;
-    Json::StreamWriterBuilder writer_;
-    // Send minified JSON.
-    writer_["indentation"] = "";
-    std::string serialized_req = Json::writeString(writer_, request);
+    Json::Value json_resp;
+    JSONCPP_STRING parse_err;
+    std::string sanitized_resp = SanitizeJson(reply_buf);
+
+    Json::CharReader *reader = Json::CharReaderBuilder().newCharReader();
+    bool success = reader->parse(sanitized_resp.c_str(),
+                                 sanitized_resp.c_str() + sanitized_resp.length(),
+                                 &json_resp, &parse_err);
+    delete reader;
+    if (success) {
+        return json_resp;
+    }
 
+    throw std::runtime_error("Error parsing response.");
+}
+
+/**
+ * Closes a socket at a deadline, aborting whichever operation on it is then
+ * awaited, unless cancelled (by leaving scope) first. The timer's handler
+ * shares ownership of the socket, so it can't outlive the socket even if it
+ * outlives the coroutine which awaited the socket.
+ */
+class SocketDeadline {
+public:
+    SocketDeadline(const std::shared_ptr<tcp::socket> &socket,
+                   const Deadline &deadline)
+        : timer_(socket->get_executor(), deadline)
+    {
+        timer_.async_wait([socket](error_code ec) {
+            if(! ec && socket->is_open()) {
+                socket->close(ec);
+            }
+        });
+    }
+
+    ~SocketDeadline()
+    {
+        timer_.cancel();
+    }
+
+private:
+    boost::asio::steady_timer timer_;
+};
+
+/**
+ * Send a serialized request over boost::asio, read the whole response.
+ *
+ * @param ip_addr IP addr of server.
+ * @param port Port of server.
+ * @param serialized_req Serialized request.
+ * @param timeout How long to wait for a response before giving up.
+ * @return Serialized response, or throw an error.
+ */
+static std::string ExchangeAsio(const std::string &ip_addr, unsigned short port,
+                                const std::string &serialized_req,
+                                std::chrono::milliseconds timeout)
+{
+    boost::asio::io_context io;
     tcp::socket s(io);
 
     // connect, send
@@ -64,39 +131,389 @@ Json::Value Client::MakeRequest(const std::string &ip_addr, unsigned short port,
     boost::asio::write(s, boost::asio::buffer(serialized_req));
     s.shutdown(tcp::socket::shutdown_send);
 
-    // read for max 5s
-    boost::asio::steady_timer timer(io, std::chrono::seconds(5));
+    // read for max timeout
+    boost::asio::steady_timer timer(io, timeout);
     timer.async_wait([&](error_code ec) { s.cancel(); });
 
-    std::string reply_buf, json_data;
+    std::string reply_buf;
     error_code  reply_ec;
     async_read(s, boost::asio::dynamic_buffer(reply_buf),
                [&](error_code ec, size_t) { timer.cancel(); reply_ec = ec; });
 
     io.run();
 
-    if (!reply_ec || reply_ec == boost::asio::error::eof) {
-        Json::Value json_resp;
-        JSONCPP_STRING parse_err;
-        std::string sanitized_resp = SanitizeJson(reply_buf);
-
-        Json::CharReader *reader = Json::CharReaderBuilder().newCharReader();
-        bool success = reader->parse(sanitized_resp.c_str(),
-                                     sanitized_resp.c_str() + sanitized_resp.length(),
-                                     &json_resp, &parse_err);
-        delete reader;
-        if (success) {
-            return json_resp;
+    if (reply_ec && reply_ec != boost::asio::error::eof) {
+        throw boost::system::system_error(reply_ec);
+    }
+    return reply_buf;
+}
+
+#ifdef HAVE_IO_URING
+/**
+ * Closes a file descriptor upon leaving scope.
+ */
+struct FdCloser {
+    int fd_;
+    ~FdCloser() { close(fd_); }
+};
+
+/**
+ * @param ip_addr IPv4 address in dotted decimal notation.
+ * @param port Port.
+ * @param addr Output: the corresponding socket address.
+ * @return Whether ip_addr could be parsed as an IPv4 address.
+ */
+static bool MakeSockAddr(const std::string &ip_addr, unsigned short port,
+                         sockaddr_in &addr)
+{
+    addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    return inet_pton(AF_INET, ip_addr.c_str(), &addr.sin_addr) == 1;
+}
+
+/**
+ * Exchanges requests and responses on an io_uring ring, one exchange at a
+ * time. Each thread making blocking requests gets one of these (see
+ * ThreadExchanger), so that the ring, and the receive buffer registered with
+ * it, are set up once per thread rather than once per request.
+ */
+class UringExchanger {
+public:
+    UringExchanger()
+        : ring_(8)
+        , buffer_(64 * 1024)
+    {
+        registered_ = ring_.RegisterBuffers({ { buffer_.data(),
+                                                buffer_.size() } });
+    }
+
+    /**
+     * Send a serialized request, read the whole response. Connecting,
+     * sending, shutting down our side and the first read are linked, and
+     * submitted together, so a response which arrives in one piece costs a
+     * single io_uring_enter (plus creating and closing the socket).
+     *
+     * @param addr Address of server.
+     * @param serialized_req Serialized request.
+     * @param deadline Time by which the exchange must complete.
+     * @return Serialized response, or throw an error.
+     */
+    std::string Exchange(const sockaddr_in &addr,
+                         const std::string &serialized_req,
+                         const Deadline &deadline)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0) {
+            throw boost::system::system_error(
+                    error_code(errno, boost::system::system_category()));
+        }
+        FdCloser closer { fd };
+
+        io_uring_sqe *sqe = ring_.NextSqe();
+        sqe->opcode = IORING_OP_CONNECT;
+        sqe->fd = fd;
+        sqe->addr = (std::uint64_t) &addr;
+        sqe->off = sizeof(addr);
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = CONNECT;
+        unsigned in_flight = 1 + QueueSend(fd, serialized_req, 0);
+
+        // An error fails the rest of the chain with ECANCELED, so the first
+        // error other than that is the one to report.
+        error_code ec;
+        std::string reply_buf;
+        size_t sent = 0;
+        io_uring_cqe cqe;
+        while(in_flight > 0) {
+            Await(fd, deadline, in_flight);
+            while(ring_.PopCompletion(cqe)) {
+                --in_flight;
+                if(cqe.res < 0) {
+                    if(! ec && cqe.res != -ECANCELED) {
+                        ec = error_code(-cqe.res,
+                                        boost::system::system_category());
+                    }
+                } else if(cqe.user_data == SEND) {
+                    // A short send breaks the chain; pick it up from there.
+                    sent += cqe.res;
+                    if(sent < serialized_req.size()) {
+                        in_flight += QueueSend(fd, serialized_req, sent);
+                    }
+                } else if(cqe.user_data == READ && cqe.res > 0) {
+                    reply_buf.append(buffer_.data(), cqe.res);
+                    QueueRead(fd);
+                    ++in_flight;
+                }
+            }
+        }
+
+        if(ec) {
+            throw boost::system::system_error(ec);
+        }
+        return reply_buf;
+    }
+
+    /**
+     * @param addr Address of server.
+     * @param deadline Time by which the connection must be established.
+     * @return Whether a connection could be established in time.
+     */
+    bool Connect(const sockaddr_in &addr, const Deadline &deadline)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if(fd < 0) {
+            return false;
+        }
+        FdCloser closer { fd };
+
+        io_uring_sqe *sqe = ring_.NextSqe();
+        sqe->opcode = IORING_OP_CONNECT;
+        sqe->fd = fd;
+        sqe->addr = (std::uint64_t) &addr;
+        sqe->off = sizeof(addr);
+        sqe->user_data = CONNECT;
+
+        unsigned in_flight = 1;
+        try {
+            Await(fd, deadline, in_flight);
+        } catch(const boost::system::system_error &) {
+            return false;
+        }
+        io_uring_cqe cqe;
+        ring_.PopCompletion(cqe);
+        return cqe.res == 0;
+    }
+
+private:
+    /// user_data of the operations making up an exchange.
+    enum : std::uint64_t { CONNECT = 1, SEND, SHUTDOWN, READ, CANCEL };
+
+    IoUring ring_;
+    /// Buffer into which responses are read.
+    std::vector<char> buffer_;
+    /// Was buffer_ registered with ring_?
+    bool registered_;
+
+    /**
+     * Queue the sending of the rest of a request, the shutting down of our
+     * side of the connection, and the first read of the response, linked
+     * (to each other, and to whatever was queued before them).
+     *
+     * @return Number of operations queued.
+     */
+    unsigned QueueSend(int fd, const std::string &serialized_req, size_t sent)
+    {
+        io_uring_sqe *sqe = ring_.NextSqe();
+        sqe->opcode = IORING_OP_SEND;
+        sqe->fd = fd;
+        sqe->addr = (std::uint64_t) (serialized_req.data() + sent);
+        sqe->len = serialized_req.size() - sent;
+        sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = SEND;
+
+        sqe = ring_.NextSqe();
+        sqe->opcode = IORING_OP_SHUTDOWN;
+        sqe->fd = fd;
+        sqe->len = SHUT_WR;
+        sqe->flags = IOSQE_IO_LINK;
+        sqe->user_data = SHUTDOWN;
+
+        QueueRead(fd);
+        return 3;
+    }
+
+    /**
+     * Queue a read of the response into buffer_.
+     */
+    void QueueRead(int fd)
+    {
+        io_uring_sqe *sqe = ring_.NextSqe();
+        sqe->opcode = registered_ ? IORING_OP_READ_FIXED : IORING_OP_RECV;
+        sqe->fd = fd;
+        sqe->addr = (std::uint64_t) buffer_.data();
+        sqe->len = buffer_.size();
+        sqe->buf_index = 0;
+        sqe->user_data = READ;
+    }
+
+    /**
+     * Submit whatever is queued, wait for everything in flight to complete,
+     * which normally takes a single io_uring_enter. If the deadline passes
+     * first (and nothing has completed), cancel what is in flight on fd
+     * (which must complete before fd is closed, and before the buffers it
+     * uses go away), then throw.
+     *
+     * @param in_flight Number of operations in flight.
+     */
+    void Await(int fd, const Deadline &deadline, unsigned in_flight)
+    {
+        if(ring_.SubmitAndWait(&deadline, in_flight)) {
+            return;
+        }
+
+        for(std::uint64_t op : { CONNECT, SEND, SHUTDOWN, READ }) {
+            io_uring_sqe *sqe = ring_.NextSqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = op;
+            sqe->user_data = CANCEL;
+        }
+        shutdown(fd, SHUT_RDWR);
+        io_uring_cqe cqe;
+        while(in_flight > 0) {
+            ring_.SubmitAndWait();
+            while(ring_.PopCompletion(cqe)) {
+                in_flight -= cqe.user_data != CANCEL;
+            }
+        }
+        throw boost::system::system_error(boost::asio::error::timed_out);
+    }
+};
+
+/**
+ * @return The calling thread's exchanger, or nullptr if the thread can't set
+ *         up a ring (e.g. because the process has too many), in which case
+ *         the thread's requests go through asio instead.
+ */
+static UringExchanger *ThreadExchanger()
+{
+    thread_local std::unique_ptr<UringExchanger> exchanger;
+    thread_local bool failed = false;
+    if(! exchanger && ! failed) {
+        try {
+            exchanger = std::make_unique<UringExchanger>();
+        } catch(const boost::system::system_error &) {
+            failed = true;
         }
+    }
+    return exchanger.get();
+}
+#endif
+
+/**
+ * Send JSON request to server, return JSON response from server, using
+ * whichever backend is in use.
+ *
+ * @param ip_addr IP addr of server.
+ * @param port Port of server.
+ * @param request Request to send to server.
+ * @param deadline Time by which the request must be answered.
+ * @return Response from server to our request.
+ */
+static Json::Value Exchange(const std::string &ip_addr, unsigned short port,
+                            const Json::Value &request,
+                            const Deadline &deadline)
+{
+    Json::StreamWriterBuilder writer_;
+    // Send minified JSON.
+    writer_["indentation"] = "";
+    std::string serialized_req = Json::writeString(writer_, request);
+
+#ifdef HAVE_IO_URING
+    sockaddr_in addr {};
+    UringExchanger *exchanger;
+    if(GetIoBackend() == IoBackend::IO_URING &&
+       MakeSockAddr(ip_addr, port, addr) && (exchanger = ThreadExchanger()))
+    {
+        return ParseResponse(exchanger->Exchange(addr, serialized_req,
+                                                 deadline));
+    }
+#endif
+
+    // Round up, so as not to give up before the deadline.
+    return ParseResponse(ExchangeAsio(
+            ip_addr, port, serialized_req,
+            std::chrono::ceil<std::chrono::milliseconds>(
+                    deadline - std::chrono::steady_clock::now())));
+}
+
+Json::Value Client::MakeRequest(const std::string &ip_addr, unsigned short port,
+                                const Json::Value &request,
+                                std::chrono::milliseconds timeout)
+{
+    return Exchange(ip_addr, port, request,
+                    std::chrono::steady_clock::now() + timeout);
+}
 
-        throw std::runtime_error("Error parsing response.");
-    } else {
+Json::Value Client::MakeRequest(const std::string &ip_addr, unsigned short port,
+                                Json::Value request, const Deadline &deadline)
+{
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+    if(remaining.count() <= 0) {
+        throw std::runtime_error("Deadline exceeded.");
+    }
+
+    request["DEADLINE_MS"] = (Json::Int64) remaining.count();
+    return Exchange(ip_addr, port, request, deadline);
+}
+
+Awaitable<Json::Value> Client::AsyncMakeRequest(std::string ip_addr,
+                                                unsigned short port,
+                                                Json::Value request,
+                                                Deadline deadline)
+{
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now());
+    if(remaining.count() <= 0) {
+        throw std::runtime_error("Deadline exceeded.");
+    }
+    request["DEADLINE_MS"] = (Json::Int64) remaining.count();
+
+    Json::StreamWriterBuilder writer_;
+    // Send minified JSON.
+    writer_["indentation"] = "";
+    std::string serialized_req = Json::writeString(writer_, request);
+
+    auto s = std::make_shared<tcp::socket>(
+            co_await boost::asio::this_coro::executor);
+
+    // Closing the socket once the deadline passes aborts whichever step of
+    // the exchange we are awaiting.
+    SocketDeadline timer(s, deadline);
+
+    // connect, send
+    co_await s->async_connect({boost::asio::ip::address::from_string(ip_addr),
+                               port}, boost::asio::use_awaitable);
+    co_await boost::asio::async_write(*s, boost::asio::buffer(serialized_req),
+                                      boost::asio::use_awaitable);
+    s->shutdown(tcp::socket::shutdown_send);
+
+    // read until the server closes the connection
+    std::string reply_buf;
+    error_code reply_ec;
+    co_await boost::asio::async_read(
+            *s, boost::asio::dynamic_buffer(reply_buf),
+            boost::asio::redirect_error(boost::asio::use_awaitable, reply_ec));
+    if(reply_ec && reply_ec != boost::asio::error::eof) {
         throw boost::system::system_error(reply_ec);
     }
+    co_return ParseResponse(reply_buf);
+}
+
+Deadline Client::GetDeadline(const Json::Value &request)
+{
+    auto now = std::chrono::steady_clock::now();
+    if(request.isMember("DEADLINE_MS")) {
+        return now + std::chrono::milliseconds(request["DEADLINE_MS"].asInt64());
+    }
+    return now + DEFAULT_REQUEST_BUDGET;
 }
 
 bool Client::IsAlive(const std::string &ip_addr, unsigned short port)
 {
+#ifdef HAVE_IO_URING
+    sockaddr_in addr {};
+    UringExchanger *exchanger;
+    if(GetIoBackend() == IoBackend::IO_URING &&
+       MakeSockAddr(ip_addr, port, addr) && (exchanger = ThreadExchanger()))
+    {
+        return exchanger->Connect(addr, std::chrono::steady_clock::now() +
+                                        DEFAULT_REQUEST_BUDGET);
+    }
+#endif
+
     boost::asio::io_context io_context;
     tcp::socket s(io_context);
     tcp::resolver resolver(io_context);
@@ -109,4 +526,22 @@ bool Client::IsAlive(const std::string &ip_addr, unsigned short port)
 
     s.close();
     return true;
-}
\ No newline at end of file
+}
+
+Awaitable<bool> Client::AsyncIsAlive(std::string ip_addr, unsigned short port,
+                                     Deadline deadline)
+{
+    auto s = std::make_shared<tcp::socket>(
+            co_await boost::asio::this_coro::executor);
+
+    // As in AsyncMakeRequest, a connection still pending at the deadline is
+    // aborted by closing the socket.
+    SocketDeadline timer(s, deadline);
+
+    error_code connect_ec;
+    co_await s->async_connect({boost::asio::ip::address::from_string(ip_addr),
+                               port},
+                              boost::asio::redirect_error(
+                                      boost::asio::use_awaitable, connect_ec));
+    co_return ! connect_ec;
+}
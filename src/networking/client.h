@@ -9,18 +9,75 @@
  * to:
  *      - Send JSON requests to a given IP/port combo and return JSON responses.
  *      - Determine whether or not a server is running on a given IP/port combo.
+ *      - Bound requests by a deadline. Requests carry the time remaining until
+ *        their deadline in a "DEADLINE_MS" field, which each hop decrements
+ *        before passing the request on, and which bounds how long we wait for
+ *        a response.
+ *      - Carry out blocking requests either on a fresh asio reactor
+ *        (portable), or on a per-thread io_uring ring (Linux only; see
+ *        io_uring.h), which submits a whole exchange in one syscall and skips
+ *        setting up a reactor for every request.
  */
 
 #include <json/json.h>
 #include <boost/asio.hpp>
 #include <boost/system/error_code.hpp>
 #include <boost/optional.hpp>
+#include <chrono>
+#include "coroutines.h"
 
 using boost::asio::ip::tcp;
 using boost::system::error_code;
 typedef boost::asio::detail::socket_option::integer<SOL_SOCKET, SO_RCVTIMEO>
         rcv_timeout_option;
 
+/// Point in (local, monotonic) time by which a request must be answered.
+using Deadline = std::chrono::steady_clock::time_point;
+
+/// Time budget given to requests whose sender did not specify a deadline.
+static const std::chrono::milliseconds DEFAULT_REQUEST_BUDGET(5000);
+
+/**
+ * Thrown when a server sheds our request with a "BUSY" response. Unlike other
+ * failed requests, this tells us nothing about whether the server is alive,
+ * only that it is overloaded, so callers should route around it (or retry it
+ * after the hint) rather than treat it as having failed.
+ */
+class BusyError : public std::runtime_error {
+public:
+    /**
+     * @param retry_after_ms The server's hint as to when it may accept
+     *                       requests again.
+     */
+    explicit BusyError(int retry_after_ms)
+        : std::runtime_error("Peer is busy.")
+        , retry_after_ms_(retry_after_ms)
+    {}
+
+    /// Milliseconds after which the server suggests we retry.
+    int retry_after_ms_;
+};
+
+/**
+ * Thrown when a server answers our request, but reports that it failed (e.g.
+ * because the key it concerns isn't there). Unlike a failure to reach the
+ * server, this tells us the server is alive and heard us, so callers should
+ * not retry the request elsewhere unless the server's errors say to.
+ */
+class RequestError : public std::runtime_error {
+public:
+    /**
+     * @param response The server's response, whose "ERRORS" say what failed.
+     */
+    explicit RequestError(Json::Value response)
+        : std::runtime_error("Failed request: " + response.toStyledString())
+        , response_(std::move(response))
+    {}
+
+    /// The server's response.
+    Json::Value response_;
+};
+
 class Client {
 public:
 
@@ -30,10 +87,54 @@ public:
      * @param ip_addr IP addr of server.
      * @param port Port of server.
      * @param request Request to send to server.
+     * @param timeout How long to wait for a response before giving up.
      * @return Response from server to our request..
      */
     static Json::Value MakeRequest(const std::string &ip_addr, unsigned short port,
-                                   const Json::Value &request);
+                                   const Json::Value &request,
+                                   std::chrono::milliseconds timeout =
+                                           DEFAULT_REQUEST_BUDGET);
+
+    /**
+     * Send JSON request to server with the time remaining until deadline in
+     * its "DEADLINE_MS" field, wait no longer than that for a response.
+     *
+     * @param ip_addr IP addr of server.
+     * @param port Port of server.
+     * @param request Request to send to server.
+     * @param deadline Time by which the request must be answered.
+     * @return Response from server to our request, or throw an error if the
+     *         deadline has already passed.
+     */
+    static Json::Value MakeRequest(const std::string &ip_addr, unsigned short port,
+                                   Json::Value request, const Deadline &deadline);
+
+    /**
+     * Awaitable version of MakeRequest(ip_addr, port, request, deadline), for
+     * use from coroutines. The exchange runs on the awaiting coroutine's
+     * executor rather than blocking a thread. (Arguments are taken by value,
+     * since they must outlive the caller's full expression.)
+     *
+     * @param ip_addr IP addr of server.
+     * @param port Port of server.
+     * @param request Request to send to server.
+     * @param deadline Time by which the request must be answered.
+     * @return Response from server to our request, or throw an error if the
+     *         deadline passes first.
+     */
+    static Awaitable<Json::Value> AsyncMakeRequest(std::string ip_addr,
+                                                   unsigned short port,
+                                                   Json::Value request,
+                                                   Deadline deadline);
+
+    /**
+     * Determine the deadline of a request we have received.
+     *
+     * @param request Request which may carry a "DEADLINE_MS" field.
+     * @return Now plus the request's remaining budget, or plus the default
+     *         budget if it has none.
+     */
+    static Deadline GetDeadline(const Json::Value &request);
 
     /**
      * Is a server running and accepting connections on ip_addr:port?
@@ -43,6 +144,18 @@ public:
      * @return Whether or not this IP/port combo accepts our requests.
      */
     static bool IsAlive(const std::string &ip_addr, unsigned short port);
+
+    /**
+     * Awaitable version of IsAlive, for use from coroutines.
+     *
+     * @param ip_addr IP address to message.
+     * @param port Port to message.
+     * @param deadline Time by which the connection must be established.
+     * @return Whether or not this IP/port combo accepts our requests.
+     */
+    static Awaitable<bool> AsyncIsAlive(std::string ip_addr,
+                                        unsigned short port,
+                                        Deadline deadline);
 };
 
 #endif
\ No newline at end of file
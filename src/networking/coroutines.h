@@ -0,0 +1,191 @@
+/**
+ * coroutines.h
+ *
+ * Maintenance routines (stabilization, finger table upkeep, etc.) are chains
+ * of RPCs which spend nearly all of their time waiting on the network. Written
+ * as blocking code, each such chain pins an OS thread for its whole duration,
+ * and RPCs which don't depend on each other still run one after the other.
+ *
+ * This file provides what's needed to write them as C++20 coroutines instead:
+ *      - MaintenanceExecutor : A small, process-wide thread pool on which all
+ *                              maintenance coroutines are interleaved.
+ *      - WhenAll             : Run several coroutines concurrently and wait
+ *                              for all of them to complete.
+ *      - RunCoroutine        : Run a coroutine on the maintenance executor,
+ *                              blocking the calling thread until it is done,
+ *                              for use from (not yet asynchronous) callers.
+ *      - AsyncSemaphore      : Bound how many coroutines do something at
+ *                              once, without holding a thread while waiting.
+ *
+ * Awaitable RPCs themselves are provided by Client::AsyncMakeRequest and
+ * RemotePeer::AsyncSendRequest.
+ */
+
+#ifndef CHORD_AND_DHASH_COROUTINES_H
+#define CHORD_AND_DHASH_COROUTINES_H
+
+#include <boost/asio.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/use_future.hpp>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+template<typename T>
+using Awaitable = boost::asio::awaitable<T>;
+
+/// Number of threads on which maintenance coroutines run.
+static const int NUM_MAINTENANCE_THREADS = 2;
+
+/**
+ * @return Thread pool shared by every maintenance coroutine in the process.
+ */
+inline boost::asio::thread_pool &MaintenanceExecutor()
+{
+    static boost::asio::thread_pool pool(NUM_MAINTENANCE_THREADS);
+    return pool;
+}
+
+/**
+ * Run tasks concurrently (interleaved on the current coroutine's executor,
+ * which should be a strand if tasks touch shared state), and wait for all of
+ * them to complete.
+ * @tparam T Result type of each task.
+ * @param tasks Coroutines to run.
+ * @return The result of each task, in order, or std::nullopt for each task
+ *         which threw an error.
+ */
+template<typename T>
+Awaitable<std::vector<std::optional<T>>>
+WhenAll(std::vector<Awaitable<T>> tasks)
+{
+    auto executor = co_await boost::asio::this_coro::executor;
+
+    // Shared with the tasks' completion handlers, which may outlive us if
+    // we are cancelled.
+    struct State {
+        explicit State(decltype(executor) ex, size_t num_tasks)
+            : results_(num_tasks)
+            , remaining_(num_tasks)
+            , done_(ex, boost::asio::steady_timer::time_point::max())
+        {}
+
+        std::vector<std::optional<T>> results_;
+        size_t remaining_;
+        boost::asio::steady_timer done_;
+    };
+    auto state = std::make_shared<State>(executor, tasks.size());
+
+    for(size_t i = 0; i < tasks.size(); ++i) {
+        boost::asio::co_spawn(executor, std::move(tasks[i]),
+            [state, i](const std::exception_ptr &err, T result) {
+                if(! err) {
+                    state->results_[i] = std::move(result);
+                }
+                if(--state->remaining_ == 0) {
+                    state->done_.cancel();
+                }
+            });
+    }
+
+    // The timer never expires on its own; the last task to finish cancels it.
+    if(state->remaining_ > 0) {
+        boost::system::error_code ignored_ec;
+        co_await state->done_.async_wait(
+                boost::asio::redirect_error(boost::asio::use_awaitable,
+                                            ignored_ec));
+    }
+    co_return std::move(state->results_);
+}
+
+/**
+ * Run a coroutine on its own strand of the maintenance executor and block
+ * until it completes. Must not be called from a maintenance thread.
+ * @tparam T Result type of the coroutine.
+ * @param task Coroutine to run.
+ * @return Its result, or throw the error it threw.
+ */
+template<typename T>
+T RunCoroutine(Awaitable<T> task)
+{
+    return boost::asio::co_spawn(
+            boost::asio::make_strand(MaintenanceExecutor()), std::move(task),
+            boost::asio::use_future).get();
+}
+
+/**
+ * Counting semaphore for coroutines. A coroutine waiting for a slot is
+ * suspended, holding no thread, until a Release hands the slot to it; slots
+ * are handed to waiters in the order they arrived. Acquire must be awaited
+ * on a strand (as every maintenance coroutine is), since Release wakes the
+ * waiter through its executor.
+ */
+class AsyncSemaphore {
+public:
+    /**
+     * @param slots Number of slots initially free.
+     */
+    explicit AsyncSemaphore(int slots)
+        : free_(slots)
+    {}
+
+    /**
+     * Take a slot, waiting for one to be released if none is free.
+     */
+    Awaitable<void> Acquire()
+    {
+        auto executor = co_await boost::asio::this_coro::executor;
+        auto waiter = std::make_shared<boost::asio::steady_timer>(
+                executor, boost::asio::steady_timer::time_point::max());
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(free_ > 0) {
+                --free_;
+                co_return;
+            }
+            waiters_.push_back(waiter);
+        }
+
+        // The timer never expires on its own; Release hands us its slot by
+        // expiring it.
+        boost::system::error_code ignored_ec;
+        co_await waiter->async_wait(
+                boost::asio::redirect_error(boost::asio::use_awaitable,
+                                            ignored_ec));
+    }
+
+    /**
+     * Give a slot back, to the longest waiting coroutine if there is one.
+     */
+    void Release()
+    {
+        std::shared_ptr<boost::asio::steady_timer> waiter;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if(waiters_.empty()) {
+                ++free_;
+                return;
+            }
+            waiter = std::move(waiters_.front());
+            waiters_.pop_front();
+        }
+
+        // Expire (rather than cancel) the timer on the waiter's own strand,
+        // so that it wakes even if its wait hasn't been started yet.
+        boost::asio::post(waiter->get_executor(), [waiter] {
+            waiter->expires_at(boost::asio::steady_timer::time_point::min());
+        });
+    }
+
+private:
+    std::mutex mutex_;
+    int free_;
+    std::deque<std::shared_ptr<boost::asio::steady_timer>> waiters_;
+};
+
+#endif
@@ -0,0 +1,737 @@
+#include "io_uring.h"
+#include <boost/system/system_error.hpp>
+#include <boost/throw_exception.hpp>
+
+#ifdef HAVE_IO_URING
+#include <netinet/in.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#endif
+
+/* ----------------------------------------------------------------------------
+ * BACKEND SELECTION
+ * -------------------------------------------------------------------------- */
+
+/**
+ * @return The backend in use, which defaults to IO_URING if it is available.
+ */
+static std::atomic<IoBackend> &Backend()
+{
+#ifdef HAVE_IO_URING
+    static std::atomic<IoBackend> backend(IoUring::Supported()
+                                          ? IoBackend::IO_URING
+                                          : IoBackend::ASIO);
+#else
+    static std::atomic<IoBackend> backend(IoBackend::ASIO);
+#endif
+    return backend;
+}
+
+void SetIoBackend(IoBackend backend)
+{
+#ifdef HAVE_IO_URING
+    if(backend == IoBackend::IO_URING && ! IoUring::Supported()) {
+        backend = IoBackend::ASIO;
+    }
+#else
+    backend = IoBackend::ASIO;
+#endif
+    Backend() = backend;
+}
+
+IoBackend GetIoBackend()
+{
+    return Backend();
+}
+
+#ifdef HAVE_IO_URING
+/**
+ * Throw the error described by errno as a boost::system::system_error, like
+ * asio would.
+ *
+ * @param what The call which failed.
+ */
+[[noreturn]] static void ThrowErrno(const char *what)
+{
+    boost::throw_exception(boost::system::system_error(
+            error_code(errno, boost::system::system_category()), what));
+}
+
+/* ----------------------------------------------------------------------------
+ * RING: Submission and completion queues shared with the kernel.
+ * -------------------------------------------------------------------------- */
+
+IoUring::IoUring(unsigned entries)
+    : sq_ring_(MAP_FAILED)
+    , cq_ring_(MAP_FAILED)
+    , sqes_map_(MAP_FAILED)
+    , sqe_tail_(0)
+{
+    io_uring_params params {};
+    ring_fd_ = (int) syscall(__NR_io_uring_setup, entries, &params);
+    if(ring_fd_ < 0) {
+        ThrowErrno("io_uring_setup");
+    }
+
+    // We wait with timeouts passed to io_uring_enter itself, rather than
+    // queueing timeout operations alongside the ones they bound.
+    if(! (params.features & IORING_FEAT_EXT_ARG)) {
+        Release();
+        errno = EOPNOTSUPP;
+        ThrowErrno("io_uring_setup");
+    }
+
+    sq_entries_ = params.sq_entries;
+    sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size_ = params.cq_off.cqes +
+                    params.cq_entries * sizeof(io_uring_cqe);
+    sqes_size_ = params.sq_entries * sizeof(io_uring_sqe);
+
+    // Both queues may live in one mapping.
+    bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+    if(single_mmap) {
+        sq_ring_size_ = cq_ring_size_ = std::max(sq_ring_size_, cq_ring_size_);
+    }
+    sq_ring_ = mmap(nullptr, sq_ring_size_, PROT_READ | PROT_WRITE,
+                    MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+    if(sq_ring_ != MAP_FAILED && single_mmap) {
+        cq_ring_ = sq_ring_;
+    } else if(sq_ring_ != MAP_FAILED) {
+        cq_ring_ = mmap(nullptr, cq_ring_size_, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, ring_fd_,
+                        IORING_OFF_CQ_RING);
+    }
+    if(cq_ring_ != MAP_FAILED) {
+        sqes_map_ = mmap(nullptr, sqes_size_, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+    }
+    if(sqes_map_ == MAP_FAILED) {
+        int mmap_errno = errno;
+        Release();
+        errno = mmap_errno;
+        ThrowErrno("mmap");
+    }
+
+    auto *sq = static_cast<char *>(sq_ring_);
+    sq_head_ = reinterpret_cast<unsigned *>(sq + params.sq_off.head);
+    sq_tail_ = reinterpret_cast<unsigned *>(sq + params.sq_off.tail);
+    sq_mask_ = reinterpret_cast<unsigned *>(sq + params.sq_off.ring_mask);
+    sq_array_ = reinterpret_cast<unsigned *>(sq + params.sq_off.array);
+    sqes_ = static_cast<io_uring_sqe *>(sqes_map_);
+
+    auto *cq = static_cast<char *>(cq_ring_);
+    cq_head_ = reinterpret_cast<unsigned *>(cq + params.cq_off.head);
+    cq_tail_ = reinterpret_cast<unsigned *>(cq + params.cq_off.tail);
+    cq_mask_ = reinterpret_cast<unsigned *>(cq + params.cq_off.ring_mask);
+    cqes_ = reinterpret_cast<io_uring_cqe *>(cq + params.cq_off.cqes);
+
+    sqe_tail_ = *sq_tail_;
+}
+
+IoUring::~IoUring()
+{
+    Release();
+}
+
+bool IoUring::Supported()
+{
+    static const bool supported = [] {
+        try {
+            IoUring probe(2);
+            return true;
+        } catch(const boost::system::system_error &) {
+            return false;
+        }
+    }();
+    return supported;
+}
+
+io_uring_sqe *IoUring::NextSqe()
+{
+    unsigned head = std::atomic_ref<unsigned>(*sq_head_).load(
+            std::memory_order_acquire);
+    if(sqe_tail_ - head >= sq_entries_) {
+        // Without SQPOLL, the kernel consumes everything we submit before
+        // io_uring_enter returns, so this frees the whole queue.
+        Submit();
+    }
+
+    unsigned index = sqe_tail_ & *sq_mask_;
+    sq_array_[index] = index;
+    ++sqe_tail_;
+
+    io_uring_sqe *sqe = &sqes_[index];
+    std::memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+void IoUring::Submit()
+{
+    unsigned to_submit = Publish();
+    while(to_submit > 0) {
+        int result = Enter(to_submit, 0, 0, nullptr, 0);
+        if(result < 0 && result != -EINTR) {
+            errno = -result;
+            ThrowErrno("io_uring_enter");
+        }
+        to_submit = Publish();
+    }
+}
+
+bool IoUring::SubmitAndWait(const Deadline *deadline, unsigned min_complete)
+{
+    io_uring_getevents_arg arg {};
+    __kernel_timespec timeout {};
+    while(true) {
+        unsigned to_submit = Publish();
+        unsigned ready = std::atomic_ref<unsigned>(*cq_tail_).load(
+                std::memory_order_acquire) - *cq_head_;
+        if(to_submit == 0 && ready >= min_complete) {
+            return true;
+        }
+
+        arg.ts = 0;
+        if(deadline) {
+            auto remaining = std::chrono::duration_cast<
+                    std::chrono::nanoseconds>(
+                            *deadline - std::chrono::steady_clock::now());
+            if(remaining.count() <= 0) {
+                Submit();
+                return ready > 0;
+            }
+            timeout.tv_sec = remaining.count() / 1000000000;
+            timeout.tv_nsec = remaining.count() % 1000000000;
+            arg.ts = (std::uint64_t) &timeout;
+        }
+
+        // The kernel waits until the completion queue holds min_complete
+        // completions, counting those we have yet to pop.
+        int result = Enter(to_submit, min_complete,
+                           IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG,
+                           &arg, sizeof(arg));
+        if(result < 0 && result != -EINTR && result != -ETIME) {
+            errno = -result;
+            ThrowErrno("io_uring_enter");
+        }
+    }
+}
+
+bool IoUring::PopCompletion(io_uring_cqe &cqe)
+{
+    unsigned head = *cq_head_;
+    if(head == std::atomic_ref<unsigned>(*cq_tail_).load(
+            std::memory_order_acquire))
+    {
+        return false;
+    }
+
+    cqe = cqes_[head & *cq_mask_];
+    std::atomic_ref<unsigned>(*cq_head_).store(head + 1,
+                                               std::memory_order_release);
+    return true;
+}
+
+bool IoUring::RegisterBuffers(const std::vector<iovec> &buffers)
+{
+    return syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_BUFFERS,
+                   buffers.data(), (unsigned) buffers.size()) == 0;
+}
+
+unsigned IoUring::Publish()
+{
+    std::atomic_ref<unsigned>(*sq_tail_).store(sqe_tail_,
+                                               std::memory_order_release);
+    return sqe_tail_ - std::atomic_ref<unsigned>(*sq_head_).load(
+            std::memory_order_acquire);
+}
+
+int IoUring::Enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+                   const void *arg, std::size_t arg_size)
+{
+    long result = syscall(__NR_io_uring_enter, ring_fd_, to_submit,
+                          min_complete, flags, arg, arg_size);
+    return result < 0 ? -errno : (int) result;
+}
+
+void IoUring::Release()
+{
+    if(sqes_map_ != MAP_FAILED) {
+        munmap(sqes_map_, sqes_size_);
+    }
+    if(cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+        munmap(cq_ring_, cq_ring_size_);
+    }
+    if(sq_ring_ != MAP_FAILED) {
+        munmap(sq_ring_, sq_ring_size_);
+    }
+    sq_ring_ = cq_ring_ = sqes_map_ = MAP_FAILED;
+    if(ring_fd_ >= 0) {
+        close(ring_fd_);
+        ring_fd_ = -1;
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * LOOP: A server's network IO, on a ring.
+ * -------------------------------------------------------------------------- */
+
+/// Number of entries in a loop's submission queue.
+static const unsigned LOOP_RING_ENTRIES = 256;
+
+/// Number of registered buffers into which a loop reads requests, and their
+/// size. A connection keeps its buffer until its request has been read, so
+/// this many connections can be read at once before the rest read into
+/// buffers of their own.
+static const int NUM_READ_BUFFERS = 64;
+static const std::size_t READ_BUFFER_SIZE = 16 * 1024;
+
+/// What a completion is for, stored in the low bits of its user_data (the
+/// rest being the handle of the connection it concerns, if any).
+enum LoopOp : std::uint64_t { OP_ACCEPT, OP_WAKEUP, OP_READ, OP_WRITE,
+                              OP_CLOSE, OP_CANCEL };
+static const int LOOP_OP_BITS = 3;
+
+/**
+ * @return user_data for an operation on a connection.
+ */
+static std::uint64_t Tag(std::uint64_t handle, LoopOp op)
+{
+    return (handle << LOOP_OP_BITS) | op;
+}
+
+/**
+ * A connection accepted by a UringLoop, from the loop's point of view.
+ */
+struct UringLoop::Connection {
+    /// Handle identifying the connection (to Respond, and in user_data).
+    std::uint64_t handle_;
+    /// Socket.
+    int fd_;
+    /// Whoever serves the connection.
+    boost::shared_ptr<UringConnection> connection_;
+    /// Index of the registered buffer into which the request is being read,
+    /// or -1 if none was free, in which case it is read into heap_buffer_.
+    int buffer_index_ = -1;
+    std::unique_ptr<char[]> heap_buffer_;
+    /// Response, and the first of its buffers not yet (entirely) written.
+    std::vector<iovec> response_;
+    std::size_t next_iov_ = 0;
+    msghdr msg_ {};
+    /// Did writing the response fail?
+    bool write_failed_ = false;
+    /// Number of operations in flight on the connection.
+    int ops_in_flight_ = 0;
+};
+
+/**
+ * Open, bind and listen on a socket.
+ *
+ * @param port Port on which to listen (on every IPv4 address).
+ * @param share_port Should SO_REUSEPORT be set?
+ * @return The listening socket, or throw an error.
+ */
+static int Listen(unsigned short port, bool share_port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) {
+        ThrowErrno("socket");
+    }
+
+    sockaddr_in addr {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    int on = 1;
+    const char *failed = nullptr;
+    if(setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) != 0 ||
+       (share_port &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) != 0))
+    {
+        failed = "setsockopt";
+    } else if(bind(fd, (const sockaddr *) &addr, sizeof(addr)) != 0) {
+        failed = "bind";
+    } else if(listen(fd, SOMAXCONN) != 0) {
+        failed = "listen";
+    }
+    if(failed) {
+        int listen_errno = errno;
+        close(fd);
+        errno = listen_errno;
+        ThrowErrno(failed);
+    }
+    return fd;
+}
+
+std::shared_ptr<UringLoop> UringLoop::Create(unsigned short port,
+                                             bool share_port,
+                                             ConnectionFactory new_connection)
+{
+    std::unique_ptr<IoUring> ring;
+    try {
+        ring = std::make_unique<IoUring>(LOOP_RING_ENTRIES);
+    } catch(const boost::system::system_error &) {
+        return nullptr;
+    }
+    return std::shared_ptr<UringLoop>(new UringLoop(std::move(ring), port,
+                                                    share_port,
+                                                    std::move(new_connection)));
+}
+
+UringLoop::UringLoop(std::unique_ptr<IoUring> ring, unsigned short port,
+                     bool share_port, ConnectionFactory new_connection)
+    : ring_(std::move(ring))
+    , listen_fd_(Listen(port, share_port))
+    , wakeup_fd_(eventfd(0, EFD_CLOEXEC))
+    , new_connection_(std::move(new_connection))
+    , read_buffers_(new char[NUM_READ_BUFFERS * READ_BUFFER_SIZE])
+    , buffers_registered_(false)
+    , next_handle_(1)
+    , accept_armed_(false)
+    , wakeup_armed_(false)
+    , wakeup_count_(0)
+    , woken_(false)
+    , stop_accepting_(false)
+    , stopping_(false)
+{
+    if(wakeup_fd_ < 0) {
+        int eventfd_errno = errno;
+        close(listen_fd_);
+        errno = eventfd_errno;
+        ThrowErrno("eventfd");
+    }
+
+    std::vector<iovec> buffers;
+    for(int i = 0; i < NUM_READ_BUFFERS; ++i) {
+        buffers.push_back({ read_buffers_.get() + i * READ_BUFFER_SIZE,
+                            READ_BUFFER_SIZE });
+        free_buffers_.push_back(NUM_READ_BUFFERS - 1 - i);
+    }
+    buffers_registered_ = ring_->RegisterBuffers(buffers);
+}
+
+UringLoop::~UringLoop()
+{
+    for(auto &[handle, connection] : connections_) {
+        close(connection->fd_);
+    }
+    close(listen_fd_);
+    close(wakeup_fd_);
+}
+
+void UringLoop::Run()
+{
+    if(stopping_) {
+        return;
+    }
+    ArmAccept();
+    ArmWakeup();
+
+    // Each pass submits everything queued while handling the previous
+    // pass's completions in one io_uring_enter, which also waits for the
+    // next completions.
+    while(accept_armed_ || wakeup_armed_ || ! connections_.empty()) {
+        ring_->SubmitAndWait();
+        io_uring_cqe cqe;
+        while(ring_->PopCompletion(cqe)) {
+            HandleCompletion(cqe);
+        }
+    }
+}
+
+void UringLoop::StopAccepting()
+{
+    stop_accepting_ = true;
+    // Stops the socket listening, which also fails the accept in flight.
+    shutdown(listen_fd_, SHUT_RDWR);
+}
+
+void UringLoop::Stop()
+{
+    stopping_ = true;
+    StopAccepting();
+    Wake();
+}
+
+void UringLoop::Respond(std::uint64_t handle, std::vector<iovec> response)
+{
+    {
+        std::lock_guard<std::mutex> lock(responses_mutex_);
+        responses_.emplace_back(handle, std::move(response));
+    }
+    Wake();
+}
+
+void UringLoop::ArmAccept()
+{
+    if(stop_accepting_) {
+        return;
+    }
+    io_uring_sqe *sqe = ring_->NextSqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = listen_fd_;
+    sqe->accept_flags = SOCK_CLOEXEC;
+    sqe->user_data = Tag(0, OP_ACCEPT);
+    accept_armed_ = true;
+}
+
+void UringLoop::ArmWakeup()
+{
+    io_uring_sqe *sqe = ring_->NextSqe();
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = wakeup_fd_;
+    sqe->addr = (std::uint64_t) &wakeup_count_;
+    sqe->len = sizeof(wakeup_count_);
+    sqe->user_data = Tag(0, OP_WAKEUP);
+    wakeup_armed_ = true;
+}
+
+void UringLoop::ArmRead(Connection &connection)
+{
+    io_uring_sqe *sqe = ring_->NextSqe();
+    sqe->fd = connection.fd_;
+    sqe->len = READ_BUFFER_SIZE;
+    if(connection.buffer_index_ >= 0) {
+        sqe->addr = (std::uint64_t) (read_buffers_.get() +
+                                     connection.buffer_index_ *
+                                     READ_BUFFER_SIZE);
+    } else {
+        sqe->addr = (std::uint64_t) connection.heap_buffer_.get();
+    }
+    if(connection.buffer_index_ >= 0 && buffers_registered_) {
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->buf_index = connection.buffer_index_;
+    } else {
+        sqe->opcode = IORING_OP_RECV;
+    }
+    sqe->user_data = Tag(connection.handle_, OP_READ);
+    ++connection.ops_in_flight_;
+}
+
+void UringLoop::ArmWrite(Connection &connection)
+{
+    connection.msg_ = {};
+    connection.msg_.msg_iov = connection.response_.data() +
+                              connection.next_iov_;
+    connection.msg_.msg_iovlen = connection.response_.size() -
+                                 connection.next_iov_;
+
+    // The connection is closed as soon as the response is written, in the
+    // same submission. (A short write cancels the close; see HandleWrite.)
+    io_uring_sqe *sqe = ring_->NextSqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = connection.fd_;
+    sqe->addr = (std::uint64_t) &connection.msg_;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_NOSIGNAL | MSG_WAITALL;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = Tag(connection.handle_, OP_WRITE);
+    ++connection.ops_in_flight_;
+
+    ArmClose(connection);
+}
+
+void UringLoop::ArmClose(Connection &connection)
+{
+    io_uring_sqe *sqe = ring_->NextSqe();
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = connection.fd_;
+    sqe->user_data = Tag(connection.handle_, OP_CLOSE);
+    ++connection.ops_in_flight_;
+}
+
+void UringLoop::HandleCompletion(const io_uring_cqe &cqe)
+{
+    auto op = (LoopOp) (cqe.user_data & ((1 << LOOP_OP_BITS) - 1));
+    if(op == OP_ACCEPT) {
+        HandleAccept(cqe.res);
+        return;
+    } else if(op == OP_WAKEUP) {
+        HandleWakeup();
+        return;
+    } else if(op == OP_CANCEL) {
+        return;
+    }
+
+    auto it = connections_.find(cqe.user_data >> LOOP_OP_BITS);
+    if(it == connections_.end()) {
+        return;
+    }
+    Connection &connection = *it->second;
+    --connection.ops_in_flight_;
+
+    // Once stopping, connections are closed as soon as nothing is in flight
+    // on them (CloseAll having cancelled whatever was).
+    if(stopping_) {
+        if(connection.ops_in_flight_ == 0) {
+            if(op != OP_CLOSE || cqe.res == -ECANCELED) {
+                close(connection.fd_);
+            }
+            connections_.erase(it);
+        }
+        return;
+    }
+
+    switch(op) {
+    case OP_READ:
+        HandleRead(connection, cqe.res);
+        break;
+    case OP_WRITE:
+        HandleWrite(connection, cqe.res);
+        break;
+    default:
+        // A close cancelled by a short or failed write is resubmitted, along
+        // with the rest of the response if there is any; otherwise, the
+        // connection is done with.
+        if(cqe.res != -ECANCELED) {
+            connections_.erase(it);
+        } else if(! connection.write_failed_ &&
+                  connection.next_iov_ < connection.response_.size())
+        {
+            ArmWrite(connection);
+        } else {
+            ArmClose(connection);
+        }
+        break;
+    }
+}
+
+void UringLoop::HandleAccept(int result)
+{
+    accept_armed_ = false;
+    if(result >= 0 && stopping_) {
+        close(result);
+    } else if(result >= 0) {
+        auto connection = std::make_unique<Connection>();
+        connection->handle_ = next_handle_++;
+        connection->fd_ = result;
+        if(! free_buffers_.empty()) {
+            connection->buffer_index_ = free_buffers_.back();
+            free_buffers_.pop_back();
+        } else {
+            connection->heap_buffer_.reset(new char[READ_BUFFER_SIZE]);
+        }
+        connection->connection_ = new_connection_();
+        connection->connection_->OnAccept(shared_from_this(),
+                                          connection->handle_);
+
+        ArmRead(*connection);
+        connections_.emplace(connection->handle_, std::move(connection));
+    }
+
+    // Errors other than our listening socket being shut down (e.g. running
+    // out of file descriptors) are transient, so keep accepting regardless.
+    ArmAccept();
+}
+
+void UringLoop::HandleWakeup()
+{
+    wakeup_armed_ = false;
+    woken_.exchange(false);
+
+    std::vector<std::pair<std::uint64_t, std::vector<iovec>>> responses;
+    {
+        std::lock_guard<std::mutex> lock(responses_mutex_);
+        responses.swap(responses_);
+    }
+    for(auto &[handle, response] : responses) {
+        auto it = connections_.find(handle);
+        if(it != connections_.end() && ! stopping_) {
+            it->second->response_ = std::move(response);
+            ArmWrite(*it->second);
+        }
+    }
+
+    if(stopping_) {
+        CloseAll();
+    } else {
+        ArmWakeup();
+    }
+}
+
+void UringLoop::HandleRead(Connection &connection, int result)
+{
+    if(result > 0) {
+        const char *data = connection.buffer_index_ >= 0
+                ? read_buffers_.get() + connection.buffer_index_ *
+                                        READ_BUFFER_SIZE
+                : connection.heap_buffer_.get();
+        connection.connection_->OnData(data, result);
+        ArmRead(connection);
+        return;
+    }
+
+    if(connection.buffer_index_ >= 0) {
+        free_buffers_.push_back(connection.buffer_index_);
+        connection.buffer_index_ = -1;
+    }
+    connection.heap_buffer_.reset();
+
+    // The client is done sending, so its request can be handled, and the
+    // response written once Respond hands it to us. If the read failed,
+    // there is no one to respond to.
+    if(result == 0) {
+        connection.connection_->OnRequestRead();
+    } else {
+        ArmClose(connection);
+    }
+}
+
+void UringLoop::HandleWrite(Connection &connection, int result)
+{
+    if(result < 0) {
+        connection.write_failed_ = true;
+        return;
+    }
+
+    // Skip over what was written, so that if the write was short, the rest
+    // is written when the cancelled close comes back.
+    auto written = (std::size_t) result;
+    while(connection.next_iov_ < connection.response_.size()) {
+        iovec &iov = connection.response_[connection.next_iov_];
+        if(written < iov.iov_len) {
+            iov.iov_base = static_cast<char *>(iov.iov_base) + written;
+            iov.iov_len -= written;
+            break;
+        }
+        written -= iov.iov_len;
+        ++connection.next_iov_;
+    }
+}
+
+void UringLoop::Wake()
+{
+    if(! woken_.exchange(true)) {
+        std::uint64_t one = 1;
+        if(write(wakeup_fd_, &one, sizeof(one)) < 0) {
+            // Only fails if the counter would overflow, in which case a
+            // wakeup is pending anyway.
+        }
+    }
+}
+
+void UringLoop::CloseAll()
+{
+    for(auto it = connections_.begin(); it != connections_.end(); ) {
+        if(it->second->ops_in_flight_ == 0) {
+            close(it->second->fd_);
+            it = connections_.erase(it);
+        } else {
+            // Cancel whatever is in flight, after which the connection is
+            // closed by HandleCompletion. (A close in flight is left be.)
+            for(LoopOp op : { OP_READ, OP_WRITE }) {
+                io_uring_sqe *sqe = ring_->NextSqe();
+                sqe->opcode = IORING_OP_ASYNC_CANCEL;
+                sqe->addr = Tag(it->first, op);
+                sqe->user_data = Tag(0, OP_CANCEL);
+            }
+            ++it;
+        }
+    }
+}
+#endif
@@ -0,0 +1,397 @@
+/**
+ * io_uring.h
+ *
+ * This file aims to implement an io_uring transport for clients and servers,
+ * as an alternative to boost::asio (and its epoll reactor) on Linux. Small
+ * RPCs spend most of their time in syscalls: a client connects, writes, shuts
+ * down and reads, a server accepts, reads and writes, each a syscall (plus
+ * epoll's own). With io_uring, all of those are queued in a ring shared with
+ * the kernel, and submitted, then reaped, together. Other files should be
+ * able to:
+ *      - Choose, at runtime, whether clients and servers use io_uring or asio
+ *        (IoBackend). io_uring is used by default wherever the kernel allows
+ *        it; asio is used wherever it doesn't (other platforms, kernels older
+ *        than 5.11, or io_uring being disabled), so callers never need to
+ *        check for themselves.
+ *      - IoUring       : Set up a ring with the raw io_uring_setup /
+ *                        io_uring_enter / io_uring_register syscalls, queue
+ *                        operations on it, submit them in one batch and reap
+ *                        their completions.
+ *      - UringLoop     : Run a server's network IO on a ring: accept
+ *                        connections, read each request into a buffer
+ *                        registered with the kernel, then write the response
+ *                        and close the connection. Everything queued while
+ *                        handling one batch of completions is submitted with
+ *                        the same io_uring_enter, so under load a whole batch
+ *                        of RPCs costs one syscall.
+ *      - UringConnection : What a UringLoop needs of the sessions it feeds
+ *                        (see Session in server.h), which hand it their
+ *                        responses with UringLoop::Respond.
+ */
+
+#ifndef CHORD_AND_DHASH_IO_URING_H
+#define CHORD_AND_DHASH_IO_URING_H
+
+#include <boost/shared_ptr.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "client.h"
+
+// io_uring is only used where its headers know of the features we rely on
+// (IORING_FEAT_EXT_ARG came with Linux 5.11, as did IORING_OP_SHUTDOWN).
+#if defined(__linux__) && __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+#ifdef IORING_FEAT_EXT_ARG
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+/**
+ * How clients and servers do their network IO.
+ *   - ASIO     : With boost::asio, on an epoll reactor. Portable.
+ *   - IO_URING : On io_uring rings, with registered buffers and batched
+ *                submissions. Linux 5.11+ only.
+ */
+enum class IoBackend { ASIO, IO_URING };
+
+/**
+ * Choose how clients (from now on) and servers (constructed from now on) do
+ * their network IO, in all threads. Defaults to IO_URING where available.
+ *
+ * @param backend Backend to use. If IO_URING is unavailable, ASIO is used
+ *                instead.
+ */
+void SetIoBackend(IoBackend backend);
+
+/**
+ * @return How clients and servers currently do their network IO.
+ */
+IoBackend GetIoBackend();
+
+class UringLoop;
+
+/**
+ * A connection accepted by a UringLoop, from the point of view of whoever
+ * serves it. All three calls are made on the loop's thread, in order.
+ */
+class UringConnection {
+public:
+    virtual ~UringConnection() = default;
+
+    /**
+     * The connection has been accepted.
+     *
+     * @param loop Loop which accepted it, to which to hand the response.
+     * @param handle Handle identifying the connection to the loop.
+     */
+    virtual void OnAccept(std::shared_ptr<UringLoop> loop,
+                          std::uint64_t handle) = 0;
+
+    /**
+     * More of the request has been read.
+     *
+     * @param data Bytes read.
+     * @param length Number of bytes read.
+     */
+    virtual void OnData(const char *data, std::size_t length) = 0;
+
+    /**
+     * The client has finished sending its request (i.e. shut down its side
+     * of the connection), so it can be handled.
+     */
+    virtual void OnRequestRead() = 0;
+};
+
+#ifdef HAVE_IO_URING
+/**
+ * An io_uring instance: a submission queue, on which operations are queued
+ * for the kernel, and a completion queue, on which the kernel reports their
+ * results. Not thread-safe; each ring belongs to one thread.
+ */
+class IoUring {
+public:
+    /**
+     * Set up a ring.
+     *
+     * @param entries Minimum size of the submission queue.
+     */
+    explicit IoUring(unsigned entries);
+
+    IoUring(const IoUring &rhs) = delete;
+    IoUring &operator=(const IoUring &rhs) = delete;
+
+    ~IoUring();
+
+    /**
+     * @return Whether the kernel lets us set up rings with the features we
+     *         need (probed once, the first time this is called).
+     */
+    static bool Supported();
+
+    /**
+     * Queue an operation. If the submission queue is full, what it holds is
+     * submitted first.
+     *
+     * @return Zeroed entry for the operation, to be filled in by the caller
+     *         before the next submission.
+     */
+    io_uring_sqe *NextSqe();
+
+    /**
+     * Submit all queued operations, without waiting for any to complete.
+     */
+    void Submit();
+
+    /**
+     * Submit all queued operations, then wait until some completions can be
+     * popped.
+     *
+     * @param deadline Time until which to wait, or nullptr to wait for as
+     *                 long as it takes.
+     * @param min_complete Number of completions to wait for.
+     * @return Whether a completion can be popped (false if the deadline
+     *         passed before any could).
+     */
+    bool SubmitAndWait(const Deadline *deadline = nullptr,
+                       unsigned min_complete = 1);
+
+    /**
+     * Pop the oldest completion off the completion queue, if there is one.
+     *
+     * @param cqe Output: the completion.
+     * @return Whether there was one.
+     */
+    bool PopCompletion(io_uring_cqe &cqe);
+
+    /**
+     * Register buffers with the kernel, which then need not map them for
+     * every read into them (see IORING_OP_READ_FIXED).
+     *
+     * @param buffers Buffers to register. Buffer i then has buf_index i.
+     * @return Whether they were registered (which can fail, e.g. if they
+     *         exceed the locked memory limit).
+     */
+    bool RegisterBuffers(const std::vector<iovec> &buffers);
+
+private:
+    /// File descriptor of the ring.
+    int ring_fd_;
+    /// Number of entries in the submission queue.
+    unsigned sq_entries_;
+    /// Mappings of the submission queue, completion queue (which may be the
+    /// same one) and submission queue entries, with their sizes.
+    void *sq_ring_, *cq_ring_, *sqes_map_;
+    std::size_t sq_ring_size_, cq_ring_size_, sqes_size_;
+    /// Submission queue fields shared with the kernel.
+    unsigned *sq_head_, *sq_tail_, *sq_mask_, *sq_array_;
+    /// Completion queue fields shared with the kernel.
+    unsigned *cq_head_, *cq_tail_, *cq_mask_;
+    io_uring_sqe *sqes_;
+    io_uring_cqe *cqes_;
+    /// Tail of the submission queue including entries handed out by NextSqe
+    /// but not yet published to the kernel.
+    unsigned sqe_tail_;
+
+    /**
+     * Publish queued entries to the kernel.
+     * @return Number of entries the kernel has yet to consume.
+     */
+    unsigned Publish();
+
+    /**
+     * Call io_uring_enter.
+     * @return Its result, or -errno.
+     */
+    int Enter(unsigned to_submit, unsigned min_complete, unsigned flags,
+              const void *arg, std::size_t arg_size);
+
+    /**
+     * Unmap whatever has been mapped and close the ring.
+     */
+    void Release();
+};
+
+/**
+ * Serves a port on an io_uring ring, running on one thread (see Run). Each
+ * accepted connection is handed to a UringConnection made for it, which is
+ * fed the request as it is read, and which eventually hands back a response
+ * (from any thread) with Respond. The response is written, and the
+ * connection closed, by the loop.
+ */
+class UringLoop : public std::enable_shared_from_this<UringLoop> {
+public:
+    /// Makes the object which will serve a newly accepted connection.
+    using ConnectionFactory =
+            std::function<boost::shared_ptr<UringConnection>()>;
+
+    /**
+     * Listen on a port, to be served by a new loop. Clients may connect
+     * straight away (their connections are then accepted once Run is
+     * called).
+     *
+     * @param port Port on which to listen (on every IPv4 address).
+     * @param share_port Should the port be shared with other listeners (via
+     *                   SO_REUSEPORT), letting the kernel spread incoming
+     *                   connections across them?
+     * @param new_connection Factory for connections' UringConnections.
+     * @return The loop, or nullptr if no ring could be set up for it (in
+     *         which case the port should be served some other way). Throws
+     *         an error if the port can't be listened on.
+     */
+    static std::shared_ptr<UringLoop> Create(unsigned short port,
+                                             bool share_port,
+                                             ConnectionFactory new_connection);
+
+    UringLoop(const UringLoop &rhs) = delete;
+    UringLoop &operator=(const UringLoop &rhs) = delete;
+
+    ~UringLoop();
+
+    /**
+     * Serve connections until Stop is called. Must be called on at most one
+     * thread at once.
+     */
+    void Run();
+
+    /**
+     * Stop accepting connections (as of when this returns, new connections
+     * are refused). Connections already accepted are still served.
+     * Thread-safe.
+     */
+    void StopAccepting();
+
+    /**
+     * Make Run close every connection (without serving them any further) and
+     * return. Thread-safe.
+     */
+    void Stop();
+
+    /**
+     * Write a response to a connection, then close it. Thread-safe.
+     *
+     * @param handle Handle of the connection, as given to its OnAccept.
+     * @param response Buffers making up the response. They must stay valid
+     *                 until the connection's UringConnection is released
+     *                 (which the loop does once the connection is closed).
+     */
+    void Respond(std::uint64_t handle, std::vector<iovec> response);
+
+private:
+    struct Connection;
+
+    /// The ring on which all of our IO runs.
+    std::unique_ptr<IoUring> ring_;
+    /// Listening socket.
+    int listen_fd_;
+    /// eventfd through which other threads wake Run.
+    int wakeup_fd_;
+    /// Makes the UringConnection for each accepted connection.
+    ConnectionFactory new_connection_;
+    /// Memory for the buffers into which requests are read, registered with
+    /// the kernel, and the indexes of those not currently lent to a
+    /// connection.
+    std::unique_ptr<char[]> read_buffers_;
+    std::vector<int> free_buffers_;
+    /// Were read_buffers_ registered? If not, reads into them are plain
+    /// recv()s.
+    bool buffers_registered_;
+    /// Connections accepted and not yet closed, by handle.
+    std::unordered_map<std::uint64_t, std::unique_ptr<Connection>>
+            connections_;
+    /// Handle of the next connection to be accepted.
+    std::uint64_t next_handle_;
+    /// Is an accept (or wakeup read) in flight?
+    bool accept_armed_, wakeup_armed_;
+    /// Counter read off wakeup_fd_.
+    std::uint64_t wakeup_count_;
+    /// Responses handed to Respond and not yet picked up by Run.
+    std::mutex responses_mutex_;
+    std::vector<std::pair<std::uint64_t, std::vector<iovec>>> responses_;
+    /// Has Run been woken (through wakeup_fd_) since it last picked up
+    /// responses? Saves waking it once per response when many arrive at
+    /// once.
+    std::atomic<bool> woken_;
+    /// Has StopAccepting/Stop been called?
+    std::atomic<bool> stop_accepting_, stopping_;
+
+    /**
+     * Constructor (see Create).
+     */
+    UringLoop(std::unique_ptr<IoUring> ring, unsigned short port,
+              bool share_port, ConnectionFactory new_connection);
+
+    /**
+     * Queue an accept on the listening socket, unless we have stopped
+     * accepting.
+     */
+    void ArmAccept();
+
+    /**
+     * Queue a read of wakeup_fd_, which completes once Wake is next called.
+     */
+    void ArmWakeup();
+
+    /**
+     * Queue a read of (more of) a connection's request into its buffer.
+     */
+    void ArmRead(Connection &connection);
+
+    /**
+     * Queue a write of (the rest of) a connection's response, linked to a
+     * close of the connection.
+     */
+    void ArmWrite(Connection &connection);
+
+    /**
+     * Queue a close of a connection.
+     */
+    void ArmClose(Connection &connection);
+
+    /**
+     * Handle a completion, queueing whatever operations follow from it.
+     */
+    void HandleCompletion(const io_uring_cqe &cqe);
+
+    /**
+     * @param result Accepted socket, or -errno.
+     */
+    void HandleAccept(int result);
+
+    /**
+     * Pick up the responses handed to Respond (or our cue to stop).
+     */
+    void HandleWakeup();
+
+    /**
+     * @param result Number of bytes read into the connection's buffer, or
+     *               -errno.
+     */
+    void HandleRead(Connection &connection, int result);
+
+    /**
+     * @param result Number of bytes of the response written, or -errno.
+     */
+    void HandleWrite(Connection &connection, int result);
+
+    /**
+     * Wake Run, unless it has already been woken and not yet noticed.
+     */
+    void Wake();
+
+    /**
+     * Close every connection, at once if nothing is in flight on it, or else
+     * once whatever is (which is cancelled) completes.
+     */
+    void CloseAll();
+};
+#endif
+
+#endif
@@ -0,0 +1,237 @@
+#include "request_trace.h"
+#include "client.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <sstream>
+
+/* ----------------------------------------------------------------------------
+ * RECORDING: Append requests to a trace file.
+ * -------------------------------------------------------------------------- */
+
+bool TraceFilter::Matches(const Json::Value &request) const
+{
+    if(! include_maintenance_ && request["CLASS"].asString() == "MAINTENANCE") {
+        return false;
+    }
+    return commands_.empty() ||
+           commands_.find(request["COMMAND"].asString()) != commands_.end();
+}
+
+TraceRecorder::~TraceRecorder()
+{
+    Stop();
+}
+
+void TraceRecorder::Start(const std::string &path, TraceFilter filter)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(out_.is_open()) {
+        out_.close();
+    }
+    filter_ = std::move(filter);
+
+    // The buffer must be in place before the file is opened.
+    buffer_.resize(BUFFER_SIZE);
+    out_.rdbuf()->pubsetbuf(buffer_.data(), (std::streamsize) buffer_.size());
+    out_.open(path, std::ofstream::out | std::ofstream::app);
+    if(! out_) {
+        throw std::runtime_error("Failed to open trace file " + path);
+    }
+    recording_ = true;
+}
+
+void TraceRecorder::Stop()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    recording_ = false;
+    if(out_.is_open()) {
+        out_.close();
+    }
+}
+
+void TraceRecorder::Record(unsigned short port, const Json::Value &request,
+                           std::string_view raw_request)
+{
+    auto timestamp = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::system_clock::now().time_since_epoch());
+
+    // Records are one per line. Newlines in JSON can only be whitespace
+    // between tokens, so in the rare request which has any, they can be
+    // blanked out without changing what it says.
+    std::string flattened;
+    if(std::memchr(raw_request.data(), '\n', raw_request.size()) ||
+       std::memchr(raw_request.data(), '\r', raw_request.size()))
+    {
+        flattened = raw_request;
+        std::replace(flattened.begin(), flattened.end(), '\n', ' ');
+        std::replace(flattened.begin(), flattened.end(), '\r', ' ');
+        raw_request = flattened;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if(! out_.is_open() || ! filter_.Matches(request)) {
+        return;
+    }
+    out_ << timestamp.count() << ' ' << port << ' ';
+    out_.write(raw_request.data(), (std::streamsize) raw_request.size());
+    out_ << '\n';
+}
+
+std::vector<TraceRecord> TraceRecorder::Load(const std::string &path)
+{
+    std::ifstream in(path);
+    if(! in) {
+        throw std::runtime_error("Failed to open trace file " + path);
+    }
+
+    std::unique_ptr<Json::CharReader> reader(
+            Json::CharReaderBuilder().newCharReader());
+    std::vector<TraceRecord> records;
+    std::string line;
+    while(std::getline(in, line)) {
+        if(line.empty()) {
+            continue;
+        }
+
+        std::istringstream fields(line);
+        long long timestamp;
+        unsigned short port;
+        if(! (fields >> timestamp >> port)) {
+            throw std::runtime_error("Malformed trace record: " + line);
+        }
+
+        // The request is the rest of the line, after the space following
+        // the port.
+        size_t offset = (size_t) fields.tellg() + 1;
+        Json::Value request;
+        JSONCPP_STRING parse_err;
+        if(offset > line.size() ||
+           ! reader->parse(line.data() + offset, line.data() + line.size(),
+                           &request, &parse_err))
+        {
+            throw std::runtime_error("Malformed trace record: " + line);
+        }
+        records.push_back({ std::chrono::microseconds(timestamp), port,
+                            std::move(request) });
+    }
+    return records;
+}
+
+
+/* ----------------------------------------------------------------------------
+ * REPLAY: Re-issue traced requests and measure how they fare.
+ * -------------------------------------------------------------------------- */
+
+double ReplayReport::Throughput() const
+{
+    if(elapsed_.count() == 0) {
+        return 0;
+    }
+    return (double) (num_requests_ - num_failed_) * 1e6 /
+           (double) elapsed_.count();
+}
+
+ReplayReport::operator Json::Value() const
+{
+    Json::Value report_json;
+    report_json["NUM_REQUESTS"] = Json::UInt64(num_requests_);
+    report_json["NUM_FAILED"] = Json::UInt64(num_failed_);
+    report_json["ELAPSED_US"] = Json::Int64(elapsed_.count());
+    report_json["THROUGHPUT"] = Throughput();
+    report_json["P50_US"] = Json::Int64(p50_.count());
+    report_json["P90_US"] = Json::Int64(p90_.count());
+    report_json["P99_US"] = Json::Int64(p99_.count());
+    report_json["MAX_US"] = Json::Int64(max_.count());
+    return report_json;
+}
+
+TraceReplayer::TraceReplayer(std::vector<Target> targets, double time_scale,
+                             TraceFilter filter)
+    : targets_(std::move(targets))
+    , time_scale_(std::max(time_scale, 0.0))
+    , filter_(std::move(filter))
+{
+    if(targets_.empty()) {
+        throw std::runtime_error("No targets to replay against.");
+    }
+}
+
+ReplayReport TraceReplayer::Replay(std::vector<TraceRecord> records) const
+{
+    std::erase_if(records, [this](const TraceRecord &record) {
+        return ! filter_.Matches(record.request_);
+    });
+
+    ReplayReport report;
+    report.num_requests_ = records.size();
+    if(records.empty()) {
+        return report;
+    }
+
+    std::stable_sort(records.begin(), records.end(),
+                     [](const TraceRecord &lhs, const TraceRecord &rhs) {
+                         return lhs.timestamp_ < rhs.timestamp_;
+                     });
+
+    std::map<unsigned short, const Target *> by_port;
+    for(const Target &target : targets_) {
+        by_port.emplace(target.second, &target);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<Awaitable<std::chrono::microseconds>> replays;
+    for(size_t i = 0; i < records.size(); ++i) {
+        auto it = by_port.find(records[i].port_);
+        const Target &target = it != by_port.end()
+                               ? *it->second
+                               : targets_[i % targets_.size()];
+        auto offset = std::chrono::duration_cast<std::chrono::microseconds>(
+                (records[i].timestamp_ - records.front().timestamp_) *
+                time_scale_);
+        replays.push_back(ReplayOne(target, std::move(records[i].request_),
+                                    start + offset));
+    }
+
+    std::vector<std::chrono::microseconds> latencies;
+    for(const auto &latency : RunCoroutine(WhenAll(std::move(replays)))) {
+        if(latency.has_value()) {
+            latencies.push_back(*latency);
+        }
+    }
+    report.elapsed_ = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start);
+    report.num_failed_ = report.num_requests_ - latencies.size();
+
+    if(! latencies.empty()) {
+        std::sort(latencies.begin(), latencies.end());
+        auto percentile = [&latencies](size_t p) {
+            return latencies[std::min(latencies.size() - 1,
+                                      latencies.size() * p / 100)];
+        };
+        report.p50_ = percentile(50);
+        report.p90_ = percentile(90);
+        report.p99_ = percentile(99);
+        report.max_ = latencies.back();
+    }
+    return report;
+}
+
+Awaitable<std::chrono::microseconds> TraceReplayer::ReplayOne(
+        Target target, Json::Value request,
+        std::chrono::steady_clock::time_point send_at)
+{
+    boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor,
+                                    send_at);
+    co_await timer.async_wait(boost::asio::use_awaitable);
+
+    auto sent = std::chrono::steady_clock::now();
+    Json::Value response = co_await Client::AsyncMakeRequest(
+            target.first, target.second, std::move(request),
+            sent + DEFAULT_REQUEST_BUDGET);
+    if(! response["SUCCESS"].asBool()) {
+        throw std::runtime_error(response["ERRORS"].asString());
+    }
+    co_return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - sent);
+}
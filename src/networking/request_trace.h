@@ -0,0 +1,202 @@
+/**
+ * request_trace.h
+ *
+ * This file aims to implement the capture and replay of the requests a server
+ * receives, so that real workloads (e.g. the traffic leading up to an
+ * incident) can be reproduced against an in-process cluster, and so that two
+ * builds can be compared on the same traffic.
+ *
+ *      - TraceFilter   : Which requests to capture or replay. Peers also
+ *                        send one another requests (e.g. to maintain the
+ *                        ring), and replaying those would rewrite the
+ *                        membership of the cluster replayed against rather
+ *                        than reproduce the load on it, so peers capture only
+ *                        the commands clients send by default.
+ *      - TraceRecorder : Appends each request a server receives (that passes
+ *                        its filter) to a trace file, as one line of the form
+ *                            <unix time in us> <port> <request JSON>
+ *                        The request is written exactly as it arrived, so
+ *                        recording costs a timestamp and a buffered write,
+ *                        not a serialization.
+ *      - TraceReplayer : Loads one or more traces and re-issues their
+ *                        requests against a set of servers, with their
+ *                        original spacing (optionally sped up or slowed
+ *                        down), reporting latency and throughput. Requests
+ *                        are issued open-loop, as they were in production:
+ *                        a slow response never delays the next request.
+ */
+
+#ifndef CHORD_AND_DHASH_REQUEST_TRACE_H
+#define CHORD_AND_DHASH_REQUEST_TRACE_H
+
+#include <json/json.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "coroutines.h"
+
+/**
+ * A request read back from a trace.
+ */
+struct TraceRecord {
+    /// Wall-clock time at which the request was received.
+    std::chrono::microseconds timestamp_;
+    /// Port of the server which received it.
+    unsigned short port_;
+    /// The request itself.
+    Json::Value request_;
+};
+
+/**
+ * Which requests to capture or replay.
+ */
+struct TraceFilter {
+    /// Commands to keep, or empty to keep every command.
+    std::set<std::string> commands_;
+    /// Keep requests of the MAINTENANCE class? These are only ever sent by
+    /// peers, in the background.
+    bool include_maintenance_ = false;
+
+    /**
+     * @param request A request.
+     * @return Does the filter keep it?
+     */
+    bool Matches(const Json::Value &request) const;
+};
+
+/**
+ * Thread-safe writer of a trace file. Constructed idle; requests are only
+ * recorded between Start and Stop.
+ */
+class TraceRecorder {
+public:
+    TraceRecorder() = default;
+
+    /**
+     * Stop recording (flushing whatever was recorded) on destruction.
+     */
+    ~TraceRecorder();
+
+    /**
+     * Start appending requests to a trace file, stopping any capture already
+     * in progress.
+     * @param path Path of the trace file (appended to if it exists).
+     * @param filter Which requests to record.
+     */
+    void Start(const std::string &path, TraceFilter filter = {});
+
+    /**
+     * Stop recording, flushing the trace file.
+     */
+    void Stop();
+
+    /**
+     * @return Are requests being recorded? (Cheap enough to check on every
+     *         request.)
+     */
+    bool IsRecording() const
+    {
+        return recording_.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * Record a request, timestamped now, if it passes the filter.
+     * @param port Port of the server which received the request.
+     * @param request The request, parsed.
+     * @param raw_request The request as received (valid JSON).
+     */
+    void Record(unsigned short port, const Json::Value &request,
+                std::string_view raw_request);
+
+    /**
+     * Read a trace file.
+     * @param path Path of the trace file.
+     * @return Its records, in the order they were written.
+     */
+    static std::vector<TraceRecord> Load(const std::string &path);
+
+private:
+    /// Size of the buffer behind out_, so that a write seldom reaches the OS.
+    static const size_t BUFFER_SIZE = 1 << 20;
+
+    std::atomic<bool> recording_ { false };
+    std::mutex mutex_;
+    TraceFilter filter_;
+    std::vector<char> buffer_;
+    std::ofstream out_;
+};
+
+/**
+ * Outcome of replaying a trace.
+ */
+struct ReplayReport {
+    /// Number of requests issued (i.e. which passed the replayer's filter).
+    size_t num_requests_ = 0;
+    /// Number which failed (or went unanswered).
+    size_t num_failed_ = 0;
+    /// Time from the first request being issued to the last response.
+    std::chrono::microseconds elapsed_ { 0 };
+    /// Latency percentiles of the requests which succeeded.
+    std::chrono::microseconds p50_ { 0 }, p90_ { 0 }, p99_ { 0 }, max_ { 0 };
+
+    /**
+     * @return Requests answered successfully per second.
+     */
+    double Throughput() const;
+
+    /**
+     * @return The report, as JSON.
+     */
+    explicit operator Json::Value() const;
+};
+
+/**
+ * Re-issues traced requests against a set of servers.
+ */
+class TraceReplayer {
+public:
+    using Target = std::pair<std::string, unsigned short>;
+
+    /**
+     * Constructor.
+     * @param targets Servers to replay against. A request goes to the target
+     *                with the port it was recorded on, if any; otherwise the
+     *                requests are spread across the targets in turn.
+     * @param time_scale Factor by which the gaps between requests are
+     *                   multiplied: 1 replays with the original timing, 0.5
+     *                   twice as fast, and 0 issues every request at once.
+     * @param filter Which of the records to replay. The rest are skipped, as
+     *               if they had never been recorded.
+     */
+    explicit TraceReplayer(std::vector<Target> targets, double time_scale = 1.0,
+                           TraceFilter filter = {});
+
+    /**
+     * Replay records, in order of timestamp, and wait for every response.
+     * @param records Records to replay (e.g. from TraceRecorder::Load, or
+     *                several such traces concatenated).
+     * @return Latency and throughput of the replay.
+     */
+    ReplayReport Replay(std::vector<TraceRecord> records) const;
+
+private:
+    /**
+     * Wait until send_at, then issue request and time its response.
+     * @return Latency of the request, or throw an error if it failed.
+     */
+    static Awaitable<std::chrono::microseconds> ReplayOne(
+            Target target, Json::Value request,
+            std::chrono::steady_clock::time_point send_at);
+
+    std::vector<Target> targets_;
+    double time_scale_;
+    TraceFilter filter_;
+};
+
+#endif
@@ -10,6 +10,28 @@
  *        the appropriate handler to generate a JSON response, and return that
  *        JSON response to the client. The server should be multithreaded and
  *        able to support multiple clients concurrently.
+ *      - Keep bulk maintenance traffic (requests whose "CLASS" field is
+ *        "MAINTENANCE") from delaying foreground requests. Maintenance
+ *        handlers run on their own thread pool with their own in-flight
+ *        limit, so a large sync cannot occupy the threads serving user reads.
+ *      - Optionally run some handlers as coroutines (e.g. those which forward
+ *        a request and wait for the answer), which hold no thread while they
+ *        wait on the network.
+ *      - Drop requests whose deadline (carried as the number of milliseconds
+ *        remaining in a "DEADLINE_MS" field) passes before their handler gets
+ *        to run, since their sender has already given up on them.
+ *      - Optionally capture every request received to a trace file (see
+ *        request_trace.h), from which the workload can later be replayed.
+ *      - Optionally run thread-per-core: each worker thread gets its own
+ *        io_context and its own acceptor, all bound to the same port with
+ *        SO_REUSEPORT so the kernel spreads connections across them. Sessions
+ *        then stay on the thread which accepted them, rather than every
+ *        thread contending on one shared reactor and accept path. Threads can
+ *        additionally be pinned to CPUs.
+ *      - Do network IO either through boost::asio or, on Linux, on io_uring
+ *        rings (see io_uring.h), as chosen by SetIoBackend when the server is
+ *        constructed. Either way, handlers run on the same io_contexts; only
+ *        accepting, reading and writing differ.
  *
  * To accomplish this, we will create two template classes, each with two
  * template parameters. The template parameters are:
@@ -37,44 +59,138 @@
 #include <boost/optional.hpp>
 #include <boost/array.hpp>
 #include <boost/circular_buffer.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <exception>
+#include <functional>
 #include <map>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <string_view>
 #include <iostream>
 #include <utility>
 #include <vector>
 #include "../data_structures/thread_safe_queue.h"
+#include "client.h"
+#include "coroutines.h"
+#include "io_uring.h"
+#include "request_trace.h"
 
 using namespace boost::asio;
 using namespace boost::asio::ip;
 using boost::system::error_code;
 
+/// Type of the handlers which a server runs as coroutines.
+using AsyncReqHandler = std::function<Awaitable<Json::Value>(Json::Value)>;
+
+/// Number of threads on which a server runs "MAINTENANCE" handlers, unless
+/// told otherwise.
+constexpr int DEFAULT_NUM_MAINTENANCE_THREADS = 2;
+
+/// Number of "MAINTENANCE" requests a server lets run (or wait for a
+/// maintenance thread) at once, unless told otherwise.
+constexpr int DEFAULT_MAX_MAINTENANCE_IN_FLIGHT = 64;
+
+/**
+ * Limits and load counters shared between a server and all of its sessions.
+ * Once either limit is exceeded, sessions stop running handlers and instead
+ * answer with a "BUSY" response, telling the client to route around us (or
+ * retry later) rather than letting every request queue until it times out.
+ */
+struct AdmissionControl {
+    /// Maximum number of sessions (i.e. open connections) to serve at once.
+    std::atomic<int> max_sessions_;
+    /// Maximum number of foreground requests whose handlers may be running
+    /// at once.
+    std::atomic<int> max_in_flight_;
+    /// Maximum number of maintenance requests whose handlers may be running
+    /// (or waiting for a maintenance thread) at once.
+    std::atomic<int> max_maintenance_in_flight_ {
+            DEFAULT_MAX_MAINTENANCE_IN_FLIGHT };
+    /// Milliseconds after which a rejected client may reasonably retry.
+    std::atomic<int> retry_after_ms_;
+    /// Number of sessions accepted and not yet destroyed.
+    std::atomic<int> active_sessions_ { 0 };
+    /// Number of foreground handlers currently running.
+    std::atomic<int> in_flight_ { 0 };
+    /// Number of maintenance handlers currently running or queued.
+    std::atomic<int> maintenance_in_flight_ { 0 };
+    /// Number of requests rejected with a "BUSY" response so far.
+    std::atomic<unsigned long> num_shed_ { 0 };
+
+    AdmissionControl(int max_sessions, int max_in_flight, int retry_after_ms)
+        : max_sessions_(max_sessions)
+        , max_in_flight_(max_in_flight)
+        , retry_after_ms_(retry_after_ms)
+    {}
+};
+
 /**
  * "Session" class represents a single connection with a client. Inherits from
  * boost::enable_shared_from_this to allow construction of shared_ptr<Session>
  * inside member functions via CRTP (asio is weird with lifetime management).
+ * Connections are either read and written through socket_, or, if accepted
+ * by a UringLoop, by that loop (which hands us the request through the
+ * UringConnection interface).
  * @tparam ReqHandlerType Type of handler function.
  */
 template<typename ReqHandlerType>
-class Session : public boost::enable_shared_from_this<Session<ReqHandlerType>> {
+class Session : public boost::enable_shared_from_this<Session<ReqHandlerType>>,
+                public UringConnection {
 public:
+    using CommandMap = std::map<std::string, ReqHandlerType>;
+    using AsyncCommandMap = std::map<std::string, AsyncReqHandler>;
+
     /**
      * Constructor.
      * @param context Context to run/stop.
      * @param commands Map of strings to functions which return JSON to send
-     *                 to client.(Should this be const ref?)
+     *                 to client (shared with the server's other sessions).
+     * @param async_commands Map of strings to coroutines which do the same.
+     * @param port Port of the server which accepted the session.
+     * @param recorder Recorder to which to write requests while capturing.
      */
     explicit Session(io_context &context,
-                     std::map<std::string, ReqHandlerType> commands,
+                     std::shared_ptr<const CommandMap> commands,
+                     std::shared_ptr<const AsyncCommandMap> async_commands,
                      bool &logging_enabled,
-                     std::shared_ptr<ThreadSafeQueue<Json::Value>> queue)
+                     std::shared_ptr<ThreadSafeQueue<Json::Value>> queue,
+                     unsigned short port,
+                     std::shared_ptr<TraceRecorder> recorder,
+                     std::shared_ptr<AdmissionControl> admission,
+                     std::shared_ptr<thread_pool> maintenance_pool)
         : commands_(std::move(commands))
-        , reader_(Json::CharReaderBuilder().newCharReader())
+        , async_commands_(std::move(async_commands))
+        , arena_(arena_buffer_.data(), arena_buffer_.size())
+        , data_(&arena_)
+        , reply_(&arena_)
+        , spliced_(&arena_)
+        , buffers_(&arena_)
         , strand_(boost::asio::make_strand(context))
         , socket_(strand_)
+        , uring_handle_(0)
         , logging_enabled_(logging_enabled)
         , request_log_(std::move(queue))
+        , port_(port)
+        , recorder_(std::move(recorder))
+        , admission_(std::move(admission))
+        , maintenance_pool_(std::move(maintenance_pool))
+        , counted_(false)
+        , shed_(false)
+    {}
+
+    /**
+     * Give up this session's slot in the server's session count.
+     */
+    ~Session()
     {
-        // Send minified JSON, so as to reduce request length.
-        writer_["indentation"] = "";
+        if(counted_) {
+            --admission_->active_sessions_;
+        }
     }
 
     /**
@@ -90,6 +206,7 @@ public:
      */
     void Run()
     {
+        Admit();
         auto self(this->shared_from_this());
         async_read(socket_, boost::asio::dynamic_buffer(data_),
             [this, self](error_code ec, std::size_t length) {
@@ -97,35 +214,117 @@ public:
             });
     }
 
+    /**
+     * Having been accepted by a UringLoop, count ourselves against the
+     * session limit (as Run does).
+     * @param loop Loop which accepted us, which will write our response.
+     * @param handle The loop's handle for our connection.
+     */
+    void OnAccept(std::shared_ptr<UringLoop> loop,
+                  std::uint64_t handle) override
+    {
+        uring_loop_ = std::move(loop);
+        uring_handle_ = handle;
+        Admit();
+    }
+
+    /**
+     * Append bytes read by our UringLoop to the request.
+     * @param data Bytes read.
+     * @param length Number of bytes read.
+     */
+    void OnData(const char *data, std::size_t length) override
+    {
+        data_.append(data, length);
+    }
+
+    /**
+     * Handle the request our UringLoop has read, as if read from socket_.
+     */
+    void OnRequestRead() override
+    {
+        auto self(this->shared_from_this());
+        post(strand_, [this, self] {
+            HandleRead(error_code(), data_.size());
+        });
+    }
+
 private:
     /// Map of strings (e.g. "GET", "PUT", etc.) to lambdas which take JSON
     /// requests as arguments and return JSON responses.
-    std::map<std::string, ReqHandlerType> commands_;
+    std::shared_ptr<const CommandMap> commands_;
+    /// Map of strings to coroutines which take JSON requests as arguments and
+    /// return JSON responses.
+    std::shared_ptr<const AsyncCommandMap> async_commands_;
+    /// Memory from which the buffers below are allocated, so that serving a
+    /// typical request doesn't touch the heap for them. Only spills over to
+    /// the heap if the request or reply outgrows arena_buffer_. Nothing is
+    /// freed until the session is destroyed, which is fine, since a session
+    /// serves exactly one request.
+    std::array<std::byte, 4096> arena_buffer_;
+    std::pmr::monotonic_buffer_resource arena_;
     /// Buffer containing client data.
-    std::string data_;
+    std::pmr::string data_;
     /// Since async_write returns immediately, reply strings must exist beyond
     /// the scope in which they are called; thus, we will use a member var
-    /// as opposed to an in-function variable.
-    std::string reply_;
-    /// Object to serialize JSON.
-    Json::StreamWriterBuilder writer_;
-    /// Object to parse JSON.
-    const std::unique_ptr<Json::CharReader> reader_;
+    /// as opposed to an in-function variable. Holds the serialized response,
+    /// minus any large strings, which are written straight from response_.
+    std::pmr::string reply_;
+    /// Response being written. Kept alive until the write completes, since
+    /// buffers_ may point into its strings.
+    Json::Value response_;
+    /// Large strings of response_ spliced into the reply, each with the
+    /// offset in reply_ at which it belongs.
+    std::pmr::vector<std::pair<size_t, std::string_view>> spliced_;
+    /// Buffer sequence making up the reply.
+    std::pmr::vector<const_buffer> buffers_;
     /// Strand makes things thread-safe.
     strand<io_context::executor_type> strand_;
     /// Socket from which to read/write.
     tcp::socket socket_;
+    /// Loop which accepted us (and which reads and writes for us instead of
+    /// socket_), if any, and its handle for our connection.
+    std::shared_ptr<UringLoop> uring_loop_;
+    std::uint64_t uring_handle_;
     /// Is logging enabled?
     bool logging_enabled_;
     /// If logging is enabled, push JSON values to this FIFO queue.
     std::shared_ptr<ThreadSafeQueue<Json::Value>> request_log_;
+    /// Port of the server which accepted us, recorded with each request.
+    unsigned short port_;
+    /// While capturing, requests are written to this recorder as well.
+    std::shared_ptr<TraceRecorder> recorder_;
+    /// Limits and load counters shared with the server and other sessions.
+    std::shared_ptr<AdmissionControl> admission_;
+    /// Thread pool on which maintenance handlers run, away from the threads
+    /// serving foreground requests.
+    std::shared_ptr<thread_pool> maintenance_pool_;
+    /// Has this session been counted in admission_->active_sessions_?
+    bool counted_;
+    /// Was this session over the session limit when it was accepted?
+    bool shed_;
+    /// When we finished reading the client's request.
+    std::chrono::steady_clock::time_point received_;
+
+    /**
+     * Count ourselves against the session limit. If we are over it, we still
+     * read the request (closing a socket with unread data would reset the
+     * connection before the client sees our reply), but we answer "BUSY"
+     * without parsing or handling it.
+     */
+    void Admit()
+    {
+        counted_ = true;
+        int num_sessions = ++admission_->active_sessions_;
+        shed_ = num_sessions > admission_->max_sessions_;
+    }
 
     /**
      * Having read into "data_" from a socket, handle the client's request.
      * @param ec General error code.
      * @param bytes_xfrd Number of bytes read from socket.
      */
-    void HandleRead(error_code ec, std::size_t bytes_xfrd)
+    void HandleRead(error_code ec, std::size_t /* bytes_xfrd */)
     {
         // EC of 2 isn't really an "error", per se. Just means that the client
         // closed the connection. The data is still available, and we can still
@@ -135,43 +334,339 @@ private:
             return;
         }
 
+        received_ = std::chrono::steady_clock::now();
         JSONCPP_STRING parse_err;
         Json::Value json_req, json_resp;
-        // Changed
-        std::string client_req_str(data_);
 
-        if (reader_->parse(client_req_str.c_str(),
-                           client_req_str.c_str() + client_req_str.length(),
-                           &json_req, &parse_err))
-        {
-            // If logging is enabled, log this request inside our queue.
-            if(logging_enabled_) {
-                request_log_->PushBack(json_req);
-            }
+        // If there were no sessions left when we were accepted, reject the
+        // request cheaply, without even parsing it.
+        if(shed_) {
+            ++admission_->num_shed_;
+            WriteResponse(BusyResponse());
+            return;
+        }
 
-            try {
-                // Get JSON response.
-                json_resp = ProcessRequest(json_req);
-                json_resp["SUCCESS"] = true;
-            } catch (const std::exception &ex) {
-                // If ProcessRequest threw an error.
-                json_resp["SUCCESS"] = false;
-                json_resp["ERRORS"] = std::string(ex.what());
-            }
-        } else {
+        // Readers are stateless between calls, so each IO thread reuses one
+        // rather than each session building its own.
+        thread_local const std::unique_ptr<Json::CharReader> reader(
+                Json::CharReaderBuilder().newCharReader());
+        if(! reader->parse(data_.c_str(), data_.c_str() + data_.length(),
+                            &json_req, &parse_err))
+        {
             // If json parsing failed.
             json_resp["SUCCESS"] = false;
             json_resp["ERRORS"] = std::string(parse_err);
+            WriteResponse(std::move(json_resp));
+            return;
+        }
+        if(! json_req.isObject()) {
+            json_resp["SUCCESS"] = false;
+            json_resp["ERRORS"] = "Request is not a JSON object.";
+            WriteResponse(std::move(json_resp));
+            return;
+        }
+
+        // If logging is enabled, log this request inside our queue.
+        if(logging_enabled_) {
+            request_log_->PushBack(json_req);
+        }
+        if(recorder_->IsRecording()) {
+            recorder_->Record(port_, json_req, data_);
+        }
+
+        // Claim a handler slot in the request's lane. If there are none left,
+        // reject the request rather than queueing it.
+        bool is_maintenance = json_req["CLASS"].asString() == "MAINTENANCE";
+        std::atomic<int> &in_flight = is_maintenance
+                                      ? admission_->maintenance_in_flight_
+                                      : admission_->in_flight_;
+        int max_in_flight = is_maintenance
+                            ? admission_->max_maintenance_in_flight_
+                            : admission_->max_in_flight_;
+        if(++in_flight > max_in_flight) {
+            --in_flight;
+            ++admission_->num_shed_;
+            WriteResponse(BusyResponse());
+            return;
+        }
+
+        // Coroutine handlers run on our strand, whatever their class, since
+        // they hold no thread while they wait.
+        auto async_it = async_commands_->find(json_req["COMMAND"].asString());
+        if(async_it != async_commands_->end()) {
+            auto self(this->shared_from_this());
+            co_spawn(strand_,
+                     HandleAsyncRequest(async_it->second, std::move(json_req)),
+                     [this, self, &in_flight](const std::exception_ptr &,
+                                              Json::Value resp) {
+                --in_flight;
+                WriteResponse(std::move(resp));
+            });
+            return;
+        }
+
+        // Foreground handlers run right here, on the server's IO threads.
+        if(! is_maintenance) {
+            json_resp = HandleRequest(std::move(json_req));
+            --in_flight;
+            WriteResponse(std::move(json_resp));
+            return;
         }
 
-        reply_ = Json::writeString(writer_, json_resp);
+        // Maintenance handlers run on the maintenance pool, and hop back onto
+        // our strand to write their response.
         auto self(this->shared_from_this());
-        async_write(socket_, buffer(reply_),
-                    [this, self](error_code ec, std::size_t bytes_xfrd) {
+        post(*maintenance_pool_,
+             [this, self, json_req = std::move(json_req)]() mutable {
+            Json::Value resp = HandleRequest(std::move(json_req));
+            --admission_->maintenance_in_flight_;
+            post(strand_, [this, self, resp = std::move(resp)]() mutable {
+                WriteResponse(std::move(resp));
+            });
+        });
+    }
+
+    /**
+     * Run the handler for a parsed request, catching any errors it throws.
+     * If the request has a deadline, first charge it for the time it spent
+     * waiting here, and drop it without running the handler if it expired.
+     * @param request Request issued by client.
+     * @return Response to request, with "SUCCESS" (and "ERRORS") set.
+     */
+    Json::Value HandleRequest(Json::Value request)
+    {
+        if(! ChargeDeadline(request)) {
+            return ExpiredResponse();
+        }
+
+        Json::Value response;
+        try {
+            // Get JSON response.
+            response = ProcessRequest(request);
+            response["SUCCESS"] = true;
+        } catch (...) {
+            // If ProcessRequest threw an error.
+            response = ErrorResponse(std::current_exception());
+        }
+        return response;
+    }
+
+    /**
+     * As HandleRequest, but for a coroutine handler.
+     * @param handler Handler of the request's command.
+     * @param request Request issued by client.
+     * @return Response to request, with "SUCCESS" (and "ERRORS") set.
+     */
+    Awaitable<Json::Value> HandleAsyncRequest(const AsyncReqHandler &handler,
+                                              Json::Value request)
+    {
+        if(! ChargeDeadline(request)) {
+            co_return ExpiredResponse();
+        }
+
+        Json::Value response;
+        try {
+            response = co_await handler(std::move(request));
+            response["SUCCESS"] = true;
+        } catch (...) {
+            response = ErrorResponse(std::current_exception());
+        }
+        co_return response;
+    }
+
+    /**
+     * If a request has a deadline, charge it for the time it spent waiting
+     * here.
+     * @param request Request issued by client.
+     * @return Whether the request still has time left.
+     */
+    bool ChargeDeadline(Json::Value &request) const
+    {
+        if(! request.isMember("DEADLINE_MS")) {
+            return true;
+        }
+
+        auto waited = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - received_);
+        Json::Int64 remaining = request["DEADLINE_MS"].asInt64() -
+                                waited.count();
+        request["DEADLINE_MS"] = remaining;
+        return remaining > 0;
+    }
+
+    /**
+     * @return Response to a request whose deadline passed before it ran.
+     */
+    static Json::Value ExpiredResponse()
+    {
+        Json::Value response;
+        response["SUCCESS"] = false;
+        response["EXPIRED"] = true;
+        response["ERRORS"] = "Deadline exceeded.";
+        return response;
+    }
+
+    /**
+     * @param err Error thrown by a handler.
+     * @return Response reporting it.
+     */
+    Json::Value ErrorResponse(const std::exception_ptr &err) const
+    {
+        Json::Value response;
+        try {
+            std::rethrow_exception(err);
+        } catch (const BusyError &ex) {
+            // The handler depended on peers which are all overloaded, so
+            // pass their "BUSY" (and the longest of their hints) back.
+            response = BusyResponse();
+            response["RETRY_AFTER_MS"] = ex.retry_after_ms_;
+        } catch (const std::exception &ex) {
+            response["SUCCESS"] = false;
+            response["ERRORS"] = std::string(ex.what());
+        } catch (...) {
+            response["SUCCESS"] = false;
+            response["ERRORS"] = "Unknown error.";
+        }
+        return response;
+    }
+
+    /**
+     * Serialize response, write it to the client. Large strings in the
+     * response (i.e. payloads, such as encoded fragments) aren't copied into
+     * the serialized reply; instead, the reply is written as a sequence of
+     * buffers, some of which point into the response's own strings.
+     * @param response Response to send.
+     */
+    void WriteResponse(Json::Value response)
+    {
+        response_ = std::move(response);
+        reply_.clear();
+        spliced_.clear();
+        Serialize(response_);
+
+        buffers_.clear();
+        size_t offset = 0;
+        for(const auto &[splice_at, payload] : spliced_) {
+            buffers_.push_back(buffer(reply_.data() + offset,
+                                      splice_at - offset));
+            buffers_.push_back(buffer(payload.data(), payload.size()));
+            offset = splice_at;
+        }
+        buffers_.push_back(buffer(reply_.data() + offset,
+                                  reply_.size() - offset));
+
+#ifdef HAVE_IO_URING
+        // The loop writes the response and closes the connection. The
+        // buffers stay valid since it holds on to us until then.
+        if(uring_loop_) {
+            std::vector<iovec> response;
+            for(const auto &buf : buffers_) {
+                response.push_back({ const_cast<void *>(buf.data()),
+                                     buf.size() });
+            }
+            uring_loop_->Respond(uring_handle_, std::move(response));
+            return;
+        }
+#endif
+
+        auto self(this->shared_from_this());
+        async_write(socket_, buffers_,
+                    [this, self](error_code ec, std::size_t) {
                       HandleWrite(ec);
                     });
     }
 
+    /**
+     * Append the minified JSON of value to reply_, except for large strings
+     * which need no escaping, which are recorded in spliced_ instead. Makes
+     * a single pass over value, writing everything as it goes.
+     * @param value Value to serialize.
+     */
+    void Serialize(const Json::Value &value)
+    {
+        switch(value.type()) {
+        case Json::nullValue:
+            reply_ += "null";
+            break;
+        case Json::intValue:
+            reply_ += Json::valueToString(value.asLargestInt());
+            break;
+        case Json::uintValue:
+            reply_ += Json::valueToString(value.asLargestUInt());
+            break;
+        case Json::realValue:
+            reply_ += Json::valueToString(value.asDouble());
+            break;
+        case Json::booleanValue:
+            reply_ += value.asBool() ? "true" : "false";
+            break;
+        case Json::stringValue: {
+            const char *begin, *end;
+            value.getString(&begin, &end);
+            SerializeString(begin, end, true);
+            break;
+        }
+        case Json::arrayValue:
+            reply_ += '[';
+            for(Json::ArrayIndex i = 0; i < value.size(); ++i) {
+                if(i > 0) {
+                    reply_ += ',';
+                }
+                Serialize(value[i]);
+            }
+            reply_ += ']';
+            break;
+        case Json::objectValue:
+            reply_ += '{';
+            for(auto it = value.begin(); it != value.end(); ++it) {
+                if(it != value.begin()) {
+                    reply_ += ',';
+                }
+                const char *name_end;
+                const char *name = it.memberName(&name_end);
+                SerializeString(name, name_end, false);
+                reply_ += ':';
+                Serialize(*it);
+            }
+            reply_ += '}';
+            break;
+        }
+    }
+
+    /**
+     * Append a string to reply_ as a JSON string literal.
+     * @param begin Start of the string.
+     * @param end End of the string.
+     * @param may_splice May the string be spliced in, rather than copied, if
+     *                   it is large enough to be worth it?
+     */
+    void SerializeString(const char *begin, const char *end, bool may_splice)
+    {
+        static const size_t MIN_SPLICE_LEN = 1024;
+        bool plain = std::all_of(begin, end, [](char c) {
+            return c >= 0x20 && c < 0x7f && c != '"' && c != '\\';
+        });
+        if(! plain) {
+            // jsoncpp's quoting stops at the first NUL, so the rare string
+            // which contains one goes through a full writer instead.
+            if(std::memchr(begin, '\0', end - begin)) {
+                reply_ += Json::writeString(Writer(), Json::Value(begin, end));
+            } else {
+                reply_ += Json::valueToQuotedString(begin);
+            }
+            return;
+        }
+
+        reply_ += '"';
+        if(may_splice && (size_t) (end - begin) >= MIN_SPLICE_LEN) {
+            spliced_.emplace_back(reply_.size(),
+                                  std::string_view(begin, end - begin));
+        } else {
+            reply_.append(begin, end);
+        }
+        reply_ += '"';
+    }
+
     /**
      * Shutdown socket after having written to socket.
      * @param ec Has an error occurred during write?
@@ -184,6 +679,20 @@ private:
         }
     }
 
+    /**
+     * @return Response telling the client that we are overloaded and when it
+     *         may be worth trying us again.
+     */
+    Json::Value BusyResponse() const
+    {
+        Json::Value busy_resp;
+        busy_resp["SUCCESS"] = false;
+        busy_resp["BUSY"] = true;
+        busy_resp["RETRY_AFTER_MS"] = admission_->retry_after_ms_.load();
+        busy_resp["ERRORS"] = "Server busy.";
+        return busy_resp;
+    }
+
     /**
      * Lookup command specified in request in commands map. Call it,
      * and return its response.
@@ -191,22 +700,31 @@ private:
      * @param request Request issued by client.
      * @return Response to request.
      */
-    Json::Value ProcessRequest(Json::Value request)
+    Json::Value ProcessRequest(const Json::Value &request)
     {
-        Json::Value response;
-        std::string command = request["COMMAND"].asString();
+        auto it = commands_->find(request["COMMAND"].asString());
 
         // If command is not valid, give a response with an error.
-        if(commands_.find(command) == commands_.end()) {
+        if(it == commands_->end()) {
             throw std::runtime_error("Invalid command.");
         }
 
-            // Otherwise, run the relevant handler.
-        else {
-            ReqHandlerType handler = commands_.at(command);
-            response = handler(request);
-        }
-        return response;
+        // Otherwise, run the relevant handler.
+        return it->second(request);
+    }
+
+    /**
+     * @return Factory for writers which produce minified JSON, so as to
+     *         reduce response length (shared by all sessions).
+     */
+    static const Json::StreamWriterBuilder &Writer()
+    {
+        static const Json::StreamWriterBuilder writer = [] {
+            Json::StreamWriterBuilder builder;
+            builder["indentation"] = "";
+            return builder;
+        }();
+        return writer;
     }
 };
 
@@ -220,6 +738,8 @@ public:
     using ServerInstantiation = Server<ReqHandlerType>;
     using SessionPtr = boost::shared_ptr<Session<ReqHandlerType>>;
     using ThreadPtr = boost::shared_ptr<boost::thread>;
+    using reuse_port = boost::asio::detail::socket_option::boolean<SOL_SOCKET,
+                                                                  SO_REUSEPORT>;
 
     /**
      * Constructor.
@@ -227,19 +747,68 @@ public:
      * @param num_threads Number worker threads to run.
      * @param commands Map of strings to functions which return JSON to send
      *                 to client.
+     * @param logging_enabled Should requests be logged from the start?
+     * @param max_sessions Max number of connections to serve concurrently
+     *                     before answering new ones with "BUSY".
+     * @param max_in_flight Max number of handlers to run concurrently before
+     *                      answering new requests with "BUSY".
+     * @param retry_after_ms Retry hint sent with "BUSY" responses.
+     * @param num_maintenance_threads Number of threads on which to run the
+     *                                handlers of "MAINTENANCE" requests.
+     * @param per_core Give each worker thread its own io_context and its own
+     *                 (SO_REUSEPORT) acceptor, rather than having all of them
+     *                 share one of each.
+     * @param pin_to_cores Pin each worker thread to its own CPU.
      */
     Server(const int port, const int num_threads,
            std::map<std::string, ReqHandlerType> commands,
-           bool logging_enabled = false)
+           bool logging_enabled = false, int max_sessions = 256,
+           int max_in_flight = 64, int retry_after_ms = 50,
+           int num_maintenance_threads = DEFAULT_NUM_MAINTENANCE_THREADS,
+           bool per_core = false,
+           bool pin_to_cores = false)
+        : Server(port, num_threads, std::move(commands),
+                 std::map<std::string, AsyncReqHandler>(), logging_enabled,
+                 max_sessions, max_in_flight, retry_after_ms,
+                 num_maintenance_threads, per_core, pin_to_cores)
+    {}
+
+    /**
+     * Constructor 2. As constructor 1, but some commands are handled by
+     * coroutines, which hold no thread while they wait (e.g. on requests of
+     * their own to other servers).
+     * @param async_commands Map of strings to coroutines which return JSON to
+     *                       send to client. These take precedence over
+     *                       commands of the same name.
+     */
+    Server(const int port, const int num_threads,
+           std::map<std::string, ReqHandlerType> commands,
+           std::map<std::string, AsyncReqHandler> async_commands,
+           bool logging_enabled = false, int max_sessions = 256,
+           int max_in_flight = 64, int retry_after_ms = 50,
+           int num_maintenance_threads = DEFAULT_NUM_MAINTENANCE_THREADS,
+           bool per_core = false,
+           bool pin_to_cores = false)
         : port_(port)
         , num_threads_(num_threads)
-        , commands_(commands)
-        , signals_(io_context_)
-        , acceptor_(io_context_)
-        , new_session_()
-        , is_alive_(true)
         , logging_enabled_(logging_enabled)
         , request_log_(std::make_shared<ThreadSafeQueue<Json::Value>>(32))
+        , recorder_(std::make_shared<TraceRecorder>())
+        , admission_(std::make_shared<AdmissionControl>(max_sessions,
+                                                        max_in_flight,
+                                                        retry_after_ms))
+        , maintenance_pool_(std::make_shared<thread_pool>(
+                                num_maintenance_threads))
+        , commands_(std::make_shared<const std::map<std::string,
+                                                    ReqHandlerType>>(
+                        std::move(commands)))
+        , async_commands_(std::make_shared<const std::map<std::string,
+                                                          AsyncReqHandler>>(
+                              std::move(async_commands)))
+        , reactors_(MakeReactors(per_core ? num_threads : 1))
+        , signals_(reactors_.front()->context_)
+        , is_alive_(true)
+        , pin_to_cores_(pin_to_cores)
     {
         /// Adding these signals allows threads to shut down gracefully when
         /// the process running the server terminates.
@@ -247,31 +816,48 @@ public:
         signals_.add(SIGTERM);
         signals_.add(SIGQUIT);
 
-        boost::asio::ip::tcp::resolver resolver(io_context_);
-        boost::asio::ip::tcp::endpoint endpoint =
-                *resolver.resolve(tcp::endpoint(tcp::v4(), port)).begin();
-        acceptor_.open(endpoint.protocol());
-        acceptor_.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
-        acceptor_.bind(endpoint);
-        acceptor_.listen();
-
-        StartAccept();
+        // Listen on every IPv4 address. (There's nothing to resolve, and
+        // reverse-resolving the wildcard address fails on hosts with no name
+        // for it.)
+        tcp::endpoint endpoint(tcp::v4(), port);
+        for(auto &reactor : reactors_) {
+#ifdef HAVE_IO_URING
+            // Sessions accepted by a loop still run on the reactor's
+            // io_context, which must keep running while it has no work.
+            if(GetIoBackend() == IoBackend::IO_URING) {
+                reactor->loop_ = UringLoop::Create(
+                        port, reactors_.size() > 1,
+                        [this, &reactor = *reactor] {
+                            return MakeSession(reactor);
+                        });
+            }
+            if(reactor->loop_) {
+                reactor->work_.emplace(reactor->context_.get_executor());
+                continue;
+            }
+#endif
+            Listen(reactor->acceptor_, endpoint, reactors_.size() > 1);
+            StartAccept(*reactor);
+        }
     }
 
     Server(const Server &rhs) = delete;
 
     Server(Server &&rhs) noexcept
-        : io_context_(std::move(rhs.io_context_))
-        , port_(std::move(rhs.port_))
+        : port_(std::move(rhs.port_))
         , num_threads_(std::move(rhs.num_threads_))
-        , commands_(std::move(rhs.commands_))
-        , signals_(io_context_)
-        , acceptor_(std::move(rhs.acceptor_))
-        , is_alive_(std::move(rhs.is_alive_))
-        , t_(std::move(rhs.t_))
-        , new_session_(std::move(rhs.new_session_))
         , logging_enabled_(rhs.logging_enabled_)
         , request_log_(std::move(rhs.request_log_))
+        , recorder_(std::move(rhs.recorder_))
+        , admission_(std::move(rhs.admission_))
+        , maintenance_pool_(std::move(rhs.maintenance_pool_))
+        , commands_(std::move(rhs.commands_))
+        , async_commands_(std::move(rhs.async_commands_))
+        , t_(std::move(rhs.t_))
+        , reactors_(std::move(rhs.reactors_))
+        , signals_(reactors_.front()->context_)
+        , is_alive_(std::move(rhs.is_alive_))
+        , pin_to_cores_(rhs.pin_to_cores_)
     {
         /// Adding these signals allows threads to shut down gracefully when
         /// the process running the server terminates.
@@ -282,24 +868,47 @@ public:
 
     ~Server()
     {
-        io_context_.stop();
+        HandleStop();
         if(t_.joinable()) {
             t_.join();
         }
+
+        // Let any running maintenance handlers finish before whatever they
+        // capture is destroyed along with us.
+        if(maintenance_pool_) {
+            maintenance_pool_->stop();
+            maintenance_pool_->join();
+        }
     }
 
     /**
-     * Start/run worker threads, join upon completion.
+     * Start/run worker threads, join upon completion. In per-core mode,
+     * thread i runs reactor i alone; otherwise all threads share reactor 0.
+     * Reactors served by io_uring get an extra thread, running their loop.
      */
     void Run()
     {
         std::vector<ThreadPtr> threads;
         for(int i = 0; i < num_threads_; i++) {
-            ThreadPtr new_thread(new boost::thread([ObjectPtr = &io_context_] {
-                ObjectPtr->run();
+            io_context *context = &reactors_[i % reactors_.size()]->context_;
+            ThreadPtr new_thread(new boost::thread([this, context, i] {
+                if(pin_to_cores_) {
+                    PinToCore(i);
+                }
+                context->run();
             }));
             threads.push_back(new_thread);
         }
+#ifdef HAVE_IO_URING
+        for(auto &reactor : reactors_) {
+            if(reactor->loop_) {
+                threads.push_back(ThreadPtr(new boost::thread(
+                        [loop = reactor->loop_] {
+                            loop->Run();
+                        })));
+            }
+        }
+#endif
 
         for(auto & thread : threads) {
             thread->join();
@@ -319,43 +928,23 @@ public:
         }
     }
 
-    /**
-     * Start accepting client connections, make a new session for each one.
-     */
-    void StartAccept()
-    {
-        new_session_.reset(
-            new Session(io_context_, commands_, logging_enabled_, request_log_),
-            [](Session<ReqHandlerType> *t) {
-                delete t;
-            });
-
-        acceptor_.async_accept(new_session_->Socket(),
-            [this](error_code ec) {
-                HandleAccept(ec);
-            });
-    }
-
-    /**
-     * Run the session after it has been set up.
-     * @param ec Has an error occurred during async_accept?
-     */
-    void HandleAccept(const error_code &ec)
-    {
-        if(! ec) {
-            new_session_->Run();
-        }
-        StartAccept();
-    }
-
     /**
      * Stop the server.
      */
     void Kill()
     {
-        post(io_context_, [this] {
-          acceptor_.close(); // causes .cancel() as well
-        });
+        for(auto &reactor : reactors_) {
+#ifdef HAVE_IO_URING
+            if(reactor->loop_) {
+                reactor->loop_->StopAccepting();
+                continue;
+            }
+#endif
+            post(reactor->acceptor_.get_executor(),
+                 [&acceptor = reactor->acceptor_] {
+                     acceptor.close(); // causes .cancel() as well
+                 });
+        }
 
         is_alive_ = false;
     }
@@ -393,7 +982,14 @@ public:
      */
     void HandleStop()
     {
-        io_context_.stop();
+        for(auto &reactor : reactors_) {
+#ifdef HAVE_IO_URING
+            if(reactor->loop_) {
+                reactor->loop_->Stop();
+            }
+#endif
+            reactor->context_.stop();
+        }
     }
 
     [[nodiscard]] boost::circular_buffer<Json::Value> GetLog() const
@@ -401,7 +997,91 @@ public:
         return request_log_->GetBuffer();
     }
 
+    /**
+     * Start appending the requests received to a trace file (unlike the
+     * request log, which keeps only the latest few in memory).
+     * @param path Path of the trace file.
+     * @param filter Which requests to capture. By default, all but those of
+     *               the MAINTENANCE class.
+     */
+    void StartRequestCapture(const std::string &path, TraceFilter filter = {})
+    {
+        recorder_->Start(path, std::move(filter));
+    }
+
+    /**
+     * Stop capturing requests, flushing the trace file.
+     */
+    void StopRequestCapture()
+    {
+        recorder_->Stop();
+    }
+
+    /**
+     * Change the limits past which requests are rejected with "BUSY". Takes
+     * effect for sessions accepted/requests read after the call.
+     * @param max_sessions Max number of concurrently served connections.
+     * @param max_in_flight Max number of concurrently running handlers.
+     * @param retry_after_ms Retry hint sent with "BUSY" responses.
+     */
+    void SetAdmissionLimits(int max_sessions, int max_in_flight,
+                            int retry_after_ms)
+    {
+        admission_->max_sessions_ = max_sessions;
+        admission_->max_in_flight_ = max_in_flight;
+        admission_->retry_after_ms_ = retry_after_ms;
+    }
+
+    /**
+     * Change the number of "MAINTENANCE" requests that may be running or
+     * queued at once before further ones are rejected with "BUSY".
+     * Foreground requests are unaffected by this limit.
+     * @param max_in_flight Max number of concurrent maintenance handlers.
+     */
+    void SetMaintenanceLimit(int max_in_flight)
+    {
+        admission_->max_maintenance_in_flight_ = max_in_flight;
+    }
+
+    /**
+     * @return Number of requests rejected with "BUSY" so far.
+     */
+    [[nodiscard]] unsigned long GetNumShed() const
+    {
+        return admission_->num_shed_;
+    }
+
+    /**
+     * @return Number of independent io_context/acceptor pairs (1 unless the
+     *         server runs in per-core mode).
+     */
+    [[nodiscard]] size_t GetNumReactors() const
+    {
+        return reactors_.size();
+    }
+
 private:
+    /**
+     * An io_context along with the acceptor (or io_uring loop) which feeds it
+     * new sessions. Sessions accepted by a reactor live out their lives on
+     * its io_context, so in per-core mode a connection is only ever touched
+     * by one thread (other than its loop's, if any).
+     */
+    struct Reactor {
+        /// IO context on which the reactor's sessions run.
+        io_context context_;
+        /// Acceptor for new client requests. Its handlers (and closing it)
+        /// run on a strand, since several threads may run context_.
+        tcp::acceptor acceptor_ { make_strand(context_) };
+        /// New client session.
+        SessionPtr new_session_;
+        /// If the reactor is served by io_uring, the loop which accepts,
+        /// reads and writes for its sessions in place of acceptor_, and a
+        /// guard keeping context_ running while no session needs it.
+        std::shared_ptr<UringLoop> loop_;
+        std::optional<executor_work_guard<io_context::executor_type>> work_;
+    };
+
     /// Port on which server runs & number of worker threads.
     const int port_, num_threads_;
     /// If this is set to true, the server will log all requests in a FIFO
@@ -410,22 +1090,144 @@ private:
     /// If logging is enabled, we will push requests received from clients to
     /// this queue.
     std::shared_ptr<ThreadSafeQueue<Json::Value>> request_log_;
+    /// Writes requests to a trace file while capture is on. Shared with every
+    /// session we create.
+    std::shared_ptr<TraceRecorder> recorder_;
+    /// Session/handler limits, shared with every session we create.
+    std::shared_ptr<AdmissionControl> admission_;
+    /// Thread pool on which the handlers of "MAINTENANCE" requests run.
+    std::shared_ptr<thread_pool> maintenance_pool_;
     /// Map of strings (e.g. "GET", PUT") to the functions which handle the
     /// corresponding requests. These functions should accept JSON requests as
     /// an argument and generate JSON responses.
-    std::map<std::string, ReqHandlerType> commands_;
+    std::shared_ptr<const std::map<std::string, ReqHandlerType>> commands_;
+    /// Map of strings to the coroutines which handle the corresponding
+    /// requests, as above.
+    std::shared_ptr<const std::map<std::string, AsyncReqHandler>>
+            async_commands_;
     /// Background thread on which server runs.
     std::thread t_;
-    /// IO context on which server runs.
-    io_context io_context_;
+    /// Reactors on which server runs: one per worker thread in per-core mode,
+    /// a single shared one otherwise.
+    std::vector<std::unique_ptr<Reactor>> reactors_;
     /// We're gonna bind SIGTERM and SIGABRT to HandleStop.
     signal_set signals_;
-    /// Acceptor for new client requests.
-    tcp::acceptor acceptor_;
-    /// New client session.
-    SessionPtr new_session_;
     /// Has server been killed yet?
     bool is_alive_;
+    /// Should worker threads be pinned to CPUs?
+    bool pin_to_cores_;
+
+    /**
+     * @param num_reactors Number of reactors to create.
+     * @return That many fresh reactors.
+     */
+    static std::vector<std::unique_ptr<Reactor>> MakeReactors(int num_reactors)
+    {
+        std::vector<std::unique_ptr<Reactor>> reactors;
+        for(int i = 0; i < std::max(num_reactors, 1); ++i) {
+            reactors.push_back(std::make_unique<Reactor>());
+        }
+        return reactors;
+    }
+
+    /**
+     * Open, bind and listen on an acceptor.
+     * @param acceptor Acceptor to set up.
+     * @param endpoint Endpoint on which to listen.
+     * @param share_port Should the port be shared with our other acceptors
+     *                   (via SO_REUSEPORT), letting the kernel spread
+     *                   incoming connections across them?
+     */
+    static void Listen(tcp::acceptor &acceptor, const tcp::endpoint &endpoint,
+                       bool share_port)
+    {
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        if(share_port) {
+            acceptor.set_option(reuse_port(true));
+        }
+        acceptor.bind(endpoint);
+        acceptor.listen();
+    }
+
+    /**
+     * Pin the calling thread to one of the CPUs it is allowed to run on. This
+     * is best effort: if pinning is unsupported or fails, the thread simply
+     * stays unpinned.
+     * @param index Index of the thread, which determines its CPU.
+     */
+    static void PinToCore(int index)
+    {
+#ifdef __linux__
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        if(sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+            return;
+        }
+        int num_allowed = CPU_COUNT(&allowed);
+        if(num_allowed == 0) {
+            return;
+        }
+
+        // Pick the (index % num_allowed)th CPU we're allowed on.
+        int target = index % num_allowed;
+        for(int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if(CPU_ISSET(cpu, &allowed) && target-- == 0) {
+                cpu_set_t pinned;
+                CPU_ZERO(&pinned);
+                CPU_SET(cpu, &pinned);
+                pthread_setaffinity_np(pthread_self(), sizeof(pinned), &pinned);
+                return;
+            }
+        }
+#endif
+    }
+
+    /**
+     * @param reactor Reactor on whose io_context the session is to run.
+     * @return New session, for a connection yet to be accepted.
+     */
+    SessionPtr MakeSession(Reactor &reactor)
+    {
+        return SessionPtr(
+            new Session(reactor.context_, commands_, async_commands_,
+                        logging_enabled_, request_log_, port_, recorder_,
+                        admission_, maintenance_pool_),
+            [](Session<ReqHandlerType> *t) {
+                delete t;
+            });
+    }
+
+    /**
+     * Start accepting client connections on a reactor, make a new session
+     * (on that reactor's io_context) for each one.
+     * @param reactor Reactor on which to accept.
+     */
+    void StartAccept(Reactor &reactor)
+    {
+        reactor.new_session_ = MakeSession(reactor);
+        reactor.acceptor_.async_accept(reactor.new_session_->Socket(),
+            [this, &reactor](error_code ec) {
+                HandleAccept(reactor, ec);
+            });
+    }
+
+    /**
+     * Run the session after it has been set up.
+     * @param reactor Reactor which accepted the session.
+     * @param ec Has an error occurred during async_accept?
+     */
+    void HandleAccept(Reactor &reactor, const error_code &ec)
+    {
+        if(! ec) {
+            reactor.new_session_->Run();
+        }
+
+        // Once Kill() has closed the acceptor, stop accepting.
+        if(reactor.acceptor_.is_open()) {
+            StartAccept(reactor);
+        }
+    }
 };
 
 #endif
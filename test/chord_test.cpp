@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
 #include "json_reader.h"
+#include "../src/chord/chord_client.h"
 #include "../src/chord/chord_peer.h"
 #include <filesystem>
+#include <thread>
 
 /**
  * In this test, we test whether AbstractChordPeer::GetSuccessor correctly
@@ -714,6 +716,316 @@ TEST(ChordIntegration, CreateAndRead)
     }
 }
 
+/**
+ * By default, a peer should capture only the requests clients send it, and
+ * none of the traffic (e.g. NOTIFY, GET_PRED) by which peers maintain the
+ * ring, so that replaying its trace reproduces its load without rewriting the
+ * membership of the ring replayed against.
+ */
+TEST(ChordIntegration, CapturesClientRequestsOnly)
+{
+    Json::Value test_info = JsonFromFile("test_json/chord_tests/"
+                                         "ChordIntegration"
+                                         "CreateAndReadTest.json");
+
+    std::vector<std::shared_ptr<ChordPeer>> peers;
+    ChordFromJson(test_info["PEERS"], peers);
+
+    std::string path = (std::filesystem::temp_directory_path() /
+                        "chord_capture_test.trace").string();
+    std::filesystem::remove(path);
+    peers[0]->StartRequestCapture(path);
+    for(int i = 0; i < 20; ++i) {
+        peers[1]->Create("captured" + std::to_string(i), std::to_string(i));
+    }
+    sleep(6);
+    peers[0]->StopRequestCapture();
+
+    std::vector<TraceRecord> records = TraceRecorder::Load(path);
+    EXPECT_FALSE(records.empty());
+    for(const TraceRecord &record : records) {
+        EXPECT_EQ(CLIENT_COMMANDS.count(record.request_["COMMAND"].asString()),
+                  1);
+    }
+    std::filesystem::remove(path);
+}
+
+/**
+ * A batched lookup must find the same successor for each key as looking the
+ * keys up one at a time would, whichever node the batch starts from. Keys
+ * whose owners are several hops away are split and forwarded in sub-batches,
+ * so a large enough batch from each node exercises the partitioning and the
+ * merging of results at every hop.
+ */
+TEST(ChordIntegration, BatchedLookup)
+{
+    Json::Value test_info = JsonFromFile("test_json/chord_tests/"
+                                         "ChordIntegration"
+                                         "CreateAndReadTest.json");
+
+    std::vector<std::shared_ptr<ChordPeer>> peers;
+    ChordFromJson(test_info["PEERS"], peers);
+
+    std::vector<std::string> keys;
+    for(int i = 0; i < 100; ++i) {
+        keys.push_back(std::to_string(i));
+    }
+
+    for(const auto &peer : peers) {
+        std::vector<RemotePeer> succs = peer->GetSuccessorBatch(keys);
+        ASSERT_EQ(succs.size(), keys.size());
+        for(int i = 0; i < keys.size(); ++i) {
+            EXPECT_EQ(std::string(succs[i].id_),
+                      std::string(peer->GetSuccessor(keys[i]).id_));
+        }
+    }
+}
+
+/**
+ * A scan of the whole keyspace, read a page at a time from one node, should
+ * return every key-value pair in the chord exactly once and in ring order,
+ * whichever peers hold them. Small pages ensure that pages both end part way
+ * through a peer's slice and span several peers' slices.
+ */
+TEST(ChordIntegration, Scan)
+{
+    Json::Value test_info = JsonFromFile("test_json/chord_tests/"
+                                         "ChordIntegration"
+                                         "CreateAndReadTest.json");
+
+    std::vector<std::shared_ptr<ChordPeer>> peers;
+    ChordFromJson(test_info["PEERS"], peers);
+
+    std::map<ChordKey, std::string> expected;
+    for(int i = 0; i < 100; ++i) {
+        peers[i % peers.size()]->Create(std::to_string(i), std::to_string(i));
+        expected.insert({ ChordKey(std::to_string(i), false),
+                          std::to_string(i) });
+    }
+
+    std::vector<std::pair<ChordKey, std::string>> scanned;
+    ScanPage page = peers[0]->Scan(ChordKey(0), ChordKey(0) - 1, 7);
+    while(true) {
+        EXPECT_LE(page.kv_pairs_.size(), 7);
+        scanned.insert(scanned.end(), page.kv_pairs_.begin(),
+                       page.kv_pairs_.end());
+        if(page.next_page_token_.empty()) {
+            break;
+        }
+        page = peers[0]->Scan(page.next_page_token_, 7);
+    }
+
+    std::vector<std::pair<ChordKey, std::string>> expected_kvs(
+            expected.begin(), expected.end());
+    EXPECT_EQ(scanned, expected_kvs);
+}
+
+/**
+ * A client which has not joined the chord should be able to create and read
+ * keys owned by any peer, bootstrapping from a single gateway. Having done
+ * so, it should have learned of (but not beyond) the peers in the chord, so
+ * that later requests go straight to the owner.
+ */
+TEST(ChordClient, CreateAndRead)
+{
+    Json::Value test_info = JsonFromFile("test_json/chord_tests/"
+                                         "ChordIntegration"
+                                         "CreateAndReadTest.json");
+
+    std::vector<std::shared_ptr<ChordPeer>> peers;
+    ChordFromJson(test_info["PEERS"], peers);
+
+    ChordClient client(peers[0]->GetIpAddr(), peers[0]->GetPort());
+    for(int i = 0; i < 50; ++i) {
+        client.Create(std::to_string(i), std::to_string(i));
+    }
+
+    for(int i = 0; i < 50; ++i) {
+        EXPECT_EQ(client.Read(std::to_string(i)), std::to_string(i));
+        EXPECT_EQ(peers[i % peers.size()]->Read(std::to_string(i)),
+                  std::to_string(i));
+    }
+
+    EXPECT_GT(client.NumCachedPeers(), 1);
+    EXPECT_LE(client.NumCachedPeers(), peers.size());
+    for(int i = 0; i < 50; ++i) {
+        ChordKey key(std::to_string(i), false);
+        EXPECT_EQ(client.Lookup(key).id_,
+                  peers[0]->GetSuccessor(std::to_string(i)).id_);
+    }
+}
+
+/**
+ * A request which the owner answers with an error other than not owning the
+ * key should fail as it is, without the client doubting (and forgetting) the
+ * owner or sending the request again.
+ */
+TEST(ChordClient, ApplicationErrorKeepsView)
+{
+    Json::Value test_info = JsonFromFile("test_json/chord_tests/"
+                                         "ChordIntegration"
+                                         "CreateAndReadTest.json");
+
+    std::vector<std::shared_ptr<ChordPeer>> peers;
+    ChordFromJson(test_info["PEERS"], peers);
+
+    ChordClient client(peers[0]->GetIpAddr(), peers[0]->GetPort());
+    client.Create("present", "value");
+    EXPECT_EQ(client.Read("present"), "value");
+
+    ChordKey missing("missing", false);
+    RemotePeer owner = client.Lookup(missing);
+    size_t num_cached = client.NumCachedPeers();
+    EXPECT_THROW(client.Read("missing"), RequestError);
+    EXPECT_EQ(client.NumCachedPeers(), num_cached);
+    EXPECT_EQ(client.Lookup(missing), owner);
+}
+
+/**
+ * In one-hop mode, each peer should learn of every other by gossip, and
+ * answer lookups from its view, agreeing with the ring's actual layout. Once
+ * a peer leaves, the rest should learn of that too.
+ */
+TEST(ChordIntegration, OneHopLookup)
+{
+    Json::Value test_info = JsonFromFile("test_json/chord_tests/"
+                                         "ChordIntegration"
+                                         "CreateAndReadTest.json");
+
+    std::vector<std::shared_ptr<ChordPeer>> peers;
+    std::function<void(std::shared_ptr<ChordPeer>)> enable_one_hop =
+        [](std::shared_ptr<ChordPeer> peer) { peer->EnableOneHop(); };
+    ChordFromJson(test_info["PEERS"], peers, enable_one_hop);
+
+    // Joins overlap with the gossip of earlier joins, so allow for a round
+    // of anti-entropy.
+    auto all_know_of = [&peers](size_t num_members) {
+        for(const auto &peer : peers) {
+            if(peer->NumMembers() != num_members) {
+                return false;
+            }
+        }
+        return true;
+    };
+    for(int i = 0; i < 200 && ! all_know_of(peers.size()); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+
+    std::set<ChordKey> ids;
+    for(const auto &peer : peers) {
+        EXPECT_EQ(peer->NumMembers(), peers.size());
+        ids.insert(peer->GetId());
+    }
+
+    for(int i = 0; i < 100; ++i) {
+        ChordKey key(std::to_string(i), false);
+        auto expected = ids.lower_bound(key);
+        if(expected == ids.end()) {
+            expected = ids.begin();
+        }
+        for(const auto &peer : peers) {
+            EXPECT_EQ(peer->GetSuccessor(std::to_string(i)).id_, *expected);
+        }
+    }
+
+    // Leaving peers broadcast their departure before they go.
+    peers.back()->Leave();
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+    for(int i = 0; i + 1 < peers.size(); ++i) {
+        EXPECT_EQ(peers[i]->NumMembers(), peers.size() - 1);
+    }
+}
+
+/**
+ * Files are stored as chunks behind a manifest. Reading a byte range should
+ * return exactly the requested bytes whether the range falls within a chunk,
+ * spans several, or runs past the end of the file, and downloading the file
+ * should reassemble it exactly.
+ */
+TEST(ChordIntegration, FileRanges)
+{
+    Json::Value test_info = JsonFromFile("test_json/chord_tests/"
+                                         "ChordIntegration"
+                                         "CreateAndReadTest.json");
+
+    std::vector<std::shared_ptr<ChordPeer>> peers;
+    ChordFromJson(test_info["PEERS"], peers);
+
+    std::string contents;
+    for(int i = 0; i < 10000; ++i) {
+        contents.push_back((char) ('a' + i * 7919 % 26));
+    }
+    std::filesystem::path upload_path = std::filesystem::temp_directory_path() /
+                                        "chord_file_ranges_upload",
+                          download_path = upload_path.string() + ".out";
+    std::ofstream(upload_path, std::ofstream::binary) << contents;
+
+    EXPECT_THROW(peers[0]->UploadFile(upload_path.string(), 0),
+                 std::runtime_error);
+    peers[0]->UploadFile(upload_path.string(), 1024);
+
+    std::vector<std::pair<size_t, size_t>> ranges {
+            { 0, 10 }, { 100, 900 }, { 1000, 100 }, { 1023, 2 },
+            { 3000, 5000 }, { 9990, 100 }, { 0, 10000 }, { 10000, 5 }
+    };
+    for(const auto &[offset, length] : ranges) {
+        EXPECT_EQ(peers[3]->ReadFileRange(upload_path.string(), offset, length),
+                  contents.substr(std::min(offset, contents.size()), length));
+    }
+
+    peers[5]->DownloadFile(upload_path.string(), download_path.string());
+    std::ifstream download(download_path, std::ifstream::binary);
+    std::string downloaded((std::istreambuf_iterator<char>(download)),
+                           std::istreambuf_iterator<char>());
+    EXPECT_EQ(downloaded, contents);
+
+    std::filesystem::remove(upload_path);
+    std::filesystem::remove(download_path);
+}
+
+/**
+ * Files uploaded before files were chunked are stored whole under their
+ * names, with no manifest. They should still download and read as they did.
+ */
+TEST(ChordIntegration, WholeFileFallback)
+{
+    Json::Value test_info = JsonFromFile("test_json/chord_tests/"
+                                         "ChordIntegration"
+                                         "CreateAndReadTest.json");
+
+    std::vector<std::shared_ptr<ChordPeer>> peers;
+    ChordFromJson(test_info["PEERS"], peers);
+
+    std::string file_name = "whole_file",
+                contents = "{\"SIZE\": 5, \"CHUNK_SIZE\": 1} is not a manifest";
+    peers[0]->Create(file_name, contents);
+
+    // Nor is JSON that looks like one but lacks a usable chunk size.
+    std::vector<std::string> lookalikes {
+            R"({"VERSION": 1, "SIZE": 5, "CHUNK_SIZE": 0})",
+            R"({"VERSION": 1, "SIZE": 5, "CHUNK_SIZE": "1"})",
+            R"({"VERSION": 1, "SIZE": 5})"
+    };
+    for(const std::string &lookalike : lookalikes) {
+        peers[0]->Create(lookalike, lookalike);
+        EXPECT_EQ(peers[3]->ReadFileRange(lookalike, 0, 1000), lookalike);
+    }
+
+    EXPECT_EQ(peers[3]->ReadFileRange(file_name, 0, 1000), contents);
+    EXPECT_EQ(peers[3]->ReadFileRange(file_name, 5, 10),
+              contents.substr(5, 10));
+    EXPECT_EQ(peers[3]->ReadFileRange(file_name, 1000, 10), "");
+
+    std::filesystem::path download_path =
+            std::filesystem::temp_directory_path() / "chord_whole_file.out";
+    peers[5]->DownloadFile(file_name, download_path.string());
+    std::ifstream download(download_path, std::ifstream::binary);
+    std::string downloaded((std::istreambuf_iterator<char>(download)),
+                           std::istreambuf_iterator<char>());
+    EXPECT_EQ(downloaded, contents);
+    std::filesystem::remove(download_path);
+}
+
 /**
  * Stabilize updates nodes' successor pointers. This test will seek to determine
  * whether, after 1 stabilize cycle, each node's successor list is up-to-date.
@@ -815,4 +1127,265 @@ TEST(ChordIntegration, NodeFailure)
                       expected_succs[j].asString());
         }
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Timeouts should start out at the maximum, then track the smoothed RTT (plus
+ * four times its variance) of each command separately, never dropping below
+ * the minimum.
+ */
+TEST(PeerHealth, TimeoutTracksRtt)
+{
+    PeerHealth health;
+    EXPECT_EQ(health.Timeout("GET_SUCC"), PeerHealth::MAX_TIMEOUT);
+
+    // A first sample of 100ms gives 100 + 4 * 50 = 300ms, below the minimum,
+    // whereas a much slower second sample pushes it above.
+    health.RecordRtt("JOIN", std::chrono::milliseconds(100));
+    EXPECT_EQ(health.Timeout("JOIN"), PeerHealth::MIN_TIMEOUT);
+    health.RecordRtt("JOIN", std::chrono::milliseconds(2000));
+    EXPECT_GT(health.Timeout("JOIN"), PeerHealth::MIN_TIMEOUT);
+    EXPECT_LE(health.Timeout("JOIN"), PeerHealth::MAX_TIMEOUT);
+
+    // Other commands are unaffected.
+    EXPECT_EQ(health.Timeout("GET_SUCC"), PeerHealth::MAX_TIMEOUT);
+}
+
+/**
+ * The breaker should trip after FAILURE_THRESHOLD consecutive failures, reject
+ * requests while cooling down, then let exactly one probe through, closing if
+ * it succeeds.
+ */
+TEST(PeerHealth, BreakerTripsAndHalfOpens)
+{
+    PeerHealth health;
+    for(int i = 0; i < PeerHealth::FAILURE_THRESHOLD - 1; ++i) {
+        health.RecordFailure();
+    }
+    EXPECT_FALSE(health.IsTripped());
+    health.RecordSuccess();
+
+    for(int i = 0; i < PeerHealth::FAILURE_THRESHOLD; ++i) {
+        health.RecordFailure();
+    }
+    EXPECT_TRUE(health.IsTripped());
+    EXPECT_FALSE(health.AllowRequest());
+
+    std::this_thread::sleep_for(PeerHealth::COOLDOWN);
+    EXPECT_FALSE(health.IsTripped());
+    EXPECT_TRUE(health.AllowRequest());
+    EXPECT_FALSE(health.AllowRequest());
+
+    // A failed probe re-opens the breaker, a successful one closes it.
+    health.RecordFailure();
+    EXPECT_TRUE(health.IsTripped());
+    std::this_thread::sleep_for(PeerHealth::COOLDOWN);
+    EXPECT_TRUE(health.AllowRequest());
+    health.RecordSuccess();
+    EXPECT_FALSE(health.IsTripped());
+    EXPECT_TRUE(health.AllowRequest());
+}
+
+/**
+ * Requests which time out because their caller allowed them less than the
+ * peer's usual timeout say nothing about the peer, so however many there are,
+ * they shouldn't trip its breaker.
+ */
+TEST(PeerHealth, CallerDeadlinesDontTrip)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::map<std::string, ReqHandler> commands = {
+            { "SLOW", [](const Json::Value &) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                return Json::Value();
+            } }
+    };
+    auto server = std::make_shared<Server<ReqHandler>>(6998, 3, commands);
+    server->RunInBackground();
+
+    RemotePeer peer("127.0.0.1", 6998);
+    Json::Value slow_req;
+    slow_req["COMMAND"] = "SLOW";
+    for(int i = 0; i < PeerHealth::FAILURE_THRESHOLD + 1; ++i) {
+        EXPECT_ANY_THROW(peer.SendRequest(
+                slow_req, std::chrono::steady_clock::now() +
+                          std::chrono::milliseconds(50)));
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    }
+    EXPECT_FALSE(PeerHealth::Of("127.0.0.1", 6998)->IsTripped());
+    EXPECT_NO_THROW(peer.SendRequest(slow_req));
+
+    server->Kill();
+}
+
+/**
+ * A peer should be interned once whatever its min key, and share a handle,
+ * which resolves to the peer with the min key it was last interned with;
+ * peers differing in ID or address should not share handles.
+ */
+TEST(PeerDirectory, InternsPeers)
+{
+    RemotePeer peer(ChordKey("abc", true), ChordKey("ab0", true),
+                    "127.0.0.1", 6999);
+    RemotePeer moved_peer(ChordKey("abc", true), ChordKey("aa0", true),
+                          "127.0.0.1", 6999);
+    RemotePeer other_peer(ChordKey("abc", true), ChordKey("ab0", true),
+                          "127.0.0.1", 7000);
+
+    PeerHandle handle(peer);
+    size_t size = PeerDirectory::Instance().Size();
+    PeerHandle same_handle { RemotePeer(Json::Value(peer)) };
+    EXPECT_EQ(handle, same_handle);
+    EXPECT_EQ(*handle, peer);
+    EXPECT_EQ(PeerDirectory::Instance().Size(), size);
+
+    PeerHandle moved_handle(moved_peer);
+    EXPECT_EQ(handle, moved_handle);
+    EXPECT_EQ(*handle, moved_peer);
+    EXPECT_EQ(PeerDirectory::Instance().Size(), size);
+
+    PeerHandle other_handle(other_peer);
+    EXPECT_FALSE(handle == other_handle);
+    EXPECT_EQ(RemotePeer(other_handle), other_peer);
+    EXPECT_EQ(PeerDirectory::Instance().Size(), size + 1);
+    EXPECT_TRUE(std::is_trivially_copyable_v<PeerHandle>);
+}
+
+/**
+ * Peers interned from many threads at once should each get one record.
+ */
+TEST(PeerDirectory, InternsConcurrently)
+{
+    const int NUM_THREADS = 8, NUM_PEERS = 200;
+    size_t size = PeerDirectory::Instance().Size();
+    std::vector<std::vector<PeerHandle>> handles(NUM_THREADS);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < NUM_THREADS; ++t) {
+        threads.emplace_back([&handles, t] {
+            for(int i = 0; i < NUM_PEERS; ++i) {
+                RemotePeer peer(ChordKey(std::to_string(i), false),
+                                ChordKey(std::to_string(t), false),
+                                "10.0.0.1", (unsigned short) (20000 + i));
+                handles[t].emplace_back(peer);
+            }
+        });
+    }
+    for(auto &thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(PeerDirectory::Instance().Size(), size + NUM_PEERS);
+    for(int t = 1; t < NUM_THREADS; ++t) {
+        EXPECT_EQ(handles[t], handles[0]);
+    }
+}
+
+/**
+ * Membership events should only take effect if they concern a later
+ * incarnation of a peer than the view knows of, or remove it at the same
+ * incarnation, so that views agree whatever order events arrive in.
+ */
+TEST(MembershipView, AppliesEventsByIncarnation)
+{
+    RemotePeer peer(ChordKey("abc", true), ChordKey("abc", true),
+                    "127.0.0.1", 6999);
+    using Type = MembershipEvent::Type;
+
+    MembershipView view;
+    EXPECT_TRUE(view.Apply(MembershipEvent(Type::JOIN, peer, 2)));
+    EXPECT_FALSE(view.Apply(MembershipEvent(Type::JOIN, peer, 2)));
+    EXPECT_FALSE(view.Apply(MembershipEvent(Type::FAIL, peer, 1)));
+    EXPECT_TRUE(view.IsMember(peer.id_));
+
+    EXPECT_TRUE(view.Apply(MembershipEvent(Type::LEAVE, peer, 2)));
+    EXPECT_FALSE(view.Apply(MembershipEvent(Type::JOIN, peer, 2)));
+    EXPECT_FALSE(view.IsMember(peer.id_));
+    EXPECT_EQ(view.Size(), 0);
+
+    EXPECT_TRUE(view.Apply(MembershipEvent(Type::JOIN, peer, 3)));
+    EXPECT_EQ(view.Size(), 1);
+
+    // The same events, in another order, give the same view.
+    MembershipView other_view;
+    other_view.Apply(MembershipEvent(Type::JOIN, peer, 3));
+    other_view.Apply(MembershipEvent(Type::LEAVE, peer, 2));
+    other_view.Apply(MembershipEvent(Type::JOIN, peer, 2));
+    EXPECT_EQ(view.Digest(), other_view.Digest());
+
+    MembershipView merged_view;
+    EXPECT_EQ(merged_view.Merge(Json::Value(view)), 1);
+    EXPECT_EQ(merged_view.Digest(), view.Digest());
+}
+
+/**
+ * Tombstones should keep stale joins out until they expire, should then be
+ * collected, and should never count towards a view's digest.
+ */
+TEST(MembershipView, CollectsTombstones)
+{
+    RemotePeer peer(ChordKey("abc", true), ChordKey("abc", true),
+                    "127.0.0.1", 6999);
+    RemotePeer other_peer(ChordKey("def", true), ChordKey("def", true),
+                          "127.0.0.1", 7000);
+    using Type = MembershipEvent::Type;
+
+    MembershipView view;
+    view.Apply(MembershipEvent(Type::JOIN, peer, 1));
+    view.Apply(MembershipEvent(Type::FAIL, peer, 1));
+    view.Apply(MembershipEvent(Type::JOIN, other_peer, 1));
+    EXPECT_FALSE(view.Apply(MembershipEvent(Type::JOIN, peer, 1)));
+    EXPECT_EQ(Json::Value(view).size(), 2);
+
+    MembershipView live_view;
+    live_view.Apply(MembershipEvent(Type::JOIN, other_peer, 1));
+    EXPECT_EQ(view.Digest(), live_view.Digest());
+
+    MembershipView short_view(std::chrono::milliseconds(0));
+    short_view.Apply(MembershipEvent(Type::JOIN, peer, 1));
+    short_view.Apply(MembershipEvent(Type::FAIL, peer, 1));
+    short_view.Apply(MembershipEvent(Type::JOIN, other_peer, 1));
+    EXPECT_EQ(Json::Value(short_view).size(), 1);
+    EXPECT_EQ(short_view.Digest(), live_view.Digest());
+}
+
+/**
+ * A broadcast passed on according to BroadcastTargets should reach every live
+ * peer in the view exactly once, and lookups should skip removed peers.
+ */
+TEST(MembershipView, BroadcastReachesEachPeerOnce)
+{
+    MembershipView view;
+    std::vector<RemotePeer> peers;
+    for(int i = 0; i < 50; ++i) {
+        ChordKey id("peer" + std::to_string(i), false);
+        peers.emplace_back(id, id, "127.0.0.1", 7000 + i);
+        view.Apply(MembershipEvent(MembershipEvent::Type::JOIN, peers.back(), 1));
+    }
+    view.Apply(MembershipEvent(MembershipEvent::Type::FAIL, peers[7], 1));
+
+    std::map<ChordKey, int> times_reached;
+    std::vector<std::pair<ChordKey, ChordKey>> to_visit {
+            { peers[0].id_, peers[0].id_ } };
+    while(! to_visit.empty()) {
+        auto [self_id, limit] = to_visit.back();
+        to_visit.pop_back();
+        ++times_reached[self_id];
+        for(const auto &[target, target_limit] :
+                view.BroadcastTargets(self_id, limit))
+        {
+            to_visit.emplace_back(target.id_, target_limit);
+        }
+    }
+
+    EXPECT_EQ(times_reached.size(), 49);
+    EXPECT_EQ(times_reached.count(peers[7].id_), 0);
+    for(const auto &[id, times] : times_reached) {
+        EXPECT_EQ(times, 1);
+    }
+
+    std::optional<RemotePeer> succ = view.Successor(peers[7].id_);
+    ASSERT_TRUE(succ.has_value());
+    EXPECT_NE(succ->id_, peers[7].id_);
+    EXPECT_TRUE(peers[7].id_.InBetween(succ->min_key_, succ->id_));
+    EXPECT_EQ(view.NSuccessors(peers[7].id_, 100).size(), 49);
+}
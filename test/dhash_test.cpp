@@ -1,7 +1,9 @@
 #include <gtest/gtest.h>
+#include "../src/chord/chord_client.h"
 #include "../src/chord/chord_peer.h"
 #include "../src/dhash/dhash_peer.h"
 #include "json_reader.h"
+#include <thread>
 
 
 /**
@@ -34,7 +36,8 @@ TEST(DHashSynchronize, AllKeysInRange)
 
     ChordKey key_to_create(test_info["KEY_TO_INSERT"].asString());
     auto val_to_create = test_info["VAL_TO_INSERT"].asString();
-    peers[0]->Create(ChordKey(key_to_create), DataBlock(val_to_create));
+    peers[0]->Create(ChordKey(key_to_create),
+                     DataBlock(val_to_create, 3, 2, 257));
 
     AddJsonNodesToChord(test_info["PEERS_TO_JOIN"], peers, adjust_ida_params);
 
@@ -148,6 +151,160 @@ TEST(DHashGlobalMaintenance, MisplacedKeys)
               ChordKey(test_info["EXPECTED_TESTED_HASH"].asString()));
 }
 
+/**
+ * Global maintenance over a key range should only push the misplaced keys
+ * within that range, leaving those outside it for a later round.
+ */
+TEST(DHashGlobalMaintenance, OnlyDirtyRange)
+{
+    Json::Value test_json = JsonFromFile("test_json/dhash_tests/"
+                                         "GlobalMaintenanceTest.json");
+    Json::Value test_info = test_json["MISPLACED_KEYS"];
+    std::vector<std::shared_ptr<DHashPeer>> peers;
+
+    std::function<void(std::shared_ptr<DHashPeer>)> adjust_ida_params =
+        [](std::shared_ptr<DHashPeer> peer) { peer->SetIdaParams(2, 1, 257); };
+    ChordFromJson(test_info["PEERS"], peers, adjust_ida_params);
+
+    int tested_ind = test_info["TESTED_IND"].asInt();
+    int correct_ind = test_info["CORRECT_SUCC_IND"].asInt();
+
+    Json::Value kvs = test_info["KEYS_TO_INSERT"];
+    for(Json::Value::const_iterator it = kvs.begin(); it != kvs.end(); ++it) {
+        ChordKey key_to_insert(it.key().asString());
+        DataBlock block(it->asString(), 2, 1, 257);
+        DataFragment frag_to_insert = block.fragments_[0];
+        peers[tested_ind]->db_.Insert({ key_to_insert, frag_to_insert });
+    }
+    ChordKey hash_before = peers[tested_ind]->db_.GetIndex().GetHash();
+
+    // The misplaced keys all lie between the tested peer and the peer which
+    // ought to store them, so the rest of the ring contains none of them.
+    peers[tested_ind]->RunGlobalMaintenance({ peers[correct_ind]->id_ + 1,
+                                              peers[tested_ind]->id_ });
+    EXPECT_EQ(peers[tested_ind]->db_.GetIndex().GetHash(), hash_before);
+
+    peers[tested_ind]->RunGlobalMaintenance({ peers[tested_ind]->id_ + 1,
+                                              peers[correct_ind]->id_ });
+    EXPECT_EQ(peers[tested_ind]->db_.GetIndex().GetHash(),
+              ChordKey(test_info["EXPECTED_TESTED_HASH"].asString()));
+}
+
+/**
+ * A fragment whose owner is down should be held by another peer, apart from
+ * its own fragments, until the owner comes back, and then handed off to it
+ * without any other peer having to rebuild it.
+ */
+TEST(DHashHintedHandoff, HandsOffWhenOwnerReturns)
+{
+    Json::Value test_json = JsonFromFile("test_json/dhash_tests/"
+                                         "GlobalMaintenanceTest.json");
+    Json::Value test_info = test_json["MISPLACED_KEYS"];
+    std::vector<std::shared_ptr<DHashPeer>> peers;
+    std::function<void(std::shared_ptr<DHashPeer>)> adjust_ida_params =
+        [](std::shared_ptr<DHashPeer> peer) { peer->SetIdaParams(2, 1, 257); };
+    ChordFromJson(test_info["PEERS"], peers, adjust_ida_params);
+
+    std::shared_ptr<DHashPeer> owner = peers[1], holder = peers[2];
+    RemotePeer owner_remote = owner->ToRemotePeer();
+    owner->Fail();
+
+    ChordKey key("hinted", false);
+    DataFragment frag = DataBlock("hinted value", 2, 1, 257).fragments_[0];
+    peers[0]->CreateHint(key, frag, owner_remote, holder->ToRemotePeer());
+    EXPECT_FALSE(holder->db_.Contains(key));
+
+    // While the owner is down, the hint stays where it is.
+    holder->HandOffHints(false);
+    ASSERT_EQ(holder->hints_.size(), 1);
+
+    sleep(1);
+    auto returned = std::make_shared<DHashPeer>(owner->GetIpAddr(),
+                                                owner->GetPort(), 3);
+    holder->HandOffHints(false);
+    EXPECT_TRUE(holder->hints_.empty());
+    ASSERT_TRUE(returned->db_.Contains(key));
+    EXPECT_EQ(returned->db_.Lookup(key), frag);
+}
+
+/**
+ * Creating a key one of whose successors is down should leave that
+ * successor's fragment with the first live peer past the key's successors.
+ * Once the ring has dropped the dead successor, the holder should hand the
+ * fragment to whichever of the key's new successors lacks one (here, itself),
+ * or drop it if local maintenance has already rebuilt that one's fragment.
+ * In one-hop mode, the dead successor is still in every view, so it is named
+ * as a successor until its failure is noticed.
+ */
+TEST(DHashHintedHandoff, CreateHintsPastDeadSuccessor)
+{
+    Json::Value test_json = JsonFromFile("test_json/dhash_tests/"
+                                         "GlobalMaintenanceTest.json");
+    Json::Value test_info = test_json["MISPLACED_KEYS"];
+    std::vector<std::shared_ptr<DHashPeer>> peers;
+    std::function<void(std::shared_ptr<DHashPeer>)> one_hop_small_ida =
+        [](std::shared_ptr<DHashPeer> peer) {
+            peer->SetIdaParams(2, 1, 257);
+            peer->EnableOneHop();
+        };
+    ChordFromJson(test_info["PEERS"], peers, one_hop_small_ida);
+
+    auto all_know_of_all = [&peers]() {
+        for(const auto &peer : peers) {
+            if(peer->NumMembers() != peers.size()) {
+                return false;
+            }
+        }
+        return true;
+    };
+    for(int i = 0; i < 200 && ! all_know_of_all(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_TRUE(all_know_of_all());
+
+    // Clockwise, the peers run 3, 0, 1, 2, so the key after peer 3 has peers
+    // 0 and 1 for successors, and peer 2 is the first peer past them.
+    std::shared_ptr<DHashPeer> creator = peers[0], dead = peers[1],
+                               holder = peers[2], other = peers[3];
+    ChordKey key = other->id_ + 1;
+    dead->Fail();
+    creator->Create(key, std::string("hinted value"));
+
+    EXPECT_TRUE(creator->db_.Contains(key));
+    EXPECT_FALSE(other->db_.Contains(key));
+    {
+        std::lock_guard<std::mutex> lock(other->hints_mutex_);
+        EXPECT_TRUE(other->hints_.empty());
+    }
+    {
+        // The holder's maintenance may already have handed the hint off.
+        std::lock_guard<std::mutex> lock(holder->hints_mutex_);
+        EXPECT_TRUE(holder->hints_.count(dead->id_) == 1 ||
+                    holder->db_.Contains(key));
+    }
+
+    auto holding_hints = [&holder]() {
+        std::lock_guard<std::mutex> lock(holder->hints_mutex_);
+        return ! holder->hints_.empty();
+    };
+    for(int i = 0; i < 200 && holding_hints(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    EXPECT_FALSE(holding_hints());
+    ASSERT_TRUE(holder->db_.Contains(key));
+    EXPECT_EQ(DataBlock::DecodeFragments({ holder->db_.Lookup(key) }, 2, 1,
+                                         257),
+              "hinted value");
+
+    // The key's successors are up and already hold fragments of it, so
+    // creating it again is refused rather than hinted (to the creator itself,
+    // as the first live peer past them).
+    EXPECT_THROW(other->Create(key, std::string("hinted value")),
+                 std::runtime_error);
+    std::lock_guard<std::mutex> lock(other->hints_mutex_);
+    EXPECT_TRUE(other->hints_.empty());
+}
+
 /**
  * Here we test the exchange node function. When called, the function should
  * message the specified peer with a node from the calling peer's merkle tree.
@@ -225,6 +382,121 @@ TEST(DHashIntegration, CreateAndRead)
     }
 }
 
+/**
+ * A DHash scan must reassemble each block from fragments held by the owner of
+ * its key and the peers following it. Scanning the whole keyspace should
+ * return every block inserted, decoded, in ring order.
+ */
+TEST(DHashIntegration, Scan)
+{
+    Json::Value test_json = JsonFromFile("test_json/dhash_tests/"
+                                         "DHashIntegration"
+                                         "CreateAndReadTest.json");
+    std::vector<std::shared_ptr<DHashPeer>> peers;
+    ChordFromJson(test_json["PEERS"], peers);
+
+    std::map<ChordKey, std::string> expected;
+    for(int i = 0; i < 5; ++i) {
+        std::string val = test_json["VAL"].asString() + std::to_string(i);
+        peers[0]->Create(std::to_string(i), val);
+        expected.insert({ ChordKey(std::to_string(i), false), val });
+    }
+
+    std::vector<std::pair<ChordKey, std::string>> scanned;
+    ScanPage page = peers[1]->Scan(ChordKey(0), ChordKey(0) - 1, 2);
+    while(true) {
+        scanned.insert(scanned.end(), page.kv_pairs_.begin(),
+                       page.kv_pairs_.end());
+        if(page.next_page_token_.empty()) {
+            break;
+        }
+        page = peers[1]->Scan(page.next_page_token_, 2);
+    }
+
+    std::vector<std::pair<ChordKey, std::string>> expected_kvs(
+            expected.begin(), expected.end());
+    EXPECT_EQ(scanned, expected_kvs);
+}
+
+/**
+ * A scan should read past a replica which has failed, gathering the rest of
+ * a block's fragments from the peers which follow it. In one-hop mode, the
+ * failed replica is still in every view, so it is named as a replica (and
+ * its successor must be found without it) until the failure is noticed.
+ */
+TEST(DHashIntegration, ScanPastFailedReplica)
+{
+    Json::Value test_json = JsonFromFile("test_json/dhash_tests/"
+                                         "DHashIntegration"
+                                         "CreateAndReadTest.json");
+    std::vector<std::shared_ptr<DHashPeer>> peers;
+    std::function<void(std::shared_ptr<DHashPeer>)> enable_one_hop =
+        [](std::shared_ptr<DHashPeer> peer) { peer->EnableOneHop(); };
+    ChordFromJson(test_json["PEERS"], peers, enable_one_hop);
+
+    auto all_know_of_all = [&peers]() {
+        for(const auto &peer : peers) {
+            if(peer->NumMembers() != peers.size()) {
+                return false;
+            }
+        }
+        return true;
+    };
+    for(int i = 0; i < 200 && ! all_know_of_all(); ++i) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    ASSERT_TRUE(all_know_of_all());
+
+    std::string val = test_json["VAL"].asString();
+    peers[0]->Create("scanned", val);
+    ChordKey key("scanned", false);
+
+    // Fail the peer holding the block's first replica, and scan just the
+    // block's key from a peer which is neither it nor the owner.
+    std::vector<RemotePeer> succs = peers[0]->GetNSuccessors("scanned", 2);
+    RemotePeer owner = succs[0], replica = succs[1];
+    std::shared_ptr<DHashPeer> scanner;
+    for(const auto &peer : peers) {
+        if(peer->GetPort() == replica.port_) {
+            peer->Fail();
+        } else if(! scanner && peer->GetPort() != owner.port_) {
+            scanner = peer;
+        }
+    }
+
+    ScanPage page = scanner->Scan(key, key, 2);
+    std::vector<std::pair<ChordKey, std::string>> expected_kvs {
+            { key, val } };
+    EXPECT_EQ(page.kv_pairs_, expected_kvs);
+}
+
+/**
+ * A client which has not joined a DHash ring should be able to store blocks
+ * which the peers can read, and read blocks which the peers stored, since
+ * it places and gathers fragments exactly as the peers do.
+ */
+TEST(ChordClient, DHashCreateAndRead)
+{
+    Json::Value test_json = JsonFromFile("test_json/dhash_tests/"
+                                         "DHashIntegration"
+                                         "CreateAndReadTest.json");
+    std::vector<std::shared_ptr<DHashPeer>> peers;
+    ChordFromJson(test_json["PEERS"], peers);
+
+    auto [n, m, p] = peers[0]->GetIdaParams();
+    ChordClient client(peers[0]->GetIpAddr(), peers[0]->GetPort(),
+                       ChordClient::Protocol::DHASH, n, m, p);
+    std::string val = test_json["VAL"].asString();
+    client.Create("from client", val + "1");
+    peers[1]->Create("from peer", val + "2");
+
+    EXPECT_EQ(client.Read("from client"), val + "1");
+    EXPECT_EQ(client.Read("from peer"), val + "2");
+    for(const auto &peer : peers) {
+        EXPECT_EQ(peer->Read("from client"), val + "1");
+    }
+}
+
 /**
  * Here, we test if the overlay network can repair itself after the voluntary
  * exit of several nodes. Since DHash requires 10 of 14 successors to
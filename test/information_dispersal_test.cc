@@ -1 +1,150 @@
-// Add tests later.
\ No newline at end of file
+#include <gtest/gtest.h>
+#include "../src/ida/data_block.h"
+#include <filesystem>
+
+/// Decoding m of a block's n fragments without constructing a block
+/// should give back the string from which the block was encoded, just as
+/// decoding a block constructed from those fragments does.
+TEST(DataBlockTest, DecodeFragments)
+{
+    std::string input;
+    for(int i = 0; i < 1000; ++i) {
+        input.push_back((char) ('a' + i % 26));
+    }
+
+    DataBlock block(input);
+    std::vector<DataFragment> ten_frags(block.fragments_.begin() + 2,
+                                        block.fragments_.begin() + 12);
+    EXPECT_EQ(DataBlock::DecodeFragments(ten_frags), input);
+    EXPECT_EQ(DataBlock(ten_frags).Decode(), input);
+}
+
+/// Blocks should round-trip arbitrary bytes, including trailing zero bytes
+/// (which are indistinguishable from the padding added by the IDA, were the
+/// length not stored), and the empty string.
+TEST(DataBlockTest, BinaryRoundTrip)
+{
+    std::string input;
+    for(int i = 0; i < 300; ++i) {
+        input.push_back((char) (i % 256));
+    }
+    input.append(5, '\0');
+
+    for(const std::string &str : { input, std::string(), std::string(3, '\0') })
+    {
+        DataBlock block(str);
+        EXPECT_EQ(block.Size(), str.size());
+        EXPECT_EQ(DataBlock(Json::Value(block)).Decode(), str);
+
+        std::vector<DataFragment> ten_frags(block.fragments_.begin(),
+                                            block.fragments_.begin() + 10);
+        EXPECT_EQ(DataBlock::DecodeFragments(ten_frags), str);
+        EXPECT_EQ(DataBlock(ten_frags).Decode(), str);
+    }
+}
+
+/// Fragments stored before payload sizes were recorded should still decode,
+/// to their payload less any trailing zero bytes, while fragments recording
+/// a size they couldn't hold should be rejected rather than trusted.
+TEST(DataBlockTest, PayloadSizes)
+{
+    std::vector<DataFragment> legacy_frags = FragsFromMatrix(
+            IDA(14, 10, 257).Encode(StrToInts("legacy")));
+    EXPECT_EQ(DataBlock::DecodeFragments(legacy_frags), "legacy");
+    EXPECT_EQ(DataBlock(legacy_frags).Decode(), "legacy");
+
+    DataBlock block(std::string("sized\0\0", 7));
+    DataFragment frag(Json::Value(block.fragments_[0]));
+    ASSERT_TRUE(frag.payload_size_.has_value());
+    EXPECT_EQ(*frag.payload_size_, 7);
+
+    std::vector<DataFragment> garbage_frags = block.fragments_;
+    for(DataFragment &garbage_frag : garbage_frags) {
+        garbage_frag.payload_size_ = 1000;
+    }
+    EXPECT_THROW(DataBlock::DecodeFragments(garbage_frags), std::runtime_error);
+}
+
+/// DecodeInto should write the same bytes as Decode returns.
+TEST(DataBlockTest, DecodeInto)
+{
+    DataBlock block(std::string("Hello, world"));
+
+    std::vector<char> buffer(block.Size());
+    block.DecodeInto(buffer.data());
+    EXPECT_EQ(std::string(buffer.begin(), buffer.end()), "Hello, world");
+
+    std::string out = "> ";
+    block.DecodeInto(out);
+    EXPECT_EQ(out, "> Hello, world");
+}
+
+/// MatrixProduct should agree with a naive product reduced mod p, including
+/// when every entry is p - 1 (the largest sums the kernels accumulate), and
+/// for row lengths which aren't a multiple of the vector width.
+TEST(MatrixMathTest, MatrixProductMatchesNaive)
+{
+    for(int prime : { 257, 251 }) {
+        for(int cols : { 1, 10, 300 }) {
+            for(int extreme = 0; extreme < 2; ++extreme) {
+                Matrix lhs(14, Vector(cols)), rhs(cols, Vector(37));
+                for(int i = 0; i < lhs.size(); ++i) {
+                    for(int k = 0; k < cols; ++k) {
+                        lhs[i][k] = extreme ? prime - 1 : (i * 31 + k) % prime;
+                    }
+                }
+                for(int k = 0; k < cols; ++k) {
+                    for(int j = 0; j < rhs[k].size(); ++j) {
+                        rhs[k][j] = extreme ? prime - 1 : (k * 17 + j) % prime;
+                    }
+                }
+
+                Matrix product = MatrixProduct(lhs, rhs, prime);
+                for(int i = 0; i < lhs.size(); ++i) {
+                    for(int j = 0; j < rhs[0].size(); ++j) {
+                        long long cell = 0;
+                        for(int k = 0; k < cols; ++k) {
+                            cell += (long long) lhs[i][k] * rhs[k][j];
+                        }
+                        EXPECT_EQ(product[i][j], cell % prime);
+                    }
+                }
+            }
+        }
+    }
+}
+
+/// A file encoded to fragment files should decode, from any m of them, back
+/// to the same bytes, across several batches and with a partial final
+/// segment.
+TEST(IDATest, EncodeAndDecodeFiles)
+{
+    auto dir = std::filesystem::temp_directory_path();
+    std::string in_file = dir / "ida_test_in", out_file = dir / "ida_test_out";
+
+    std::string contents;
+    for(int i = 0; i < 50003; ++i) {
+        contents.push_back((char) ((i * 131) % 256));
+    }
+    std::ofstream(in_file, std::ofstream::binary) << contents;
+
+    IDA ida(14, 10, 257);
+    std::vector<std::string> frag_files;
+    for(int i = 0; i < 14; ++i) {
+        frag_files.push_back(dir / ("ida_test_frag_" + std::to_string(i)));
+    }
+    ida.EncodeToFiles(in_file.c_str(), frag_files);
+
+    for(int first : { 0, 4 }) {
+        std::vector<std::string> ten_files(frag_files.begin() + first,
+                                           frag_files.begin() + first + 10);
+        ida.DecodeFromFiles(ten_files, out_file.c_str());
+        EXPECT_TRUE(ReadFile(out_file.c_str()) == contents) << first;
+    }
+
+    std::filesystem::remove(in_file);
+    std::filesystem::remove(out_file);
+    for(const std::string &frag_file : frag_files) {
+        std::filesystem::remove(frag_file);
+    }
+}
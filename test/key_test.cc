@@ -1,5 +1,7 @@
 #include <gtest/gtest.h>
+#include "../src/data_structures/finger_table.h"
 #include "../src/data_structures/key.h"
+#include <random>
 
 /// Note that these will have a max value of 255.
 using EightBitKey = GenericKey<2, 8>;
@@ -76,6 +78,10 @@ TEST(KeyInBetweenTest, InclusiveWithModulo)
 /// in previous implementations when computing the size of the logical ring).
 TEST(KeyInBetweenTest, DifferingLengths)
 {
+    if(ChordKey::BinaryLen() != 128) {
+        GTEST_SKIP() << "Keys are 128-bit hashes.";
+    }
+
 	// This was previously an edge case. The differing lengths of the keys
 	// produced an inaccurate value for hex codes, so now we simply assume
 	// a constant keyspace of 16^32 keys.
@@ -84,4 +90,95 @@ TEST(KeyInBetweenTest, DifferingLengths)
         ub("f4ee136cb4059b2883450e7e93698bd", true);
 
 	EXPECT_FALSE(key.InBetween(lb, ub, true));
-}
\ No newline at end of file
+}
+
+
+/// Keys of a 64-bit ring, which are stored as native integers (whatever the
+/// width of ChordKey in this build).
+using SixtyFourBitKey = GenericKey<16, 16>;
+static_assert(SixtyFourBitKey::NATIVE);
+
+/// Native key arithmetic should agree with unsigned 64-bit arithmetic, which
+/// wraps at the same point as the ring, except that equal keys are a whole
+/// ring apart.
+TEST(NativeKeyTest, ArithmeticWraps)
+{
+    std::mt19937_64 random(95);
+    for(int i = 0; i < 1000; ++i) {
+        uint64_t a = random(), b = i % 2 ? random() : a;
+        SixtyFourBitKey key_a(a), key_b(b);
+        EXPECT_EQ((key_a + key_b).Value(), (uint64_t) (a + b));
+        EXPECT_EQ((key_a + 1).Value(), (uint64_t) (a + 1));
+        EXPECT_EQ((key_a - 1).Value(), (uint64_t) (a - 1));
+        if(a == b) {
+            EXPECT_EQ(key_a - key_b, SixtyFourBitKey::KeysInRing());
+        } else {
+            EXPECT_EQ((key_a - key_b).Value(), (uint64_t) (a - b));
+        }
+    }
+
+    EXPECT_EQ(SixtyFourBitKey(UINT64_MAX) + 1, SixtyFourBitKey(0));
+    EXPECT_EQ(SixtyFourBitKey(0) - 1, SixtyFourBitKey(UINT64_MAX));
+    EXPECT_EQ(SixtyFourBitKey::PowerOfTwo(63).Value(), (uint64_t) 1 << 63);
+    EXPECT_EQ(SixtyFourBitKey::PowerOfTwo(64), SixtyFourBitKey(0));
+}
+
+/// Native keys parsed from hashes wider than the ring should be taken modulo
+/// its size, and print as hex without leading zeros.
+TEST(NativeKeyTest, ParsesAndPrints)
+{
+    SixtyFourBitKey wide("fedcba98765432100123456789abcdef", true),
+                    narrow("0123456789abcdef", true);
+    EXPECT_EQ(wide, narrow);
+    EXPECT_EQ(std::string(narrow), "123456789abcdef");
+    EXPECT_EQ(std::string(SixtyFourBitKey(0)), "0");
+    EXPECT_EQ(SixtyFourBitKey("plaintext", false),
+              SixtyFourBitKey("plaintext", false));
+    EXPECT_THROW(SixtyFourBitKey("not hex", true), std::runtime_error);
+}
+
+/// Native InBetween should agree with distances measured clockwise from the
+/// lower bound, including for ranges which wrap past zero.
+TEST(NativeKeyTest, InBetweenWraps)
+{
+    std::mt19937_64 random(64);
+    for(int i = 0; i < 1000; ++i) {
+        uint64_t lower = random(), upper = random(),
+                 value = i % 3 ? random() : lower + random() % 4;
+        if(lower == upper) {
+            continue;
+        }
+        uint64_t offset = value - lower, span = upper - lower;
+        SixtyFourBitKey key(value);
+        EXPECT_EQ(key.InBetween(SixtyFourBitKey(lower),
+                                SixtyFourBitKey(upper), true),
+                  offset <= span);
+        EXPECT_EQ(key.InBetween(SixtyFourBitKey(lower),
+                                SixtyFourBitKey(upper), false),
+                  offset > 0 && offset < span);
+    }
+
+    SixtyFourBitKey near_max(UINT64_MAX - 1);
+    EXPECT_TRUE(SixtyFourBitKey(0).InBetween(near_max, SixtyFourBitKey(1)));
+    EXPECT_TRUE(SixtyFourBitKey(UINT64_MAX).InBetween(near_max,
+                                                      SixtyFourBitKey(1)));
+    EXPECT_FALSE(SixtyFourBitKey(2).InBetween(near_max, SixtyFourBitKey(1)));
+}
+
+/// Finger ranges should tile the ring clockwise from the key after the
+/// table's starting key all the way round to the key before it, for whatever
+/// width ChordKey has in this build.
+TEST(NativeKeyTest, FingerRangesTileRing)
+{
+    ChordKey start("fedcba9876543210", true);
+    FingerTable<int> fingers(start);
+
+    EXPECT_EQ(fingers.GetNthRange(0).first, start + 1);
+    EXPECT_EQ(fingers.GetNthRange(0).second, start + 1);
+    for(int i = 0; i + 1 < (int) ChordKey::BinaryLen(); ++i) {
+        EXPECT_EQ(fingers.GetNthRange(i).second + 1,
+                  fingers.GetNthRange(i + 1).first);
+    }
+    EXPECT_EQ(fingers.GetNthRange((int) ChordKey::BinaryLen() - 1).second,
+              start - 1);
+}
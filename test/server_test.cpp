@@ -1,6 +1,10 @@
 #include "../src/networking/server.h"
 #include "../src/networking/client.h"
+#include "../src/networking/io_uring.h"
+#include "../src/networking/request_trace.h"
 #include <gtest/gtest.h>
+#include <filesystem>
+#include <future>
 
 class ServerWrapper1 {
 public:
@@ -18,12 +22,12 @@ public:
                  }
                 },
                 { "HANG",
-                  [this](const Json::Value &_) {
+                  [this](const Json::Value &) {
                      return hang();
                   }
                 },
                 { "LONG_REQ",
-                  [this](const Json::Value &_) {
+                  [this](const Json::Value &) {
                      return long_response();
                  }
                 }
@@ -112,7 +116,7 @@ public:
                         }
                 },
                 { "HANG",
-                        [this](const Json::Value &_) {
+                        [this](const Json::Value &) {
                           return hang();
                         }
                 }
@@ -286,4 +290,699 @@ TEST(Request, LongRequest)
     EXPECT_EQ(long_resp["DATA"].asString(), std::string(16384, '0'));
 
     sw.Kill();
-}
\ No newline at end of file
+}
+
+/**
+ * Once a server is serving as many sessions as it is allowed, it should reject
+ * further requests with a "BUSY" response carrying a retry hint rather than
+ * queueing them, and it should accept requests again once load drops.
+ */
+TEST(Server, ShedsLoadWhenBusy)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::map<std::string, ReqHandler> commands = {
+            { "ADD_VAL",
+              [](const Json::Value &req) {
+                  Json::Value resp;
+                  resp["VALUE"] = req["VALUE"].asInt() + 1;
+                  return resp;
+              }
+            }
+    };
+    auto server = std::make_shared<Server<ReqHandler>>(4006, 3, commands,
+                                                       false, 1, 64, 25);
+    server->RunInBackground();
+
+    // Occupy the only session slot with a connection that never finishes
+    // sending its request.
+    boost::asio::io_context io;
+    tcp::socket idle_conn(io);
+    idle_conn.connect({ boost::asio::ip::address::from_string("127.0.0.1"),
+                        4006 });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    Json::Value add_one_req, add_one_resp;
+    add_one_req["COMMAND"] = "ADD_VAL";
+    add_one_req["VALUE"] = 1;
+    add_one_resp = Client::MakeRequest("127.0.0.1", 4006, add_one_req);
+
+    EXPECT_FALSE(add_one_resp["SUCCESS"].asBool());
+    EXPECT_TRUE(add_one_resp["BUSY"].asBool());
+    EXPECT_EQ(add_one_resp["RETRY_AFTER_MS"].asInt(), 25);
+    EXPECT_EQ(server->GetNumShed(), 1);
+
+    idle_conn.close();
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    add_one_resp = Client::MakeRequest("127.0.0.1", 4006, add_one_req);
+    EXPECT_TRUE(add_one_resp["SUCCESS"].asBool());
+    EXPECT_EQ(add_one_resp["VALUE"].asInt(), 2);
+
+    server->Kill();
+}
+
+/**
+ * A handler which found every peer it depends on busy should have its request
+ * answered "BUSY", with the retry hint it was given, without its thread
+ * waiting the hint out.
+ */
+TEST(Server, PassesOnBusyFromHandler)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::map<std::string, ReqHandler> commands = {
+            { "FORWARD",
+              [](const Json::Value &) -> Json::Value {
+                  throw BusyError(250);
+              }
+            }
+    };
+    auto server = std::make_shared<Server<ReqHandler>>(4017, 1, commands);
+    server->RunInBackground();
+
+    Json::Value forward_req, forward_resp;
+    forward_req["COMMAND"] = "FORWARD";
+    auto start = std::chrono::steady_clock::now();
+    forward_resp = Client::MakeRequest("127.0.0.1", 4017, forward_req);
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(250));
+    EXPECT_FALSE(forward_resp["SUCCESS"].asBool());
+    EXPECT_TRUE(forward_resp["BUSY"].asBool());
+    EXPECT_EQ(forward_resp["RETRY_AFTER_MS"].asInt(), 250);
+
+    server->Kill();
+}
+
+/**
+ * Coroutine handlers should hold no thread while they wait: on a server with a
+ * single thread, several of them should wait at once, and synchronous
+ * handlers should still be served meanwhile. Their errors should be reported
+ * as those of synchronous handlers are.
+ */
+TEST(Server, AsyncHandlersHoldNoThread)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::map<std::string, ReqHandler> commands = {
+            { "ECHO",
+              [](const Json::Value &req) {
+                  Json::Value resp;
+                  resp["DATA"] = req["DATA"];
+                  return resp;
+              }
+            }
+    };
+    std::map<std::string, AsyncReqHandler> async_commands = {
+            { "SLOW_ECHO",
+              [](Json::Value req) -> Awaitable<Json::Value> {
+                  boost::asio::steady_timer timer(
+                          co_await boost::asio::this_coro::executor,
+                          std::chrono::milliseconds(300));
+                  co_await timer.async_wait(boost::asio::use_awaitable);
+                  if(! req.isMember("DATA")) {
+                      throw std::runtime_error("No data.");
+                  }
+                  Json::Value resp;
+                  resp["DATA"] = req["DATA"];
+                  co_return resp;
+              }
+            }
+    };
+    auto server = std::make_shared<Server<ReqHandler>>(4018, 1, commands,
+                                                       async_commands);
+    server->RunInBackground();
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::future<Json::Value>> slow_resps;
+    for(int i = 0; i < 3; ++i) {
+        slow_resps.push_back(std::async(std::launch::async, [i] {
+            Json::Value req;
+            req["COMMAND"] = "SLOW_ECHO";
+            if(i > 0) {
+                req["DATA"] = i;
+            }
+            return Client::MakeRequest("127.0.0.1", 4018, req);
+        }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    Json::Value echo_req;
+    echo_req["COMMAND"] = "ECHO";
+    echo_req["DATA"] = "quick";
+    EXPECT_EQ(Client::MakeRequest("127.0.0.1", 4018, echo_req)["DATA"],
+              "quick");
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(250));
+
+    Json::Value failed = slow_resps[0].get();
+    EXPECT_FALSE(failed["SUCCESS"].asBool());
+    EXPECT_EQ(failed["ERRORS"].asString(), "No data.");
+    for(int i = 1; i < 3; ++i) {
+        Json::Value resp = slow_resps[i].get();
+        EXPECT_TRUE(resp["SUCCESS"].asBool());
+        EXPECT_EQ(resp["DATA"].asInt(), i);
+    }
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(550));
+
+    server->Kill();
+}
+
+TEST(Server, MaintenanceDoesNotBlockForeground)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::map<std::string, ReqHandler> commands = {
+            { "ADD_VAL",
+              [](const Json::Value &req) {
+                  Json::Value resp;
+                  resp["VALUE"] = req["VALUE"].asInt() + 1;
+                  return resp;
+              }
+            },
+            { "SYNC",
+              [](const Json::Value &) {
+                  std::this_thread::sleep_for(std::chrono::seconds(1));
+                  return Json::Value();
+              }
+            }
+    };
+    // A single IO thread, which a slow handler would otherwise monopolize.
+    auto server = std::make_shared<Server<ReqHandler>>(4007, 1, commands);
+    server->RunInBackground();
+
+    Json::Value sync_req;
+    sync_req["COMMAND"] = "SYNC";
+    sync_req["CLASS"] = "MAINTENANCE";
+    std::thread sync_thread([&sync_req] {
+        Json::Value sync_resp = Client::MakeRequest("127.0.0.1", 4007,
+                                                    sync_req);
+        EXPECT_TRUE(sync_resp["SUCCESS"].asBool());
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    Json::Value add_one_req, add_one_resp;
+    add_one_req["COMMAND"] = "ADD_VAL";
+    add_one_req["VALUE"] = 1;
+    auto start = std::chrono::steady_clock::now();
+    add_one_resp = Client::MakeRequest("127.0.0.1", 4007, add_one_req);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    EXPECT_TRUE(add_one_resp["SUCCESS"].asBool());
+    EXPECT_EQ(add_one_resp["VALUE"].asInt(), 2);
+    EXPECT_LT(elapsed, std::chrono::milliseconds(500));
+
+    sync_thread.join();
+    server->Kill();
+}
+
+TEST(Client, DeadlineBoundsWait)
+{
+    ServerWrapper sw(1, 4008);
+    sw.Run();
+
+    Json::Value hang_req;
+    hang_req["COMMAND"] = "HANG";
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_ANY_THROW(Client::MakeRequest("127.0.0.1", 4008, hang_req,
+                                         start + std::chrono::milliseconds(300)));
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(2));
+
+    // A request whose deadline has passed shouldn't be sent at all.
+    EXPECT_ANY_THROW(Client::MakeRequest("127.0.0.1", 4008, hang_req, start));
+    sw.Kill();
+}
+
+/**
+ * A request whose deadline passes while it waits for a handler thread should
+ * be answered with "EXPIRED" rather than handled.
+ */
+TEST(Server, DropsExpiredRequests)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::atomic<int> num_handled = 0;
+    std::map<std::string, ReqHandler> commands = {
+            { "SYNC",
+              [&num_handled](const Json::Value &) {
+                  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+                  ++num_handled;
+                  return Json::Value();
+              }
+            }
+    };
+    // A single maintenance thread, so the second request queues behind the
+    // first.
+    auto server = std::make_shared<Server<ReqHandler>>(4009, 3, commands,
+                                                       false, 256, 64, 50, 1);
+    server->RunInBackground();
+
+    Json::Value sync_req;
+    sync_req["COMMAND"] = "SYNC";
+    sync_req["CLASS"] = "MAINTENANCE";
+    std::thread sync_thread([&sync_req] {
+        Json::Value sync_resp = Client::MakeRequest("127.0.0.1", 4009,
+                                                    sync_req);
+        EXPECT_TRUE(sync_resp["SUCCESS"].asBool());
+    });
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    Json::Value late_req = sync_req, late_resp;
+    late_req["DEADLINE_MS"] = 100;
+    late_resp = Client::MakeRequest("127.0.0.1", 4009, late_req);
+    EXPECT_FALSE(late_resp["SUCCESS"].asBool());
+    EXPECT_TRUE(late_resp["EXPIRED"].asBool());
+
+    sync_thread.join();
+    EXPECT_EQ(num_handled, 1);
+    server->Kill();
+}
+
+/// In per-core mode, each worker thread should get its own reactor, and
+/// connections spread across them should all be served.
+TEST(Server, PerCoreMode)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::map<std::string, ReqHandler> commands = {
+            { "ECHO",
+              [](const Json::Value &req) {
+                  Json::Value resp;
+                  resp["VAL"] = req["VAL"];
+                  return resp;
+              }
+            }
+    };
+    auto server = std::make_shared<Server<ReqHandler>>(4010, 4, commands,
+                                                       false, 256, 64, 50, 2,
+                                                       true, true);
+    EXPECT_EQ(server->GetNumReactors(), 4);
+    server->RunInBackground();
+
+    std::vector<std::thread> clients;
+    std::atomic<int> num_succeeded = 0;
+    for(int i = 0; i < 8; ++i) {
+        clients.emplace_back([i, &num_succeeded] {
+            for(int j = 0; j < 10; ++j) {
+                Json::Value req;
+                req["COMMAND"] = "ECHO";
+                req["VAL"] = i * 10 + j;
+                Json::Value resp = Client::MakeRequest("127.0.0.1", 4010, req);
+                if(resp["SUCCESS"].asBool() && resp["VAL"].asInt() == i * 10 + j) {
+                    ++num_succeeded;
+                }
+            }
+        });
+    }
+    for(auto &client : clients) {
+        client.join();
+    }
+
+    EXPECT_EQ(num_succeeded, 80);
+    server->Kill();
+}
+
+/// Both IO backends should carry requests (large and small) identically, and
+/// both should fail cleanly when no server is listening.
+TEST(Client, IoBackends)
+{
+    ServerWrapper1 sw(2, 4011);
+    sw.Run();
+
+    IoBackend default_backend = GetIoBackend();
+    Json::Value long_req;
+    long_req["COMMAND"] = "LONG_REQ";
+    long_req["DATA"] = std::string(200000, '0');
+    for(IoBackend backend : { IoBackend::ASIO, IoBackend::IO_URING }) {
+        SetIoBackend(backend);
+        Json::Value long_resp = Client::MakeRequest("127.0.0.1", 4011,
+                                                    long_req);
+        EXPECT_TRUE(long_resp["SUCCESS"].asBool());
+        EXPECT_EQ(long_resp["DATA"].asString(), std::string(16384, '0'));
+        EXPECT_TRUE(Client::IsAlive("127.0.0.1", 4011));
+        EXPECT_FALSE(Client::IsAlive("127.0.0.1", 4099));
+        EXPECT_ANY_THROW(Client::MakeRequest("127.0.0.1", 4099, long_req));
+    }
+    SetIoBackend(default_backend);
+    sw.Kill();
+}
+
+/// Servers should serve requests identically on either IO backend, to
+/// clients on either backend, and stop accepting connections once killed.
+TEST(Server, IoBackends)
+{
+    IoBackend default_backend = GetIoBackend();
+    for(IoBackend server_backend : { IoBackend::ASIO, IoBackend::IO_URING }) {
+        SetIoBackend(server_backend);
+        ServerWrapper1 sw(2, 4019);
+        sw.Run();
+
+        Json::Value add_req, long_req;
+        add_req["COMMAND"] = "ADD_VAL";
+        add_req["VALUE"] = 1;
+        long_req["COMMAND"] = "LONG_REQ";
+        long_req["DATA"] = std::string(200000, '0');
+        for(IoBackend backend : { IoBackend::ASIO, IoBackend::IO_URING }) {
+            SetIoBackend(backend);
+            std::vector<std::future<int>> sums;
+            for(int i = 0; i < 16; ++i) {
+                sums.push_back(std::async(std::launch::async, [&add_req] {
+                    return Client::MakeRequest("127.0.0.1", 4019,
+                                               add_req)["VALUE"].asInt();
+                }));
+            }
+            for(auto &sum : sums) {
+                EXPECT_EQ(sum.get(), 3);
+            }
+
+            Json::Value long_resp = Client::MakeRequest("127.0.0.1", 4019,
+                                                        long_req);
+            EXPECT_EQ(long_resp["DATA"].asString(), std::string(16384, '0'));
+        }
+
+        // asio closes its acceptor asynchronously.
+        sw.Kill();
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        EXPECT_FALSE(Client::IsAlive("127.0.0.1", 4019));
+    }
+    SetIoBackend(default_backend);
+}
+
+/// Large strings in a response are written straight from the response rather
+/// than copied into the serialized reply; the client should not be able to
+/// tell the difference.
+TEST(Server, SplicesLargeStrings)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::string payload(100000, 'A'), escaped(4096, '"');
+    for(size_t i = 0; i < payload.size(); ++i) {
+        payload[i] = (char) ('A' + i % 26);
+    }
+    std::map<std::string, ReqHandler> commands = {
+            { "READ",
+              [&payload, &escaped](const Json::Value &) {
+                  Json::Value resp, frag;
+                  frag["FRAGMENT"] = payload;
+                  frag["INDEX"] = 3;
+                  resp["VALUE"] = frag;
+                  resp["KV_PAIRS"].append(frag);
+                  resp["KV_PAIRS"].append(frag);
+                  resp["ESCAPED"] = escaped;
+                  resp["SMALL"] = "small";
+                  resp["TYPES"]["NULL"] = Json::Value();
+                  resp["TYPES"]["INT"] = -7;
+                  resp["TYPES"]["UINT"] = Json::UInt64(1) << 63;
+                  resp["TYPES"]["REAL"] = 0.1;
+                  resp["TYPES"]["BOOL"] = true;
+                  resp["TYPES"]["EMPTY"] = Json::Value(Json::arrayValue);
+                  resp["TYPES"]["NUL"] = std::string("a\0b", 3);
+                  resp["TYPES"]["UTF8\n"] = "caf\xc3\xa9\t";
+                  return resp;
+              }
+            }
+    };
+    auto server = std::make_shared<Server<ReqHandler>>(4012, 2, commands);
+    server->RunInBackground();
+
+    Json::Value req, resp;
+    req["COMMAND"] = "READ";
+    resp = Client::MakeRequest("127.0.0.1", 4012, req);
+    EXPECT_TRUE(resp["SUCCESS"].asBool());
+    EXPECT_EQ(resp["VALUE"]["FRAGMENT"].asString(), payload);
+    EXPECT_EQ(resp["VALUE"]["INDEX"].asInt(), 3);
+    EXPECT_EQ(resp["KV_PAIRS"].size(), 2);
+    EXPECT_EQ(resp["KV_PAIRS"][1]["FRAGMENT"].asString(), payload);
+    EXPECT_EQ(resp["ESCAPED"].asString(), escaped);
+    EXPECT_EQ(resp["SMALL"].asString(), "small");
+    EXPECT_TRUE(resp["TYPES"]["NULL"].isNull());
+    EXPECT_TRUE(resp["TYPES"].isMember("NULL"));
+    EXPECT_EQ(resp["TYPES"]["INT"].asInt(), -7);
+    EXPECT_EQ(resp["TYPES"]["UINT"].asUInt64(), Json::UInt64(1) << 63);
+    EXPECT_EQ(resp["TYPES"]["REAL"].asDouble(), 0.1);
+    EXPECT_TRUE(resp["TYPES"]["BOOL"].asBool());
+    EXPECT_TRUE(resp["TYPES"]["EMPTY"].isArray());
+    EXPECT_EQ(resp["TYPES"]["NUL"].asString(), std::string("a\0b", 3));
+    EXPECT_EQ(resp["TYPES"]["UTF8\n"].asString(), "caf\xc3\xa9\t");
+    server->Kill();
+}
+
+/// Sessions allocate their buffers from a per-session arena, share the
+/// server's command map and reuse their IO thread's JSON reader. None of that
+/// should show across many requests, whether or not they fit in the arena's
+/// initial block, and serving them shouldn't copy any handler.
+TEST(Server, SessionsShareStateAcrossRequests)
+{
+    // Counts every copy made of it, so that sessions copying the command map
+    // would show.
+    struct CountingEcho {
+        std::atomic<int> *num_copies_;
+
+        explicit CountingEcho(std::atomic<int> *num_copies)
+            : num_copies_(num_copies)
+        {}
+
+        CountingEcho(const CountingEcho &rhs)
+            : num_copies_(rhs.num_copies_)
+        {
+            ++*num_copies_;
+        }
+
+        Json::Value operator()(const Json::Value &req) const
+        {
+            Json::Value resp;
+            resp["DATA"] = req["DATA"];
+            return resp;
+        }
+    };
+
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::atomic<int> num_copies = 0;
+    std::map<std::string, ReqHandler> commands;
+    commands.emplace("ECHO", CountingEcho(&num_copies));
+    // A single IO thread, so that every request goes through the same reader.
+    auto server = std::make_shared<Server<ReqHandler>>(4015, 1,
+                                                       std::move(commands));
+    server->RunInBackground();
+    int copies_before = num_copies;
+
+    for(int i = 0; i < 40; ++i) {
+        // Every fourth request (and its echo) outgrows the arena's 4096-byte
+        // initial block.
+        size_t length = i % 4 == 3 ? 10000 + i : 10 + i;
+        Json::Value req;
+        req["COMMAND"] = "ECHO";
+        req["DATA"] = std::string(length, (char) ('a' + i % 26));
+        Json::Value resp = Client::MakeRequest("127.0.0.1", 4015, req);
+        ASSERT_TRUE(resp["SUCCESS"].asBool()) << "request " << i;
+        EXPECT_EQ(resp["DATA"].asString(), req["DATA"].asString());
+    }
+
+    // Requests which fail to parse shouldn't upset the reader for those
+    // after them.
+    Json::Value bad_resp = Client::MakeRequest("127.0.0.1", 4015,
+                                               Json::Value("not an object"));
+    EXPECT_FALSE(bad_resp["SUCCESS"].asBool());
+    Json::Value req;
+    req["COMMAND"] = "ECHO";
+    req["DATA"] = "after";
+    EXPECT_EQ(Client::MakeRequest("127.0.0.1", 4015, req)["DATA"].asString(),
+              "after");
+
+    EXPECT_EQ(num_copies, copies_before);
+    server->Kill();
+}
+
+/// Awaitable requests run from coroutines should proceed concurrently on the
+/// maintenance executor, with failures reported per request.
+TEST(Client, AsyncRequestsInterleave)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::map<std::string, ReqHandler> commands = {
+            { "SLOW_ECHO",
+              [](const Json::Value &req) {
+                  std::this_thread::sleep_for(std::chrono::milliseconds(300));
+                  Json::Value resp;
+                  resp["VAL"] = req["VAL"];
+                  return resp;
+              }
+            }
+    };
+    auto server = std::make_shared<Server<ReqHandler>>(4013, 4, commands);
+    server->RunInBackground();
+
+    auto deadline = std::chrono::steady_clock::now() +
+                    std::chrono::milliseconds(2000);
+    std::vector<Awaitable<Json::Value>> requests;
+    for(int i = 0; i < 4; ++i) {
+        Json::Value req;
+        req["COMMAND"] = "SLOW_ECHO";
+        req["VAL"] = i;
+        requests.push_back(Client::AsyncMakeRequest("127.0.0.1", 4013, req,
+                                                    deadline));
+    }
+    Json::Value unanswered;
+    unanswered["COMMAND"] = "SLOW_ECHO";
+    requests.push_back(Client::AsyncMakeRequest("127.0.0.1", 4099, unanswered,
+                                                deadline));
+
+    auto start = std::chrono::steady_clock::now();
+    auto responses = RunCoroutine(WhenAll(std::move(requests)));
+    EXPECT_LT(std::chrono::steady_clock::now() - start,
+              std::chrono::milliseconds(900));
+
+    ASSERT_EQ(responses.size(), 5);
+    for(int i = 0; i < 4; ++i) {
+        ASSERT_TRUE(responses[i].has_value());
+        EXPECT_TRUE((*responses[i])["SUCCESS"].asBool());
+        EXPECT_EQ((*responses[i])["VAL"].asInt(), i);
+    }
+    EXPECT_FALSE(responses[4].has_value());
+    server->Kill();
+}
+
+/// Coroutines waiting on an AsyncSemaphore should get slots in the order they
+/// asked, as soon as they're released, and never more at once than it has.
+TEST(Client, AsyncSemaphoreHandsOverSlots)
+{
+    AsyncSemaphore slots(2);
+    int held = 0;
+    int most_held = 0;
+    std::vector<int> order;
+    auto task = [&](int i) -> Awaitable<int> {
+        co_await slots.Acquire();
+        order.push_back(i);
+        most_held = std::max(most_held, ++held);
+        boost::asio::steady_timer timer(
+                co_await boost::asio::this_coro::executor,
+                std::chrono::milliseconds(100));
+        co_await timer.async_wait(boost::asio::use_awaitable);
+        --held;
+        slots.Release();
+        co_return i;
+    };
+    std::vector<Awaitable<int>> tasks;
+    for(int i = 0; i < 6; ++i) {
+        tasks.push_back(task(i));
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    auto results = RunCoroutine(WhenAll(std::move(tasks)));
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    EXPECT_GE(elapsed, std::chrono::milliseconds(300));
+    EXPECT_LT(elapsed, std::chrono::milliseconds(400));
+
+    ASSERT_EQ(results.size(), 6);
+    for(int i = 0; i < 6; ++i) {
+        EXPECT_EQ(results[i], i);
+    }
+    EXPECT_EQ(order, std::vector<int>({ 0, 1, 2, 3, 4, 5 }));
+    EXPECT_EQ(most_held, 2);
+}
+
+/// Requests captured to a trace should read back exactly as they were sent,
+/// and replaying them should reproduce the workload, at its original pace
+/// unless told otherwise.
+TEST(Server, CapturesAndReplaysRequests)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::atomic<int> num_handled = 0;
+    std::map<std::string, ReqHandler> commands = {
+            { "ECHO",
+              [&num_handled](const Json::Value &req) {
+                  ++num_handled;
+                  Json::Value resp;
+                  resp["VAL"] = req["VAL"];
+                  return resp;
+              }
+            }
+    };
+    auto server = std::make_shared<Server<ReqHandler>>(4014, 2, commands);
+    server->RunInBackground();
+
+    std::string path = (std::filesystem::temp_directory_path() /
+                        "server_capture_test.trace").string();
+    std::filesystem::remove(path);
+    server->StartRequestCapture(path);
+    for(int i = 0; i < 5; ++i) {
+        Json::Value req;
+        req["COMMAND"] = "ECHO";
+        req["VAL"] = i;
+        Client::MakeRequest("127.0.0.1", 4014, req);
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    }
+    server->StopRequestCapture();
+
+    std::vector<TraceRecord> records = TraceRecorder::Load(path);
+    ASSERT_EQ(records.size(), 5);
+    for(int i = 0; i < 5; ++i) {
+        EXPECT_EQ(records[i].port_, 4014);
+        EXPECT_EQ(records[i].request_["COMMAND"].asString(), "ECHO");
+        EXPECT_EQ(records[i].request_["VAL"].asInt(), i);
+        if(i > 0) {
+            EXPECT_GE(records[i].timestamp_ - records[i - 1].timestamp_,
+                      std::chrono::milliseconds(50));
+        }
+    }
+
+    num_handled = 0;
+    TraceReplayer replayer({ { "127.0.0.1", 4014 } });
+    ReplayReport report = replayer.Replay(records);
+    EXPECT_EQ(report.num_requests_, 5);
+    EXPECT_EQ(report.num_failed_, 0);
+    EXPECT_EQ(num_handled, 5);
+    EXPECT_GE(report.elapsed_, std::chrono::milliseconds(200));
+    EXPECT_GT(report.Throughput(), 0);
+
+    TraceReplayer fast_replayer({ { "127.0.0.1", 4014 } }, 0);
+    EXPECT_LT(fast_replayer.Replay(records).elapsed_,
+              std::chrono::milliseconds(200));
+
+    // Requests recorded on other ports go to the targets we have, even when
+    // (as here) those are down, in which case each is reported as failed.
+    TraceReplayer unreachable({ { "127.0.0.1", 4099 } }, 0);
+    EXPECT_EQ(unreachable.Replay(records).num_failed_, 5);
+
+    std::filesystem::remove(path);
+    server->Kill();
+}
+
+/// A capture should keep only the requests its filter matches, leaving out
+/// MAINTENANCE-class requests unless told otherwise, and a replay should skip
+/// the records its own filter leaves out.
+TEST(Server, FiltersCapturedAndReplayedRequests)
+{
+    using ReqHandler = std::function<Json::Value(const Json::Value &)>;
+    std::atomic<int> num_handled = 0;
+    auto count = [&num_handled](const Json::Value &) {
+        ++num_handled;
+        return Json::Value();
+    };
+    std::map<std::string, ReqHandler> commands = {
+            { "READ", count }, { "WRITE", count }, { "NOTIFY", count }
+    };
+    auto server = std::make_shared<Server<ReqHandler>>(4016, 2, commands);
+    server->RunInBackground();
+
+    std::string path = (std::filesystem::temp_directory_path() /
+                        "server_filter_test.trace").string();
+    std::filesystem::remove(path);
+    server->StartRequestCapture(path, TraceFilter { { "READ", "WRITE" } });
+    for(const char *command : { "READ", "WRITE", "NOTIFY" }) {
+        Json::Value req;
+        req["COMMAND"] = command;
+        Client::MakeRequest("127.0.0.1", 4016, req);
+        req["CLASS"] = "MAINTENANCE";
+        Client::MakeRequest("127.0.0.1", 4016, req);
+    }
+    server->StopRequestCapture();
+
+    std::vector<TraceRecord> records = TraceRecorder::Load(path);
+    ASSERT_EQ(records.size(), 2);
+    EXPECT_EQ(records[0].request_["COMMAND"].asString(), "READ");
+    EXPECT_EQ(records[1].request_["COMMAND"].asString(), "WRITE");
+
+    num_handled = 0;
+    TraceReplayer replayer({ { "127.0.0.1", 4016 } }, 0,
+                           TraceFilter { { "WRITE" } });
+    ReplayReport report = replayer.Replay(records);
+    EXPECT_EQ(report.num_requests_, 1);
+    EXPECT_EQ(report.num_failed_, 0);
+    EXPECT_EQ(num_handled, 1);
+
+    std::filesystem::remove(path);
+    server->Kill();
+}
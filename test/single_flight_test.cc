@@ -0,0 +1,75 @@
+#include <gtest/gtest.h>
+#include "../src/data_structures/single_flight.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+
+/// Concurrent calls for the same key should run the function once and all
+/// return its result.
+TEST(SingleFlight, MergesIdenticalCalls)
+{
+    SingleFlight<int, int> flight;
+    std::atomic<int> num_calls = 0;
+    auto deadline = std::chrono::steady_clock::now() + 5s;
+
+    std::vector<std::thread> threads;
+    std::vector<int> results(8);
+    for(int i = 0; i < 8; ++i) {
+        threads.emplace_back([&, i] {
+            results[i] = flight.Do(1, deadline, [&] {
+                ++num_calls;
+                std::this_thread::sleep_for(200ms);
+                return 42;
+            });
+        });
+    }
+    for(auto &t : threads) {
+        t.join();
+    }
+
+    EXPECT_EQ(num_calls, 1);
+    for(int result : results) {
+        EXPECT_EQ(result, 42);
+    }
+    EXPECT_EQ(flight.NumInFlight(), 0);
+}
+
+/// Calls for different keys, or for the same key once a previous call has
+/// completed, should not be merged.
+TEST(SingleFlight, DistinctAndSequentialCallsRun)
+{
+    SingleFlight<int, int> flight;
+    auto deadline = std::chrono::steady_clock::now() + 5s;
+
+    EXPECT_EQ(flight.Do(1, deadline, [] { return 1; }), 1);
+    EXPECT_EQ(flight.Do(1, deadline, [] { return 2; }), 2);
+    EXPECT_EQ(flight.Do(2, deadline, [] { return 3; }), 3);
+}
+
+/// Errors should be shared with merged callers, and a merged caller should
+/// stop waiting once its deadline passes.
+TEST(SingleFlight, SharesErrorsAndRespectsDeadline)
+{
+    SingleFlight<int, int> flight;
+    auto far_deadline = std::chrono::steady_clock::now() + 5s;
+
+    std::thread leader([&] {
+        EXPECT_ANY_THROW(flight.Do(1, far_deadline, [] {
+            std::this_thread::sleep_for(500ms);
+            throw std::runtime_error("Lookup failed");
+            return 0;
+        }));
+    });
+    std::this_thread::sleep_for(100ms);
+
+    // Joins the leader's call, but gives up before it completes.
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_ANY_THROW(flight.Do(1, start + 100ms, [] { return 1; }));
+    EXPECT_LT(std::chrono::steady_clock::now() - start, 400ms);
+
+    // Joins the leader's call, and receives its error.
+    EXPECT_ANY_THROW(flight.Do(1, far_deadline, [] { return 1; }));
+    leader.join();
+}